@@ -4,13 +4,29 @@
 #include <Arduino.h>
 
 /*
-Calculates XMODEM CRC16 against an array of bytes
+Calculates XMODEM CRC16 (polynomial 0x1021, initial value 0x0000, not reflected) against an array of bytes
+
+Table driven, the lookup tables are generated by the compiler.
+AVR uses a 16 entry table held in flash (4 bits at a time, 32 bytes), everything else
+uses a 256 entry table (8 bits at a time, 512 bytes).
+
+This file is identical in the controller, ATTINY and STM32 projects, please keep it that way.
 */
 
 class CRC16 {
    public:
       static uint16_t CalculateArray(uint8_t data[], uint16_t length);
-    private:
-      static uint8_t reflect(uint8_t data, uint8_t bits = 32);
+
+      // Incremental calculation, for example as bytes are received
+      // start with Initial and pass the previous result back in
+      static const uint16_t Initial = 0x0000;
+      static uint16_t Update(uint16_t crc, uint8_t data);
+      static uint16_t Update(uint16_t crc, const uint8_t *data, uint16_t length);
+
+      // Single table variants, Update() uses the best one for the platform
+      static uint16_t UpdateNibble(uint16_t crc, uint8_t data);
+#if !defined(__AVR__)
+      static uint16_t UpdateByte(uint16_t crc, uint8_t data);
+#endif
 };
 #endif
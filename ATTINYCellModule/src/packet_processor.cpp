@@ -172,13 +172,8 @@ bool PacketProcessor::onPacketReceived(PacketStruct *receivebuffer)
 
   if (validateCRC == receivebuffer->crc)
   {
-    // Validate address ranges before processing to prevent buffer overruns
-    if (receivebuffer->start_address >= maximum_cell_modules ||
-        receivebuffer->end_address >= maximum_cell_modules ||
-        receivebuffer->hops > maximum_cell_modules) {
-      badpackets++;
-      return false;
-    }
+    // Addresses are for the whole chain (not limited to maximum_cell_modules), replies are
+    // written to moduledata[] using the address modulo the packet size so cannot overrun
 
 #if defined(FAKE_16_CELLS)
     uint8_t start = receivebuffer->hops;
@@ -0,0 +1,86 @@
+#ifndef BinaryCellLog_H_
+#define BinaryCellLog_H_
+
+#include <Arduino.h>
+#include <defines.h>
+#include <string>
+
+#include "SdLog.h"
+
+// The cell data log (/data_YYYYMMDD.dbl) in binary, instead of a CSV line of thousands of characters.
+// HostTools/src/dbl2csv.cpp turns it back into the CSV.
+//
+// The file starts with Magic, then records, each starting with a tag byte.  Little endian.
+//   'H' header      u8 banks, u8 modules per bank, u8 modules, u16 records per block
+//   'K' keyframe    u32 time, then the columns at full width
+//   'D' delta       u16 seconds since the record before, then each column as an int8 change from it
+//   'T' block end   u16 records, u32 first time, u32 last time, u32 file offset of the block's keyframe
+// Times are local time in seconds since 1970, as written in the CSV.
+//
+// The columns are one field for every module, then the next field:
+//   voltage mV (u16), internal temp (i8), external temp (i8), PWM % (u16), bad packets (u16),
+//   balance mAh (u16), then flags (u8, bit 0 bypass, bit 1 bypass over temp) which are never deltas.
+//
+// A block is a keyframe then deltas, up to BlockRecords records.  A keyframe replaces a delta when a
+// change doesn't fit in an int8.  'H' and a new block start the file, and follow a restart, a change of
+// module count or any rows the SD log had to drop.  The 'T' records index the blocks, read back from the
+// end of the file, the last block has none if the file wasn't closed at the end of the day.
+class BinaryCellLog
+{
+public:
+  static constexpr char Magic[4] = {'D', 'B', 'L', 1};
+  static constexpr uint16_t BlockRecords = 64;
+  static constexpr uint8_t Fields = 7;
+
+  static constexpr uint8_t HeaderSize = 1 + 5;
+  static constexpr uint8_t TrailerSize = 1 + 14;
+  static constexpr uint16_t KeyframeSize(uint8_t modules) { return 1 + 4 + 11 * modules; }
+  static constexpr uint16_t DeltaSize(uint8_t modules) { return 1 + 2 + 7 * modules; }
+
+  // Adds a row to "log", in "filename" (.dbl).  "time" is local time from LocalTime().
+  void Write(SdLog &log, const char *filename, uint32_t time, const CellReadings *cells, const CellModuleInfo *info,
+             uint8_t banks, uint8_t modulesPerBank, uint8_t modules);
+
+  // Seconds since 1970 for a local date and time, month 1 to 12
+  static uint32_t LocalTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+
+  uint32_t keyframes = 0;
+  uint32_t deltas = 0;
+  uint32_t blocks = 0;
+
+private:
+  // Values last written, the deltas are against these
+  struct Values
+  {
+    uint16_t voltagemV[maximum_controller_cell_modules];
+    int8_t internalTemp[maximum_controller_cell_modules];
+    int8_t externalTemp[maximum_controller_cell_modules];
+    uint16_t pwm[maximum_controller_cell_modules];
+    uint16_t badPackets[maximum_controller_cell_modules];
+    uint16_t balancemAh[maximum_controller_cell_modules];
+    uint8_t flags[maximum_controller_cell_modules];
+  };
+
+  Values _values[2];
+  Values *_last = &_values[0];
+  Values *_next = &_values[1];
+  std::string _filename;
+  uint8_t _modules = 0;
+  uint16_t _records = 0;
+  uint32_t _firstTime = 0;
+  uint32_t _lastTime = 0;
+  uint32_t _blockStart = 0;
+  // Start again with 'H' and a keyframe
+  bool _restart = false;
+  // A column being built
+  uint8_t _column[2 * maximum_controller_cell_modules];
+
+  bool DeltasFit(uint32_t time) const;
+  void WriteColumn16(SdLog &log, const uint16_t *values);
+  void WriteDeltas16(SdLog &log, const uint16_t *values, const uint16_t *last);
+  void WriteColumn8(SdLog &log, const uint8_t *values);
+  void WriteDeltas8(SdLog &log, const int8_t *values, const int8_t *last);
+  void WriteTrailer(SdLog &log);
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef CellHistory_H_
+#define CellHistory_H_
+
+#include <Arduino.h>
+#include <defines.h>
+
+// Voltage and temperatures of every module for each snapshot, held in RAM for the web charts.
+//
+// Each module has its own stream of samples, bit packed into chunks taken from a pool.  The first
+// sample of a chunk is stored as it is (16 bit voltage, 8 bit temperatures), after that a value is
+// stored as the change from the sample before, a prefix says how many bits follow:
+//   0                no change
+//   10   + 3 bits    +-4
+//   110  + 7 bits    +-64
+//   1110 + 11 bits   +-1024
+//   1111 + 32 bits   anything else
+// Temperatures move slowly, so they are only stored every TemperatureEvery snapshots (and at the start
+// of a chunk), Read repeats the last one in between.  Sample times are one more stream, a 32 bit time
+// at the start of a chunk then the change in the gap between samples (delta of delta), which for a
+// steady polling rate is nearly always 0.
+//
+// When the pool is full the chunk with the oldest samples is reused, so the time covered depends on the
+// number of modules and how much the readings move.  Begin sizes the pool from the number of modules and
+// the memory free, PSRAM if the board has it.  Every module always has a part written chunk, so the chunk
+// size is picked from the number of modules and the pool (see Layout).  With one chunk each a large pack
+// would reuse chunks still being written and lose a module's whole history at a time.  With 5 second
+// polling and no PSRAM (a pool of about 100KB) it holds about 13 hours of 16 modules, 3.3 hours of 64 and
+// 55 minutes of 200, nearly six times that at 30 seconds.  With PSRAM it is about 18 hours of up to 64
+// modules and 11 hours of 200.  The statistics give the bits per module sample and the time every module
+// has samples from.
+//
+// Add() is called by rules_task, Read() by the web server, both take the lock.
+class CellHistory
+{
+public:
+  struct Sample
+  {
+    // Seconds since 1970
+    uint32_t time;
+    // Zero if the module had not replied
+    uint16_t voltagemV;
+    int8_t internalTemp;
+    int8_t externalTemp;
+  };
+
+  // Allocates the pool for a pack of numberOfCells modules, false if there isn't the memory.  The size
+  // stays the same if the number of modules changes later.
+  bool Begin(uint8_t numberOfCells);
+
+  // A new snapshot of modules 0 to numberOfCells-1, "now" must be a valid (SNTP) time
+  void Add(uint32_t now, const CellReadings *cells, uint8_t numberOfCells);
+
+  // Copies up to "maximum" samples of "cell" taken between from and to (seconds since 1970), starting
+  // at sample number "next" (0 for the oldest held).  Returns the number copied and moves "next" on,
+  // 0 once there are no more.
+  uint16_t Read(uint8_t cell, uint32_t from, uint32_t to, uint32_t &next, Sample samples[], uint16_t maximum);
+
+  // Time of the oldest sample still held (0 if none)
+  uint32_t OldestTime();
+
+  // Time from which every module has samples, the history really held (0 if none)
+  uint32_t CompleteTime();
+
+  // Bytes in each chunk, set from the number of modules
+  uint16_t ChunkSize() const { return _chunkSize; }
+
+  // Bytes allocated by Begin
+  uint32_t PoolSize() const { return _poolSize; }
+
+  // Snapshots added, and the bits and time used to store them
+  uint32_t snapshots = 0;
+  uint64_t cellSamples = 0;
+  uint64_t cellBits = 0;
+  uint64_t encode_us = 0;
+
+private:
+  // Owner of a chunk, a module number or one of these
+  static constexpr uint8_t Times = 0xFE;
+  static constexpr uint8_t Free = 0xFF;
+
+  static constexpr uint16_t MinimumChunkSize = 64;
+  static constexpr uint16_t MaximumChunkSize = 128;
+
+  // Pool wanted for each module (and the times), about 18 hours at 5 second polling
+  static constexpr uint32_t BytesPerModule = 8192;
+  // Always allocated, even if that leaves less than HeapReserve
+  static constexpr uint32_t MinimumPoolSize = 32768;
+  // Chunk numbers are int16_t and finding a chunk looks at all of them
+  static constexpr uint32_t MaximumPoolSize = 1024 * 1024;
+  // Internal heap left for WiFi, the web server and the tasks started after Begin
+  static constexpr uint32_t HeapReserve = 96 * 1024;
+
+  static constexpr uint8_t TemperatureEvery = 6;
+  static bool TemperatureSample(uint32_t sample) { return sample % TemperatureEvery == 0; }
+
+  // Header of a chunk, the data follows it to the end of the chunk
+  struct Chunk
+  {
+    // Number of the first sample
+    uint32_t firstSample;
+    uint8_t owner;
+    uint8_t samples;
+    uint16_t bits;
+  };
+
+  // Values a stream is encoded against
+  struct Stream
+  {
+    // Chunk being written, -1 for none
+    int16_t chunk;
+    int32_t last[3];
+    // Times only, gap between the last two samples
+    int32_t lastGap;
+  };
+
+  uint8_t *_pool = nullptr;
+  uint32_t _poolSize = 0;
+  uint16_t _chunkSize = MaximumChunkSize;
+  uint16_t _numberOfChunks = 0;
+  // Modules the pool is laid out for
+  uint8_t _numberOfCells = 0;
+  Stream _cells[maximum_controller_cell_modules];
+  Stream _times;
+  // Number of the next sample
+  uint32_t _nextSample = 0;
+  SemaphoreHandle_t _lock = nullptr;
+
+  Chunk &ChunkAt(uint16_t i) const { return *(Chunk *)(_pool + (uint32_t)i * _chunkSize); }
+  static uint8_t *Data(Chunk &c) { return (uint8_t *)(&c + 1); }
+  static const uint8_t *Data(const Chunk &c) { return (const uint8_t *)(&c + 1); }
+
+  void Layout(uint8_t numberOfCells);
+  bool Append(uint8_t owner, Stream &stream, const int32_t values[], uint8_t count);
+  uint16_t OldestChunk() const;
+  int16_t FindChunk(uint8_t owner, uint32_t sample) const;
+  uint32_t SampleTime(uint32_t sample) const;
+};
+
+extern CellHistory cellHistory;
+
+#endif
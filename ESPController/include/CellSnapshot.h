@@ -0,0 +1,83 @@
+#ifndef CellSnapshot_H_
+#define CellSnapshot_H_
+
+#include <Arduino.h>
+#include <defines.h>
+
+// Coherent copy of cellReadings, published once per complete sweep of the modules.
+//
+// replyqueue_task updates cellReadings one reply at a time, so anything reading it directly can see
+// half of a bank from one sweep and half from the next.  voltageandstatussnapshot_task copies the
+// readings into one of two buffers and then publishes it with a new epoch number, readers always
+// get the most recently published buffer without waiting or locking.
+//
+// A reader is only disturbed if it is still using a buffer two publishes later (several seconds),
+// StillValid() detects that.  Readers that block whilst holding a view check it before using what they
+// read: the CSV cell log (SD card), MQTT, InfluxDB and /api/monitor2 (network).  The binary cell log
+// copies what it needs before it blocks.
+//
+// Usage:
+//   auto view = cellSnapshot.Acquire();
+//   ... view.cells->voltagemV[i] ...
+//   if (!cellSnapshot.StillValid(view)) ...
+class CellSnapshot
+{
+public:
+  struct View
+  {
+    // Every module (maximum_controller_cell_modules), invalid until the module has replied
+    const CellReadings *cells;
+    // Increases by one for each publish, zero until the first complete sweep
+    uint32_t epoch;
+    uint32_t sequence;
+    // esp_timer_get_time() when the snapshot was published
+    int64_t published;
+  };
+
+  // replyqueue_task, around any update of cellReadings
+  void BeginUpdate()
+  {
+    __atomic_store_n(&_updateSequence, _updateSequence + 1, __ATOMIC_RELEASE);
+  }
+
+  void EndUpdate()
+  {
+    __atomic_store_n(&_updateSequence, _updateSequence + 1, __ATOMIC_RELEASE);
+  }
+
+  // voltageandstatussnapshot_task, copy the readings and make them the current snapshot
+  void Publish(const CellReadings *cells);
+
+  View Acquire() const;
+
+  // False if the buffer the view points to has since been reused
+  bool StillValid(const View &view) const;
+
+  uint32_t Epoch() const
+  {
+    return __atomic_load_n(&_epoch, __ATOMIC_ACQUIRE);
+  }
+
+  // Copies abandoned because replyqueue_task changed the readings during the copy
+  uint32_t retries = 0;
+
+private:
+  struct Buffer
+  {
+    CellReadings cells;
+    int64_t published;
+    // Odd whilst being written
+    uint32_t sequence;
+  };
+
+  Buffer _buffers[2] = {};
+  uint32_t _epoch = 0;
+  // Odd whilst replyqueue_task is changing cellReadings
+  uint32_t _updateSequence = 0;
+
+  bool Copy(Buffer &b, const CellReadings *cells);
+};
+
+extern CellSnapshot cellSnapshot;
+
+#endif
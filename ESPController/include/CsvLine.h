@@ -0,0 +1,53 @@
+#ifndef CsvLine_H_
+#define CsvLine_H_
+
+#include <Arduino.h>
+#include <time.h>
+
+// Builds a line of text for the SD card logs in a buffer it is given, without allocating, in place of
+// std::to_string, pad_zero and float_to_string.  The text is always null terminated, anything that
+// doesn't fit is dropped and Overflowed() set.
+class CsvLine
+{
+public:
+  CsvLine(char *buffer, size_t size) : _buffer(buffer), _size(size), _length(0) { Clear(); }
+
+  CsvLine &Text(const char *text) { return Text(text, strlen(text)); }
+  CsvLine &Text(const char *text, size_t length);
+  CsvLine &Char(char c);
+  // "Y" or "N"
+  CsvLine &YesNo(bool value) { return Char(value ? 'Y' : 'N'); }
+  // Decimal, zero padded to at least "digits"
+  CsvLine &Unsigned(uint32_t value, uint8_t digits = 1);
+  CsvLine &Signed(int32_t value);
+  // The same text as printf("%.4f")
+  CsvLine &Float4(float value);
+  // 8 characters of 0 and 1, bit 7 first
+  CsvLine &Binary(uint8_t value);
+  // "YYYY-MM-DD HH:MM:SS", tm_year and tm_mon already changed to the year and month 1 to 12
+  CsvLine &DateTime(const tm &timeinfo);
+
+  const char *Data() const { return _buffer; }
+  size_t Length() const { return _length; }
+  size_t Space() const { return _size - 1 - _length; }
+  bool Overflowed() const { return _overflowed; }
+  void Clear() { Truncate(0); }
+  // Back to the first "length" characters
+  void Truncate(size_t length)
+  {
+    if (length < _length)
+    {
+      _length = length;
+    }
+    _overflowed = false;
+    _buffer[_length] = 0;
+  }
+
+private:
+  char *_buffer;
+  size_t _size;
+  size_t _length;
+  bool _overflowed;
+};
+
+#endif
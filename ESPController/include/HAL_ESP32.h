@@ -92,7 +92,9 @@ public:
     }
 
     void ConfigureI2C(void (*TCA6408Interrupt)(void), void (*TCA9534AInterrupt)(void), void (*TCA6416Interrupt)(void));
-    void SetOutputState(uint8_t outputId, RelayState state);
+    // Set every relay output with a single i2c write
+    void SetOutputStates(const RelayState *state);
+    RelayState GetOutputState(uint8_t outputId) const;
     uint8_t ReadTCA6408InputRegisters();
     uint8_t ReadTCA9534InputRegisters();
     uint16_t ReadTCA6416InputRegisters();
@@ -0,0 +1,115 @@
+#ifndef LatencyHistogram_H_
+#define LatencyHistogram_H_
+
+#include <stdint.h>
+
+// Round trip time histogram with logarithmic buckets, four per doubling of time (about 19% wide)
+// covering 0.5ms to 67 seconds.  Slower replies are counted in the last bucket.
+//
+// Percentiles are estimated as the upper edge of the bucket holding that sample, clamped to the
+// exact minimum and maximum, so are never more than one bucket width out.
+//
+// No RTOS/Arduino dependencies, this is also compiled into the host side chain simulator.
+// Not thread safe, PacketReceiveProcessor serialises access.
+class LatencyHistogram
+{
+public:
+  static constexpr uint8_t numberOfBuckets = 64;
+
+  struct Summary
+  {
+    uint32_t count;
+    uint32_t minimum_us;
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t maximum_us;
+  };
+
+  void Add(uint32_t value_us)
+  {
+    buckets[Bucket(value_us)]++;
+    if (count == 0 || value_us < minimum_us)
+    {
+      minimum_us = value_us;
+    }
+    if (value_us > maximum_us)
+    {
+      maximum_us = value_us;
+    }
+    count++;
+  }
+
+  Summary Summarise() const
+  {
+    Summary s{count, minimum_us, 0, 0, maximum_us};
+    if (count > 0)
+    {
+      s.p50_us = Percentile(50);
+      s.p99_us = Percentile(99);
+    }
+    return s;
+  }
+
+  void Reset()
+  {
+    *this = LatencyHistogram{};
+  }
+
+private:
+  // Bucket width below 4 units is linear, each unit is 512us
+  static constexpr uint8_t unitShift = 9;
+
+  uint32_t buckets[numberOfBuckets] = {};
+  uint32_t count = 0;
+  uint32_t minimum_us = 0;
+  uint32_t maximum_us = 0;
+
+  static uint8_t Bucket(uint32_t value_us)
+  {
+    const uint32_t units = value_us >> unitShift;
+    if (units < 4)
+    {
+      return (uint8_t)units;
+    }
+
+    // Most significant bit picks the octave, the next two bits the quarter within it
+    const uint8_t msb = (uint8_t)(31 - __builtin_clz(units));
+    const uint32_t b = 4 * (msb - 1) + ((units >> (msb - 2)) & 3);
+    return b < numberOfBuckets ? (uint8_t)b : numberOfBuckets - 1;
+  }
+
+  // Smallest value (us) which falls in the bucket after b
+  static uint32_t BucketUpper(uint8_t b)
+  {
+    const uint8_t next = b + 1;
+    if (next < 4)
+    {
+      return (uint32_t)next << unitShift;
+    }
+    const uint8_t msb = next / 4 + 1;
+    return (uint32_t)(4 + next % 4) << (msb - 2 + unitShift);
+  }
+
+  uint32_t Percentile(uint8_t percent) const
+  {
+    // Rank of the sample we want, rounded up so p99 of a small sample is the maximum
+    const uint32_t rank = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    uint32_t total = 0;
+    for (uint8_t b = 0; b < numberOfBuckets; b++)
+    {
+      total += buckets[b];
+      if (total >= rank)
+      {
+        if (b == numberOfBuckets - 1)
+        {
+          return maximum_us;
+        }
+        const uint32_t upper = BucketUpper(b);
+        return upper < minimum_us ? minimum_us : (upper > maximum_us ? maximum_us : upper);
+      }
+    }
+    return maximum_us;
+  }
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef PacketPacing_H_
+#define PacketPacing_H_
+
+#include <stdint.h>
+
+// Decides when transmit_task can release the next request onto the module ring.
+//
+// In reply driven mode up to "window" requests are allowed to be outstanding (sent, but the
+// reply has not yet travelled all the way around the ring).  Requests are tracked by their
+// sequence number, replies come back in the same order they were sent so a reply also tells
+// us that any older outstanding request has been lost.
+//
+// A request which has not been answered within the reply timeout is counted as lost, the timeout
+// is calculated from the measured round trip time (smoothed average + 4 x mean deviation, the same
+// estimator TCP uses for its retransmit timer).
+//
+// transmit_task never waits longer than the legacy fixed per-baud delay before sending, so a lost
+// reply or a very long module string never runs slower than the fixed delay did.
+//
+// No RTOS/Arduino dependencies, this is also compiled into the host side pacing benchmark.
+// Not thread safe, PacketReceiveProcessor serialises access.
+class PacketPacing
+{
+public:
+  // Maximum number of requests tracked (and maximum configurable window)
+  static constexpr uint8_t maximumWindow = 32;
+
+  // Shortest reply timeout we ever use
+  static constexpr uint32_t minimumTimeoutMillisecond = 25;
+
+  struct WindowStatistics
+  {
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t lost;
+    uint32_t latencyMinimum_us;
+    uint32_t latencyMaximum_us;
+    uint64_t latencyTotal_us;
+  };
+
+  // Fixed delay used before reply driven pacing existed, ensures the first module
+  // has time to process and clear the request before another packet is sent
+  static uint16_t LegacyDelay(uint16_t baudrate)
+  {
+    switch (baudrate)
+    {
+    case 10000:
+      return 350;
+    case 9600:
+      return 450;
+    case 5000:
+      return 700;
+    default:
+      return 900;
+    }
+  }
+
+  // Shortest gap (ms) between two requests when more than one is outstanding.
+  // Modules store and forward, so the first module must have received (1 packet time)
+  // and retransmitted (1 packet time) the previous request before the next one starts arriving.
+  static uint32_t MinimumSpacing(uint16_t baudrate)
+  {
+    // Packet plus 2 bytes COBS framing, 10 bits per byte
+    const uint32_t packet_ms = ((40 + 2) * 10 * 1000) / baudrate;
+    return 2 * packet_ms + 20;
+  }
+
+  /// @brief Use the round trip measured by the timing packet until we have our own samples
+  /// @param roundtrip_ms value of PacketReceiveProcessor::packetTimerMillisecond
+  void Seed(uint32_t roundtrip_ms)
+  {
+    if (samples == 0)
+    {
+      seed_us = roundtrip_ms * 1000;
+    }
+  }
+
+  /// @brief Time (ms) after which an outstanding request is considered lost
+  uint32_t ReplyTimeout() const
+  {
+    uint32_t t;
+    if (samples == 0)
+    {
+      // No samples yet, use the timing packet measurement
+      t = (seed_us + seed_us / 2) / 1000;
+    }
+    else
+    {
+      t = (srtt_us + 4 * rttvar_us) / 1000 + 1;
+    }
+    return t < minimumTimeoutMillisecond ? minimumTimeoutMillisecond : t;
+  }
+
+  /// @brief Record a request being transmitted
+  /// @param sequence PacketStruct::sequence of the request
+  /// @param window window size in force when the request was sent, zero for fixed pacing (statistics are kept per window size)
+  /// @param now_us timestamp (microseconds)
+  void RequestSent(uint16_t sequence, uint8_t window, int64_t now_us)
+  {
+    if (count == maximumWindow)
+    {
+      // No room to track any more, oldest request is assumed lost
+      Lost(0);
+      Remove(1);
+    }
+
+    Outstanding &o = outstanding[(head + count) % maximumWindow];
+    o.sequence = sequence;
+    o.window = window;
+    o.sent_us = now_us;
+    count++;
+
+    Statistics(window).requests++;
+  }
+
+  /// @brief Match a reply to an outstanding request
+  /// @param roundtrip_us if not null, set to the round trip time of the matched request
+  /// @return true if the reply matched a request, older unanswered requests are counted as lost
+  bool ReplyReceived(uint16_t sequence, int64_t now_us, uint32_t *roundtrip_us = nullptr)
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      const Outstanding &o = outstanding[(head + i) % maximumWindow];
+      if (o.sequence != sequence)
+      {
+        continue;
+      }
+
+      // Requests sent before this one will never be answered
+      for (uint8_t n = 0; n < i; n++)
+      {
+        Lost(n);
+      }
+
+      const uint32_t rtt = (uint32_t)(now_us - o.sent_us);
+      Sample(rtt);
+      if (roundtrip_us != nullptr)
+      {
+        *roundtrip_us = rtt;
+      }
+
+      WindowStatistics &s = Statistics(o.window);
+      s.replies++;
+      s.latencyTotal_us += rtt;
+      if (s.latencyMinimum_us == 0 || rtt < s.latencyMinimum_us)
+      {
+        s.latencyMinimum_us = rtt;
+      }
+      if (rtt > s.latencyMaximum_us)
+      {
+        s.latencyMaximum_us = rtt;
+      }
+
+      Remove(i + 1);
+      return true;
+    }
+
+    unmatchedReplies++;
+    return false;
+  }
+
+  /// @brief Count requests outstanding longer than ReplyTimeout() as lost
+  /// @return number of requests expired
+  uint8_t ExpireRequests(int64_t now_us)
+  {
+    const int64_t timeout_us = (int64_t)ReplyTimeout() * 1000;
+    uint8_t expired = 0;
+    while (count > 0 && now_us - outstanding[head].sent_us > timeout_us)
+    {
+      Lost(0);
+      Remove(1);
+      expired++;
+    }
+    return expired;
+  }
+
+  uint8_t OutstandingRequests() const { return count; }
+
+  // Smoothed round trip (ms), zero if no replies have been matched
+  uint32_t SmoothedRoundTrip() const { return srtt_us / 1000; }
+
+  const WindowStatistics &GetStatistics(uint8_t window) const { return windowStatistics[Index(window)]; }
+
+  void ResetCounters()
+  {
+    for (auto &s : windowStatistics)
+    {
+      s = WindowStatistics{};
+    }
+    lostRequests = 0;
+    unmatchedReplies = 0;
+  }
+
+  // Total requests which never received a reply
+  uint32_t lostRequests = 0;
+  // Replies which did not match an outstanding request (arrived after being counted as lost)
+  uint32_t unmatchedReplies = 0;
+
+private:
+  struct Outstanding
+  {
+    int64_t sent_us;
+    uint16_t sequence;
+    uint8_t window;
+  };
+
+  Outstanding outstanding[maximumWindow];
+  uint8_t head = 0;
+  uint8_t count = 0;
+
+  // Index 0 holds statistics for fixed (legacy) pacing, then one entry per window size
+  WindowStatistics windowStatistics[maximumWindow + 1] = {};
+
+  uint32_t samples = 0;
+  uint32_t srtt_us = 0;
+  uint32_t rttvar_us = 0;
+  uint32_t seed_us = 60 * 1000 * 1000;
+
+  static uint8_t Index(uint8_t window) { return window > maximumWindow ? maximumWindow : window; }
+
+  WindowStatistics &Statistics(uint8_t window) { return windowStatistics[Index(window)]; }
+
+  // Count the n'th oldest outstanding request as lost
+  void Lost(uint8_t n)
+  {
+    Statistics(outstanding[(head + n) % maximumWindow].window).lost++;
+    lostRequests++;
+  }
+
+  // Remove the n oldest outstanding requests
+  void Remove(uint8_t n)
+  {
+    head = (head + n) % maximumWindow;
+    count -= n;
+  }
+
+  void Sample(uint32_t roundtrip_us)
+  {
+    if (samples == 0)
+    {
+      srtt_us = roundtrip_us;
+      rttvar_us = roundtrip_us / 2;
+    }
+    else
+    {
+      int32_t err = (int32_t)roundtrip_us - (int32_t)srtt_us;
+      // Gains of 1/8 and 1/4 (RFC6298)
+      srtt_us = (uint32_t)((int32_t)srtt_us + err / 8);
+      uint32_t abs_err = (uint32_t)(err < 0 ? -err : err);
+      rttvar_us = (uint32_t)((int32_t)rttvar_us + ((int32_t)abs_err - (int32_t)rttvar_us) / 4);
+    }
+
+    if (samples < UINT32_MAX)
+    {
+      samples++;
+    }
+  }
+};
+
+#endif
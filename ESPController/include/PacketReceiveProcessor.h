@@ -5,15 +5,45 @@
 #include <defines.h>
 
 #include "crc16.h"
+#include "PacketPacing.h"
+#include "LatencyHistogram.h"
 
 class PacketReceiveProcessor
 {
 public:
   PacketReceiveProcessor() {}
   ~PacketReceiveProcessor() {}
-  bool ProcessReply(const PacketStruct *receivebuffer);
+  // receivedMillisecond is millis() when the reply arrived, used for the timing packet round trip
+  bool ProcessReply(const PacketStruct *receivebuffer, uint32_t receivedMillisecond);
   bool HasCommsTimedOut()  const;
 
+  // Request tracking, called by transmit_task
+  void RequestSent(uint16_t sequence, uint8_t window);
+  uint8_t ExpireRequests();
+  uint8_t OutstandingRequests();
+
+  // Copies of pacing statistics for the web server/diagnostics
+  PacketPacing::WindowStatistics GetWindowStatistics(uint8_t window);
+  uint32_t SmoothedRoundTrip();
+  uint32_t ReplyTimeout();
+  uint32_t LostRequests();
+  uint32_t UnmatchedReplies();
+
+  // Round trip time of replies to a command (lower 4 bits of PacketStruct::command)
+  LatencyHistogram::Summary CommandLatency(uint8_t command) const;
+
+  // Errors on one link of the ring, link 0 is the controller to the first module, link "modules" is
+  // the last module back to the controller.
+  // Modules pass on packets with a bad CRC unchanged and every module after the damage counts them,
+  // so the increase in badPacketCount from one module to the next shows where the damage happened.
+  struct LinkErrors
+  {
+    uint32_t crc;
+    // Valid replies which no module processed, by the number of modules they passed through
+    uint32_t notProcessed;
+  };
+  LinkErrors GetLinkErrors(uint8_t link, uint8_t modules) const;
+
   uint16_t totalCRCErrors = 0;
   uint16_t totalOutofSequenceErrors = 0;
   uint16_t totalNotProcessedErrors = 0;
@@ -31,17 +61,40 @@ public:
     totalNotProcessedErrors = 0;
     packetsReceived = 0;
     totalOutofSequenceErrors = 0;
+    memset(_notProcessedAtHop, 0, sizeof(_notProcessedAtHop));
+
+    portENTER_CRITICAL(&_pacingLock);
+    _pacing.ResetCounters();
+    for (auto &h : _latency)
+    {
+      h.Reset();
+    }
+    portEXIT_CRITICAL(&_pacingLock);
   }
 
 private:
-  PacketStruct _packetbuffer;
-  //uint8_t ReplyFromBank() {return (_packetbuffer.address & B00110000) >> 4;}
+  // Reply being processed, only valid during ProcessReply
+  const PacketStruct *_packetbuffer = nullptr;
+
+  // Outstanding requests, accessed from transmit_task, replyqueue_task and web server
+  PacketPacing _pacing;
+  // Round trip per command, updated with _pacing
+  LatencyHistogram _latency[16];
+  mutable portMUX_TYPE _pacingLock = portMUX_INITIALIZER_UNLOCKED;
+
+  uint16_t _notProcessedAtHop[maximum_controller_cell_modules + 1] = {};
+
+  // Replies to these may have end_address == maximum_controller_cell_modules
+  static bool IsBroadcastCommand(uint8_t command);
+  //uint8_t ReplyFromBank() {return (_packetbuffer->address & B00110000) >> 4;}
   //See issue 11 - if we receive zero for the address then we have 16 modules or no modules and a loop
-  uint8_t ReplyForCommand() { return (_packetbuffer.command & 0x0F); }
-  bool ReplyWasProcessedByAModule() { return (_packetbuffer.command & B10000000) > 0; }
+  uint8_t ReplyForCommand() { return (_packetbuffer->command & 0x0F); }
+  bool ReplyWasProcessedByAModule() { return (_packetbuffer->command & B10000000) > 0; }
 
   void ProcessReplySettings();
   void ProcessReplyVoltage();
+  void UpdateVoltageAndStatus(uint8_t m, uint16_t value);
+  void NotifyIfAllVoltagesRead();
   void ProcessReplyTemperature();
 
   void ProcessReplyBadPacketCount();
@@ -52,5 +105,6 @@ private:
 };
 
 extern TaskHandle_t voltageandstatussnapshot_task_handle;
+extern TaskHandle_t transmit_task_handle;
 
 #endif
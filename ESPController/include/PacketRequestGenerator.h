@@ -18,9 +18,45 @@
 //  0000 0100  = Report number of bad packets
 //  0000 0101  = Report settings/configuration
 
+// Request classes, transmit_task always sends the highest priority request waiting.
+// A lower class gets a turn after requestStarvationLimit requests have been sent ahead of it.
+enum RequestPriority : uint8_t
+{
+  // Voltage, status and temperature polls which the rules depend on
+  Safety = 0,
+  // Balance PWM, timing and requests made from the web interface
+  Telemetry = 1,
+  // Settings and counters read in the background by lazy_tasks
+  Housekeeping = 2
+};
+
+const uint8_t numberOfRequestPriorities = 3;
+const uint8_t requestStarvationLimit = 8;
+// Total length of all the request queues
+const uint8_t maximumQueuedRequests = 60;
+
 class PacketRequestGenerator
 {
 public:
+  // Per class counters for /api/monitor2
+  struct PriorityStatistics
+  {
+    uint16_t queueLength;
+    uint16_t maximumQueueLength;
+    uint32_t sent;
+    // Time (ms) requests waited in the queue before being sent
+    uint32_t waitTotal;
+    uint32_t waitMaximum;
+  };
+
+  // Create the request queues, call once before any requests are made
+  void begin();
+
+  // Called by transmit_task, waits up to ticksToWait for a request and returns the one to send next
+  bool nextRequest(PacketStruct *packet, TickType_t ticksToWait);
+
+  PriorityStatistics getStatistics(RequestPriority priority);
+
   bool sendGetSettingsRequest(uint8_t cellid);
   bool sendIdentifyModuleRequest(uint8_t cellid);
   bool sendSaveSetting(uint8_t m, uint16_t BypassThresholdmV, uint8_t BypassOverTempShutdown, float Calibration);
@@ -38,25 +74,69 @@ public:
   bool sendGetAdditionalSettingsRequest(uint8_t cellid);
   bool sendSaveAdditionalSetting(uint8_t cellid, int16_t FanSwitchOnT, uint16_t RelayMinV, uint16_t RelayRange, uint16_t RunAwayCellMinimumVoltagemV, uint16_t RunAwayCellDifferentialmV);
 
+  // Total requests waiting in all classes
   uint16_t queueLength()
   {
-    return (uint16_t)uxQueueMessagesWaiting(_requestq);
+    return (uint16_t)uxSemaphoreGetCount(_requestsWaiting);
   }
 
   void ResetCounters()
   {
     packetsGenerated = 0;
-  }
-
-  void setQueueHandle(QueueHandle_t q)
-  {
-    _requestq = q;
+    packetsCoalesced = 0;
+    for (auto &lane : _lanes)
+    {
+      lane.maximumQueueLength = 0;
+      lane.sent = 0;
+      lane.waitTotal = 0;
+      lane.waitMaximum = 0;
+    }
   }
 
   uint32_t packetsGenerated = 0;
+  // Read requests dropped because a queued request already covered the same modules
+  uint32_t packetsCoalesced = 0;
 
 private:
-  QueueHandle_t _requestq = nullptr;
+  struct QueuedRequest
+  {
+    PacketStruct packet;
+    // esp_timer_get_time() when the request was queued
+    int64_t queued;
+    // Slot in _pendingReads, -1 if not tracked (not a read, or the table was full)
+    int8_t pendingSlot;
+  };
+
+  struct Lane
+  {
+    QueueHandle_t queue;
+    uint16_t maximumQueueLength;
+    uint32_t sent;
+    uint32_t waitTotal;
+    uint32_t waitMaximum;
+  };
+
+  Lane _lanes[numberOfRequestPriorities] = {};
+  // Counts requests in all the queues, transmit_task blocks on this
+  SemaphoreHandle_t _requestsWaiting = nullptr;
+  // Requests sent whilst a lower priority class was waiting
+  uint8_t _sentAheadOfLowerPriority = 0;
+
+  // Read requests waiting in the queues (or about to be), used to drop duplicates
+  struct PendingRead
+  {
+    // 0xFF when the slot is free
+    uint8_t command;
+    uint8_t start_address;
+    uint8_t end_address;
+  };
+  PendingRead _pendingReads[maximumQueuedRequests];
+  portMUX_TYPE _pendingLock = portMUX_INITIALIZER_UNLOCKED;
+
+  static RequestPriority priorityOf(uint8_t command);
+  static bool canCoalesce(uint8_t command);
+  bool coalesceOrTrack(const PacketStruct *_packetbuffer, int8_t *slot);
+  void untrack(int8_t slot);
   bool pushPacketToQueue(PacketStruct *_packetbuffer, TickType_t ticksToWait);
   bool pushPacketToQueue(PacketStruct *_packetbuffer);
   void setPacketAddress(PacketStruct *_packetbuffer, uint8_t module);
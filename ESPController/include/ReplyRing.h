@@ -0,0 +1,87 @@
+#ifndef ReplyRing_H_
+#define ReplyRing_H_
+
+#include <Arduino.h>
+#include <defines.h>
+
+// Preallocated replies passed from the serial decoder (loop task) to replyqueue_task.
+//
+// Only slot numbers go through the FreeRTOS queues, so a reply is copied once (out of the
+// SerialEncoder buffer into its slot) and then processed in place.
+// A slot is owned by the decoder between Acquire() and Publish(), and by replyqueue_task
+// between Next() and Release().
+class ReplyRing
+{
+public:
+  static constexpr uint8_t numberOfSlots = 8;
+
+  struct Slot
+  {
+    PacketStruct packet;
+    // millis() as the reply finished arriving, used for the timing packet round trip
+    uint32_t receivedMillisecond;
+  };
+
+  void begin()
+  {
+    _free = xQueueCreate(numberOfSlots, sizeof(uint8_t));
+    assert(_free);
+    _filled = xQueueCreate(numberOfSlots, sizeof(uint8_t));
+    assert(_filled);
+
+    for (uint8_t i = 0; i < numberOfSlots; i++)
+    {
+      xQueueSendToBack(_free, &i, 0);
+    }
+  }
+
+  // Decoder, returns nullptr if replyqueue_task has fallen behind and every slot is in use
+  Slot *Acquire()
+  {
+    uint8_t i;
+    if (_free == nullptr || xQueueReceive(_free, &i, 0) != pdPASS)
+    {
+      full++;
+      return nullptr;
+    }
+    return &_slots[i];
+  }
+
+  void Publish(Slot *slot)
+  {
+    uint8_t i = (uint8_t)(slot - _slots);
+    xQueueSendToBack(_filled, &i, 0);
+  }
+
+  // replyqueue_task, waits for the next reply in arrival order
+  Slot *Next(TickType_t ticksToWait)
+  {
+    uint8_t i;
+    if (_filled == nullptr || xQueueReceive(_filled, &i, ticksToWait) != pdPASS)
+    {
+      return nullptr;
+    }
+    return &_slots[i];
+  }
+
+  void Release(Slot *slot)
+  {
+    uint8_t i = (uint8_t)(slot - _slots);
+    xQueueSendToBack(_free, &i, 0);
+  }
+
+  // Replies dropped because no slot was free
+  uint32_t full = 0;
+
+  // CPU cycles spent on replies by the decoder and by replyqueue_task, for /api/diagnostic
+  uint32_t packets = 0;
+  uint64_t decodeCycles = 0;
+  uint64_t processCycles = 0;
+
+private:
+  Slot _slots[numberOfSlots];
+  QueueHandle_t _free = nullptr;
+  QueueHandle_t _filled = nullptr;
+};
+
+#endif
@@ -88,6 +88,44 @@ private:
     int64_t ChargingTimer{0};
     std::array<bool, RELAY_RULES> rule_outcome;
 
+    // Cell values for one bank, only recalculated when the readings for that bank change
+    struct BankValues
+    {
+        uint32_t voltage;
+        uint32_t limitedVoltage;
+        uint16_t highestCellVoltage;
+        uint16_t lowestCellVoltage;
+        uint8_t address_HighestCellVoltage;
+        uint8_t address_LowestCellVoltage;
+        int8_t highestExternalTemp;
+        int8_t lowestExternalTemp;
+        uint8_t address_highestExternalTemp;
+        uint8_t address_lowestExternalTemp;
+        int8_t highestInternalTemp;
+        int8_t lowestInternalTemp;
+        uint8_t invalidModuleCount;
+        uint8_t zeroVoltageModuleCount;
+        bool hasExternalTempSensor;
+    };
+    std::array<BankValues, maximum_number_of_banks> bankValues;
+
+    // Readings bankValues were calculated from, used to spot which banks have changed
+    struct
+    {
+        bool valid[maximum_controller_cell_modules];
+        uint16_t voltagemV[maximum_controller_cell_modules];
+        int8_t internalTemp[maximum_controller_cell_modules];
+        int8_t externalTemp[maximum_controller_cell_modules];
+    } processed;
+    // Layout and settings bankValues were calculated with, zero banks forces every bank to be recalculated
+    uint8_t processedBanks{0};
+    uint8_t processedSeriesModules{0};
+    uint16_t processedCellmaxmv{0};
+
+    bool BankChanged(uint8_t firstCell, uint8_t count, const CellReadings *cells) const;
+    void ProcessBank(uint8_t bank, uint8_t firstCell, uint8_t count, const CellReadings *cells, uint16_t cellmaxmv);
+    void CombineBanks(uint8_t banks);
+
 public:
     static const std::array<std::string, 1 + MAXIMUM_RuleNumber> RuleTextDescription;
     static const std::array<std::string, 1 + MAXIMUM_InternalWarningCode> InternalWarningCodeDescription;
@@ -136,6 +174,15 @@ public:
     int8_t highestInternalTemp;
     int8_t lowestInternalTemp;
 
+    // Dynamic charge voltage calculated for each bank (0.1V) and the voltage range (mV) it used,
+    // DynamicChargeVoltage is the lowest of these.  Zero when a cell is over cellmaxmv or dynamic charge is off.
+    struct DynamicChargeBank
+    {
+        uint16_t voltage;
+        uint16_t range;
+    };
+    std::array<DynamicChargeBank, maximum_number_of_banks> dynamicChargeBank;
+
     std::array<InternalErrorCode, 1 + MAXIMUM_InternalErrorCode> ErrorCodes;
     std::array<InternalWarningCode, 1 + MAXIMUM_InternalWarningCode> WarningCodes;
 
@@ -182,6 +229,10 @@ public:
     int8_t numberOfActiveWarnings;
     int8_t numberOfBalancingModules;
 
+    // CellSnapshot epoch (and when it was published) the cell values above were calculated from
+    uint32_t snapshotEpoch = 0;
+    int64_t snapshotPublished = 0;
+
     /// @brief Clear all rules (off)
     void resetAllRules()
     {
@@ -206,8 +257,15 @@ public:
     }
 
     void ClearValues();
-    void ProcessCell(uint8_t bank, uint8_t cellNumber, const CellModuleInfo *c, uint16_t cellmaxmv);
-    void ProcessBank(uint8_t bank);
+
+    /// @brief Calculate the cell, bank and pack values from a set of readings.
+    /// Only banks whose readings differ from the previous call are scanned again.
+    /// @return Number of banks scanned
+    uint8_t UpdateCellValues(const CellReadings *cells, uint8_t banks, uint8_t seriesModules, uint16_t cellmaxmv);
+
+    // Banks scanned/skipped by UpdateCellValues, for diagnostics
+    uint32_t banksScanned = 0;
+    uint32_t banksSkipped = 0;
     void SetWarning(InternalWarningCode warncode);
     void CalculateChargingMode(const diybms_eeprom_settings *mysettings, const currentmonitoring_struct *currentMonitor);
 
@@ -242,7 +300,7 @@ public:
 
     bool IsChargeAllowed(const diybms_eeprom_settings *mysettings);
     bool IsDischargeAllowed(const diybms_eeprom_settings *mysettings);
-    void CalculateDynamicChargeVoltage(const diybms_eeprom_settings *mysettings, const CellModuleInfo *cellarray);
+    void CalculateDynamicChargeVoltage(const diybms_eeprom_settings *mysettings, const CellReadings *cells);
     void CalculateDynamicChargeCurrent(const diybms_eeprom_settings *mysettings);
     uint16_t DynamicChargeVoltage() const;
     int16_t DynamicChargeCurrent() const;
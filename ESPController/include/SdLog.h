@@ -0,0 +1,99 @@
+#ifndef SdLog_H_
+#define SdLog_H_
+
+#include <Arduino.h>
+#include <SD.h>
+#include <string>
+
+// A daily CSV log on the SD card, kept open and written behind.
+//
+// Rows are added to a RAM buffer without touching the card.  Once Threshold bytes are waiting they are
+// written out, ending on a 512 byte sector boundary of the file so the card only sees whole sectors,
+// and the rest stays in the buffer.  After FlushInterval everything waiting is written and the file
+// flushed, so a power cut loses at most that much.  The file stays open until the name changes (a new
+// day), the card is unmounted or logging is switched off, which all write out the buffer first.
+//
+// The bus lock (the VSPI mutex, shared with the TFT) is only taken around card access, never while a
+// row is being formatted.  The log's own lock is taken first, so Close() can be called from any task.
+class SdLog
+{
+public:
+  // Take and give the bus lock
+  typedef bool (*BusFunction)();
+
+  SdLog(const char *name, uint16_t bufferSize, BusFunction lockBus, BusFunction unlockBus)
+      : _name(name), _bufferSize(bufferSize), _lockBus(lockBus), _unlockBus(unlockBus) {}
+
+  // Allocates the buffer, false if there isn't the memory
+  bool Begin();
+
+  // Starts a row for "filename".  If that isn't the file being written, the rows waiting are written out,
+  // the old file closed and "filename" opened.  Returns true if it is a new file, so needs a header.
+  bool Start(const char *filename);
+  bool Start(const std::string &filename) { return Start(filename.c_str()); }
+
+  // Adds to the row, if the buffer fills up whole sectors are written out
+  void Append(const char *data, size_t length);
+  void Append(const std::string &data) { Append(data.data(), data.length()); }
+
+  // Row complete, writes out if Threshold bytes are waiting or FlushInterval has passed
+  void End();
+
+  // Writes out and flushes if FlushInterval has passed, for a log that only gets the odd row
+  void FlushIfDue();
+
+  // Writes out everything waiting and closes the file, before the card is unmounted
+  void Close();
+
+  // Offset in the file the next byte appended will have
+  uint32_t Position() const { return _fileSize + _used; }
+
+  // False once the card has less than MinimumFreeSpace, nothing is written after that
+  bool SpaceAvailable() const { return !_cardFull; }
+
+  // Writes to the card and the time the bus lock was held, includes opening, flushing and closing
+  uint32_t writes = 0;
+  uint32_t flushes = 0;
+  uint32_t opens = 0;
+  uint64_t bytesWritten = 0;
+  uint64_t busHold_us = 0;
+  uint32_t busHoldMax_us = 0;
+  uint32_t busLocks = 0;
+  // Bytes lost because the buffer was full and the card couldn't be written
+  uint32_t bytesDropped = 0;
+
+  static constexpr uint16_t SectorSize = 512;
+  static constexpr uint32_t FlushInterval = 60 * 1000;
+  static constexpr uint64_t MinimumFreeSpace = 25 * 1024 * 1024;
+
+private:
+  const char *_name;
+  const uint16_t _bufferSize;
+  BusFunction _lockBus;
+  BusFunction _unlockBus;
+
+  uint8_t *_buffer = nullptr;
+  uint16_t _used = 0;
+  // Written out once this many bytes are waiting
+  uint16_t _threshold = 0;
+  std::string _filename;
+  File _file;
+  // Size of the file on the card, to end writes on a sector boundary
+  uint32_t _fileSize = 0;
+  uint32_t _lastFlush = 0;
+  // Written to the file since it was last flushed
+  bool _unflushed = false;
+  // The file couldn't be opened, the rest of the row is dropped
+  bool _skipRow = false;
+  bool _cardFull = false;
+  int64_t _lockedAt = 0;
+  SemaphoreHandle_t _lock = nullptr;
+
+  bool LockBus();
+  void UnlockBus();
+  void WriteOut(bool everything);
+  void WriteOutIfDue();
+  void CloseFile();
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef VoltageGuard_H_
+#define VoltageGuard_H_
+
+#include <Arduino.h>
+#include <defines.h>
+
+#include "Rules.h"
+#include "LatencyHistogram.h"
+
+// Fast path for the cell and bank voltage protection rules.
+//
+// Rules only sees a reading once the sweep it belongs to has been published as a snapshot, which
+// for a large pack is seconds after the module replied.  replyqueue_task calls Check() with the
+// modules in each voltage reply, which compares them against the ModuleOverVoltage,
+// ModuleUnderVoltage and BankOverVoltage rule values so the relays can be changed straight away.
+//
+// The guard only ever trips a rule.  Whether a rule is active, and when it resets (with hysteresis),
+// is still decided by Rules::RunRules, Release() drops each trip once Rules has evaluated a snapshot
+// containing the reading that caused it.  Relay outputs use a rule if either says it is active.
+//
+// Check() only reads, Trip() and Release() are called with relayMutex (main.cpp) held, which also
+// serialises the relay outputs.
+class VoltageGuard
+{
+public:
+  // replyqueue_task, after readings for modules "first" to "last" have been stored.
+  // Returns a bit (1 << index in "guarded") for each rule whose value the readings are beyond,
+  // leaving out rules already tripped or active in Rules.
+  uint8_t Check(uint8_t first, uint8_t last, const CellReadings *cells, const diybms_eeprom_settings *settings, const Rules *rules) const;
+
+  // Trip the rules returned by Check(), received_us is esp_timer_get_time() when the reply arrived
+  // and epoch the latest snapshot published.
+  // Returns true if a rule has tripped which Rules did not already have active.
+  bool Trip(uint8_t exceeded, const Rules *rules, int64_t received_us, uint32_t epoch);
+
+  // rules_task, with the Rules outcome just calculated
+  void Release(const Rules *rules);
+
+  // Only checks readings whilst true, set by rules_task once every module has returned a voltage
+  // and the controller is running (the same condition RunRules applies)
+  bool armed = false;
+
+  bool Tripped(Rule r) const
+  {
+    const int8_t i = Index(r);
+    return i >= 0 && _trips[i].tripped;
+  }
+
+  // Time from the reply arriving to relays changed by the fast path, and to Rules reporting the same rule (us)
+  LatencyHistogram fastReaction;
+  LatencyHistogram rulesReaction;
+
+  uint32_t trips = 0;
+  // Trips released without Rules ever reporting the rule as active
+  uint32_t unconfirmed = 0;
+
+private:
+  static constexpr uint8_t numberOfRules = 3;
+  static constexpr Rule guarded[numberOfRules] = {Rule::ModuleOverVoltage, Rule::ModuleUnderVoltage, Rule::BankOverVoltage};
+
+  struct TripState
+  {
+    bool tripped;
+    // Rules has reported the rule active since the trip
+    bool confirmed;
+    int64_t received_us;
+    // Snapshot epoch when the trip happened, Rules has seen the reading once its epoch is later
+    uint32_t epoch;
+  };
+  TripState _trips[numberOfRules] = {};
+
+  static int8_t Index(Rule r)
+  {
+    for (int8_t i = 0; i < numberOfRules; i++)
+    {
+      if (guarded[i] == r)
+      {
+        return i;
+      }
+    }
+    return -1;
+  }
+};
+
+extern VoltageGuard voltageGuard;
+
+#endif
@@ -1,145 +1,248 @@
 #ifndef CIRCULAR_BUFFER_HPP_
 #define CIRCULAR_BUFFER_HPP_
 
+#include <algorithm>
 #include <array>
-// #include <mutex>
-// #include <optional>
-
-template <class T, size_t TElemCount>
+#include <atomic>
+#include <stddef.h>
+#include <type_traits>
+
+// Fixed size ring of T, TElemCount must be a power of two.
+//
+// head_ and tail_ count every item ever written/read, the slot is the count masked by TElemCount - 1,
+// so the buffer holds head_ - tail_ items and all TElemCount slots can be used.
+//
+// With TSpsc = true one task may write (put_n, try_put, write_spans/commit) while one other task reads
+// (get, read_n, read_spans/consume, iteration) without a lock.  put() overwrites the oldest item,
+// which moves the reader's position, so it is only available without TSpsc.
+//
+// Contiguous access, for copying in/out without going item by item:
+//   auto s = buffer.read_spans();
+//   send(s.first.data, s.first.size); send(s.second.data, s.second.size);
+//   buffer.consume(s.size());
+template <class T, size_t TElemCount, bool TSpsc = false>
 class circular_buffer
 {
+	static_assert(TElemCount > 0 && (TElemCount & (TElemCount - 1)) == 0, "TElemCount must be a power of two");
+
 public:
 	explicit circular_buffer() = default;
 
-	void put(T item) noexcept
+	// Items in one contiguous part of the buffer
+	template <class U>
+	struct span_of
 	{
-		// std::lock_guard<std::recursive_mutex> lock(mutex_);
+		U *data;
+		size_t size;
+
+		U *begin() const noexcept { return data; }
+		U *end() const noexcept { return data + size; }
+	};
+	using span = span_of<T>;
+	using const_span = span_of<const T>;
+
+	// The free space or the items held, the second part is empty unless they wrap around the end
+	template <class S>
+	struct spans_of
+	{
+		S first;
+		S second;
+
+		size_t size() const noexcept { return first.size + second.size; }
+	};
+	using spans = spans_of<span>;
+	using const_spans = spans_of<const_span>;
 
-		buf_[head_] = item;
+	// Adds an item, the oldest is dropped if full
+	void put(T item) noexcept
+	{
+		static_assert(!TSpsc, "put() moves the reader, use try_put() or put_n()");
 
-		if (full_)
+		if (full())
 		{
-			tail_ = (tail_ + 1) % TElemCount;
+			tail_++;
 		}
+		buf_[head_ & mask] = item;
+		head_++;
+	}
 
-		head_ = (head_ + 1) % TElemCount;
-
-		full_ = head_ == tail_;
+	// Adds an item unless full
+	bool try_put(const T &item) noexcept
+	{
+		const size_t head = load(head_, std::memory_order_relaxed);
+		if (head - load(tail_, std::memory_order_acquire) == TElemCount)
+		{
+			return false;
+		}
+		buf_[head & mask] = item;
+		store(head_, head + 1, std::memory_order_release);
+		return true;
 	}
 
-	T get() const noexcept
+	// Adds up to "count" items, as many as fit, returns the number added
+	size_t put_n(const T *items, size_t count) noexcept
 	{
-		// std::lock_guard<std::recursive_mutex> lock(mutex_);
+		auto s = write_spans();
+		count = count < s.size() ? count : s.size();
+
+		const size_t first = count < s.first.size ? count : s.first.size;
+		std::copy(items, items + first, s.first.data);
+		std::copy(items + first, items + count, s.second.data);
+		commit(count);
+		return count;
+	}
 
-		if (empty())
+	// Removes and returns the oldest item, T() if empty
+	T get() noexcept
+	{
+		const size_t tail = load(tail_, std::memory_order_relaxed);
+		if (load(head_, std::memory_order_acquire) == tail)
 		{
 			return T();
 		}
 
 		// Read data and advance the tail (we now have a free space)
-		auto val = buf_[tail_];
-		full_ = false;
-		tail_ = (tail_ + 1) % TElemCount;
-
+		T val = buf_[tail & mask];
+		store(tail_, tail + 1, std::memory_order_release);
 		return val;
 	}
 
-	// Just for debug...
-	/*
-	T element(uint16_t index) const noexcept
+	// Removes up to "count" of the oldest items, returns the number copied to "items"
+	size_t read_n(T *items, size_t count) noexcept
 	{
-		// We can't look beyond the current buffer size
-		if (empty() || index > size())
-		{
-			return T();
-		}
+		auto s = read_spans();
+		count = count < s.size() ? count : s.size();
+
+		const size_t first = count < s.first.size ? count : s.first.size;
+		std::copy(s.first.data, s.first.data + first, items);
+		std::copy(s.second.data, s.second.data + (count - first), items + first);
+		consume(count);
+		return count;
+	}
 
-		return buf_[index];
-	}*/
+	// Free space, fill it and then commit() how much was written
+	spans write_spans() noexcept
+	{
+		const size_t head = load(head_, std::memory_order_relaxed);
+		const size_t free = TElemCount - (head - load(tail_, std::memory_order_acquire));
+		return split<spans>(buf_.data(), head & mask, free);
+	}
 
-	T peek(uint16_t look_ahead_counter) const noexcept
+	void commit(size_t count) noexcept
 	{
-		size_t pos;
+		store(head_, load(head_, std::memory_order_relaxed) + count, std::memory_order_release);
+	}
 
-		// We can't look beyond the current buffer size
-		if (empty() || look_ahead_counter > size())
+	// Items held, oldest first, then consume() how many have been used
+	const_spans read_spans() const noexcept
+	{
+		const size_t tail = load(tail_, std::memory_order_relaxed);
+		const size_t used = load(head_, std::memory_order_acquire) - tail;
+		return split<const_spans>(buf_.data(), tail & mask, used);
+	}
+
+	void consume(size_t count) noexcept
+	{
+		store(tail_, load(tail_, std::memory_order_relaxed) + count, std::memory_order_release);
+	}
+
+	// Item "look_ahead_counter" from the oldest, T() if there isn't one
+	T peek(size_t look_ahead_counter) const noexcept
+	{
+		const size_t tail = load(tail_, std::memory_order_relaxed);
+		if (look_ahead_counter >= load(head_, std::memory_order_acquire) - tail)
 		{
 			return T();
 		}
+		return buf_[(tail + look_ahead_counter) & mask];
+	}
 
-		pos = tail_ + look_ahead_counter;
-		if (pos >= capacity())
-		{
-			pos -= capacity();
-		}
-		/*
-		for (int i = 0; i < look_ahead_counter; i++)
+	// Oldest to newest, the items held when begin() was called
+	class const_iterator
+	{
+	public:
+		const_iterator(const T *buf, size_t position) noexcept : buf_(buf), position_(position) {}
+
+		const T &operator*() const noexcept { return buf_[position_ & mask]; }
+		const T *operator->() const noexcept { return &buf_[position_ & mask]; }
+		const_iterator &operator++() noexcept
 		{
-			if (++(pos) == size())
-				pos = 0;
-			else
-				pos++;
+			position_++;
+			return *this;
 		}
-		*/
-		return buf_[pos];
+		bool operator!=(const const_iterator &other) const noexcept { return position_ != other.position_; }
+		bool operator==(const const_iterator &other) const noexcept { return position_ == other.position_; }
+
+	private:
+		const T *buf_;
+		size_t position_;
+	};
+
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(buf_.data(), load(tail_, std::memory_order_relaxed));
+	}
+
+	const_iterator end() const noexcept
+	{
+		return const_iterator(buf_.data(), load(head_, std::memory_order_acquire));
 	}
 
+	// Not safe whilst another task is using the buffer
 	void reset() noexcept
 	{
-		// std::lock_guard<std::recursive_mutex> lock(mutex_);
-		head_ = tail_;
-		full_ = false;
+		store(tail_, load(head_, std::memory_order_relaxed), std::memory_order_relaxed);
 	}
 
 	bool empty() const noexcept
 	{
-		// Can have a race condition in a multi-threaded application
-		// std::lock_guard<std::recursive_mutex> lock(mutex_);
-		// if head and tail are equal, we are empty
-		return (!full_ && (head_ == tail_));
+		return size() == 0;
 	}
 
 	bool full() const noexcept
 	{
-		// If tail is ahead the head by 1, we are full
-		return full_;
+		return size() == TElemCount;
 	}
 
-	size_t capacity() const noexcept
+	constexpr size_t capacity() const noexcept
 	{
 		return TElemCount;
 	}
 
 	size_t size() const noexcept
 	{
-		// A lock is needed in size ot prevent a race condition, because head_, tail_, and full_
-		// can be updated between executing lines within this function in a multi-threaded
-		// application
-		// std::lock_guard<std::recursive_mutex> lock(mutex_);
+		// Tail first, so the writer can only make it larger than it was
+		const size_t tail = load(tail_, std::memory_order_acquire);
+		return load(head_, std::memory_order_acquire) - tail;
+	}
 
-		size_t size = TElemCount;
+private:
+	static constexpr size_t mask = TElemCount - 1;
 
-		if (!full_)
-		{
-			if (head_ >= tail_)
-			{
-				size = head_ - tail_;
-			}
-			else
-			{
-				size = TElemCount + head_ - tail_;
-			}
-		}
+	// Plain counters unless shared between tasks
+	using index_type = typename std::conditional<TSpsc, std::atomic<size_t>, size_t>::type;
+
+	static size_t load(const size_t &index, std::memory_order) noexcept { return index; }
+	static size_t load(const std::atomic<size_t> &index, std::memory_order order) noexcept { return index.load(order); }
+	static void store(size_t &index, size_t value, std::memory_order) noexcept { index = value; }
+	static void store(std::atomic<size_t> &index, size_t value, std::memory_order order) noexcept { index.store(value, order); }
 
-		return size;
+	// "count" items from slot "start", in up to two parts
+	template <class S, class U>
+	static S split(U *buf, size_t start, size_t count) noexcept
+	{
+		const size_t first = count < TElemCount - start ? count : TElemCount - start;
+		S s;
+		s.first.data = buf + start;
+		s.first.size = first;
+		s.second.data = buf;
+		s.second.size = count - first;
+		return s;
 	}
 
-private:
-	// mutable std::recursive_mutex mutex_;
-	mutable std::array<T, TElemCount> buf_;
-	mutable size_t head_ = 0;
-	mutable size_t tail_ = 0;
-	mutable bool full_ = 0;
+	std::array<T, TElemCount> buf_{};
+	index_type head_{0};
+	index_type tail_{0};
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -131,6 +131,10 @@ struct diybms_eeprom_settings
   uint8_t totalNumberOfSeriesModules;
   uint16_t baudRate;
   uint16_t interpacketgap;
+  // Release next module request as soon as the reply arrives (instead of fixed delay)
+  bool replydrivenpacing;
+  // Maximum number of module requests outstanding when replydrivenpacing is enabled
+  uint8_t packetwindow;
 
   int32_t rulevalue[RELAY_RULES];
   int32_t rulehysteresis[RELAY_RULES];
@@ -155,6 +159,8 @@ struct diybms_eeprom_settings
 
   bool loggingEnabled;
   uint16_t loggingFrequencySeconds;
+  // Cell data log in binary (.dbl) instead of CSV
+  bool loggingBinary;
 
   bool currentMonitoringEnabled;
   uint8_t currentMonitoringModBusAddress;
@@ -325,27 +331,9 @@ struct CellModuleInfo
 {
   /// @brief  Used as part of the enquiry functions
   bool settingsCached : 1;
-  /// @brief Set to true once the module has replied with data
-  bool valid : 1;
-  /// @brief  Bypass is active
-  bool inBypass : 1;
-  /// @brief  Bypass active and temperature over set point
-  bool bypassOverTemp : 1;
   // Introduced for v490 all-in-one cells, prevents changes to module configuration
   bool ChangesProhibited : 1;
 
-  /// @brief actual cell voltage (millivolts)
-  uint16_t voltagemV;
-  /// @brief keeps track of minimum voltage this cell reached
-  uint16_t voltagemVMin;
-  /// @brief keeps track of maximum voltage this cell reached
-  uint16_t voltagemVMax;
-  // Signed integer byte (negative temperatures)
-  /// @brief Internal (on-board) temperature sensor in degrees C
-  int8_t internalTemp;
-  /// @brief External temperature sensor in degrees C
-  int8_t externalTemp;
-
   uint8_t BypassOverTempShutdown;
   uint16_t BypassThresholdmV;
   uint16_t badPacketCount;
@@ -364,8 +352,6 @@ struct CellModuleInfo
   uint16_t BoardVersionNumber;
   /// @brief Last 4 bytes of GITHUB version
   uint32_t CodeVersionNumber;
-  /// @brief Value of PWM timer for load shedding
-  uint16_t PWMValue;
 
   uint16_t BalanceCurrentCount;
   uint16_t PacketReceivedCount;
@@ -378,6 +364,32 @@ struct CellModuleInfo
   uint16_t RunAwayCellDifferentialmV;
 };
 
+// Values every module reports on each sweep, held as one array per field (indexed by module)
+// so the loops over every module in rules, the web API, MQTT and CAN read contiguous memory.
+// Module settings and counters, which are rarely read, stay in CellModuleInfo.
+struct CellReadings
+{
+  /// @brief Set to true once the module has replied with data
+  bool valid[maximum_controller_cell_modules];
+  /// @brief  Bypass is active
+  bool inBypass[maximum_controller_cell_modules];
+  /// @brief  Bypass active and temperature over set point
+  bool bypassOverTemp[maximum_controller_cell_modules];
+  /// @brief actual cell voltage (millivolts)
+  uint16_t voltagemV[maximum_controller_cell_modules];
+  /// @brief keeps track of minimum voltage this cell reached
+  uint16_t voltagemVMin[maximum_controller_cell_modules];
+  /// @brief keeps track of maximum voltage this cell reached
+  uint16_t voltagemVMax[maximum_controller_cell_modules];
+  // Signed integer byte (negative temperatures)
+  /// @brief Internal (on-board) temperature sensor in degrees C
+  int8_t internalTemp[maximum_controller_cell_modules];
+  /// @brief External temperature sensor in degrees C
+  int8_t externalTemp[maximum_controller_cell_modules];
+  /// @brief Value of PWM timer for load shedding
+  uint16_t PWMValue[maximum_controller_cell_modules];
+};
+
 // This enum holds the states the controller goes through whilst
 // it stabilizes and moves into running state.
 enum ControllerState : uint8_t
@@ -399,6 +411,8 @@ enum CardAction : uint8_t
 
 // This holds all the cell information in a large array array
 extern CellModuleInfo cmi[maximum_controller_cell_modules];
+// Latest readings from each module, updated as replies arrive (see also CellSnapshot)
+extern CellReadings cellReadings;
 
 struct avrprogramsettings
 {
@@ -2,304 +2,213 @@
 #define History_H_
 
 #pragma once
-/*
-#define USE_ESP_IDF_LOG 1
-static constexpr const char *const TAG = "diybms-hist";
-*/
+
 #include "defines.h"
 #include "Rules.h"
-#include "circular_buffer.hpp"
 #include <esp_http_server.h>
-
+#include <FS.h>
+
+// History of the pack at three resolutions, held in RAM.
+//
+// rules_task calls Add() with every new snapshot.  Each tier keeps the average, minimum and maximum of
+// the samples in its interval, so a 30 minute record still shows the lowest cell voltage and the
+// highest current seen during those 30 minutes.
+//
+// Records are stored in blocks of BlockSize bytes.  The first record in a block is stored in full,
+// the rest as the difference from the record before (zigzag varints), minimum/maximum values as the
+// difference from their average, so most values take a single byte.  When a tier is full its oldest
+// block is dropped.
+//
+// The 5 and 30 minute tiers are kept over a restart in an append only file of chunks, each chunk is a
+// block with its sequence number and a CRC.  A block is appended once it is full, the block being
+// filled every CheckpointInterval.  Restore() only reads the chunk headers, the records are read in
+// when a request needs them or by Checkpoint() in the background.  Once the file has grown to
+// CompactSize it is rewritten with just the blocks held.
 class History
 {
-private:
-    static const int NUMBER_OF_HISTORY_POINTS = 36;
-    struct history_values
+public:
+    // Values in a record, voltages (V) and current (A) are * 100, state of charge is % * 100
+    enum Field : uint8_t
     {
-        time_t historic_time;
-        // Highest cell voltage range (mV) across all banks
-        uint16_t highestBankRange;
-
-        // Highest cell voltage in the whole system (millivolts)
-        uint16_t highestCellVoltage;
-        // Lowest cell voltage in the whole system (millivolts)
-        uint16_t lowestCellVoltage;
-
-        // Highest pack voltage (millivolts)
-        uint32_t highestBankVoltage;
-        // Lowest pack voltage (millivolts)
-        uint32_t lowestBankVoltage;
-
-        int8_t highestExternalTemp;
-        int8_t lowestExternalTemp;
-
-        uint8_t address_LowCellVoltage;
-        uint8_t address_HighCellVoltage;
-
-        float voltage;
-        float current;
-        float stateofcharge;
-        uint32_t milliamphour_in;
-        uint32_t milliamphour_out;
+        Time,
+        VoltageAvg,
+        VoltageMin,
+        VoltageMax,
+        CurrentAvg,
+        CurrentMin,
+        CurrentMax,
+        StateOfCharge,
+        MilliampHourIn,
+        MilliampHourOut,
+        LowestCellAvg,
+        LowestCellMin,
+        AddressLowCell,
+        HighestCellAvg,
+        HighestCellMax,
+        AddressHighCell,
+        BankRangeAvg,
+        BankRangeMax,
+        LowestBankVoltage,
+        HighestBankVoltage,
+        LowestExternalTemp,
+        HighestExternalTemp,
+        NumberOfFields
     };
 
-    circular_buffer<history_values, NUMBER_OF_HISTORY_POINTS> historic_readings;
+    static constexpr uint16_t BlockSize = 512;
+    static constexpr uint8_t NumberOfTiers = 3;
 
-public:
-    void Clear()
+    struct Block
     {
-        // Zero out memory for holding historic data
-        memset(&historic_readings, 0, sizeof(historic_readings));
-    }
+        // Time of the first record
+        uint32_t firstTime;
+        // Bytes of data used
+        uint16_t used;
+        uint8_t records;
+        uint8_t reserved;
+        uint8_t data[BlockSize - 8];
+    };
 
-    // Capture important statistics as a snapshot in time into circular buffer
-    void SnapshotHistory(time_t now, Rules *rules, currentmonitoring_struct *currentMonitor)
-    {
-        history_values hr;
-        history_values *ptr = &hr;
+    // Allocates the blocks the first time, then empties every tier
+    void Clear();
 
-        // Zero all values
-        memset(ptr, 0, sizeof(history_values));
-        // Capture the values
-        ptr->historic_time = now;
-        ptr->highestBankRange = rules->highestBankRange;
-        ptr->highestCellVoltage = rules->highestCellVoltage;
-        ptr->lowestCellVoltage = rules->lowestCellVoltage;
-        ptr->highestBankVoltage = rules->highestBankVoltage;
-        ptr->lowestBankVoltage = rules->lowestBankVoltage;
-        ptr->highestExternalTemp = rules->highestExternalTemp;
-        ptr->lowestExternalTemp = rules->lowestExternalTemp;
-        ptr->address_LowCellVoltage = rules->address_LowestCellVoltage;
-        ptr->address_HighCellVoltage = rules->address_HighestCellVoltage;
+    // Sample the rules outcome and current monitor, "now" must be a valid (SNTP) time
+    void Add(time_t now, const Rules *rules, const currentmonitoring_struct *currentMonitor);
 
-        if (currentMonitor->validReadings)
-        {
-            ptr->voltage = currentMonitor->modbus.voltage;
-            ptr->current = currentMonitor->modbus.current;
-            ptr->milliamphour_in = currentMonitor->modbus.milliamphour_in;
-            ptr->milliamphour_out = currentMonitor->modbus.milliamphour_out;
-            ptr->stateofcharge = currentMonitor->stateofcharge;
-        }
+    // /api/history, "resolution" in seconds (0 = finest tier holding "from"), from/to in seconds since 1970
+    esp_err_t GenerateJSON(httpd_req_t *req, char buffer[], int bufferLenMax, uint32_t resolution, uint32_t from, uint32_t to);
 
-        historic_readings.put(hr);
-    }
+    // /api/historybin, the blocks holding from to "to" as they are stored, little endian:
+    //   "DHB", version 1, uint32 resolution, uint8 number of fields, then for each field
+    //     uint8 flags (1 = relative to field "reference" of the same record, else the previous record,
+    //       2 = value is * 100, 4 = unsigned, 8 = time, relative to the previous time + resolution)
+    //     int8 reference, uint8 name length, name (as in /api/history)
+    //   each block: uint32 firstTime, uint16 bytes, uint8 records, uint8 0, records
+    // A record is a zigzag varint per field (see Decode), the first in a block is relative to zero.
+    // Records either side of from/to are not removed.
+    esp_err_t GenerateBinary(httpd_req_t *req, char buffer[], int bufferLenMax, uint32_t resolution, uint32_t from, uint32_t to);
 
-    esp_err_t GenerateJSON(httpd_req_t *req, char buffer[], int bufferLenMax)
+    struct TierStatistics
     {
-        // allocate & clear memory for copy of history values
-        auto h = (history_values *)calloc(NUMBER_OF_HISTORY_POINTS, sizeof(history_values));
-
-        if (h == nullptr)
-        {
-            // malloc failed
-            return httpd_resp_set_status(req, HTTPD_500);
-        }
-
-        // Take a copy of all the historic readings, this allows the loops further on to work optimaly in creating JSON.
-        size_t size = historic_readings.size();
-        for (uint16_t i = 0; i < size; i++)
-        {
-            h[i] = historic_readings.peek(i);
-        }
-
-        int bufferused = 0;
-
-        // TIME
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "{\"time\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%ld", h[i].historic_time);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // stateofcharge
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"stateofcharge\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.2f", h[i].stateofcharge);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // voltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"voltage\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.2f", h[i].voltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
-
-        // voltrange
-        bufferused = 0;
-
-        // milliamphour_in
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"milliamphour_in\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].milliamphour_in);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // milliamphour_out
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"milliamphour_out\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].milliamphour_out);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // current
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"current\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%.4f", h[i].current);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
-
-        // voltrange
-        bufferused = 0;
-
-        // highestExternalTemp
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestExternalTemp\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%i", h[i].highestExternalTemp);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // lowestExternalTemp
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestExternalTemp\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%i", h[i].lowestExternalTemp);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        // lowestBankVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestBankVoltage\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].lowestBankVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
+        uint32_t resolution;
+        uint32_t records;
+        uint32_t bytes;
+        uint32_t capacity;
+    };
+    TierStatistics Statistics(uint8_t tier);
 
-        // voltrange
-        bufferused = 0;
+    // At power up, after Clear()
+    void Restore(fs::FS &fs);
 
-        // HighestBankVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestBankVoltage\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestBankVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
+    // Appends new blocks to the file, reads in blocks left by Restore().  Called from lazy_tasks.
+    void Checkpoint();
 
-        // HighestBankRange
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestBankRange\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestBankRange);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-        // highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"highestCellVoltage\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].highestCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-        // Address highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"address_HighCellV\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].address_HighCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
+    // Time taken by Restore() and blocks it found, blocks still in the file
+    uint32_t restore_us = 0;
+    uint32_t restoredBlocks = 0;
+    uint32_t pendingBlocks = 0;
+    // Chunks written and failures reading/writing the file
+    uint32_t chunksWritten = 0;
+    uint32_t fileErrors = 0;
 
-        // voltrange
-        bufferused = 0;
+    static constexpr const char *filename = "/history.dat";
+    // Seconds between writes of the block being filled
+    static constexpr uint32_t CheckpointInterval = 15 * 60;
+    static constexpr uint32_t CompactSize = 128 * 1024;
 
-        // lowestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"lowestCellVoltage\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].lowestCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
+    // Decodes the record at "p" in a block of the tier with "resolution", which follows "previous"
+    // (zeroes for the first record)
+    static const uint8_t *Decode(const uint8_t *p, const int32_t previous[], int32_t record[], uint32_t resolution);
 
-        // Address highestCellVoltage
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "],\"address_LowCellV\":[");
-        for (uint16_t i = 0; i < size; i++)
-        {
-            bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%u", h[i].address_LowCellVoltage);
-            if (i != (size - 1))
-            {
-                bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",");
-            }
-        }
+private:
+    enum class Aggregate : uint8_t
+    {
+        Last,
+        Average,
+        Minimum,
+        Maximum,
+        // Value from the sample holding the minimum/maximum of field "reference"
+        AtMinimum,
+        AtMaximum
+    };
 
-        // Closing tag
-        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "]}");
+    struct FieldDefinition
+    {
+        Aggregate aggregate;
+        // Minimum/Maximum are stored relative to this field of the same record (-1 = previous record)
+        int8_t reference;
+    };
+    static const FieldDefinition fields[NumberOfFields];
 
-        //  Send it...
-        httpd_resp_send_chunk(req, buffer, bufferused);
+    struct TierDefinition
+    {
+        // Seconds per record
+        uint32_t resolution;
+        uint16_t numberOfBlocks;
+        // Kept in the history file
+        bool persist;
+    };
+    static const TierDefinition tierDefinitions[NumberOfTiers];
 
-        free(h);
+    struct Tier
+    {
+        Block *blocks;
+        // Sequence numbers of the oldest block and the one after the newest, block n is blocks[n % numberOfBlocks]
+        uint32_t firstBlock;
+        uint32_t nextBlock;
+        // Last record stored, the next is encoded relative to it
+        int32_t last[NumberOfFields];
+
+        // Samples in the current interval
+        uint32_t count;
+        int64_t accumulated[NumberOfFields];
+
+        // Persisted tiers only, file offset of each block whose records are still in the file (else NotInFile)
+        uint32_t *fileOffset;
+        // Blocks before writtenBlock are in the file, and writtenRecords of block writtenBlock
+        uint32_t writtenBlock;
+        uint8_t writtenRecords;
+        // "last" isn't known after Restore(), so the next record starts a new block
+        bool startNewBlock;
+    };
+    Tier tiers[NumberOfTiers] = {};
+    SemaphoreHandle_t _lock = nullptr;
 
-        // Indicate last chunk (zero byte length)
-        return httpd_resp_send_chunk(req, buffer, 0);
-    }
+    // On disk, the block follows the header
+    struct ChunkHeader
+    {
+        uint32_t magic;
+        uint32_t sequence;
+        uint8_t tier;
+        uint8_t reserved;
+        // CRC16 of sequence, tier, reserved and the block
+        uint16_t crc;
+    };
+    struct Chunk
+    {
+        ChunkHeader header;
+        Block block;
+    };
+    static constexpr uint32_t ChunkMagic = 0x54534844; // "DHST"
+    static constexpr uint32_t NotInFile = UINT32_MAX;
+
+    fs::FS *_fs = nullptr;
+    // Taken before _lock, by whoever is using the file and _chunk
+    SemaphoreHandle_t _fileLock = nullptr;
+    Chunk _chunk;
+    int64_t _lastCheckpoint = 0;
+    // Rewrite the file before appending to it
+    bool _compact = false;
+
+    void Store(uint8_t tier, const int32_t record[]);
+    bool SelectBlocks(uint32_t resolution, uint32_t from, uint32_t to, uint8_t &tier, uint32_t &first, uint32_t &last) const;
+    bool ReadChunk(File &file, uint32_t offset, uint8_t tier, uint32_t sequence);
+    bool WriteChunk(File &file, uint8_t tier, uint32_t sequence);
+    uint16_t LoadBlocks(File &file, uint16_t maximum);
+    void LoadPending(uint16_t maximum);
+    void Compact();
+
+    static uint8_t *Encode(uint8_t *p, const int32_t previous[], const int32_t record[], uint32_t resolution);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -7,6 +7,7 @@
 #include "Rules.h"
 #include "PacketRequestGenerator.h"
 #include "PacketReceiveProcessor.h"
+#include "CellSnapshot.h"
 
 #include <mqtt_client.h>
 
@@ -19,6 +20,7 @@ void mqtt2(const PacketReceiveProcessor *receiveProc,
            const Rules *rules);
 void mqtt1(const currentmonitoring_struct *currentMonitor,const Rules *rules);
 void GeneralStatusPayload(const PacketRequestGenerator *prg, const PacketReceiveProcessor *receiveProc, uint16_t requestq_count,const Rules *rules);
+void CommsDiagnostics(const PacketReceiveProcessor *receiveProc);
 void BankLevelInformation(const Rules *rules);
 void RuleStatus(const Rules *rules);
 
@@ -37,7 +37,7 @@ static std::string uint8_to_binary_string(uint8_t number)
   uint8_t bit = B10000000;
   for (size_t i = 0; i < 8; i++)
   {
-    n.append((number && bit) ? "1" : "0");
+    n.append((number & bit) ? "1" : "0");
     bit = bit >> 1;
   }
   return n;
@@ -15,12 +15,14 @@
 #include "ArduinoJson.h"
 #include "PacketRequestGenerator.h"
 #include "PacketReceiveProcessor.h"
+#include "CellSnapshot.h"
 
 #include "EmbeddedFiles_AutoGenerated.h"
 #include "HAL_ESP32.h"
 
 #include "CurrentMonitorINA229.h"
 #include "history.h"
+#include "CellHistory.h"
 
 esp_err_t api_handler(httpd_req_t *req);
 esp_err_t content_handler_downloadfile(httpd_req_t *req);
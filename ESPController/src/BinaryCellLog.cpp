@@ -0,0 +1,205 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-binlog";
+
+#include "BinaryCellLog.h"
+
+constexpr char BinaryCellLog::Magic[4];
+
+static inline uint8_t *Put16(uint8_t *p, uint16_t value)
+{
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+  return p + 2;
+}
+
+static inline uint8_t *Put32(uint8_t *p, uint32_t value)
+{
+  return Put16(Put16(p, (uint16_t)value), (uint16_t)(value >> 16));
+}
+
+static inline bool FitsInt8(int32_t difference)
+{
+  return difference >= INT8_MIN && difference <= INT8_MAX;
+}
+
+uint32_t BinaryCellLog::LocalTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+  // Days since 1970-01-01 in the proleptic Gregorian calendar, with March as the first month of the year
+  const int32_t y = year - (month <= 2 ? 1 : 0);
+  const int32_t era = y / 400;
+  const int32_t yearOfEra = y - era * 400;
+  const int32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  const int32_t days = era * 146097 + dayOfEra - 719468;
+  return (uint32_t)days * 86400 + hour * 3600U + minute * 60U + second;
+}
+
+bool BinaryCellLog::DeltasFit(uint32_t time) const
+{
+  const uint32_t gap = time - _lastTime;
+  if (time <= _lastTime || gap > UINT16_MAX)
+  {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < _modules; i++)
+  {
+    if (!FitsInt8(_next->voltagemV[i] - _last->voltagemV[i]) ||
+        !FitsInt8(_next->internalTemp[i] - _last->internalTemp[i]) ||
+        !FitsInt8(_next->externalTemp[i] - _last->externalTemp[i]) ||
+        !FitsInt8(_next->pwm[i] - _last->pwm[i]) ||
+        !FitsInt8(_next->badPackets[i] - _last->badPackets[i]) ||
+        !FitsInt8(_next->balancemAh[i] - _last->balancemAh[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BinaryCellLog::WriteColumn16(SdLog &log, const uint16_t *values)
+{
+  uint8_t *p = _column;
+  for (uint8_t i = 0; i < _modules; i++)
+  {
+    p = Put16(p, values[i]);
+  }
+  log.Append((const char *)_column, p - _column);
+}
+
+void BinaryCellLog::WriteDeltas16(SdLog &log, const uint16_t *values, const uint16_t *last)
+{
+  for (uint8_t i = 0; i < _modules; i++)
+  {
+    _column[i] = (uint8_t)(int8_t)(values[i] - last[i]);
+  }
+  log.Append((const char *)_column, _modules);
+}
+
+void BinaryCellLog::WriteColumn8(SdLog &log, const uint8_t *values)
+{
+  log.Append((const char *)values, _modules);
+}
+
+void BinaryCellLog::WriteDeltas8(SdLog &log, const int8_t *values, const int8_t *last)
+{
+  for (uint8_t i = 0; i < _modules; i++)
+  {
+    _column[i] = (uint8_t)(int8_t)(values[i] - last[i]);
+  }
+  log.Append((const char *)_column, _modules);
+}
+
+void BinaryCellLog::WriteTrailer(SdLog &log)
+{
+  uint8_t trailer[TrailerSize];
+  trailer[0] = 'T';
+  Put32(Put32(Put32(Put16(&trailer[1], _records), _firstTime), _lastTime), _blockStart);
+  log.Append((const char *)trailer, sizeof(trailer));
+  _records = 0;
+}
+
+void BinaryCellLog::Write(SdLog &log, const char *filename, uint32_t time, const CellReadings *cells, const CellModuleInfo *info,
+                          uint8_t banks, uint8_t modulesPerBank, uint8_t modules)
+{
+  // The same values the CSV has
+  for (uint8_t i = 0; i < modules; i++)
+  {
+    _next->voltagemV[i] = cells->voltagemV[i];
+    _next->internalTemp[i] = cells->internalTemp[i];
+    _next->externalTemp[i] = cells->externalTemp[i];
+    _next->pwm[i] = (uint16_t)(int)((float)cells->PWMValue[i] / (float)255.0 * 100);
+    _next->badPackets[i] = info[i].badPacketCount;
+    _next->balancemAh[i] = info[i].BalanceCurrentCount;
+    _next->flags[i] = (cells->inBypass[i] ? 1 : 0) | (cells->bypassOverTemp[i] ? 2 : 0);
+  }
+
+  // A new day, end the last block of yesterday's file
+  if (_records != 0 && _filename != filename)
+  {
+    log.Start(_filename);
+    WriteTrailer(log);
+    log.End();
+  }
+
+  const uint32_t dropped = log.bytesDropped;
+  const bool created = log.Start(filename);
+  if (created)
+  {
+    log.Append(Magic, sizeof(Magic));
+  }
+
+  if (created || _restart || _filename != filename || modules != _modules)
+  {
+    if (_records != 0 && !created && _filename == filename && !_restart)
+    {
+      WriteTrailer(log);
+    }
+
+    uint8_t header[HeaderSize] = {'H', banks, modulesPerBank, modules};
+    Put16(&header[4], BlockRecords);
+    log.Append((const char *)header, sizeof(header));
+
+    _filename = filename;
+    _modules = modules;
+    _records = 0;
+    _restart = false;
+  }
+
+  const bool keyframe = _records == 0 || !DeltasFit(time);
+  if (keyframe && _records != 0)
+  {
+    WriteTrailer(log);
+  }
+  if (_records == 0)
+  {
+    _blockStart = log.Position();
+    _firstTime = time;
+    blocks++;
+  }
+
+  if (keyframe)
+  {
+    uint8_t start[5] = {'K'};
+    Put32(&start[1], time);
+    log.Append((const char *)start, sizeof(start));
+    WriteColumn16(log, _next->voltagemV);
+    WriteColumn8(log, (const uint8_t *)_next->internalTemp);
+    WriteColumn8(log, (const uint8_t *)_next->externalTemp);
+    WriteColumn16(log, _next->pwm);
+    WriteColumn16(log, _next->badPackets);
+    WriteColumn16(log, _next->balancemAh);
+    keyframes++;
+  }
+  else
+  {
+    uint8_t start[3] = {'D'};
+    Put16(&start[1], (uint16_t)(time - _lastTime));
+    log.Append((const char *)start, sizeof(start));
+    WriteDeltas16(log, _next->voltagemV, _last->voltagemV);
+    WriteDeltas8(log, _next->internalTemp, _last->internalTemp);
+    WriteDeltas8(log, _next->externalTemp, _last->externalTemp);
+    WriteDeltas16(log, _next->pwm, _last->pwm);
+    WriteDeltas16(log, _next->badPackets, _last->badPackets);
+    WriteDeltas16(log, _next->balancemAh, _last->balancemAh);
+    deltas++;
+  }
+  WriteColumn8(log, _next->flags);
+
+  _records++;
+  _lastTime = time;
+  std::swap(_last, _next);
+
+  if (_records == BlockRecords)
+  {
+    WriteTrailer(log);
+  }
+  log.End();
+
+  if (log.bytesDropped != dropped)
+  {
+    // Part of the file is missing, the next row can't be a delta
+    ESP_LOGW(TAG, "Rows dropped, restarting %s", filename);
+    _restart = true;
+  }
+}
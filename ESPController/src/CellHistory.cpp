@@ -0,0 +1,506 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-cellhist";
+
+#include "CellHistory.h"
+#include <esp_heap_caps.h>
+
+// Bits are written most significant first, "data" must start zeroed
+static inline void PutBits(uint8_t *data, uint16_t &position, uint32_t value, uint8_t count)
+{
+  while (count > 0)
+  {
+    const uint8_t space = 8 - (position & 7);
+    const uint8_t n = min(space, count);
+    const uint8_t bits = (uint8_t)((value >> (count - n)) & ((1U << n) - 1));
+    data[position >> 3] |= bits << (space - n);
+    position += n;
+    count -= n;
+  }
+}
+
+static inline uint32_t GetBits(const uint8_t *data, uint16_t &position, uint8_t count)
+{
+  uint32_t value = 0;
+  while (count > 0)
+  {
+    const uint8_t available = 8 - (position & 7);
+    const uint8_t n = min(available, count);
+    const uint8_t bits = (data[position >> 3] >> (available - n)) & ((1U << n) - 1);
+    value = (value << n) | bits;
+    position += n;
+    count -= n;
+  }
+  return value;
+}
+
+static inline void PutValue(uint8_t *data, uint16_t &position, int32_t value)
+{
+  const uint32_t z = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  if (z == 0)
+  {
+    PutBits(data, position, 0b0, 1);
+  }
+  else if (z <= 8)
+  {
+    PutBits(data, position, 0b10, 2);
+    PutBits(data, position, z - 1, 3);
+  }
+  else if (z <= 128)
+  {
+    PutBits(data, position, 0b110, 3);
+    PutBits(data, position, z - 1, 7);
+  }
+  else if (z <= 2048)
+  {
+    PutBits(data, position, 0b1110, 4);
+    PutBits(data, position, z - 1, 11);
+  }
+  else
+  {
+    PutBits(data, position, 0b1111, 4);
+    PutBits(data, position, (uint32_t)value, 32);
+  }
+}
+
+static inline int32_t GetValue(const uint8_t *data, uint16_t &position)
+{
+  uint8_t prefix = 0;
+  while (prefix < 4 && GetBits(data, position, 1) == 1)
+  {
+    prefix++;
+  }
+
+  static const uint8_t lengths[] = {0, 3, 7, 11};
+  if (prefix == 0)
+  {
+    return 0;
+  }
+  if (prefix == 4)
+  {
+    return (int32_t)GetBits(data, position, 32);
+  }
+  const uint32_t z = GetBits(data, position, lengths[prefix]) + 1;
+  return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+// Next time from a times chunk, "first" for the first sample of the chunk
+static inline void GetTime(const uint8_t *data, uint16_t &position, bool first, int32_t &time, int32_t &gap)
+{
+  if (first)
+  {
+    time = (int32_t)GetBits(data, position, 32);
+    gap = 0;
+    return;
+  }
+  const int32_t t = (int32_t)((uint32_t)time + (uint32_t)gap + (uint32_t)GetValue(data, position));
+  gap = (int32_t)((uint32_t)t - (uint32_t)time);
+  time = t;
+}
+
+bool CellHistory::Begin(uint8_t numberOfCells)
+{
+  if (_pool != nullptr)
+  {
+    return true;
+  }
+
+  static_assert(MaximumPoolSize / MinimumChunkSize <= INT16_MAX, "Chunk numbers are int16_t");
+
+  const uint32_t wanted = min(MaximumPoolSize, max(MinimumPoolSize, (numberOfCells + 1U) * BytesPerModule));
+
+  // PSRAM is slower, but there is plenty of it
+  const uint32_t psram = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  if (psram >= MinimumPoolSize)
+  {
+    _poolSize = min(wanted, psram) / MaximumChunkSize * MaximumChunkSize;
+    _pool = (uint8_t *)heap_caps_calloc(_poolSize, 1, MALLOC_CAP_SPIRAM);
+  }
+
+  if (_pool == nullptr)
+  {
+    const uint32_t internal = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    const uint32_t largest = (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    const uint32_t available = min(largest, internal > HeapReserve ? internal - HeapReserve : 0U);
+    _poolSize = max(MinimumPoolSize, min(wanted, available) / MaximumChunkSize * MaximumChunkSize);
+    _pool = (uint8_t *)heap_caps_calloc(_poolSize, 1, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+
+  if (_pool == nullptr)
+  {
+    ESP_LOGE(TAG, "Unable to allocate %u bytes", _poolSize);
+    _poolSize = 0;
+    return false;
+  }
+  ESP_LOGI(TAG, "%u bytes for module history", _poolSize);
+
+  Layout(0);
+  _lock = xSemaphoreCreateMutex();
+  return true;
+}
+
+// Empties the pool and picks the largest chunk size which still gives every module (and the times) two
+// chunks, so there is always a full chunk to reuse before one still being written.  Smaller chunks than
+// MinimumChunkSize lose more to the header and the first sample than they gain.
+// Called with _lock held, or from Begin.
+void CellHistory::Layout(uint8_t numberOfCells)
+{
+  _chunkSize = MaximumChunkSize;
+  while (_chunkSize > MinimumChunkSize && _poolSize / _chunkSize < 2U * (numberOfCells + 1U))
+  {
+    _chunkSize /= 2;
+  }
+  _numberOfChunks = (uint16_t)(_poolSize / _chunkSize);
+  _numberOfCells = numberOfCells;
+
+  for (uint16_t i = 0; i < _numberOfChunks; i++)
+  {
+    ChunkAt(i).owner = Free;
+  }
+  for (auto &s : _cells)
+  {
+    s.chunk = -1;
+  }
+  _times.chunk = -1;
+
+  if (numberOfCells != 0)
+  {
+    ESP_LOGI(TAG, "%u modules, %u chunks of %u bytes", numberOfCells, _numberOfChunks, _chunkSize);
+  }
+}
+
+// Called with _lock held
+bool CellHistory::Append(uint8_t owner, Stream &stream, const int32_t values[], uint8_t count)
+{
+  // Sample is encoded again, in full, if it has to start a new chunk
+  for (uint8_t attempt = 0; attempt < 2; attempt++)
+  {
+    if (stream.chunk < 0)
+    {
+      // Reuse the chunk whose samples end first, so the times are only dropped once the modules are
+      const uint16_t slot = OldestChunk();
+      const uint8_t previousOwner = ChunkAt(slot).owner;
+      if (previousOwner != Free)
+      {
+        // Only matters if it was still being written
+        Stream &previous = previousOwner == Times ? _times : _cells[previousOwner];
+        if (previous.chunk == (int16_t)slot)
+        {
+          previous.chunk = -1;
+        }
+      }
+
+      Chunk &c = ChunkAt(slot);
+      memset(&c, 0, _chunkSize);
+      c.firstSample = _nextSample;
+      c.owner = owner;
+      stream = {};
+      stream.chunk = (int16_t)slot;
+    }
+
+    Chunk &c = ChunkAt((uint16_t)stream.chunk);
+    uint8_t encoded[24] = {};
+    uint16_t bits = 0;
+    if (owner == Times)
+    {
+      if (c.samples == 0)
+      {
+        PutBits(encoded, bits, (uint32_t)values[0], 32);
+      }
+      else
+      {
+        // Relative to the previous time plus the previous gap
+        PutValue(encoded, bits, (int32_t)((uint32_t)values[0] - (uint32_t)stream.last[0] - (uint32_t)stream.lastGap));
+      }
+    }
+    else if (c.samples == 0)
+    {
+      PutBits(encoded, bits, (uint16_t)values[0], 16);
+      PutBits(encoded, bits, (uint8_t)values[1], 8);
+      PutBits(encoded, bits, (uint8_t)values[2], 8);
+    }
+    else
+    {
+      const uint8_t stored = TemperatureSample(_nextSample) ? count : 1;
+      for (uint8_t i = 0; i < stored; i++)
+      {
+        PutValue(encoded, bits, (int32_t)((uint32_t)values[i] - (uint32_t)stream.last[i]));
+      }
+    }
+
+    if (c.samples < UINT8_MAX && c.bits + bits <= (_chunkSize - sizeof(Chunk)) * 8)
+    {
+      for (uint16_t p = 0; p < bits; p += 8)
+      {
+        const uint8_t n = min((uint16_t)8, (uint16_t)(bits - p));
+        PutBits(Data(c), c.bits, encoded[p >> 3] >> (8 - n), n);
+      }
+
+      if (owner == Times)
+      {
+        stream.lastGap = c.samples == 0 ? 0 : (int32_t)((uint32_t)values[0] - (uint32_t)stream.last[0]);
+      }
+      else
+      {
+        cellSamples++;
+        cellBits += bits;
+      }
+      memcpy(stream.last, values, count * sizeof(int32_t));
+      c.samples++;
+      return true;
+    }
+
+    // Full
+    stream.chunk = -1;
+  }
+  return false;
+}
+
+void CellHistory::Add(uint32_t now, const CellReadings *cells, uint8_t numberOfCells)
+{
+  if (_pool == nullptr)
+  {
+    return;
+  }
+
+  const int64_t started = esp_timer_get_time();
+  xSemaphoreTake(_lock, portMAX_DELAY);
+
+  if (numberOfCells != _numberOfCells)
+  {
+    // A different pack, the module numbers no longer mean the same modules
+    Layout(numberOfCells);
+  }
+
+  const int32_t time = (int32_t)now;
+  Append(Times, _times, &time, 1);
+
+  const bool temperatures = TemperatureSample(_nextSample);
+  for (uint8_t m = 0; m < numberOfCells && m < maximum_controller_cell_modules; m++)
+  {
+    Stream &stream = _cells[m];
+    int32_t values[3] = {cells->valid[m] ? cells->voltagemV[m] : 0, cells->internalTemp[m], cells->externalTemp[m]};
+    if (!temperatures && stream.chunk >= 0)
+    {
+      // Keep the temperatures Read will repeat, also if this sample starts a new chunk
+      values[1] = stream.last[1];
+      values[2] = stream.last[2];
+    }
+    Append(m, stream, values, 3);
+  }
+
+  _nextSample++;
+  snapshots++;
+  xSemaphoreGive(_lock);
+  encode_us += (uint64_t)(esp_timer_get_time() - started);
+}
+
+// A free chunk, or else the one whose last sample is the oldest
+uint16_t CellHistory::OldestChunk() const
+{
+  uint16_t oldest = 0;
+  uint32_t oldestEnd = UINT32_MAX;
+  for (uint16_t i = 0; i < _numberOfChunks; i++)
+  {
+    const Chunk &c = ChunkAt(i);
+    if (c.owner == Free)
+    {
+      return i;
+    }
+    const uint32_t end = c.firstSample + c.samples;
+    if (end < oldestEnd)
+    {
+      oldest = i;
+      oldestEnd = end;
+    }
+  }
+  return oldest;
+}
+
+// Chunk of "owner" holding "sample", or else the first after it.  -1 if there isn't one.
+int16_t CellHistory::FindChunk(uint8_t owner, uint32_t sample) const
+{
+  int16_t after = -1;
+  for (uint16_t i = 0; i < _numberOfChunks; i++)
+  {
+    const Chunk &c = ChunkAt(i);
+    if (c.owner != owner || c.samples == 0)
+    {
+      continue;
+    }
+    if (c.firstSample <= sample && sample - c.firstSample < c.samples)
+    {
+      return (int16_t)i;
+    }
+    if (c.firstSample > sample && (after < 0 || c.firstSample < ChunkAt((uint16_t)after).firstSample))
+    {
+      after = (int16_t)i;
+    }
+  }
+  return after;
+}
+
+uint16_t CellHistory::Read(uint8_t cell, uint32_t from, uint32_t to, uint32_t &next, Sample samples[], uint16_t maximum)
+{
+  if (_pool == nullptr || cell >= maximum_controller_cell_modules)
+  {
+    return 0;
+  }
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+
+  // Position in the times, decoded alongside
+  int16_t timeChunk = -1;
+  uint32_t timeSample = 0;
+  uint16_t timePosition = 0;
+  int32_t time = 0;
+  int32_t gap = 0;
+
+  uint16_t count = 0;
+  while (count < maximum && next != UINT32_MAX)
+  {
+    const int16_t found = FindChunk(cell, next);
+    if (found < 0)
+    {
+      break;
+    }
+    const Chunk &c = ChunkAt((uint16_t)found);
+
+    uint16_t position = 0;
+    int32_t values[3] = {};
+    uint8_t i = 0;
+    for (; i < c.samples && count < maximum; i++)
+    {
+      const uint32_t sample = c.firstSample + i;
+      if (i == 0)
+      {
+        values[0] = (int32_t)GetBits(Data(c), position, 16);
+        values[1] = (int8_t)GetBits(Data(c), position, 8);
+        values[2] = (int8_t)GetBits(Data(c), position, 8);
+      }
+      else
+      {
+        const uint8_t stored = TemperatureSample(sample) ? 3 : 1;
+        for (uint8_t v = 0; v < stored; v++)
+        {
+          values[v] = (int32_t)((uint32_t)values[v] + (uint32_t)GetValue(Data(c), position));
+        }
+      }
+
+      if (sample < next)
+      {
+        continue;
+      }
+      next = sample + 1;
+
+      // Find the time of this sample
+      if (timeChunk < 0 || sample < timeSample || sample - ChunkAt((uint16_t)timeChunk).firstSample >= ChunkAt((uint16_t)timeChunk).samples)
+      {
+        timeChunk = FindChunk(Times, sample);
+        if (timeChunk < 0 || ChunkAt((uint16_t)timeChunk).firstSample > sample)
+        {
+          // Time has already been dropped
+          timeChunk = -1;
+          continue;
+        }
+        timeSample = ChunkAt((uint16_t)timeChunk).firstSample;
+        timePosition = 0;
+        time = 0;
+        gap = 0;
+      }
+      while (timeSample <= sample)
+      {
+        const Chunk &tc = ChunkAt((uint16_t)timeChunk);
+        GetTime(Data(tc), timePosition, timeSample == tc.firstSample, time, gap);
+        timeSample++;
+      }
+
+      if ((uint32_t)time < from)
+      {
+        continue;
+      }
+      if ((uint32_t)time > to)
+      {
+        next = UINT32_MAX;
+        break;
+      }
+      samples[count++] = Sample{(uint32_t)time, (uint16_t)values[0], (int8_t)values[1], (int8_t)values[2]};
+    }
+
+    if (i == c.samples && next != UINT32_MAX)
+    {
+      next = c.firstSample + c.samples;
+    }
+  }
+
+  xSemaphoreGive(_lock);
+  return count;
+}
+
+uint32_t CellHistory::OldestTime()
+{
+  if (_pool == nullptr)
+  {
+    return 0;
+  }
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  uint32_t oldest = 0;
+  const int16_t c = FindChunk(Times, 0);
+  if (c >= 0)
+  {
+    // First sample in a chunk is stored in full
+    uint16_t position = 0;
+    oldest = GetBits(Data(ChunkAt((uint16_t)c)), position, 32);
+  }
+  xSemaphoreGive(_lock);
+  return oldest;
+}
+
+// Time of "sample", 0 if its time has been dropped.  Called with _lock held.
+uint32_t CellHistory::SampleTime(uint32_t sample) const
+{
+  const int16_t found = FindChunk(Times, sample);
+  if (found < 0 || ChunkAt((uint16_t)found).firstSample > sample)
+  {
+    return 0;
+  }
+
+  const Chunk &c = ChunkAt((uint16_t)found);
+  uint16_t position = 0;
+  int32_t time = 0;
+  int32_t gap = 0;
+  for (uint32_t s = c.firstSample; s <= sample; s++)
+  {
+    GetTime(Data(c), position, s == c.firstSample, time, gap);
+  }
+  return (uint32_t)time;
+}
+
+uint32_t CellHistory::CompleteTime()
+{
+  if (_pool == nullptr)
+  {
+    return 0;
+  }
+
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  // Chunks are dropped one module at a time, so it is the module whose oldest sample is the newest.
+  // A times chunk holds more samples than a module's, so it can end (and be reused) before a module
+  // chunk holding the same samples, Read skips those.
+  const int16_t times = FindChunk(Times, 0);
+  uint32_t newest = times < 0 ? 0 : ChunkAt((uint16_t)times).firstSample;
+  bool held = _numberOfCells != 0 && times >= 0;
+  for (uint8_t m = 0; m < _numberOfCells; m++)
+  {
+    const int16_t c = FindChunk(m, 0);
+    if (c < 0)
+    {
+      held = false;
+      break;
+    }
+    newest = max(newest, ChunkAt((uint16_t)c).firstSample);
+  }
+  const uint32_t time = held ? SampleTime(newest) : 0;
+  xSemaphoreGive(_lock);
+  return time;
+}
@@ -0,0 +1,74 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-snap";
+
+#include "CellSnapshot.h"
+
+// Returns false if replyqueue_task changed the readings whilst copying
+bool CellSnapshot::Copy(Buffer &b, const CellReadings *cells)
+{
+  const uint32_t before = __atomic_load_n(&_updateSequence, __ATOMIC_ACQUIRE);
+  if (before & 1)
+  {
+    return false;
+  }
+
+  memcpy(&b.cells, cells, sizeof(CellReadings));
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&_updateSequence, __ATOMIC_RELAXED) == before;
+}
+
+void CellSnapshot::Publish(const CellReadings *cells)
+{
+  // Write the buffer readers are not using, anyone still holding it from two publishes ago will see the sequence change
+  const uint32_t next = _epoch + 1;
+  Buffer &b = _buffers[next & 1];
+  __atomic_store_n(&b.sequence, b.sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  bool copied = false;
+  for (uint8_t attempt = 0; attempt < 4 && !copied; attempt++)
+  {
+    copied = Copy(b, cells);
+    if (!copied)
+    {
+      retries++;
+      // Let replyqueue_task finish the reply it is working on
+      vTaskDelay(1);
+    }
+  }
+
+  b.published = esp_timer_get_time();
+  __atomic_store_n(&b.sequence, b.sequence + 1, __ATOMIC_RELEASE);
+
+  if (!copied)
+  {
+    // Keep the previous snapshot rather than publish a mixture
+    ESP_LOGW(TAG, "Snapshot skipped");
+    return;
+  }
+
+  __atomic_store_n(&_epoch, next, __ATOMIC_RELEASE);
+}
+
+CellSnapshot::View CellSnapshot::Acquire() const
+{
+  for (;;)
+  {
+    const uint32_t epoch = __atomic_load_n(&_epoch, __ATOMIC_ACQUIRE);
+    const Buffer &b = _buffers[epoch & 1];
+    const uint32_t sequence = __atomic_load_n(&b.sequence, __ATOMIC_ACQUIRE);
+
+    // Only odd if this reader was preempted for a whole publish after reading the epoch, try again
+    if ((sequence & 1) == 0)
+    {
+      return View{&b.cells, epoch, sequence, b.published};
+    }
+  }
+}
+
+bool CellSnapshot::StillValid(const View &view) const
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&_buffers[view.epoch & 1].sequence, __ATOMIC_RELAXED) == view.sequence;
+}
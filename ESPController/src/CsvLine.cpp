@@ -0,0 +1,125 @@
+#include "CsvLine.h"
+
+#include <math.h>
+
+// "00" to "99", two digits at a time halves the divisions
+static const char DigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+CsvLine &CsvLine::Text(const char *text, size_t length)
+{
+  if (length > Space())
+  {
+    length = Space();
+    _overflowed = true;
+  }
+  memcpy(_buffer + _length, text, length);
+  _length += length;
+  _buffer[_length] = 0;
+  return *this;
+}
+
+CsvLine &CsvLine::Char(char c)
+{
+  return Text(&c, 1);
+}
+
+CsvLine &CsvLine::Unsigned(uint32_t value, uint8_t digits)
+{
+  // Written backwards from the end of "text"
+  char text[16];
+  char *p = text + sizeof(text);
+  while (value >= 100)
+  {
+    const uint32_t pair = (value % 100) * 2;
+    value /= 100;
+    *--p = DigitPairs[pair + 1];
+    *--p = DigitPairs[pair];
+  }
+  if (value >= 10)
+  {
+    *--p = DigitPairs[value * 2 + 1];
+    *--p = DigitPairs[value * 2];
+  }
+  else
+  {
+    *--p = (char)('0' + value);
+  }
+  while (p > text && text + sizeof(text) - p < digits)
+  {
+    *--p = '0';
+  }
+  return Text(p, text + sizeof(text) - p);
+}
+
+CsvLine &CsvLine::Signed(int32_t value)
+{
+  if (value < 0)
+  {
+    Char('-');
+    return Unsigned(0U - (uint32_t)value);
+  }
+  return Unsigned((uint32_t)value);
+}
+
+CsvLine &CsvLine::Float4(float value)
+{
+  if (!isfinite(value) || fabsf(value) >= 1.0e9F)
+  {
+    // Not from a working sensor, printf can have it
+    char text[64];
+    snprintf(text, sizeof(text), "%.4f", value);
+    return Text(text);
+  }
+
+  // A float has 24 significant bits, so times 10000 is exact as a double.  Rounded half to even on the
+  // exact value, as printf does.
+  const double scaled = fabs((double)value * 10000.0);
+  uint64_t fixed = (uint64_t)scaled;
+  const double remainder = scaled - (double)fixed;
+  if (remainder > 0.5 || (remainder == 0.5 && (fixed & 1) != 0))
+  {
+    fixed++;
+  }
+
+  if (signbit(value))
+  {
+    // printf gives "-0.0000" for a small negative number too
+    Char('-');
+  }
+  return Unsigned((uint32_t)(fixed / 10000)).Char('.').Unsigned((uint32_t)(fixed % 10000), 4);
+}
+
+CsvLine &CsvLine::Binary(uint8_t value)
+{
+  char text[8];
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    text[i] = (value & (0x80 >> i)) ? '1' : '0';
+  }
+  return Text(text, sizeof(text));
+}
+
+CsvLine &CsvLine::DateTime(const tm &timeinfo)
+{
+  return Unsigned((uint16_t)timeinfo.tm_year, 4)
+      .Char('-')
+      .Unsigned((uint16_t)timeinfo.tm_mon, 2)
+      .Char('-')
+      .Unsigned((uint16_t)timeinfo.tm_mday, 2)
+      .Char(' ')
+      .Unsigned((uint16_t)timeinfo.tm_hour, 2)
+      .Char(':')
+      .Unsigned((uint16_t)timeinfo.tm_min, 2)
+      .Char(':')
+      .Unsigned((uint16_t)timeinfo.tm_sec, 2);
+}
@@ -384,21 +384,34 @@ void HAL_ESP32::WriteTCA6408OutputState()
     }
 }
 
-void HAL_ESP32::SetOutputState(uint8_t outputId, RelayState state)
+void HAL_ESP32::SetOutputStates(const RelayState *state)
 {
-    ESP_LOGD(TAG, "SetOutputState %u=%u", outputId, state);
-
     // Relays connected to TCA6408A
     // P4 = RELAY1 (outputId=0)
     // P5 = RELAY2 (outputId=1)
     // P6 = RELAY3_SSR (outputId=2)
     // P7 = RELAY4_SSR (outputId=3)
-    if (outputId <= 3)
+    uint8_t pins = TCA6408_Output_Pins & B00001111;
+    for (uint8_t outputId = 0; outputId < RELAY_TOTAL && outputId <= 3; outputId++)
+    {
+        if (state[outputId] == RelayState::RELAY_ON)
+        {
+            pins |= (1 << (outputId + 4));
+        }
+    }
+
+    ESP_LOGD(TAG, "SetOutputStates %02X", pins);
+    TCA6408_Output_Pins = pins;
+    WriteTCA6408OutputState();
+}
+
+RelayState HAL_ESP32::GetOutputState(uint8_t outputId) const
+{
+    if (outputId <= 3 && (TCA6408_Output_Pins & (1 << (outputId + 4))))
     {
-        uint8_t bit = outputId + 4;
-        TCA6408_Output_Pins = (state == RelayState::RELAY_ON) ? (TCA6408_Output_Pins | (1 << bit)) : (TCA6408_Output_Pins & ~(1 << bit));
-        WriteTCA6408OutputState();
+        return RelayState::RELAY_ON;
     }
+    return RelayState::RELAY_OFF;
 }
 
 void HAL_ESP32::Led(uint8_t bits)
@@ -11,7 +11,117 @@ bool PacketReceiveProcessor::HasCommsTimedOut() const
   return ((millisecondSinceLastPacket > 5 * packetTimerMillisecond) && (millisecondSinceLastPacket > 10000));
 }
 
-bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
+void PacketReceiveProcessor::RequestSent(uint16_t sequence, uint8_t window)
+{
+  portENTER_CRITICAL(&_pacingLock);
+  _pacing.RequestSent(sequence, window, esp_timer_get_time());
+  portEXIT_CRITICAL(&_pacingLock);
+}
+
+// Any requests which have not been answered within the reply timeout are counted as lost
+uint8_t PacketReceiveProcessor::ExpireRequests()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto expired = _pacing.ExpireRequests(esp_timer_get_time());
+  portEXIT_CRITICAL(&_pacingLock);
+
+  if (expired > 0)
+  {
+    ESP_LOGW(TAG, "%u request(s) not answered", expired);
+  }
+  return expired;
+}
+
+uint8_t PacketReceiveProcessor::OutstandingRequests()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.OutstandingRequests();
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+PacketPacing::WindowStatistics PacketReceiveProcessor::GetWindowStatistics(uint8_t window)
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.GetStatistics(window);
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+uint32_t PacketReceiveProcessor::SmoothedRoundTrip()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.SmoothedRoundTrip();
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+uint32_t PacketReceiveProcessor::ReplyTimeout()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.ReplyTimeout();
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+uint32_t PacketReceiveProcessor::LostRequests()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.lostRequests;
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+uint32_t PacketReceiveProcessor::UnmatchedReplies()
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _pacing.unmatchedReplies;
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+LatencyHistogram::Summary PacketReceiveProcessor::CommandLatency(uint8_t command) const
+{
+  portENTER_CRITICAL(&_pacingLock);
+  auto value = _latency[command & 0x0F].Summarise();
+  portEXIT_CRITICAL(&_pacingLock);
+  return value;
+}
+
+PacketReceiveProcessor::LinkErrors PacketReceiveProcessor::GetLinkErrors(uint8_t link, uint8_t modules) const
+{
+  LinkErrors e{0, 0};
+  if (link > modules || modules > maximum_controller_cell_modules)
+  {
+    return e;
+  }
+
+  // Bad packets seen by the modules either side of the link, the controller is at both ends of the ring
+  int32_t before = (link == 0) ? 0 : cmi[link - 1].badPacketCount;
+  int32_t after = (link == modules) ? totalCRCErrors : cmi[link].badPacketCount;
+
+  // A module which restarted has a lower count than those before it
+  e.crc = (after > before) ? (uint32_t)(after - before) : 0;
+  e.notProcessed = _notProcessedAtHop[link];
+  return e;
+}
+
+// Requests sent with setPacketAddressBroadcast
+bool PacketReceiveProcessor::IsBroadcastCommand(uint8_t command)
+{
+  switch (command)
+  {
+  case COMMAND::Timing:
+  case COMMAND::ResetBadPacketCounter:
+  case COMMAND::ResetBalanceCurrentCounter:
+  case COMMAND::WriteSettings:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer, uint32_t receivedMillisecond)
 {
   packetsReceived++;
 
@@ -20,12 +130,16 @@ bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
     return false;
   }
 
+  // Broadcast requests use maximum_controller_cell_modules as the end address.  Their replies don't
+  // touch the per module arrays, every other reply loops to end_address so it must be a real module.
+  const uint8_t lastAddress = IsBroadcastCommand(receivebuffer->command & 0x0F) ? maximum_controller_cell_modules
+                                                                                : maximum_controller_cell_modules - 1;
   if (receivebuffer->start_address >= maximum_controller_cell_modules ||
-      receivebuffer->end_address >= maximum_controller_cell_modules) {
+      receivebuffer->end_address > lastAddress) {
     ESP_LOGE(TAG, "Address range validation failed: start=%u, end=%u, max=%u",
              receivebuffer->start_address,
              receivebuffer->end_address,
-             maximum_controller_cell_modules);
+             lastAddress);
     totalOutofSequenceErrors++;
     return false;
   }
@@ -45,31 +159,47 @@ bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
     return false;
   }
 
-  // Copy to our buffer (probably don't need to do this), just use pointer instead
-  memcpy(&_packetbuffer, receivebuffer, sizeof(_packetbuffer));
+  // Processed in place, the reply is not copied
+  _packetbuffer = receivebuffer;
 
   // Calculate the CRC and compare to received
-  uint16_t validateCRC = CRC16::CalculateArray((uint8_t *)&_packetbuffer, sizeof(_packetbuffer) - 2);
+  uint16_t validateCRC = CRC16::CalculateArray((uint8_t *)_packetbuffer, sizeof(PacketStruct) - 2);
 
-  if (validateCRC == _packetbuffer.crc)
+  if (validateCRC == _packetbuffer->crc)
   {
     // Its a valid packet...
     packetLastReceivedMillisecond = (uint32_t)millis();
 
-    totalModulesFound = _packetbuffer.hops;
+    totalModulesFound = _packetbuffer->hops;
+
+    // Match reply to the request which generated it, this also detects lost requests
+    uint32_t roundtrip_us;
+    portENTER_CRITICAL(&_pacingLock);
+    bool matched = _pacing.ReplyReceived(_packetbuffer->sequence, esp_timer_get_time(), &roundtrip_us);
+    if (matched)
+    {
+      _latency[ReplyForCommand()].Add(roundtrip_us);
+    }
+    portEXIT_CRITICAL(&_pacingLock);
+
+    if (matched && transmit_task_handle != NULL)
+    {
+      // Window has space, release the next request
+      xTaskNotifyGive(transmit_task_handle);
+    }
 
     // Careful of overflowing the uint16_t in sequence
-    if (packetLastReceivedSequence > 0 && _packetbuffer.sequence > 0 && _packetbuffer.sequence != packetLastReceivedSequence + 1)
+    if (packetLastReceivedSequence > 0 && _packetbuffer->sequence > 0 && _packetbuffer->sequence != packetLastReceivedSequence + 1)
     {
-      ESP_LOGE(TAG, "OOS Error, expected=%u, got=%u", packetLastReceivedSequence + 1, _packetbuffer.sequence);
+      ESP_LOGE(TAG, "OOS Error, expected=%u, got=%u", packetLastReceivedSequence + 1, _packetbuffer->sequence);
       totalOutofSequenceErrors++;
     }
 
-    packetLastReceivedSequence = _packetbuffer.sequence;
+    packetLastReceivedSequence = _packetbuffer->sequence;
 
     if (ReplyWasProcessedByAModule())
     {
-      // ESP_LOGD(TAG, "Hops %u, start %u end %u, command=%u", _packetbuffer.hops, _packetbuffer.start_address, _packetbuffer.end_address,ReplyForCommand());
+      // ESP_LOGD(TAG, "Hops %u, start %u end %u, command=%u", _packetbuffer->hops, _packetbuffer->start_address, _packetbuffer->end_address,ReplyForCommand());
 
       switch (ReplyForCommand())
       {
@@ -78,13 +208,17 @@ bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
 
       case COMMAND::Timing:
       {
-        uint32_t tnow = (_packetbuffer.moduledata[2] << 16) + _packetbuffer.moduledata[3];
-        uint32_t tprevious = (_packetbuffer.moduledata[0] << 16) + _packetbuffer.moduledata[1];
+        uint32_t tnow = receivedMillisecond;
+        uint32_t tprevious = (_packetbuffer->moduledata[0] << 16) + _packetbuffer->moduledata[1];
 
         // Check millis time hasn't rolled over
         if (tnow > tprevious)
         {
           packetTimerMillisecond = tnow - tprevious;
+
+          portENTER_CRITICAL(&_pacingLock);
+          _pacing.Seed(packetTimerMillisecond);
+          portEXIT_CRITICAL(&_pacingLock);
         }
 
         break;
@@ -92,21 +226,8 @@ bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
       case COMMAND::ReadVoltageAndStatus:
         ProcessReplyVoltage();
 
-        // ESP_LOGD(TAG, "Updated volt status cells %u to %u", _packetbuffer.start_address, _packetbuffer.end_address);
-
-        // TODO: REVIEW THIS LOGIC
-        if (_packetbuffer.end_address == _packetbuffer.hops - 1)
-        {
-          // We have just processed a voltage reading for the entire chain of modules (all banks)
-          // at this point we should update any display or rules logic
-          // as we have a clean snapshot of voltages and statues
-
-          ESP_LOGD(TAG, "Finished all reads");
-          if (voltageandstatussnapshot_task_handle != NULL)
-          {
-            xTaskNotify(voltageandstatussnapshot_task_handle, 0x00, eNotifyAction::eNoAction);
-          }
-        }
+        // ESP_LOGD(TAG, "Updated volt status cells %u to %u", _packetbuffer->start_address, _packetbuffer->end_address);
+        NotifyIfAllVoltagesRead();
         break;
 
       case COMMAND::ReadBadPacketCounter:
@@ -156,6 +277,8 @@ bool PacketReceiveProcessor::ProcessReply(const PacketStruct *receivebuffer)
     {
       // Error count for a request that was not processed by any module in the string
       totalNotProcessedErrors++;
+      // The ring ended after this many modules, hops has already been validated
+      _notProcessedAtHop[_packetbuffer->hops]++;
       ESP_LOGD(TAG, "Modules ignored request");
     }
   }
@@ -175,9 +298,9 @@ void PacketReceiveProcessor::ProcessReplyBadPacketCount()
 {
   // Called when a decoded packet has arrived in buffer for command
   uint8_t q = 0;
-  for (uint8_t i = _packetbuffer.start_address; i <= _packetbuffer.end_address; i++)
+  for (uint8_t i = _packetbuffer->start_address; i <= _packetbuffer->end_address; i++)
   {
-    cmi[i].badPacketCount = _packetbuffer.moduledata[q];
+    cmi[i].badPacketCount = _packetbuffer->moduledata[q];
     q++;
   }
 }
@@ -188,10 +311,10 @@ void PacketReceiveProcessor::ProcessReplyTemperature()
 
   // 40 offset for below zero temps
   uint8_t q = 0;
-  for (uint8_t i = _packetbuffer.start_address; i <= _packetbuffer.end_address; i++)
+  for (uint8_t i = _packetbuffer->start_address; i <= _packetbuffer->end_address; i++)
   {
-    cmi[i].internalTemp = ((_packetbuffer.moduledata[q] & 0xFF00) >> 8) - 40;
-    cmi[i].externalTemp = (_packetbuffer.moduledata[q] & 0x00FF) - 40;
+    cellReadings.internalTemp[i] = ((_packetbuffer->moduledata[q] & 0xFF00) >> 8) - 40;
+    cellReadings.externalTemp[i] = (_packetbuffer->moduledata[q] & 0x00FF) - 40;
     q++;
   }
 }
@@ -199,18 +322,18 @@ void PacketReceiveProcessor::ProcessReplyTemperature()
 void PacketReceiveProcessor::ProcessReplyReadBalanceCurrentCounter()
 {
   uint8_t q = 0;
-  for (uint8_t i = _packetbuffer.start_address; i <= _packetbuffer.end_address; i++)
+  for (uint8_t i = _packetbuffer->start_address; i <= _packetbuffer->end_address; i++)
   {
-    cmi[i].BalanceCurrentCount = _packetbuffer.moduledata[q];
+    cmi[i].BalanceCurrentCount = _packetbuffer->moduledata[q];
     q++;
   }
 }
 void PacketReceiveProcessor::ProcessReplyReadPacketReceivedCounter()
 {
   uint8_t q = 0;
-  for (uint8_t i = _packetbuffer.start_address; i <= _packetbuffer.end_address; i++)
+  for (uint8_t i = _packetbuffer->start_address; i <= _packetbuffer->end_address; i++)
   {
-    cmi[i].PacketReceivedCount = _packetbuffer.moduledata[q];
+    cmi[i].PacketReceivedCount = _packetbuffer->moduledata[q];
     q++;
   }
 }
@@ -219,97 +342,117 @@ void PacketReceiveProcessor::ProcessReplyBalancePower()
 {
   // Called when a decoded packet has arrived in _packetbuffer for command 1
   uint8_t q = 0;
-  for (uint8_t i = _packetbuffer.start_address; i <= _packetbuffer.end_address; i++)
+  for (uint8_t i = _packetbuffer->start_address; i <= _packetbuffer->end_address; i++)
   {
-    cmi[i].PWMValue = _packetbuffer.moduledata[q];
+    cellReadings.PWMValue[i] = _packetbuffer->moduledata[q];
     q++;
   }
 }
 
-void PacketReceiveProcessor::ProcessReplyVoltage()
+void PacketReceiveProcessor::NotifyIfAllVoltagesRead()
 {
-  // Called when a decoded packet has arrived in _packetbuffer for command 1
+  // TODO: REVIEW THIS LOGIC
+  if (_packetbuffer->end_address == _packetbuffer->hops - 1)
+  {
+    // We have just processed a voltage reading for the entire chain of modules (all banks)
+    // at this point we should update any display or rules logic
+    // as we have a clean snapshot of voltages and statues
 
-  if (_packetbuffer.end_address < _packetbuffer.start_address)
-    return;
+    ESP_LOGD(TAG, "Finished all reads");
+    if (voltageandstatussnapshot_task_handle != NULL)
+    {
+      xTaskNotifyGive(voltageandstatussnapshot_task_handle);
+    }
+  }
+}
 
-  for (uint8_t i = 0; i <= _packetbuffer.end_address - _packetbuffer.start_address; i++)
-  {
+void PacketReceiveProcessor::UpdateVoltageAndStatus(uint8_t m, uint16_t value)
+{
+  // 3 top bits remaining
+  // X = In bypass
+  // Y = Bypass over temperature
+  // Z = Not used
 
-    CellModuleInfo *cellptr = &cmi[_packetbuffer.start_address + i];
+  const uint16_t voltagemV = value & 0x1FFF;
+  cellReadings.voltagemV[m] = voltagemV;
+  cellReadings.inBypass[m] = (value & 0x8000) > 0;
+  cellReadings.bypassOverTemp[m] = (value & 0x4000) > 0;
 
-    // 3 top bits remaining
-    // X = In bypass
-    // Y = Bypass over temperature
-    // Z = Not used
+  if (voltagemV > cellReadings.voltagemVMax[m])
+  {
+    cellReadings.voltagemVMax[m] = voltagemV;
+  }
 
-    cellptr->voltagemV = _packetbuffer.moduledata[i] & 0x1FFF;
-    cellptr->inBypass = (_packetbuffer.moduledata[i] & 0x8000) > 0;
-    cellptr->bypassOverTemp = (_packetbuffer.moduledata[i] & 0x4000) > 0;
+  if (voltagemV < cellReadings.voltagemVMin[m])
+  {
+    cellReadings.voltagemVMin[m] = voltagemV;
+  }
 
-    if (cellptr->voltagemV > cellptr->voltagemVMax)
-    {
-      cellptr->voltagemVMax = cellptr->voltagemV;
-    }
+  if (voltagemV > 0)
+  {
+    cellReadings.valid[m] = true;
+  }
+}
 
-    if (cellptr->voltagemV < cellptr->voltagemVMin)
-    {
-      cellptr->voltagemVMin = cellptr->voltagemV;
-    }
+void PacketReceiveProcessor::ProcessReplyVoltage()
+{
+  // Called when a decoded packet has arrived in _packetbuffer for command 1
 
-    if (cellptr->voltagemV > 0)
-    {
-      cellptr->valid = true;
-    }
+  if (_packetbuffer->end_address < _packetbuffer->start_address)
+    return;
+
+  for (uint8_t i = 0; i <= _packetbuffer->end_address - _packetbuffer->start_address; i++)
+  {
+    UpdateVoltageAndStatus(_packetbuffer->start_address + i, _packetbuffer->moduledata[i]);
   }
 }
 
 void PacketReceiveProcessor::ProcessReplyAdditionalSettings()
 {
-  uint8_t m = _packetbuffer.start_address;
-
-  cmi[m].FanSwitchOnTemperature = (int16_t)_packetbuffer.moduledata[0];
-  cmi[m].RelayMinmV = _packetbuffer.moduledata[1];
-  cmi[m].RelayRangemV = _packetbuffer.moduledata[2];
-  cmi[m].ParasiteVoltagemV = _packetbuffer.moduledata[3];
-  cmi[m].RunAwayCellMinimumVoltagemV = _packetbuffer.moduledata[4];
-  cmi[m].RunAwayCellDifferentialmV = _packetbuffer.moduledata[5];
+  uint8_t m = _packetbuffer->start_address;
+
+  cmi[m].FanSwitchOnTemperature = (int16_t)_packetbuffer->moduledata[0];
+  cmi[m].RelayMinmV = _packetbuffer->moduledata[1];
+  cmi[m].RelayRangemV = _packetbuffer->moduledata[2];
+  cmi[m].ParasiteVoltagemV = _packetbuffer->moduledata[3];
+  cmi[m].RunAwayCellMinimumVoltagemV = _packetbuffer->moduledata[4];
+  cmi[m].RunAwayCellDifferentialmV = _packetbuffer->moduledata[5];
 }
 
 void PacketReceiveProcessor::ProcessReplySettings()
 {
-  uint8_t m = _packetbuffer.start_address;
+  uint8_t m = _packetbuffer->start_address;
 
   // TODO: Validate m here to prevent array overflow
   cmi[m].settingsCached = true;
 
   FLOATUNION_t myFloat;
 
-  myFloat.word[0] = _packetbuffer.moduledata[0];
-  myFloat.word[1] = _packetbuffer.moduledata[1];
+  myFloat.word[0] = _packetbuffer->moduledata[0];
+  myFloat.word[1] = _packetbuffer->moduledata[1];
 
   // Arduino float (4 byte)
   cmi[m].LoadResistance = myFloat.number;
   // Arduino float(4 byte)
-  myFloat.word[0] = _packetbuffer.moduledata[2];
-  myFloat.word[1] = _packetbuffer.moduledata[3];
+  myFloat.word[0] = _packetbuffer->moduledata[2];
+  myFloat.word[1] = _packetbuffer->moduledata[3];
   cmi[m].Calibration = myFloat.number;
 
   // Arduino float(4 byte)
-  myFloat.word[0] = _packetbuffer.moduledata[4];
-  myFloat.word[1] = _packetbuffer.moduledata[5];
+  myFloat.word[0] = _packetbuffer->moduledata[4];
+  myFloat.word[1] = _packetbuffer->moduledata[5];
   cmi[m].mVPerADC = myFloat.number;
   // uint8_t
-  cmi[m].BypassOverTempShutdown = _packetbuffer.moduledata[6] & 0x00FF;
-  cmi[m].ChangesProhibited = (_packetbuffer.moduledata[6] & 0x8000) > 0;
+  cmi[m].BypassOverTempShutdown = _packetbuffer->moduledata[6] & 0x00FF;
+  cmi[m].ChangesProhibited = (_packetbuffer->moduledata[6] & 0x8000) > 0;
   // uint16_t
-  cmi[m].BypassThresholdmV = _packetbuffer.moduledata[7];
+  cmi[m].BypassThresholdmV = _packetbuffer->moduledata[7];
   // uint16_t
-  cmi[m].Internal_BCoefficient = _packetbuffer.moduledata[8];
+  cmi[m].Internal_BCoefficient = _packetbuffer->moduledata[8];
   // uint16_t
-  cmi[m].External_BCoefficient = _packetbuffer.moduledata[9];
+  cmi[m].External_BCoefficient = _packetbuffer->moduledata[9];
   // uint16_t
-  cmi[m].BoardVersionNumber = _packetbuffer.moduledata[10];
+  cmi[m].BoardVersionNumber = _packetbuffer->moduledata[10];
 
-  cmi[m].CodeVersionNumber = (_packetbuffer.moduledata[14] << 16) + _packetbuffer.moduledata[15];
+  cmi[m].CodeVersionNumber = (_packetbuffer->moduledata[14] << 16) + _packetbuffer->moduledata[15];
 }
@@ -183,16 +183,229 @@ bool PacketRequestGenerator::pushPacketToQueue(PacketStruct *_packetbuffer)
 
 bool PacketRequestGenerator::pushPacketToQueue(PacketStruct *_packetbuffer, TickType_t ticksToWait)
 {
-  if (xQueueSendToBack(_requestq, _packetbuffer, ticksToWait) != pdPASS)
+  int8_t slot = -1;
+  if (coalesceOrTrack(_packetbuffer, &slot))
+  {
+    // The request already queued will return the same data
+    return true;
+  }
+
+  Lane &lane = _lanes[priorityOf(_packetbuffer->command)];
+
+  QueuedRequest request;
+  memcpy(&request.packet, _packetbuffer, sizeof(PacketStruct));
+  request.queued = esp_timer_get_time();
+  request.pendingSlot = slot;
+
+  if (xQueueSendToBack(lane.queue, &request, ticksToWait) != pdPASS)
   {
     // Failed to post the message, even after delay
+    untrack(slot);
     return false;
   }
 
+  xSemaphoreGive(_requestsWaiting);
+
+  auto length = (uint16_t)uxQueueMessagesWaiting(lane.queue);
+  if (length > lane.maximumQueueLength)
+  {
+    lane.maximumQueueLength = length;
+  }
+
   packetsGenerated++;
   return true;
 }
 
+void PacketRequestGenerator::begin()
+{
+  // Safety holds a full sweep of 200 modules, housekeeping blocks lazy_tasks when full
+  const UBaseType_t length[numberOfRequestPriorities] = {30, 10, 20};
+
+  for (uint8_t p = 0; p < numberOfRequestPriorities; p++)
+  {
+    _lanes[p].queue = xQueueCreate(length[p], sizeof(QueuedRequest));
+    assert(_lanes[p].queue);
+  }
+
+  _requestsWaiting = xSemaphoreCreateCounting(maximumQueuedRequests, 0);
+  assert(_requestsWaiting);
+
+  memset(_pendingReads, 0xFF, sizeof(_pendingReads));
+}
+
+// Reads carry no data, so a queued read covering the same modules gives an identical reply
+bool PacketRequestGenerator::canCoalesce(uint8_t command)
+{
+  switch (command)
+  {
+  case COMMAND::ReadVoltageAndStatus:
+  case COMMAND::ReadTemperature:
+  case COMMAND::ReadBadPacketCounter:
+  case COMMAND::ReadSettings:
+  case COMMAND::ReadBalancePowerPWM:
+  case COMMAND::ReadBalanceCurrentCounter:
+  case COMMAND::ReadPacketReceivedCounter:
+  case COMMAND::ReadAdditionalSettings:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+// Returns true if a pending read of the same command already covers the address range of this request.
+// Otherwise the request is recorded as pending in "slot" so later duplicates can be merged into it, "slot"
+// is -1 if it isn't (not a read, or the table is full).
+// A wider request arriving after a narrower one is still queued, the queue can't be edited in place.
+bool PacketRequestGenerator::coalesceOrTrack(const PacketStruct *_packetbuffer, int8_t *slot)
+{
+  *slot = -1;
+  if (!canCoalesce(_packetbuffer->command))
+  {
+    return false;
+  }
+
+  bool covered = false;
+  PendingRead *freeSlot = nullptr;
+
+  portENTER_CRITICAL(&_pendingLock);
+  for (auto &r : _pendingReads)
+  {
+    if (r.command == _packetbuffer->command &&
+        r.start_address <= _packetbuffer->start_address &&
+        r.end_address >= _packetbuffer->end_address)
+    {
+      covered = true;
+      break;
+    }
+    if (freeSlot == nullptr && r.command == 0xFF)
+    {
+      freeSlot = &r;
+    }
+  }
+
+  if (covered)
+  {
+    packetsCoalesced++;
+  }
+  else if (freeSlot != nullptr)
+  {
+    // When full the request is just sent without being tracked
+    freeSlot->command = _packetbuffer->command;
+    freeSlot->start_address = _packetbuffer->start_address;
+    freeSlot->end_address = _packetbuffer->end_address;
+    *slot = (int8_t)(freeSlot - _pendingReads);
+  }
+  portEXIT_CRITICAL(&_pendingLock);
+
+  return covered;
+}
+
+// Frees the slot of the request taken off the queue.  By slot, not by address range, as an identical
+// request sent untracked whilst the table was full must not free the entry of one queued later.
+void PacketRequestGenerator::untrack(int8_t slot)
+{
+  if (slot < 0)
+  {
+    return;
+  }
+  portENTER_CRITICAL(&_pendingLock);
+  _pendingReads[slot].command = 0xFF;
+  portEXIT_CRITICAL(&_pendingLock);
+}
+
+RequestPriority PacketRequestGenerator::priorityOf(uint8_t command)
+{
+  switch (command & 0x0F)
+  {
+  case COMMAND::ReadVoltageAndStatus:
+  case COMMAND::ReadTemperature:
+    return RequestPriority::Safety;
+
+  case COMMAND::ReadSettings:
+  case COMMAND::ReadAdditionalSettings:
+  case COMMAND::ReadBadPacketCounter:
+  case COMMAND::ReadBalanceCurrentCounter:
+  case COMMAND::ReadPacketReceivedCounter:
+    return RequestPriority::Housekeeping;
+
+  default:
+    return RequestPriority::Telemetry;
+  }
+}
+
+bool PacketRequestGenerator::nextRequest(PacketStruct *packet, TickType_t ticksToWait)
+{
+  // Only transmit_task takes requests, so once this succeeds at least one queue has a request
+  if (xSemaphoreTake(_requestsWaiting, ticksToWait) != pdTRUE)
+  {
+    return false;
+  }
+
+  int8_t highest = -1;
+  int8_t lower = -1;
+  for (uint8_t p = 0; p < numberOfRequestPriorities; p++)
+  {
+    if (uxQueueMessagesWaiting(_lanes[p].queue) > 0)
+    {
+      if (highest < 0)
+      {
+        highest = p;
+      }
+      else if (lower < 0)
+      {
+        lower = p;
+      }
+    }
+  }
+
+  int8_t p = highest;
+  if (lower < 0)
+  {
+    _sentAheadOfLowerPriority = 0;
+  }
+  else if (++_sentAheadOfLowerPriority > requestStarvationLimit)
+  {
+    // Let the lower class have a turn
+    p = lower;
+    _sentAheadOfLowerPriority = 0;
+  }
+
+  if (p < 0)
+  {
+    ESP_LOGE(TAG, "Request count/queue mismatch");
+    return false;
+  }
+
+  Lane &lane = _lanes[p];
+  QueuedRequest request;
+  if (xQueueReceive(lane.queue, &request, 0) != pdPASS)
+  {
+    return false;
+  }
+
+  memcpy(packet, &request.packet, sizeof(PacketStruct));
+
+  // From now on a new request for these modules needs to be sent again
+  untrack(request.pendingSlot);
+
+  auto wait = (uint32_t)((esp_timer_get_time() - request.queued) / 1000);
+  lane.sent++;
+  lane.waitTotal += wait;
+  if (wait > lane.waitMaximum)
+  {
+    lane.waitMaximum = wait;
+  }
+
+  return true;
+}
+
+PacketRequestGenerator::PriorityStatistics PacketRequestGenerator::getStatistics(RequestPriority priority)
+{
+  const Lane &lane = _lanes[priority];
+  return PriorityStatistics{(uint16_t)uxQueueMessagesWaiting(lane.queue), lane.maximumQueueLength, lane.sent, lane.waitTotal, lane.waitMaximum};
+}
+
 void PacketRequestGenerator::setPacketAddressModuleRange(PacketStruct *_packetbuffer, uint8_t startmodule, uint8_t endmodule)
 {
   _packetbuffer->start_address = startmodule;
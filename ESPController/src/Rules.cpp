@@ -76,76 +76,94 @@ void Rules::ClearValues()
 
     dynamicChargeVoltage = 0;
     dynamicChargeCurrent = 0;
+
+    // Bank values need calculating again
+    processedBanks = 0;
 }
 
-// Looking at individual voltages and temperatures and sum up Bank voltages.
-void Rules::ProcessCell(uint8_t bank, uint8_t cellNumber, const CellModuleInfo *c, uint16_t cellmaxmv)
+// True if the readings for these cells differ from those last used for the bank
+bool Rules::BankChanged(uint8_t firstCell, uint8_t count, const CellReadings *cells) const
 {
-    if (c->valid == false)
-    {
-        invalidModuleCount++;
-        return;
-    }
+    return memcmp(&processed.valid[firstCell], &cells->valid[firstCell], count * sizeof(bool)) != 0 ||
+           memcmp(&processed.voltagemV[firstCell], &cells->voltagemV[firstCell], count * sizeof(uint16_t)) != 0 ||
+           memcmp(&processed.internalTemp[firstCell], &cells->internalTemp[firstCell], count * sizeof(int8_t)) != 0 ||
+           memcmp(&processed.externalTemp[firstCell], &cells->externalTemp[firstCell], count * sizeof(int8_t)) != 0;
+}
 
-    bankvoltage.at(bank) += c->voltagemV;
-    limitedbankvoltage.at(bank) += min(c->voltagemV, cellmaxmv);
+// Looking at individual voltages and temperatures and sum up the Bank voltage.
+// Cells firstCell to firstCell+count-1 are all in the bank, totals are kept in locals
+// (the compiler can't assume the cell arrays don't overlap the members) and stored once.
+void Rules::ProcessBank(uint8_t bank, uint8_t firstCell, uint8_t count, const CellReadings *cells, uint16_t cellmaxmv)
+{
+    BankValues b{0, 0, 0, 0xFFFF,
+                 maximum_controller_cell_modules + 1, maximum_controller_cell_modules + 1,
+                 -127, 127,
+                 maximum_controller_cell_modules + 1, maximum_controller_cell_modules + 1,
+                 -127, 127,
+                 0, 0, false};
 
-    // If the voltage of the module is zero, we probably haven't requested it yet (which happens during power up)
-    // so keep count so we don't accidentally trigger rules.
-    if (c->voltagemV == 0)
+    for (uint8_t cellNumber = firstCell; cellNumber < firstCell + count; cellNumber++)
     {
-        zeroVoltageModuleCount++;
-    }
+        if (cells->valid[cellNumber] == false)
+        {
+            b.invalidModuleCount++;
+            continue;
+        }
 
-    if (c->voltagemV > HighestCellVoltageInBank.at(bank))
-    {
-        HighestCellVoltageInBank.at(bank) = c->voltagemV;
-    }
-    if (c->voltagemV < LowestCellVoltageInBank.at(bank))
-    {
-        LowestCellVoltageInBank.at(bank) = c->voltagemV;
-    }
+        const uint16_t voltagemV = cells->voltagemV[cellNumber];
 
-    if (c->voltagemV > highestCellVoltage)
-    {
-        highestCellVoltage = c->voltagemV;
-        address_HighestCellVoltage = cellNumber;
-        index_bank_HighestCellVoltage = bank;
-    }
+        b.voltage += voltagemV;
+        b.limitedVoltage += min(voltagemV, cellmaxmv);
 
-    if (c->voltagemV < lowestCellVoltage)
-    {
-        lowestCellVoltage = c->voltagemV;
-        address_LowestCellVoltage = cellNumber;
-    }
+        // If the voltage of the module is zero, we probably haven't requested it yet (which happens during power up)
+        // so keep count so we don't accidentally trigger rules.
+        if (voltagemV == 0)
+        {
+            b.zeroVoltageModuleCount++;
+        }
 
-    if (c->externalTemp != -40)
-    {
-        // Record that we do have at least one external temperature sensor on a module
-        moduleHasExternalTempSensor = true;
+        if (voltagemV > b.highestCellVoltage)
+        {
+            b.highestCellVoltage = voltagemV;
+            b.address_HighestCellVoltage = cellNumber;
+        }
 
-        if (c->externalTemp > highestExternalTemp)
+        if (voltagemV < b.lowestCellVoltage)
         {
-            highestExternalTemp = c->externalTemp;
-            address_highestExternalTemp = cellNumber;
+            b.lowestCellVoltage = voltagemV;
+            b.address_LowestCellVoltage = cellNumber;
         }
 
-        if (c->externalTemp < lowestExternalTemp)
+        const int8_t externalTemp = cells->externalTemp[cellNumber];
+        if (externalTemp != -40)
         {
-            lowestExternalTemp = c->externalTemp;
-            address_lowestExternalTemp = cellNumber;
+            // Record that we do have at least one external temperature sensor on a module
+            b.hasExternalTempSensor = true;
+
+            if (externalTemp > b.highestExternalTemp)
+            {
+                b.highestExternalTemp = externalTemp;
+                b.address_highestExternalTemp = cellNumber;
+            }
+
+            if (externalTemp < b.lowestExternalTemp)
+            {
+                b.lowestExternalTemp = externalTemp;
+                b.address_lowestExternalTemp = cellNumber;
+            }
         }
-    }
 
-    if (c->internalTemp > highestInternalTemp)
-    {
-        highestInternalTemp = c->internalTemp;
+        const int8_t internalTemp = cells->internalTemp[cellNumber];
+        b.highestInternalTemp = max(b.highestInternalTemp, internalTemp);
+        b.lowestInternalTemp = min(b.lowestInternalTemp, internalTemp);
     }
 
-    if (c->externalTemp < lowestInternalTemp)
-    {
-        lowestInternalTemp = c->internalTemp;
-    }
+    bankValues.at(bank) = b;
+
+    memcpy(&processed.valid[firstCell], &cells->valid[firstCell], count * sizeof(bool));
+    memcpy(&processed.voltagemV[firstCell], &cells->voltagemV[firstCell], count * sizeof(uint16_t));
+    memcpy(&processed.internalTemp[firstCell], &cells->internalTemp[firstCell], count * sizeof(int8_t));
+    memcpy(&processed.externalTemp[firstCell], &cells->externalTemp[firstCell], count * sizeof(int8_t));
 }
 
 uint16_t Rules::VoltageRangeInBank(uint8_t bank) const
@@ -156,24 +174,136 @@ uint16_t Rules::VoltageRangeInBank(uint8_t bank) const
     return HighestCellVoltageInBank.at(bank) - LowestCellVoltageInBank.at(bank);
 }
 
-void Rules::ProcessBank(uint8_t bank)
+// Work out the pack values from the values of each bank, in bank order so ties go to the lowest cell number
+void Rules::CombineBanks(uint8_t banks)
 {
-    // Combine the voltages - work out the highest and lowest Bank voltages
-    if (bankvoltage.at(bank) > highestBankVoltage)
-    {
-        highestBankVoltage = bankvoltage.at(bank);
-        address_highestBankVoltage = bank;
-    }
-    if (bankvoltage.at(bank) < lowestBankVoltage)
-    {
-        lowestBankVoltage = bankvoltage.at(bank);
-        address_lowestBankVoltage = bank;
+    bankvoltage.fill(0);
+    limitedbankvoltage.fill(0);
+    LowestCellVoltageInBank.fill(0xFFFF);
+    HighestCellVoltageInBank.fill(0);
+
+    uint32_t highestBank = 0;
+    uint8_t address_highestBank = maximum_number_of_banks + 1;
+    uint32_t lowestBank = 0xFFFFFFFF;
+    uint8_t address_lowestBank = maximum_number_of_banks + 1;
+    uint16_t highest = 0;
+    uint8_t address_highest = maximum_controller_cell_modules + 1;
+    uint8_t index_bank_highest = 0;
+    uint16_t lowest = 0xFFFF;
+    uint8_t address_lowest = maximum_controller_cell_modules + 1;
+    int8_t highestExternal = -127;
+    uint8_t address_highestExternal = maximum_controller_cell_modules + 1;
+    int8_t lowestExternal = 127;
+    uint8_t address_lowestExternal = maximum_controller_cell_modules + 1;
+    int8_t highestInternal = -127;
+    int8_t lowestInternal = 127;
+    uint8_t invalid = 0;
+    uint8_t zeroVoltage = 0;
+    bool hasExternal = false;
+
+    for (uint8_t bank = 0; bank < banks; bank++)
+    {
+        const BankValues &b = bankValues.at(bank);
+
+        bankvoltage.at(bank) = b.voltage;
+        limitedbankvoltage.at(bank) = b.limitedVoltage;
+        HighestCellVoltageInBank.at(bank) = b.highestCellVoltage;
+        LowestCellVoltageInBank.at(bank) = b.lowestCellVoltage;
+
+        // Combine the voltages - work out the highest and lowest Bank voltages
+        if (b.voltage > highestBank)
+        {
+            highestBank = b.voltage;
+            address_highestBank = bank;
+        }
+        if (b.voltage < lowestBank)
+        {
+            lowestBank = b.voltage;
+            address_lowestBank = bank;
+        }
+
+        if (b.highestCellVoltage > highest)
+        {
+            highest = b.highestCellVoltage;
+            address_highest = b.address_HighestCellVoltage;
+            index_bank_highest = bank;
+        }
+        if (b.lowestCellVoltage < lowest)
+        {
+            lowest = b.lowestCellVoltage;
+            address_lowest = b.address_LowestCellVoltage;
+        }
+
+        if (b.highestExternalTemp > highestExternal)
+        {
+            highestExternal = b.highestExternalTemp;
+            address_highestExternal = b.address_highestExternalTemp;
+        }
+        if (b.lowestExternalTemp < lowestExternal)
+        {
+            lowestExternal = b.lowestExternalTemp;
+            address_lowestExternal = b.address_lowestExternalTemp;
+        }
+
+        highestInternal = max(highestInternal, b.highestInternalTemp);
+        lowestInternal = min(lowestInternal, b.lowestInternalTemp);
+
+        invalid += b.invalidModuleCount;
+        zeroVoltage += b.zeroVoltageModuleCount;
+        hasExternal |= b.hasExternalTempSensor;
+    }
+
+    highestBankVoltage = highestBank;
+    address_highestBankVoltage = address_highestBank;
+    lowestBankVoltage = lowestBank;
+    address_lowestBankVoltage = address_lowestBank;
+    highestCellVoltage = highest;
+    address_HighestCellVoltage = address_highest;
+    index_bank_HighestCellVoltage = index_bank_highest;
+    lowestCellVoltage = lowest;
+    address_LowestCellVoltage = address_lowest;
+    highestExternalTemp = highestExternal;
+    address_highestExternalTemp = address_highestExternal;
+    lowestExternalTemp = lowestExternal;
+    address_lowestExternalTemp = address_lowestExternal;
+    highestInternalTemp = highestInternal;
+    lowestInternalTemp = lowestInternal;
+    invalidModuleCount = invalid;
+    zeroVoltageModuleCount = zeroVoltage;
+    moduleHasExternalTempSensor = hasExternal;
+
+    // Needs invalidModuleCount
+    highestBankRange = 0;
+    for (uint8_t bank = 0; bank < banks; bank++)
+    {
+        highestBankRange = max(highestBankRange, VoltageRangeInBank(bank));
     }
+}
+
+uint8_t Rules::UpdateCellValues(const CellReadings *cells, uint8_t banks, uint8_t seriesModules, uint16_t cellmaxmv)
+{
+    const bool all = (banks != processedBanks || seriesModules != processedSeriesModules || cellmaxmv != processedCellmaxmv);
 
-    if (VoltageRangeInBank(bank) > highestBankRange)
+    uint8_t scanned = 0;
+    for (uint8_t bank = 0; bank < banks; bank++)
     {
-        highestBankRange = VoltageRangeInBank(bank);
+        const uint8_t firstCell = bank * seriesModules;
+        if (all || BankChanged(firstCell, seriesModules, cells))
+        {
+            ProcessBank(bank, firstCell, seriesModules, cells, cellmaxmv);
+            scanned++;
+        }
     }
+
+    processedBanks = banks;
+    processedSeriesModules = seriesModules;
+    processedCellmaxmv = cellmaxmv;
+
+    CombineBanks(banks);
+
+    banksScanned += scanned;
+    banksSkipped += banks - scanned;
+    return scanned;
 }
 
 void Rules::SetWarning(InternalWarningCode warncode)
@@ -231,12 +361,12 @@ void Rules::RunRules(
         // Currents can be both positive and negative (depending on current flow, we ABS that to get an always POSITIVE number)
         auto integercurrent = (uint32_t)(abs(currentMonitor->modbus.current) + (float)0.5);
 
-        if (integercurrent > value[Rule::CurrentMonitorOverCurrentAmps] && ruleOutcome(Rule::CurrentMonitorOverCurrentAmps) == false)
+        if (integercurrent > (uint32_t)value[Rule::CurrentMonitorOverCurrentAmps] && ruleOutcome(Rule::CurrentMonitorOverCurrentAmps) == false)
         {
             // CurrentMonitorOverCurrentAmps - TRIGGERED
             setRuleStatus(Rule::CurrentMonitorOverCurrentAmps, true);
         }
-        else if (integercurrent < hysteresisvalue[Rule::CurrentMonitorOverCurrentAmps] && ruleOutcome(Rule::CurrentMonitorOverCurrentAmps) == true)
+        else if (integercurrent < (uint32_t)hysteresisvalue[Rule::CurrentMonitorOverCurrentAmps] && ruleOutcome(Rule::CurrentMonitorOverCurrentAmps) == true)
         {
             // CurrentMonitorOverCurrentAmps - HYSTERESIS RESET
             setRuleStatus(Rule::CurrentMonitorOverCurrentAmps, false);
@@ -244,23 +374,23 @@ void Rules::RunRules(
 
         auto integervoltagemV = (uint32_t)((currentMonitor->modbus.voltage * 1000.0) + (float)0.5);
 
-        if (integervoltagemV > value[Rule::CurrentMonitorOverVoltage] && ruleOutcome(Rule::CurrentMonitorOverVoltage) == false)
+        if (integervoltagemV > (uint32_t)value[Rule::CurrentMonitorOverVoltage] && ruleOutcome(Rule::CurrentMonitorOverVoltage) == false)
         {
             // Rule - CURRENT MONITOR Bank over voltage (mV)
             setRuleStatus(Rule::CurrentMonitorOverVoltage, true);
         }
-        else if (integervoltagemV < hysteresisvalue[Rule::CurrentMonitorOverVoltage] && ruleOutcome(Rule::CurrentMonitorOverVoltage) == true)
+        else if (integervoltagemV < (uint32_t)hysteresisvalue[Rule::CurrentMonitorOverVoltage] && ruleOutcome(Rule::CurrentMonitorOverVoltage) == true)
         {
             // Rule - CURRENT MONITOR Bank over voltage (mV) - HYSTERESIS RESET
             setRuleStatus(Rule::CurrentMonitorOverVoltage, false);
         }
 
-        if (integervoltagemV < value[Rule::CurrentMonitorUnderVoltage] && ruleOutcome(Rule::CurrentMonitorUnderVoltage) == false)
+        if (integervoltagemV < (uint32_t)value[Rule::CurrentMonitorUnderVoltage] && ruleOutcome(Rule::CurrentMonitorUnderVoltage) == false)
         {
             // Rule - CURRENT MONITOR Bank under voltage (mV)
             setRuleStatus(Rule::CurrentMonitorUnderVoltage, true);
         }
-        else if (integervoltagemV > hysteresisvalue[Rule::CurrentMonitorUnderVoltage] && ruleOutcome(Rule::CurrentMonitorUnderVoltage) == true)
+        else if (integervoltagemV > (uint32_t)hysteresisvalue[Rule::CurrentMonitorUnderVoltage] && ruleOutcome(Rule::CurrentMonitorUnderVoltage) == true)
         {
             // Rule - CURRENT MONITOR Bank under voltage (mV) - HYSTERESIS RESET
             setRuleStatus(Rule::CurrentMonitorUnderVoltage, false);
@@ -369,23 +499,23 @@ void Rules::RunRules(
     }
 
     // Whole Bank voltages
-    if (highestBankVoltage > value[Rule::BankOverVoltage] && ruleOutcome(Rule::BankOverVoltage) == false)
+    if (highestBankVoltage > (uint32_t)value[Rule::BankOverVoltage] && ruleOutcome(Rule::BankOverVoltage) == false)
     {
         // Rule - Bank over voltage (mV)
         setRuleStatus(Rule::BankOverVoltage, true);
     }
-    else if (highestBankVoltage < hysteresisvalue[Rule::BankOverVoltage] && ruleOutcome(Rule::BankOverVoltage) == true)
+    else if (highestBankVoltage < (uint32_t)hysteresisvalue[Rule::BankOverVoltage] && ruleOutcome(Rule::BankOverVoltage) == true)
     {
         // Rule - Bank over voltage (mV) - HYSTERESIS RESET
         setRuleStatus(Rule::BankOverVoltage, false);
     }
 
-    if (lowestBankVoltage < value[Rule::BankUnderVoltage] && ruleOutcome(Rule::BankUnderVoltage) == false)
+    if (lowestBankVoltage < (uint32_t)value[Rule::BankUnderVoltage] && ruleOutcome(Rule::BankUnderVoltage) == false)
     {
         // Rule - Bank under voltage (mV)
         setRuleStatus(Rule::BankUnderVoltage, true);
     }
-    else if (lowestBankVoltage > hysteresisvalue[Rule::BankUnderVoltage] && ruleOutcome(Rule::BankUnderVoltage) == true)
+    else if (lowestBankVoltage > (uint32_t)hysteresisvalue[Rule::BankUnderVoltage] && ruleOutcome(Rule::BankUnderVoltage) == true)
     {
         // Rule - Bank under voltage (mV) - HYSTERESIS RESET
         setRuleStatus(Rule::BankUnderVoltage, false);
@@ -574,8 +704,10 @@ void Rules::CalculateDynamicChargeCurrent(const diybms_eeprom_settings *mysettin
 // This will always return a charge voltage - its the calling functions responsibility  to check "IsChargeAllowed" function and take necessary action.
 // Thanks to Matthias U (Smurfix) for the ideas and pseudo code https://community.openenergymonitor.org/u/smurfix/
 // Output is cached in variable dynamicChargeVoltage as its used in multiple places
-void Rules::CalculateDynamicChargeVoltage(const diybms_eeprom_settings *mysettings, const CellModuleInfo *cellarray)
+void Rules::CalculateDynamicChargeVoltage(const diybms_eeprom_settings *mysettings, const CellReadings *cells)
 {
+    dynamicChargeBank.fill(DynamicChargeBank{0, 0});
+
     if (!mysettings->dynamiccharge || mysettings->protocol == ProtocolEmulation::EMULATION_DISABLED)
     {
         // Dynamic charge switched off, use default or float voltage
@@ -614,42 +746,47 @@ void Rules::CalculateDynamicChargeVoltage(const diybms_eeprom_settings *mysettin
     // This is unlikely to work if the value is changed from 1 (an integer)
     const int16_t UniformDerating = 1;
 
-    // Calculate voltage range
-    uint32_t R = min(
-        (int16_t)((mysettings->cellmaxmv - highestCellVoltage) * UniformDerating),
-        (int16_t)((mysettings->cellmaxspikemv - mysettings->kneemv) / ((float)mysettings->sensitivity / 10.0F)));
-    // Avoid future divide by zero errors
-    if (R == 0)
+    const auto spikeRange = (int16_t)((mysettings->cellmaxspikemv - mysettings->kneemv) / ((float)mysettings->sensitivity / 10.0F));
+
+    // Each bank from its own cells, as the banks are in parallel they all get the same charge voltage so use the lowest.
+    // A bank with modules that haven't replied (or read 0mV) has a bank voltage short of those cells and would pull
+    // the charge voltage down towards 0V, so it is left out.  If no bank has every reading S stays at its maximum and
+    // the default or float voltage is used below.
+    uint32_t S = 0xFFFFFFFF;
+    for (uint8_t bank = 0; bank < mysettings->totalNumberOfBanks; bank++)
     {
-        R = 1;
-    }
-    ESP_LOGD(TAG, "R=%u", R);
+        const uint16_t highest = HighestCellVoltageInBank.at(bank);
 
-    // We use the Bank with the highest cell voltage for these calculations - although hopefully all banks are very similar :-)
-    uint32_t S = bankvoltage.at(index_bank_HighestCellVoltage);
-    ESP_LOGD(TAG, "S=%u", S);
+        const BankValues &b = bankValues.at(bank);
+        if (b.invalidModuleCount > 0 || b.zeroVoltageModuleCount > 0 || highest == 0)
+        {
+            ESP_LOGD(TAG, "bank=%u skipped, invalid=%u, zero=%u", bank, b.invalidModuleCount, b.zeroVoltageModuleCount);
+            continue;
+        }
 
-    uint32_t HminusR = (uint32_t)highestCellVoltage - R;
-    ESP_LOGD(TAG, "HminusR=%u", HminusR);
+        // Calculate voltage range
+        uint32_t R = (uint32_t)max((int16_t)1, min((int16_t)((mysettings->cellmaxmv - highest) * UniformDerating), spikeRange));
 
-    uint32_t MminusH = mysettings->cellmaxmv - highestCellVoltage;
-    ESP_LOGD(TAG, "MminusH=%u", MminusH);
+        uint32_t bankS = bankvoltage.at(bank);
+        const uint32_t HminusR = (uint32_t)highest - R;
+        const uint32_t MminusH = mysettings->cellmaxmv - highest;
 
-    // Jump to start of cells in the correct bank.
-    uint8_t cellid = index_bank_HighestCellVoltage * mysettings->totalNumberOfSeriesModules;
-    for (uint8_t i = 0; i < mysettings->totalNumberOfSeriesModules; i++)
-    {
-        if (cellarray[i].voltagemV >= HminusR)
+        const uint8_t cellid = bank * mysettings->totalNumberOfSeriesModules;
+        for (uint8_t i = cellid; i < cellid + mysettings->totalNumberOfSeriesModules; i++)
         {
-            S += ((MminusH) * (cellarray[i].voltagemV - (HminusR)) / R);
+            if (cells->voltagemV[i] >= HminusR)
+            {
+                bankS += ((MminusH) * (cells->voltagemV[i] - (HminusR)) / R);
+            }
         }
 
-        ESP_LOGD(TAG, "id=%u, V=%u, S=%u", cellid, cellarray[i].voltagemV, S);
-    }
+        // Scale down to 0.1V
+        bankS = bankS / 100;
+        ESP_LOGD(TAG, "bank=%u, H=%u, R=%u, S=%u", bank, highest, R, bankS);
 
-    // Scale down to 0.1V
-    S = S / 100;
-    ESP_LOGD(TAG, "S=%u", S);
+        dynamicChargeBank.at(bank) = DynamicChargeBank{(uint16_t)min(bankS, (uint32_t)0xFFFF), (uint16_t)R};
+        S = min(S, bankS);
+    }
 
     // Return MIN of either the above calculation or the "user specified value"
     dynamicChargeVoltage = min(S, (uint32_t)mysettings->chargevolt);
@@ -782,6 +919,6 @@ void Rules::setChargingMode(ChargingMode newMode)
 {
     if (chargemode == newMode)
         return;
-    ESP_LOGI(TAG, "Charging mode changed %u", newMode);
+    ESP_LOGI(TAG, "Charging mode changed %u", (uint8_t)newMode);
     chargemode = newMode;
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-sdlog";
+
+#include "SdLog.h"
+
+bool SdLog::Begin()
+{
+  _lock = xSemaphoreCreateMutex();
+  _buffer = (uint8_t *)malloc(_bufferSize);
+  if (_buffer == nullptr)
+  {
+    ESP_LOGE(TAG, "%s: no memory for %u byte buffer", _name, _bufferSize);
+    return false;
+  }
+  // Half the buffer in whole sectors
+  _threshold = max(SectorSize, (uint16_t)(_bufferSize / 2 / SectorSize * SectorSize));
+  return true;
+}
+
+bool SdLog::LockBus()
+{
+  if (!_lockBus())
+  {
+    ESP_LOGE(TAG, "%s: unable to get bus", _name);
+    return false;
+  }
+  _lockedAt = esp_timer_get_time();
+  busLocks++;
+  return true;
+}
+
+void SdLog::UnlockBus()
+{
+  const uint32_t held = (uint32_t)(esp_timer_get_time() - _lockedAt);
+  _unlockBus();
+  busHold_us += held;
+  busHoldMax_us = max(busHoldMax_us, held);
+}
+
+// Bus lock held.  Either everything waiting, or up to the last sector boundary of the file.
+void SdLog::WriteOut(bool everything)
+{
+  if (!_file || _used == 0)
+  {
+    return;
+  }
+
+  uint16_t length = _used;
+  if (!everything)
+  {
+    length = (uint16_t)((_fileSize + _used) / SectorSize * SectorSize - _fileSize);
+    if (length == 0)
+    {
+      return;
+    }
+  }
+
+  const size_t written = _file.write(_buffer, length);
+  writes++;
+  bytesWritten += written;
+  _fileSize += (uint32_t)written;
+  _unflushed = true;
+
+  memmove(_buffer, _buffer + length, _used - length);
+  _used -= length;
+
+  if (written != length)
+  {
+    // Card removed or full, opened again on the next row
+    ESP_LOGE(TAG, "%s: wrote %u of %u bytes to %s", _name, (uint32_t)written, length, _filename.c_str());
+    bytesDropped += length - (uint32_t)written;
+    CloseFile();
+  }
+}
+
+// Bus lock held
+void SdLog::CloseFile()
+{
+  if (_file)
+  {
+    _file.close();
+    flushes++;
+  }
+  _unflushed = false;
+}
+
+bool SdLog::Start(const char *filename)
+{
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  _skipRow = false;
+
+  if (_buffer == nullptr)
+  {
+    _skipRow = true;
+    return false;
+  }
+
+  if (_file && _filename == filename)
+  {
+    return false;
+  }
+
+  // A new day, or the first row since the card was mounted
+  bool created = false;
+  if (!LockBus())
+  {
+    _skipRow = !_file;
+    return false;
+  }
+
+  WriteOut(true);
+  CloseFile();
+  _filename = filename;
+
+  // Checked once a day, or if the file couldn't be opened
+  _cardFull = SD.totalBytes() - SD.usedBytes() < MinimumFreeSpace;
+  if (!_cardFull)
+  {
+    _file = SD.open(filename, FILE_APPEND);
+    if (_file)
+    {
+      opens++;
+      _fileSize = (uint32_t)_file.size();
+      created = _fileSize == 0;
+      _lastFlush = millis();
+      ESP_LOGI(TAG, "%s: %s %s", _name, created ? "create" : "append", filename);
+    }
+    else
+    {
+      ESP_LOGE(TAG, "%s: unable to open %s", _name, filename);
+    }
+  }
+  UnlockBus();
+
+  _skipRow = !_file;
+  return created;
+}
+
+void SdLog::Append(const char *data, size_t length)
+{
+  if (_skipRow)
+  {
+    bytesDropped += (uint32_t)length;
+    return;
+  }
+
+  while (length > 0)
+  {
+    if (_used == _bufferSize)
+    {
+      // Full, make room by writing out whole sectors
+      if (LockBus())
+      {
+        WriteOut(false);
+        UnlockBus();
+      }
+      if (_used == _bufferSize)
+      {
+        bytesDropped += (uint32_t)length;
+        return;
+      }
+    }
+
+    const uint16_t n = (uint16_t)min(length, (size_t)(_bufferSize - _used));
+    memcpy(_buffer + _used, data, n);
+    _used += n;
+    data += n;
+    length -= n;
+  }
+}
+
+// Log lock held
+void SdLog::WriteOutIfDue()
+{
+  if (!_file)
+  {
+    return;
+  }
+
+  const bool due = (_used != 0 || _unflushed) && (millis() - _lastFlush) >= FlushInterval;
+  if (_used < _threshold && !due)
+  {
+    return;
+  }
+
+  if (LockBus())
+  {
+    WriteOut(due);
+    if (due && _file)
+    {
+      _file.flush();
+      flushes++;
+      _unflushed = false;
+      _lastFlush = millis();
+    }
+    UnlockBus();
+  }
+}
+
+void SdLog::End()
+{
+  _skipRow = false;
+  WriteOutIfDue();
+  xSemaphoreGive(_lock);
+}
+
+void SdLog::FlushIfDue()
+{
+  if (_lock == nullptr)
+  {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  WriteOutIfDue();
+  xSemaphoreGive(_lock);
+}
+
+void SdLog::Close()
+{
+  if (_lock == nullptr)
+  {
+    return;
+  }
+  xSemaphoreTake(_lock, portMAX_DELAY);
+  if (_file && LockBus())
+  {
+    WriteOut(true);
+    CloseFile();
+    UnlockBus();
+    ESP_LOGI(TAG, "%s: closed %s", _name, _filename.c_str());
+  }
+  xSemaphoreGive(_lock);
+}
@@ -0,0 +1,110 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-guard";
+
+#include "VoltageGuard.h"
+
+constexpr Rule VoltageGuard::guarded[];
+
+uint8_t VoltageGuard::Check(uint8_t first, uint8_t last, const CellReadings *cells, const diybms_eeprom_settings *settings, const Rules *rules) const
+{
+  if (!armed || last < first || last >= maximum_controller_cell_modules)
+  {
+    return 0;
+  }
+
+  uint8_t exceeded = 0;
+  for (uint8_t m = first; m <= last; m++)
+  {
+    // Zero volt modules are reported by Rules (ZeroVoltModule), not as under voltage
+    const uint16_t v = cells->voltagemV[m];
+    if (!cells->valid[m] || v == 0)
+    {
+      continue;
+    }
+    if (v > settings->rulevalue[Rule::ModuleOverVoltage])
+    {
+      exceeded |= 1 << 0;
+    }
+    if (v < settings->rulevalue[Rule::ModuleUnderVoltage])
+    {
+      exceeded |= 1 << 1;
+    }
+  }
+
+  // Totals of the banks this reply touched, from the latest reading of every module in them
+  const uint8_t series = settings->totalNumberOfSeriesModules;
+  if (series > 0)
+  {
+    const uint8_t lastBank = min((uint8_t)(last / series), (uint8_t)(settings->totalNumberOfBanks - 1));
+    for (uint8_t bank = first / series; bank <= lastBank; bank++)
+    {
+      uint32_t total = 0;
+      const uint8_t firstCell = bank * series;
+      uint8_t i = 0;
+      for (; i < series && cells->valid[firstCell + i]; i++)
+      {
+        total += cells->voltagemV[firstCell + i];
+      }
+      if (i == series && (int32_t)total > settings->rulevalue[Rule::BankOverVoltage])
+      {
+        exceeded |= 1 << 2;
+      }
+    }
+  }
+
+  for (uint8_t i = 0; i < numberOfRules; i++)
+  {
+    if (_trips[i].tripped || rules->ruleOutcome(guarded[i]))
+    {
+      exceeded &= ~(1 << i);
+    }
+  }
+  return exceeded;
+}
+
+bool VoltageGuard::Trip(uint8_t exceeded, const Rules *rules, int64_t received_us, uint32_t epoch)
+{
+  bool tripped = false;
+  for (uint8_t i = 0; i < numberOfRules; i++)
+  {
+    if ((exceeded & (1 << i)) == 0 || _trips[i].tripped || rules->ruleOutcome(guarded[i]))
+    {
+      continue;
+    }
+
+    _trips[i] = TripState{true, false, received_us, epoch};
+    trips++;
+    tripped = true;
+    ESP_LOGW(TAG, "Tripped %s", Rules::RuleTextDescription.at(guarded[i]).c_str());
+  }
+  return tripped;
+}
+
+void VoltageGuard::Release(const Rules *rules)
+{
+  for (uint8_t i = 0; i < numberOfRules; i++)
+  {
+    TripState &t = _trips[i];
+    if (!t.tripped)
+    {
+      continue;
+    }
+
+    if (!t.confirmed && rules->ruleOutcome(guarded[i]))
+    {
+      t.confirmed = true;
+      rulesReaction.Add((uint32_t)(esp_timer_get_time() - t.received_us));
+    }
+
+    // Rules has now evaluated a snapshot taken after the trip (or RunRules is ignoring module voltages)
+    if ((int32_t)(rules->snapshotEpoch - t.epoch) > 0 || !armed)
+    {
+      if (!t.confirmed)
+      {
+        unconfirmed++;
+      }
+      t.tripped = false;
+      ESP_LOGI(TAG, "Released %s", Rules::RuleTextDescription.at(guarded[i]).c_str());
+    }
+  }
+}
@@ -0,0 +1,973 @@
+#define USE_ESP_IDF_LOG 1
+static constexpr const char *const TAG = "diybms-hist";
+
+#include "history.h"
+#include "crc16.h"
+
+const History::FieldDefinition History::fields[NumberOfFields] = {
+    // Time, start of the interval
+    {Aggregate::Last, -1},
+    // Voltage
+    {Aggregate::Average, -1},
+    {Aggregate::Minimum, VoltageAvg},
+    {Aggregate::Maximum, VoltageAvg},
+    // Current
+    {Aggregate::Average, -1},
+    {Aggregate::Minimum, CurrentAvg},
+    {Aggregate::Maximum, CurrentAvg},
+    // StateOfCharge, MilliampHourIn, MilliampHourOut
+    {Aggregate::Last, -1},
+    {Aggregate::Last, -1},
+    {Aggregate::Last, -1},
+    // Lowest cell voltage
+    {Aggregate::Average, -1},
+    {Aggregate::Minimum, LowestCellAvg},
+    {Aggregate::AtMinimum, LowestCellMin},
+    // Highest cell voltage
+    {Aggregate::Average, -1},
+    {Aggregate::Maximum, HighestCellAvg},
+    {Aggregate::AtMaximum, HighestCellMax},
+    // Bank range
+    {Aggregate::Average, -1},
+    {Aggregate::Maximum, BankRangeAvg},
+    // LowestBankVoltage, HighestBankVoltage, LowestExternalTemp, HighestExternalTemp
+    {Aggregate::Minimum, -1},
+    {Aggregate::Maximum, -1},
+    {Aggregate::Minimum, -1},
+    {Aggregate::Maximum, -1},
+};
+
+// 10 seconds for the last hour, 5 minutes for a day and 30 minutes for a month (65KB).
+// Records take 24 to 30 bytes, the longer intervals see bigger changes between records.
+// The last hour isn't kept over a restart, it would be most of the writes to flash.
+const History::TierDefinition History::tierDefinitions[NumberOfTiers] = {{10, 20, false}, {300, 18, true}, {1800, 92, true}};
+
+static inline uint8_t *PutVarint(uint8_t *p, int32_t value)
+{
+    uint32_t z = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    while (z >= 0x80)
+    {
+        *p++ = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    *p++ = (uint8_t)z;
+    return p;
+}
+
+static inline const uint8_t *GetVarint(const uint8_t *p, int32_t &value)
+{
+    uint32_t z = 0;
+    uint8_t shift = 0;
+    uint8_t b;
+    do
+    {
+        b = *p++;
+        z |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    value = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+    return p;
+}
+
+// Differences are modulo 2^32, so the mAh counters can wrap.  Time is relative to the interval after the
+// previous record, which is nearly always 0.
+uint8_t *History::Encode(uint8_t *p, const int32_t previous[], const int32_t record[], uint32_t resolution)
+{
+    for (uint8_t f = 0; f < NumberOfFields; f++)
+    {
+        const bool sameRecord = fields[f].reference >= 0 && (fields[f].aggregate == Aggregate::Minimum || fields[f].aggregate == Aggregate::Maximum);
+        uint32_t reference = (uint32_t)(sameRecord ? record[fields[f].reference] : previous[f]);
+        if (f == Time)
+        {
+            reference += resolution;
+        }
+        p = PutVarint(p, (int32_t)((uint32_t)record[f] - reference));
+    }
+    return p;
+}
+
+const uint8_t *History::Decode(const uint8_t *p, const int32_t previous[], int32_t record[], uint32_t resolution)
+{
+    for (uint8_t f = 0; f < NumberOfFields; f++)
+    {
+        const bool sameRecord = fields[f].reference >= 0 && (fields[f].aggregate == Aggregate::Minimum || fields[f].aggregate == Aggregate::Maximum);
+        uint32_t reference = (uint32_t)(sameRecord ? record[fields[f].reference] : previous[f]);
+        if (f == Time)
+        {
+            reference += resolution;
+        }
+        int32_t difference;
+        p = GetVarint(p, difference);
+        record[f] = (int32_t)(reference + (uint32_t)difference);
+    }
+    return p;
+}
+
+void History::Clear()
+{
+    if (_lock == nullptr)
+    {
+        _lock = xSemaphoreCreateMutex();
+        _fileLock = xSemaphoreCreateMutex();
+    }
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < NumberOfTiers; i++)
+    {
+        Block *blocks = tiers[i].blocks;
+        uint32_t *fileOffset = tiers[i].fileOffset;
+        if (blocks == nullptr)
+        {
+            // Separate allocations, one of 46KB is more likely to fit than all three together
+            const size_t bytes = tierDefinitions[i].numberOfBlocks * sizeof(Block);
+            blocks = (Block *)malloc(bytes);
+            if (blocks == nullptr)
+            {
+                ESP_LOGE(TAG, "Unable to allocate %u bytes for %us history", (uint32_t)bytes, tierDefinitions[i].resolution);
+            }
+            else
+            {
+                ESP_LOGI(TAG, "%u bytes for %us history", (uint32_t)bytes, tierDefinitions[i].resolution);
+                if (tierDefinitions[i].persist)
+                {
+                    fileOffset = (uint32_t *)malloc(tierDefinitions[i].numberOfBlocks * sizeof(uint32_t));
+                }
+            }
+        }
+        tiers[i] = {};
+        tiers[i].blocks = blocks;
+        tiers[i].fileOffset = fileOffset;
+        if (fileOffset != nullptr)
+        {
+            for (uint16_t n = 0; n < tierDefinitions[i].numberOfBlocks; n++)
+            {
+                fileOffset[n] = NotInFile;
+            }
+        }
+    }
+    pendingBlocks = 0;
+    xSemaphoreGive(_lock);
+}
+
+// Called with _lock held
+void History::Store(uint8_t tier, const int32_t record[])
+{
+    Tier &t = tiers[tier];
+    const uint16_t numberOfBlocks = tierDefinitions[tier].numberOfBlocks;
+
+    uint8_t encoded[NumberOfFields * 5];
+    Block *b = nullptr;
+    size_t length = 0;
+
+    if (t.nextBlock != t.firstBlock && !t.startNewBlock)
+    {
+        b = &t.blocks[(t.nextBlock - 1) % numberOfBlocks];
+        length = Encode(encoded, t.last, record, tierDefinitions[tier].resolution) - encoded;
+        if (b->records == UINT8_MAX || b->used + length > sizeof(b->data))
+        {
+            b = nullptr;
+        }
+    }
+
+    if (b == nullptr)
+    {
+        // New block, starting with the record in full
+        if (t.nextBlock - t.firstBlock == numberOfBlocks)
+        {
+            t.firstBlock++;
+        }
+        const uint16_t slot = t.nextBlock % numberOfBlocks;
+        if (t.fileOffset != nullptr && t.fileOffset[slot] != NotInFile)
+        {
+            // Dropped before it was read in
+            t.fileOffset[slot] = NotInFile;
+            pendingBlocks--;
+        }
+        b = &t.blocks[slot];
+        t.nextBlock++;
+        t.startNewBlock = false;
+
+        const int32_t zero[NumberOfFields] = {};
+        length = Encode(encoded, zero, record, tierDefinitions[tier].resolution) - encoded;
+        b->firstTime = (uint32_t)record[Time];
+        b->used = 0;
+        b->records = 0;
+    }
+
+    memcpy(&b->data[b->used], encoded, length);
+    b->used += length;
+    b->records++;
+    memcpy(t.last, record, sizeof(t.last));
+}
+
+void History::Add(time_t now, const Rules *rules, const currentmonitoring_struct *currentMonitor)
+{
+    if (_lock == nullptr)
+    {
+        return;
+    }
+
+    int32_t sample[NumberOfFields] = {};
+    if (currentMonitor->validReadings)
+    {
+        sample[VoltageAvg] = sample[VoltageMin] = sample[VoltageMax] = (int32_t)lroundf(currentMonitor->modbus.voltage * 100.0F);
+        sample[CurrentAvg] = sample[CurrentMin] = sample[CurrentMax] = (int32_t)lroundf(currentMonitor->modbus.current * 100.0F);
+        sample[StateOfCharge] = (int32_t)lroundf(currentMonitor->stateofcharge * 100.0F);
+        sample[MilliampHourIn] = (int32_t)currentMonitor->modbus.milliamphour_in;
+        sample[MilliampHourOut] = (int32_t)currentMonitor->modbus.milliamphour_out;
+    }
+    sample[LowestCellAvg] = sample[LowestCellMin] = rules->lowestCellVoltage;
+    sample[AddressLowCell] = rules->address_LowestCellVoltage;
+    sample[HighestCellAvg] = sample[HighestCellMax] = rules->highestCellVoltage;
+    sample[AddressHighCell] = rules->address_HighestCellVoltage;
+    sample[BankRangeAvg] = sample[BankRangeMax] = rules->highestBankRange;
+    sample[LowestBankVoltage] = (int32_t)rules->lowestBankVoltage;
+    sample[HighestBankVoltage] = (int32_t)rules->highestBankVoltage;
+    sample[LowestExternalTemp] = rules->lowestExternalTemp;
+    sample[HighestExternalTemp] = rules->highestExternalTemp;
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < NumberOfTiers; i++)
+    {
+        Tier &t = tiers[i];
+        if (t.blocks == nullptr)
+        {
+            continue;
+        }
+        sample[Time] = (int32_t)(now - (now % tierDefinitions[i].resolution));
+
+        // Sample is in the next interval, store the one just finished
+        if (t.count > 0 && t.accumulated[Time] != sample[Time])
+        {
+            int32_t record[NumberOfFields];
+            for (uint8_t f = 0; f < NumberOfFields; f++)
+            {
+                record[f] = (int32_t)(fields[f].aggregate == Aggregate::Average ? t.accumulated[f] / (int64_t)t.count : t.accumulated[f]);
+            }
+            Store(i, record);
+            t.count = 0;
+        }
+
+        if (t.count == 0)
+        {
+            for (uint8_t f = 0; f < NumberOfFields; f++)
+            {
+                t.accumulated[f] = sample[f];
+            }
+            t.count = 1;
+            continue;
+        }
+
+        // Before the minimum/maximum they refer to are updated
+        for (uint8_t f = 0; f < NumberOfFields; f++)
+        {
+            const int8_t r = fields[f].reference;
+            if ((fields[f].aggregate == Aggregate::AtMinimum && sample[r] < t.accumulated[r]) ||
+                (fields[f].aggregate == Aggregate::AtMaximum && sample[r] > t.accumulated[r]))
+            {
+                t.accumulated[f] = sample[f];
+            }
+        }
+
+        for (uint8_t f = 0; f < NumberOfFields; f++)
+        {
+            switch (fields[f].aggregate)
+            {
+            case Aggregate::Last:
+                t.accumulated[f] = sample[f];
+                break;
+            case Aggregate::Average:
+                t.accumulated[f] += sample[f];
+                break;
+            case Aggregate::Minimum:
+                t.accumulated[f] = min(t.accumulated[f], (int64_t)sample[f]);
+                break;
+            case Aggregate::Maximum:
+                t.accumulated[f] = max(t.accumulated[f], (int64_t)sample[f]);
+                break;
+            default:
+                break;
+            }
+        }
+        t.count++;
+    }
+    xSemaphoreGive(_lock);
+}
+
+History::TierStatistics History::Statistics(uint8_t tier)
+{
+    TierStatistics s = {};
+    s.resolution = tierDefinitions[tier].resolution;
+    s.capacity = tierDefinitions[tier].numberOfBlocks * sizeof(Block);
+    if (_lock == nullptr || tiers[tier].blocks == nullptr)
+    {
+        return s;
+    }
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    const Tier &t = tiers[tier];
+    for (uint32_t n = t.firstBlock; n != t.nextBlock; n++)
+    {
+        const Block &b = t.blocks[n % tierDefinitions[tier].numberOfBlocks];
+        s.records += b.records;
+        s.bytes += b.used;
+    }
+    xSemaphoreGive(_lock);
+    return s;
+}
+
+// Names and formats in /api/history, "Hundredths" are sent as a decimal
+enum class Format : uint8_t
+{
+    Signed,
+    Unsigned,
+    // Value is * 100
+    Hundredths
+};
+struct Series
+{
+    const char *name;
+    History::Field field;
+    Format format;
+};
+static const Series series[History::NumberOfFields] = {
+    {"time", History::Time, Format::Unsigned},
+    {"voltage", History::VoltageAvg, Format::Hundredths},
+    {"voltage_min", History::VoltageMin, Format::Hundredths},
+    {"voltage_max", History::VoltageMax, Format::Hundredths},
+    {"current", History::CurrentAvg, Format::Hundredths},
+    {"current_min", History::CurrentMin, Format::Hundredths},
+    {"current_max", History::CurrentMax, Format::Hundredths},
+    {"stateofcharge", History::StateOfCharge, Format::Hundredths},
+    {"milliamphour_in", History::MilliampHourIn, Format::Unsigned},
+    {"milliamphour_out", History::MilliampHourOut, Format::Unsigned},
+    {"lowestCellVoltage", History::LowestCellMin, Format::Signed},
+    {"lowestCellVoltage_avg", History::LowestCellAvg, Format::Signed},
+    {"address_LowCellV", History::AddressLowCell, Format::Signed},
+    {"highestCellVoltage", History::HighestCellMax, Format::Signed},
+    {"highestCellVoltage_avg", History::HighestCellAvg, Format::Signed},
+    {"address_HighCellV", History::AddressHighCell, Format::Signed},
+    {"highestBankRange", History::BankRangeMax, Format::Signed},
+    {"highestBankRange_avg", History::BankRangeAvg, Format::Signed},
+    {"lowestBankVoltage", History::LowestBankVoltage, Format::Signed},
+    {"highestBankVoltage", History::HighestBankVoltage, Format::Signed},
+    {"lowestExternalTemp", History::LowestExternalTemp, Format::Signed},
+    {"highestExternalTemp", History::HighestExternalTemp, Format::Signed},
+};
+
+// Tier for "resolution" (0 = finest tier going back to "from", or the month for everything) and
+// the blocks holding records between from and to.  Called with _lock held, false for an unknown resolution.
+bool History::SelectBlocks(uint32_t resolution, uint32_t from, uint32_t to, uint8_t &tier, uint32_t &first, uint32_t &last) const
+{
+    int8_t found = -1;
+    for (uint8_t i = 0; i < NumberOfTiers; i++)
+    {
+        const Tier &t = tiers[i];
+        if (t.blocks == nullptr)
+        {
+            continue;
+        }
+        if ((resolution != 0 && tierDefinitions[i].resolution == resolution) ||
+            (resolution == 0 && from != 0 && t.nextBlock != t.firstBlock && t.blocks[t.firstBlock % tierDefinitions[i].numberOfBlocks].firstTime <= from))
+        {
+            found = i;
+            break;
+        }
+    }
+    if (found < 0 && resolution == 0 && tiers[NumberOfTiers - 1].blocks != nullptr)
+    {
+        found = NumberOfTiers - 1;
+    }
+    if (found < 0)
+    {
+        return false;
+    }
+
+    tier = (uint8_t)found;
+    const Tier &t = tiers[tier];
+    const uint16_t numberOfBlocks = tierDefinitions[tier].numberOfBlocks;
+    first = t.firstBlock;
+    last = t.nextBlock;
+    while (first != last && first + 1 != last && t.blocks[(first + 1) % numberOfBlocks].firstTime <= from)
+    {
+        first++;
+    }
+    while (first != last && t.blocks[(last - 1) % numberOfBlocks].firstTime > to)
+    {
+        last--;
+    }
+    return true;
+}
+
+esp_err_t History::GenerateJSON(httpd_req_t *req, char buffer[], int bufferLenMax, uint32_t resolution, uint32_t from, uint32_t to)
+{
+    if (_lock == nullptr)
+    {
+        return httpd_resp_set_status(req, HTTPD_500);
+    }
+
+    // Any blocks Restore() left in the file are read in first
+    LoadPending(UINT16_MAX);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+
+    uint8_t tier;
+    uint32_t first;
+    uint32_t last;
+    if (!SelectBlocks(resolution, from, to, tier, first, last))
+    {
+        xSemaphoreGive(_lock);
+        return httpd_resp_send_err(req, httpd_err_code_t::HTTPD_400_BAD_REQUEST, "Unknown resolution");
+    }
+    const Tier &t = tiers[tier];
+    const uint16_t numberOfBlocks = tierDefinitions[tier].numberOfBlocks;
+
+    // Records in each block now, and how many of those are sent, so every series has the same number of values
+    const uint32_t size = last - first;
+    auto records = (uint8_t *)malloc(max(size, (uint32_t)1) * 2);
+    if (records == nullptr)
+    {
+        xSemaphoreGive(_lock);
+        return httpd_resp_set_status(req, HTTPD_500);
+    }
+    uint8_t *sent = records + size;
+    for (uint32_t n = 0; n < size; n++)
+    {
+        records[n] = t.blocks[(first + n) % numberOfBlocks].records;
+    }
+    xSemaphoreGive(_lock);
+
+    int bufferused = 0;
+    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "{\"resolution\":%u", tierDefinitions[tier].resolution);
+
+    // One block at a time is copied, so Add() isn't held up whilst sending
+    Block b;
+    for (const auto &s : series)
+    {
+        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, ",\"%s\":[", s.name);
+        bool firstValue = true;
+
+        for (uint32_t n = 0; n < size; n++)
+        {
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            // Dropped since the first series was sent, its values are null
+            const bool dropped = (int32_t)(first + n - t.firstBlock) < 0;
+            if (!dropped)
+            {
+                b = t.blocks[(first + n) % numberOfBlocks];
+            }
+            xSemaphoreGive(_lock);
+
+            if (s.field == Time)
+            {
+                sent[n] = 0;
+            }
+
+            const uint8_t *p = b.data;
+            int32_t previous[NumberOfFields] = {};
+            int32_t record[NumberOfFields];
+            for (uint8_t r = 0; r < records[n]; r++)
+            {
+                // Send it...
+                if (bufferused > bufferLenMax - 64)
+                {
+                    httpd_resp_send_chunk(req, buffer, bufferused);
+                    bufferused = 0;
+                }
+
+                if (dropped)
+                {
+                    if (r < sent[n])
+                    {
+                        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, firstValue ? "null" : ",null");
+                        firstValue = false;
+                    }
+                    continue;
+                }
+
+                p = Decode(p, previous, record, tierDefinitions[tier].resolution);
+                memcpy(previous, record, sizeof(previous));
+                if ((uint32_t)record[Time] < from || (uint32_t)record[Time] > to)
+                {
+                    continue;
+                }
+
+                const int32_t v = record[s.field];
+                if (s.field == Time)
+                {
+                    sent[n]++;
+                }
+
+                if (s.format == Format::Hundredths)
+                {
+                    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, firstValue ? "%.2f" : ",%.2f", v / 100.0F);
+                }
+                else if (s.format == Format::Unsigned)
+                {
+                    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, firstValue ? "%u" : ",%u", (uint32_t)v);
+                }
+                else
+                {
+                    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, firstValue ? "%li" : ",%li", (long)v);
+                }
+                firstValue = false;
+            }
+        }
+        bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "]");
+    }
+
+    // Closing tag
+    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "}");
+    httpd_resp_send_chunk(req, buffer, bufferused);
+
+    free(records);
+
+    // Indicate last chunk (zero byte length)
+    return httpd_resp_send_chunk(req, buffer, 0);
+}
+
+esp_err_t History::GenerateBinary(httpd_req_t *req, char buffer[], int bufferLenMax, uint32_t resolution, uint32_t from, uint32_t to)
+{
+    if (_lock == nullptr)
+    {
+        return httpd_resp_set_status(req, HTTPD_500);
+    }
+
+    LoadPending(UINT16_MAX);
+
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    uint8_t tier;
+    uint32_t first;
+    uint32_t last;
+    const bool found = SelectBlocks(resolution, from, to, tier, first, last);
+    xSemaphoreGive(_lock);
+    if (!found)
+    {
+        return httpd_resp_send_err(req, httpd_err_code_t::HTTPD_400_BAD_REQUEST, "Unknown resolution");
+    }
+    httpd_resp_set_type(req, "application/octet-stream");
+
+    // Header, describing each field so the decoder doesn't need to match this firmware
+    int bufferused = 0;
+    memcpy(&buffer[bufferused], "DHB", 3);
+    buffer[bufferused + 3] = 1;
+    bufferused += 4;
+    memcpy(&buffer[bufferused], &tierDefinitions[tier].resolution, sizeof(uint32_t));
+    bufferused += sizeof(uint32_t);
+    buffer[bufferused++] = NumberOfFields;
+    for (uint8_t f = 0; f < NumberOfFields; f++)
+    {
+        const Series *s = series;
+        while (s->field != f)
+        {
+            s++;
+        }
+        const bool sameRecord = fields[f].reference >= 0 && (fields[f].aggregate == Aggregate::Minimum || fields[f].aggregate == Aggregate::Maximum);
+        const uint8_t length = (uint8_t)strlen(s->name);
+        buffer[bufferused++] = (char)((sameRecord ? 1 : 0) | (s->format == Format::Hundredths ? 2 : 0) | (s->format == Format::Unsigned ? 4 : 0) | (f == Time ? 8 : 0));
+        buffer[bufferused++] = (char)(sameRecord ? fields[f].reference : -1);
+        buffer[bufferused++] = (char)length;
+        memcpy(&buffer[bufferused], s->name, length);
+        bufferused += length;
+    }
+
+    // Then the blocks as they are stored, copied straight into the buffer
+    const Tier &t = tiers[tier];
+    const uint16_t numberOfBlocks = tierDefinitions[tier].numberOfBlocks;
+    for (uint32_t n = first; n != last; n++)
+    {
+        // Send it...
+        if (bufferused > bufferLenMax - (int)sizeof(Block))
+        {
+            httpd_resp_send_chunk(req, buffer, bufferused);
+            bufferused = 0;
+        }
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        // Dropped since the request started
+        if ((int32_t)(n - t.firstBlock) >= 0)
+        {
+            const Block &b = t.blocks[n % numberOfBlocks];
+            const size_t length = offsetof(Block, data) + b.used;
+            memcpy(&buffer[bufferused], &b, length);
+            bufferused += length;
+        }
+        xSemaphoreGive(_lock);
+    }
+
+    httpd_resp_send_chunk(req, buffer, bufferused);
+    // Indicate last chunk (zero byte length)
+    return httpd_resp_send_chunk(req, buffer, 0);
+}
+
+// CRC of everything after the CRC field
+static uint16_t ChunkCRC(const uint8_t *sequence, const uint8_t *block, uint16_t blockLength)
+{
+    uint16_t crc = CRC16::Update(CRC16::Initial, sequence, 6);
+    return CRC16::Update(crc, block, blockLength);
+}
+
+// Reads the chunk at "offset" into _chunk, false if it isn't the expected block or is damaged
+bool History::ReadChunk(File &file, uint32_t offset, uint8_t tier, uint32_t sequence)
+{
+    if (!file.seek(offset) || file.read((uint8_t *)&_chunk, sizeof(Chunk)) != sizeof(Chunk))
+    {
+        return false;
+    }
+    const ChunkHeader &h = _chunk.header;
+    return h.magic == ChunkMagic && h.tier == tier && h.sequence == sequence && _chunk.block.used <= sizeof(_chunk.block.data) &&
+           h.crc == ChunkCRC((const uint8_t *)&h.sequence, (const uint8_t *)&_chunk.block, sizeof(Block));
+}
+
+// Appends the block in _chunk
+bool History::WriteChunk(File &file, uint8_t tier, uint32_t sequence)
+{
+    ChunkHeader &h = _chunk.header;
+    h.magic = ChunkMagic;
+    h.sequence = sequence;
+    h.tier = tier;
+    h.reserved = 0;
+    h.crc = ChunkCRC((const uint8_t *)&h.sequence, (const uint8_t *)&_chunk.block, sizeof(Block));
+    if (file.write((const uint8_t *)&_chunk, sizeof(Chunk)) != sizeof(Chunk))
+    {
+        return false;
+    }
+    chunksWritten++;
+    return true;
+}
+
+void History::Restore(fs::FS &fs)
+{
+    const int64_t started = esp_timer_get_time();
+    _fs = &fs;
+    if (_lock == nullptr || !fs.exists(filename))
+    {
+        return;
+    }
+
+    xSemaphoreTake(_fileLock, portMAX_DELAY);
+    File file = fs.open(filename, "r");
+    if (!file)
+    {
+        xSemaphoreGive(_fileLock);
+        return;
+    }
+
+    // A chunk left part written by a power cut is ignored, appending after it would misalign the rest
+    const uint32_t size = file.size();
+    uint32_t numberOfChunks = size / sizeof(Chunk);
+    _compact = (size % sizeof(Chunk)) != 0;
+
+    // Only the header and the start of the block up to the data are read
+    const size_t headerLength = sizeof(ChunkHeader) + offsetof(Block, data);
+    auto readHeader = [&](uint32_t c) -> bool
+    {
+        const ChunkHeader &h = _chunk.header;
+        const Block &b = _chunk.block;
+        if (!file.seek(c * sizeof(Chunk)) || file.read((uint8_t *)&_chunk, headerLength) != headerLength ||
+            h.magic != ChunkMagic || h.tier >= NumberOfTiers || !tierDefinitions[h.tier].persist ||
+            tiers[h.tier].blocks == nullptr || tiers[h.tier].fileOffset == nullptr || b.used > sizeof(b.data))
+        {
+            // Nothing after this can be trusted
+            numberOfChunks = c;
+            _compact = true;
+            return false;
+        }
+        return true;
+    };
+
+    // Newest block of each tier
+    bool found[NumberOfTiers] = {};
+    uint32_t newest[NumberOfTiers] = {};
+    for (uint32_t c = 0; c < numberOfChunks && readHeader(c); c++)
+    {
+        const uint8_t i = _chunk.header.tier;
+        newest[i] = found[i] ? max(newest[i], _chunk.header.sequence) : _chunk.header.sequence;
+        found[i] = true;
+    }
+
+    // Blocks that fit in each tier, the last chunk of a block is the most recent
+    uint32_t oldest[NumberOfTiers];
+    memcpy(oldest, newest, sizeof(oldest));
+    xSemaphoreTake(_lock, portMAX_DELAY);
+    for (uint32_t c = 0; c < numberOfChunks && readHeader(c); c++)
+    {
+        const ChunkHeader &h = _chunk.header;
+        const uint16_t numberOfBlocks = tierDefinitions[h.tier].numberOfBlocks;
+        if (newest[h.tier] - h.sequence >= numberOfBlocks)
+        {
+            continue;
+        }
+        Tier &t = tiers[h.tier];
+        const uint16_t slot = h.sequence % numberOfBlocks;
+        Block &b = t.blocks[slot];
+        b.firstTime = _chunk.block.firstTime;
+        b.used = _chunk.block.used;
+        b.records = _chunk.block.records;
+        t.fileOffset[slot] = c * sizeof(Chunk);
+        oldest[h.tier] = min(oldest[h.tier], h.sequence);
+    }
+
+    restoredBlocks = 0;
+    for (uint8_t i = 0; i < NumberOfTiers; i++)
+    {
+        if (!found[i])
+        {
+            continue;
+        }
+        Tier &t = tiers[i];
+        const uint16_t numberOfBlocks = tierDefinitions[i].numberOfBlocks;
+        t.firstBlock = oldest[i];
+        t.nextBlock = newest[i] + 1;
+        t.writtenBlock = t.nextBlock;
+        t.writtenRecords = 0;
+        t.startNewBlock = true;
+
+        uint32_t previousTime = 0;
+        for (uint32_t n = t.firstBlock; n != t.nextBlock; n++)
+        {
+            Block &b = t.blocks[n % numberOfBlocks];
+            if (t.fileOffset[n % numberOfBlocks] == NotInFile)
+            {
+                // Never written, left empty
+                b.firstTime = previousTime;
+                b.used = 0;
+                b.records = 0;
+                continue;
+            }
+            previousTime = b.firstTime;
+            restoredBlocks++;
+        }
+    }
+    pendingBlocks = restoredBlocks;
+    xSemaphoreGive(_lock);
+
+    file.close();
+    xSemaphoreGive(_fileLock);
+
+    restore_us = (uint32_t)(esp_timer_get_time() - started);
+    ESP_LOGI(TAG, "Restored %u blocks from %u chunks in %u us", restoredBlocks, numberOfChunks, restore_us);
+}
+
+// Reads in up to "maximum" blocks left in the file by Restore(), called with _fileLock held
+uint16_t History::LoadBlocks(File &file, uint16_t maximum)
+{
+    uint16_t loaded = 0;
+    for (uint8_t i = 0; i < NumberOfTiers && loaded < maximum; i++)
+    {
+        Tier &t = tiers[i];
+        if (t.fileOffset == nullptr)
+        {
+            continue;
+        }
+        const uint16_t numberOfBlocks = tierDefinitions[i].numberOfBlocks;
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        uint32_t n = t.firstBlock;
+        const uint32_t last = t.nextBlock;
+        xSemaphoreGive(_lock);
+
+        for (; n != last && loaded < maximum; n++)
+        {
+            const uint16_t slot = n % numberOfBlocks;
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            const uint32_t offset = t.fileOffset[slot];
+            xSemaphoreGive(_lock);
+            if (offset == NotInFile)
+            {
+                continue;
+            }
+
+            // File is read without holding up Add()
+            const bool ok = ReadChunk(file, offset, i, n);
+
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            // Unless it has been dropped meanwhile
+            if (t.fileOffset[slot] == offset)
+            {
+                Block &b = t.blocks[slot];
+                if (ok)
+                {
+                    memcpy(b.data, _chunk.block.data, sizeof(b.data));
+                }
+                else
+                {
+                    ESP_LOGE(TAG, "Damaged %us history block %u", tierDefinitions[i].resolution, n);
+                    fileErrors++;
+                    b.used = 0;
+                    b.records = 0;
+                }
+                t.fileOffset[slot] = NotInFile;
+                pendingBlocks--;
+                loaded++;
+            }
+            xSemaphoreGive(_lock);
+        }
+    }
+    return loaded;
+}
+
+void History::LoadPending(uint16_t maximum)
+{
+    if (pendingBlocks == 0 || _fs == nullptr)
+    {
+        return;
+    }
+
+    xSemaphoreTake(_fileLock, portMAX_DELAY);
+    // If the file can't be opened the blocks are left empty
+    File file = _fs->open(filename, "r");
+    LoadBlocks(file, maximum);
+    file.close();
+    xSemaphoreGive(_fileLock);
+}
+
+// Rewrites the file with only the blocks held, called with _fileLock held once everything is read in
+void History::Compact()
+{
+    static constexpr const char *temporary = "/history.tmp";
+    File file = _fs->open(temporary, "w");
+    if (!file)
+    {
+        fileErrors++;
+        return;
+    }
+
+    bool ok = true;
+    for (uint8_t i = 0; i < NumberOfTiers && ok; i++)
+    {
+        Tier &t = tiers[i];
+        if (t.fileOffset == nullptr)
+        {
+            continue;
+        }
+        const uint16_t numberOfBlocks = tierDefinitions[i].numberOfBlocks;
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        uint32_t n = t.firstBlock;
+        const uint32_t last = t.nextBlock;
+        xSemaphoreGive(_lock);
+
+        for (; n != last && ok; n++)
+        {
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            if ((int32_t)(n - t.firstBlock) < 0)
+            {
+                // Dropped meanwhile
+                xSemaphoreGive(_lock);
+                continue;
+            }
+            memcpy(&_chunk.block, &t.blocks[n % numberOfBlocks], sizeof(Block));
+            xSemaphoreGive(_lock);
+
+            ok = WriteChunk(file, i, n);
+
+            // The last block may still be filling
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            t.writtenBlock = n;
+            t.writtenRecords = _chunk.block.records;
+            xSemaphoreGive(_lock);
+        }
+    }
+    file.close();
+
+    if (ok && _fs->rename(temporary, filename))
+    {
+        _compact = false;
+        ESP_LOGI(TAG, "Compacted history file");
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Unable to compact history file");
+        fileErrors++;
+        _fs->remove(temporary);
+    }
+}
+
+void History::Checkpoint()
+{
+    if (_fs == nullptr || _lock == nullptr)
+    {
+        return;
+    }
+
+    // A few at a time, so everything is in RAM well before the file next needs compacting
+    LoadPending(_compact ? UINT16_MAX : 4);
+
+    xSemaphoreTake(_fileLock, portMAX_DELAY);
+
+    if (_compact && pendingBlocks == 0)
+    {
+        Compact();
+    }
+
+    const int64_t now = esp_timer_get_time();
+    const bool due = now - _lastCheckpoint >= (int64_t)CheckpointInterval * 1000000;
+
+    File file;
+    bool failed = false;
+    for (uint8_t i = 0; i < NumberOfTiers && !failed && !_compact; i++)
+    {
+        Tier &t = tiers[i];
+        if (t.fileOffset == nullptr)
+        {
+            continue;
+        }
+        const uint16_t numberOfBlocks = tierDefinitions[i].numberOfBlocks;
+
+        // Every full block not yet written, then the block being filled if it is due
+        for (;;)
+        {
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            const uint32_t n = (int32_t)(t.writtenBlock - t.firstBlock) < 0 ? t.firstBlock : t.writtenBlock;
+            const uint8_t written = n == t.writtenBlock ? t.writtenRecords : 0;
+            const bool full = n != t.nextBlock && n + 1 != t.nextBlock;
+            const uint8_t records = n == t.nextBlock ? 0 : t.blocks[n % numberOfBlocks].records;
+            const bool write = full || (due && records != written);
+            if (write)
+            {
+                memcpy(&_chunk.block, &t.blocks[n % numberOfBlocks], sizeof(Block));
+            }
+            xSemaphoreGive(_lock);
+
+            if (!write)
+            {
+                break;
+            }
+
+            if (!file)
+            {
+                file = _fs->open(filename, "a");
+            }
+            if (!file || !WriteChunk(file, i, n))
+            {
+                ESP_LOGE(TAG, "Unable to write history file");
+                fileErrors++;
+                failed = true;
+                break;
+            }
+
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            t.writtenBlock = full ? n + 1 : n;
+            t.writtenRecords = full ? 0 : records;
+            xSemaphoreGive(_lock);
+
+            if (!full)
+            {
+                break;
+            }
+        }
+    }
+
+    if (file)
+    {
+        _compact = _compact || file.size() >= CompactSize;
+        file.close();
+    }
+    if (due)
+    {
+        _lastCheckpoint = now;
+    }
+
+    xSemaphoreGive(_fileLock);
+}
@@ -11,6 +11,7 @@
 static constexpr const char *const TAG = "diybms-influxdb";
 
 #include "influxdb.h"
+#include "CellSnapshot.h"
 #include "string_utils.h"
 #include <esp_http_client.h>
 #include <string>
@@ -135,21 +136,24 @@ void influx_task_action()
     std::string module_data;
     module_data.reserve(768);
 
+    auto view = cellSnapshot.Acquire();
+    const uint8_t firstModule = moduleIndex;
+
     // Generate data to send to InfluxDB.
     for (uint8_t remainingModules = MAX_MODULES_PER_CALL;
          moduleIndex < TotalNumberOfCells() && remainingModules > 0;
          remainingModules--, moduleIndex++)
     {
         // Only generate data for the module if it is valid.
-        if (cmi[moduleIndex].valid)
+        if (view.cells->valid[moduleIndex])
         {
             uint8_t bank = moduleIndex / mysettings.totalNumberOfSeriesModules;
             uint8_t module_in_bank = moduleIndex - (bank * mysettings.totalNumberOfSeriesModules);
             std::string module_id = std::to_string(bank).append("_").append(std::to_string(module_in_bank));
-            std::string module_internal_temp = std::to_string(cmi[moduleIndex].internalTemp).append("i");
-            std::string module_external_temp = std::to_string(cmi[moduleIndex].externalTemp).append("i");
-            std::string module_bypass = cmi[moduleIndex].inBypass ? "true" : "false";
-            std::string module_voltage = float_to_string(cmi[moduleIndex].voltagemV / 1000.0f);
+            std::string module_internal_temp = std::to_string(view.cells->internalTemp[moduleIndex]).append("i");
+            std::string module_external_temp = std::to_string(view.cells->externalTemp[moduleIndex]).append("i");
+            std::string module_bypass = view.cells->inBypass[moduleIndex] ? "true" : "false";
+            std::string module_voltage = float_to_string(view.cells->voltagemV[moduleIndex] / 1000.0f);
             /*
                         ESP_LOGV(TAG, "Index:%d, bank:%d, module:%d, id:%s, voltage:%s, int-temp:%s, ext-temp:%s, bypass:%s",
                                  moduleIndex, bank, module_in_bank,
@@ -175,6 +179,14 @@ void influx_task_action()
         }
     }
 
+    if (!cellSnapshot.StillValid(view))
+    {
+        // The buffer was reused part way through, send these modules next time
+        ESP_LOGW(TAG, "Cell snapshot changed, batch dropped");
+        moduleIndex = firstModule;
+        return;
+    }
+
     // Ensure moduleIndex remains within bounds.
     if (moduleIndex > (TotalNumberOfCells() - 1))
     {
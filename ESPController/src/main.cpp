@@ -83,6 +83,10 @@ extern "C"
 #include "CurrentMonitorINA229.h"
 
 #include "history.h"
+#include "CellHistory.h"
+#include "SdLog.h"
+#include "BinaryCellLog.h"
+#include "CsvLine.h"
 
 CurrentMonitorINA229 currentmon_internal = CurrentMonitorINA229();
 extern void randomCharacters(char *value, int length);
@@ -103,6 +107,15 @@ bool wifi_isconnected = false;
 bool net_services_started = false;
 
 History history = History();
+CellHistory cellHistory;
+
+// Daily CSV logs on the SD card, written behind
+static bool LockVSPI() { return hal.GetVSPIMutex(); }
+static bool UnlockVSPI() { return hal.ReleaseVSPIMutex(); }
+SdLog cellLog("cells", 4096, LockVSPI, UnlockVSPI);
+SdLog currentLog("current", 1024, LockVSPI, UnlockVSPI);
+SdLog outputLog("outputs", 1024, LockVSPI, UnlockVSPI);
+BinaryCellLog binaryCellLog;
 
 // holds modbus data
 uint8_t frame[256];
@@ -134,6 +147,10 @@ int64_t canbus_last_305_message_time = 0;
 
 RelayState previousRelayState[RELAY_TOTAL];
 bool previousRelayPulse[RELAY_TOTAL];
+// Held whilst changing the relays, by rules_task, pulse_relay_off and by replyqueue_task when voltageGuard trips
+SemaphoreHandle_t relayMutex = nullptr;
+// Rules outcome the relays are set from, copied from rules after each ProcessRules
+bool relayRuleOutcome[RELAY_RULES];
 
 volatile enumInputState InputState[INPUTS_TOTAL];
 
@@ -165,6 +182,7 @@ TaskHandle_t mppt_can_task_handle = nullptr;
 
 // This large array holds all the information about the modules
 CellModuleInfo cmi[maximum_controller_cell_modules];
+CellReadings cellReadings;
 
 avrprogramsettings _avrsettings;
 
@@ -172,18 +190,22 @@ avrprogramsettings _avrsettings;
 const uint16_t MAX_SEND_RS485_PACKET_LENGTH = 36;
 
 QueueHandle_t rs485_transmit_q_handle;
-QueueHandle_t request_q_handle;
-QueueHandle_t reply_q_handle;
 
 #include "crc16.h"
 #include "settings.h"
 
 #include "PacketRequestGenerator.h"
 #include "PacketReceiveProcessor.h"
+#include "ReplyRing.h"
+#include "CellSnapshot.h"
+#include "VoltageGuard.h"
 #include "webserver.h"
 
 PacketRequestGenerator prg = PacketRequestGenerator();
 PacketReceiveProcessor receiveProc = PacketReceiveProcessor();
+ReplyRing replyRing;
+CellSnapshot cellSnapshot;
+VoltageGuard voltageGuard;
 
 // Memory to hold in and out serial buffer
 uint8_t SerialPacketReceiveBuffer[2 * sizeof(PacketStruct)];
@@ -215,6 +237,16 @@ void LED(uint8_t bits)
     // Wait until this task is triggered, when
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
+    // Every module has just replied, copy the readings for rules, web, MQTT and logging
+    cellSnapshot.Publish(&cellReadings);
+
+    // Run the rules straight away on the new readings.  Give, not eNoAction, so a snapshot published
+    // whilst rules_task is still running leaves it a count to take rather than being lost
+    if (rule_task_handle != nullptr)
+    {
+      xTaskNotifyGive(rule_task_handle);
+    }
+
     if (_tft_screen_available)
     {
       // Refresh the TFT display
@@ -316,6 +348,10 @@ void unmountSDCard()
   }
 
   ESP_LOGI(TAG, "Unmounting SD card");
+  // Rows still in RAM are written before the card goes
+  cellLog.Close();
+  currentLog.Close();
+  outputLog.Close();
   hal.UnmountSDCard();
   _sd_card_installed = false;
 }
@@ -406,205 +442,160 @@ void wake_up_tft(bool force)
   } // end for
 }
 
-bool check_sdcard_freespace()
+// Each log checks the free space when it opens a file (once a day)
+void check_sdcard_freespace(const SdLog &log)
 {
-  // Create a new file
-  uint64_t freeSpace = SD.totalBytes() - SD.usedBytes();
-
   // Ensure there is more than 25MB of free space on SD card before creating a file
-  if (freeSpace < (uint64_t)(25 * 1024 * 1024))
+  if (!log.SpaceAvailable() && mysettings.loggingEnabled)
   {
     ESP_LOGE(TAG, "SD card has less than 25MiB remaining, logging stopped");
     // We had an error, so switch off logging (this is only in memory so not written perm.)
     mysettings.loggingEnabled = false;
-    return false;
   }
-
-  return true;
 }
 
 /// @brief Log cell monitoring data to SDCARD
 /// @param filename
 /// @param timeinfo
-void log_cell_monitoring_data_to_sdcard(std::string filename, const tm timeinfo)
+void log_cell_monitoring_data_to_sdcard(const char *filename, const tm timeinfo)
 {
-  if (!check_sdcard_freespace())
-  {
+  if (mysettings.loggingBinary)
+  {
+    auto view = cellSnapshot.Acquire();
+    const uint32_t time = BinaryCellLog::LocalTime((uint16_t)timeinfo.tm_year, (uint8_t)timeinfo.tm_mon, (uint8_t)timeinfo.tm_mday,
+                                                   (uint8_t)timeinfo.tm_hour, (uint8_t)timeinfo.tm_min, (uint8_t)timeinfo.tm_sec);
+    binaryCellLog.Write(cellLog, filename, time, view.cells, cmi, mysettings.totalNumberOfBanks, mysettings.totalNumberOfSeriesModules,
+                        TotalNumberOfCells());
+    check_sdcard_freespace(cellLog);
     return;
   }
 
-  File file;
-  auto exists = SD.exists(filename.c_str());
+  // Rows go to RAM, the SD card is only written once there are a few sectors.
+  // The line is built on the stack and added a few modules at a time, nothing is allocated.
+  char buffer[192];
+  CsvLine line(buffer, sizeof(buffer));
 
-  // Open/create file
-  ESP_LOGD(TAG, "%s log %s", exists ? "Append" : "Create", filename.c_str());
-  file = SD.open(filename.c_str(), exists ? FILE_APPEND : FILE_WRITE);
-
-  if (!exists)
+  if (cellLog.Start(filename))
   {
-    file.print("DateTime,");
-
-    std::string header;
-    header.reserve(150);
+    line.Text("DateTime,");
 
     for (auto i = 0; i < TotalNumberOfCells(); i++)
     {
-      std::string n;
-      n = std::to_string(i);
-
-      header.clear();
-
-      header.append("VoltagemV_")
-          .append(n)
-          .append(",InternalTemp_")
-          .append(n)
-          .append(",ExternalTemp_")
-          .append(n)
-          .append(",Bypass_")
-          .append(n)
-          .append(",PWM_")
-          .append(n)
-          .append(",BypassOverTemp_")
-          .append(n)
-          .append(",BadPackets_")
-          .append(n)
-          .append(",BalancemAh_")
-          .append(n);
-
-      if (i < TotalNumberOfCells() - 1)
-      {
-        header.append(",");
-      }
-      else
-      {
-        header.append("\r\n");
-      }
-
-      file.write((const uint8_t *)header.c_str(), header.length());
+      line.Text("VoltagemV_")
+          .Unsigned(i)
+          .Text(",InternalTemp_")
+          .Unsigned(i)
+          .Text(",ExternalTemp_")
+          .Unsigned(i)
+          .Text(",Bypass_")
+          .Unsigned(i)
+          .Text(",PWM_")
+          .Unsigned(i)
+          .Text(",BypassOverTemp_")
+          .Unsigned(i)
+          .Text(",BadPackets_")
+          .Unsigned(i)
+          .Text(",BalancemAh_")
+          .Unsigned(i)
+          .Text(i < TotalNumberOfCells() - 1 ? "," : "\r\n");
+
+      cellLog.Append(line.Data(), line.Length());
+      line.Clear();
     }
   }
 
-  std::string dataMessage;
-  dataMessage.reserve(150);
-
-  dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
-      .append(" ")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
-      .append(",");
+  line.DateTime(timeinfo).Char(',');
 
+  auto view = cellSnapshot.Acquire();
+  // Modules in "line", from "first", after "start" characters
+  auto first = 0;
+  size_t start = line.Length();
   for (auto i = 0; i < TotalNumberOfCells(); i++)
   {
     // This may output invalid data when controller is first powered up
-    dataMessage.append(std::to_string(cmi[i].voltagemV))
-        .append(",")
-        .append(std::to_string(cmi[i].internalTemp))
-        .append(",")
-        .append(std::to_string(cmi[i].externalTemp))
-        .append(",")
-        .append(cmi[i].inBypass ? "Y" : "N")
-        .append(",")
-        .append(std::to_string((int)((float)cmi[i].PWMValue / (float)255.0 * 100)))
-        .append(",")
-        .append(cmi[i].bypassOverTemp ? "Y" : "N")
-        .append(",")
-        .append(std::to_string(cmi[i].badPacketCount))
-        .append(",")
-        .append(std::to_string(cmi[i].BalanceCurrentCount));
-
-    if (i < TotalNumberOfCells() - 1)
-    {
-      dataMessage.append(",");
-    }
-    else
+    line.Unsigned(view.cells->voltagemV[i])
+        .Char(',')
+        .Signed(view.cells->internalTemp[i])
+        .Char(',')
+        .Signed(view.cells->externalTemp[i])
+        .Char(',')
+        .YesNo(view.cells->inBypass[i])
+        .Char(',')
+        .Signed((int)((float)view.cells->PWMValue[i] / (float)255.0 * 100))
+        .Char(',')
+        .YesNo(view.cells->bypassOverTemp[i])
+        .Char(',')
+        .Unsigned(cmi[i].badPacketCount)
+        .Char(',')
+        .Unsigned(cmi[i].BalanceCurrentCount)
+        .Text(i < TotalNumberOfCells() - 1 ? "," : "\r\n");
+
+    // A module is at most 37 characters
+    if (line.Space() < 48 || i == TotalNumberOfCells() - 1)
     {
-      dataMessage.append("\r\n");
+      if (!cellSnapshot.StillValid(view))
+      {
+        // The buffer was reused whilst SdLog waited for the card.  The modules already written can't be
+        // taken back, so the rest of the row comes from the latest snapshot.
+        ESP_LOGW(TAG, "Cell snapshot changed during row, from module %i", first);
+        view = cellSnapshot.Acquire();
+        line.Truncate(start);
+        i = first - 1;
+        continue;
+      }
+      cellLog.Append(line.Data(), line.Length());
+      line.Clear();
+      first = i + 1;
+      start = 0;
     }
-
-    // Write the string out to file on each cell to avoid generating a huge string
-    file.write((const uint8_t *)dataMessage.c_str(), dataMessage.length());
-
-    // Start another string
-    dataMessage.clear();
   }
-  file.flush();
-  file.close();
+  cellLog.End();
+  check_sdcard_freespace(cellLog);
 
-  ESP_LOGI(TAG, "Cell monitor log file");
+  ESP_LOGD(TAG, "Cell monitor log file");
 }
 
 /// @brief Log current monitoring data to SD CARD
 /// @param cmon_filename
 /// @param timeinfo
-void log_current_data_to_sdcard(std::string cmon_filename, const tm timeinfo)
+void log_current_data_to_sdcard(const char *cmon_filename, const tm timeinfo)
 {
-  if (!check_sdcard_freespace())
+  if (currentLog.Start(cmon_filename))
   {
-    return;
+    currentLog.Append("DateTime,valid,voltage,current,mAhIn,mAhOut,DailymAhIn,DailymAhOut,power,temperature,relayState\r\n");
   }
 
-  auto exists = SD.exists(cmon_filename.c_str());
-
-  File file2;
-
-  // Open existing file (assumes there is enough SD card space to log)
-  file2 = SD.open(cmon_filename.c_str(), exists ? FILE_APPEND : FILE_WRITE);
-  ESP_LOGD(TAG, "%s file %s", exists ? "Append" : "Create", cmon_filename.c_str());
-
-  if (!exists)
-  {
-    file2.println("DateTime,valid,voltage,current,mAhIn,mAhOut,DailymAhIn,DailymAhOut,power,temperature,relayState");
-  }
-
-  std::string dataMessage;
-  dataMessage.reserve(128);
-
-  dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
-      .append(" ")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
-      .append(",");
-
-  dataMessage.append(currentMonitor.validReadings ? "1" : "0")
-      .append(",")
-      .append(float_to_string(currentMonitor.modbus.voltage))
-      .append(",")
-      .append(float_to_string(currentMonitor.modbus.current))
-      .append(",")
-      .append(std::to_string(currentMonitor.modbus.milliamphour_in))
-      .append(",")
-      .append(std::to_string(currentMonitor.modbus.milliamphour_out))
-      .append(",")
-      .append(std::to_string(currentMonitor.modbus.daily_milliamphour_in))
-      .append(",")
-      .append(std::to_string(currentMonitor.modbus.daily_milliamphour_out))
-      .append(",")
-      .append(float_to_string(currentMonitor.modbus.power))
-      .append(",")
-      .append(std::to_string(currentMonitor.modbus.temperature))
-      .append(",")
-      .append(currentMonitor.RelayState ? "1" : "0")
-      .append("\r\n");
-
-  file2.write((const uint8_t *)dataMessage.c_str(), dataMessage.length());
-  file2.flush();
-  file2.close();
-
-  ESP_LOGI(TAG, "Current monitor log file");
+  char buffer[192];
+  CsvLine line(buffer, sizeof(buffer));
+
+  line.DateTime(timeinfo)
+      .Char(',')
+      .Char(currentMonitor.validReadings ? '1' : '0')
+      .Char(',')
+      .Float4(currentMonitor.modbus.voltage)
+      .Char(',')
+      .Float4(currentMonitor.modbus.current)
+      .Char(',')
+      .Unsigned(currentMonitor.modbus.milliamphour_in)
+      .Char(',')
+      .Unsigned(currentMonitor.modbus.milliamphour_out)
+      .Char(',')
+      .Unsigned(currentMonitor.modbus.daily_milliamphour_in)
+      .Char(',')
+      .Unsigned(currentMonitor.modbus.daily_milliamphour_out)
+      .Char(',')
+      .Float4(currentMonitor.modbus.power)
+      .Char(',')
+      .Signed(currentMonitor.modbus.temperature)
+      .Char(',')
+      .Char(currentMonitor.RelayState ? '1' : '0')
+      .Text("\r\n");
+
+  currentLog.Append(line.Data(), line.Length());
+  currentLog.End();
+  check_sdcard_freespace(currentLog);
+
+  ESP_LOGD(TAG, "Current monitor log file");
 }
 
 // Output a status log to the SD Card in CSV format
@@ -633,41 +624,48 @@ void log_current_data_to_sdcard(std::string cmon_filename, const tm timeinfo)
         // Month is 0 to 11 based!
         timeinfo.tm_mon++;
 
-        std::string filename;
-        filename.reserve(32);
-        filename.append("/data_").append(std::to_string(timeinfo.tm_year)).append(pad_zero(2, (uint16_t)timeinfo.tm_mon)).append(pad_zero(2, (uint16_t)timeinfo.tm_mday)).append(".csv");
+        char filename[32];
+        CsvLine(filename, sizeof(filename)).Text("/data_").Unsigned(timeinfo.tm_year).Unsigned(timeinfo.tm_mon, 2).Unsigned(timeinfo.tm_mday, 2).Text(mysettings.loggingBinary ? ".dbl" : ".csv");
 
-        // Prevent other devices using the VSPI bus
-        if (hal.GetVSPIMutex())
-        {
-          log_cell_monitoring_data_to_sdcard(filename, timeinfo);
+        // The logs take the VSPI mutex themselves, only when writing to the card
+        log_cell_monitoring_data_to_sdcard(filename, timeinfo);
 
-          // Now log the current monitor
-          if (mysettings.currentMonitoringEnabled)
-          {
-            std::string cmon_filename;
-            cmon_filename.reserve(32);
-            cmon_filename.append("/modbus")
-                .append(pad_zero(2, mysettings.currentMonitoringModBusAddress))
-                .append("_")
-                .append(std::to_string(timeinfo.tm_year))
-                .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
-                .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
-                .append(".csv");
-
-            log_current_data_to_sdcard(cmon_filename, timeinfo);
-
-          } // end of logging for current monitor
+        // Now log the current monitor
+        if (mysettings.currentMonitoringEnabled)
+        {
+          char cmon_filename[32];
+          CsvLine(cmon_filename, sizeof(cmon_filename))
+              .Text("/modbus")
+              .Unsigned(mysettings.currentMonitoringModBusAddress, 2)
+              .Char('_')
+              .Unsigned(timeinfo.tm_year)
+              .Unsigned(timeinfo.tm_mon, 2)
+              .Unsigned(timeinfo.tm_mday, 2)
+              .Text(".csv");
+
+          log_current_data_to_sdcard(cmon_filename, timeinfo);
+
+        } // end of logging for current monitor
+        else
+        {
+          currentLog.Close();
         }
 
-        // Must be the last thing...
-        hal.ReleaseVSPIMutex();
+        // Output states are only logged when they change
+        outputLog.FlushIfDue();
       }
       else
       {
         ESP_LOGE(TAG, "Invalid datetime");
       }
     }
+    else if (_sd_card_installed && !mysettings.loggingEnabled)
+    {
+      // Logging switched off, write out what is waiting
+      cellLog.Close();
+      currentLog.Close();
+      outputLog.Close();
+    }
   } // end for loop
 }
 
@@ -683,74 +681,53 @@ void log_current_data_to_sdcard(std::string cmon_filename, const tm timeinfo)
   }
 }
 
-void sdcardlog_output(std::string filename, const tm timeinfo)
+void sdcardlog_output(const char *filename, const tm timeinfo)
 {
-  if (!check_sdcard_freespace())
-  {
-    return;
-  }
-
-  File file;
+  char buffer[96];
+  CsvLine line(buffer, sizeof(buffer));
 
-  auto exists = SD.exists(filename.c_str());
-  file = SD.open(filename.c_str(), exists ? FILE_APPEND : FILE_WRITE);
-  if (!exists)
+  if (outputLog.Start(filename))
   {
-    // Create the file
-    ESP_LOGD(TAG, "Create log %s", filename.c_str());
+    // New file
+    ESP_LOGD(TAG, "Create log %s", filename);
 
-    std::string header;
-    header.reserve(128);
-
-    header.append("DateTime,TCA6408,TCA9534,");
+    line.Text("DateTime,TCA6408,TCA9534,");
 
     for (uint8_t i = 0; i < RELAY_TOTAL; i++)
     {
-      header.append("Output_").append(std::to_string(i));
+      line.Text("Output_").Unsigned(i);
       if (i < RELAY_TOTAL - 1)
       {
-        header.append(",");
+        line.Char(',');
       }
     }
-    header.append("\r\n");
-    file.write((const uint8_t *)header.c_str(), header.length());
-  }
-
-  std::string dataMessage;
-  dataMessage.reserve(128);
-
-  dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
-      .append("-")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
-      .append(" ")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
-      .append(":")
-      .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
-      .append(",")
-      .append(uint8_to_binary_string(hal.LastTCA6408Value()))
-      .append(",")
-      .append(uint8_to_binary_string(hal.LastTCA9534APWRValue()))
-      .append(",");
+    line.Text("\r\n");
+    outputLog.Append(line.Data(), line.Length());
+    line.Clear();
+  }
+
+  line.DateTime(timeinfo)
+      .Char(',')
+      .Binary(hal.LastTCA6408Value())
+      .Char(',')
+      .Binary(hal.LastTCA9534APWRValue())
+      .Char(',');
 
   for (uint8_t i = 0; i < RELAY_TOTAL; i++)
   {
     // This may output invalid data when controller is first powered up
-    dataMessage.append(previousRelayState[i] == RelayState::RELAY_ON ? "Y" : "N");
+    line.YesNo(previousRelayState[i] == RelayState::RELAY_ON);
     if (i < RELAY_TOTAL - 1)
     {
-      dataMessage.append(",");
+      line.Char(',');
     }
   }
-  dataMessage.append("\r\n");
-  file.write((const uint8_t *)dataMessage.c_str(), dataMessage.length());
-  file.flush();
-  file.close();
+  line.Text("\r\n");
+  outputLog.Append(line.Data(), line.Length());
+  outputLog.End();
+  check_sdcard_freespace(outputLog);
 
-  ESP_LOGI(TAG, "Output State logging");
+  ESP_LOGD(TAG, "Output State logging");
 }
 
 // Writes a status log of the OUTPUT STATUES to the SD Card in CSV format
@@ -776,17 +753,10 @@ void sdcardlog_output(std::string filename, const tm timeinfo)
         // Month is 0 to 11 based!
         timeinfo.tm_mon++;
 
-        std::string filename;
-        filename.reserve(32);
-        filename.append("/output_status_").append(std::to_string(timeinfo.tm_year)).append(pad_zero(2, (uint16_t)timeinfo.tm_mon)).append(pad_zero(2, (uint16_t)timeinfo.tm_mday)).append(".csv");
+        char filename[32];
+        CsvLine(filename, sizeof(filename)).Text("/output_status_").Unsigned(timeinfo.tm_year).Unsigned(timeinfo.tm_mon, 2).Unsigned(timeinfo.tm_mday, 2).Text(".csv");
 
-        // Prevent other devices using the VSPI bus
-        if (hal.GetVSPIMutex())
-        {
-          sdcardlog_output(filename, timeinfo);
-          // Must be the last thing...
-          hal.ReleaseVSPIMutex();
-        }
+        sdcardlog_output(filename, timeinfo);
       }
       else
       {
@@ -1048,107 +1018,264 @@ uint16_t minutesSinceMidnight()
   }
 }
 
+// Set the relays from relayRuleOutcome and any rules voltageGuard has tripped, called with relayMutex held
+// Returns the number of relays changed
+uint8_t SetRelays()
+{
+  RelayState relay[RELAY_TOTAL];
+
+  // Set defaults based on configuration
+  for (int8_t y = 0; y < RELAY_TOTAL; y++)
+  {
+    relay[y] = mysettings.rulerelaydefault[y] == RELAY_ON ? RELAY_ON : RELAY_OFF;
+  }
+
+  // Test the rules (in reverse order)
+  for (int8_t n = RELAY_RULES - 1; n >= 0; n--)
+  {
+    if (relayRuleOutcome[n] || voltageGuard.Tripped((Rule)n))
+    {
+      for (int8_t y = 0; y < RELAY_TOTAL; y++)
+      {
+        // Dont change relay if its set to ignore/X
+        if (mysettings.rulerelaystate[n][y] != RELAY_X)
+        {
+          if (mysettings.rulerelaystate[n][y] == RELAY_ON)
+          {
+            relay[y] = RELAY_ON;
+          }
+          else
+          {
+            relay[y] = RELAY_OFF;
+          }
+        }
+      }
+    }
+  }
+
+  // Outputs as they are now, pulsed relays have already been switched back off
+  RelayState outputs[RELAY_TOTAL];
+  for (int8_t n = 0; n < RELAY_TOTAL; n++)
+  {
+    outputs[n] = hal.GetOutputState(n);
+  }
+
+  uint8_t changes = 0;
+  bool firePulse = false;
+  for (int8_t n = 0; n < RELAY_TOTAL; n++)
+  {
+    if (previousRelayState[n] != relay[n])
+    {
+      ESP_LOGI(TAG, "Set relay %i=%i", n, relay[n] == RelayState::RELAY_ON ? 1 : 0);
+      changes++;
+      outputs[n] = relay[n];
+
+      // Record the previous state of the relay, to use on the next loop to prevent chatter
+      previousRelayState[n] = relay[n];
+
+      if (mysettings.relaytype[n] == RELAY_PULSE)
+      {
+        previousRelayPulse[n] = true;
+        firePulse = true;
+        ESP_LOGI(TAG, "Relay %i PULSED", n);
+      }
+    }
+  }
+
+  if (changes)
+  {
+    // All the changed relays in one i2c transaction
+    hal.SetOutputStates(outputs);
+  }
+
+  if (firePulse)
+  {
+    // Fire timer to switch off relay in a few ms
+    if (xTimerStart(pulse_relay_off_timer, 10) != pdPASS)
+    {
+      ESP_LOGE(TAG, "Pulse timer start error");
+    }
+  }
+
+  if (changes)
+  {
+    // Fire task to record state of outputs to SD Card
+    xTaskNotify(sdcardlog_outputs_task_handle, 0x00, eNotifyAction::eNoAction);
+  }
+
+  return changes;
+}
+
+// Fast path for the voltage protection rules (see VoltageGuard.h), called by replyqueue_task after
+// each voltage reply so a cell or bank beyond its rule value changes the relays straight away
+void CheckVoltageGuard(const PacketStruct *packet, uint32_t receivedMillisecond)
+{
+  const uint8_t exceeded = voltageGuard.Check(packet->start_address, packet->end_address, &cellReadings, &mysettings, &rules);
+  if (exceeded == 0)
+  {
+    return;
+  }
+
+  // When the reply arrived, to within 1ms
+  const int64_t received_us = esp_timer_get_time() - (int64_t)(millis() - receivedMillisecond) * 1000;
+
+  xSemaphoreTake(relayMutex, portMAX_DELAY);
+  if (voltageGuard.Trip(exceeded, &rules, received_us, cellSnapshot.Epoch()))
+  {
+    SetRelays();
+    voltageGuard.fastReaction.Add((uint32_t)(esp_timer_get_time() - received_us));
+
+    // MQTT report the relay state
+    xTaskNotify(rule_state_change_task_handle, 0x00, eNotifyAction::eNoAction);
+  }
+  xSemaphoreGive(relayMutex);
+}
+
 [[noreturn]] void replyqueue_task(void *)
 {
   for (;;)
   {
-    if (reply_q_handle != nullptr)
+    ReplyRing::Slot *slot = replyRing.Next(portMAX_DELAY);
+    if (slot != nullptr)
     {
-      PacketStruct ps;
-      if (xQueueReceive(reply_q_handle, &ps, portMAX_DELAY) == pdPASS)
-      {
+      auto start = ESP.getCycleCount();
+
 #if defined(PACKET_LOGGING_RECEIVE)
 // Process decoded incoming packet
-// dumpPacketToDebug('R', &ps);
+// dumpPacketToDebug('R', &slot->packet);
 #endif
 
-        if (!receiveProc.ProcessReply(&ps))
-        {
-          // Error blue
-          LED(RGBLED::Blue);
+      cellSnapshot.BeginUpdate();
+      bool processed = receiveProc.ProcessReply(&slot->packet, slot->receivedMillisecond);
+      cellSnapshot.EndUpdate();
 
-          ESP_LOGE(TAG, "Packet Failed");
+      const uint8_t command = slot->packet.command & 0x0F;
+      if (processed && command == COMMAND::ReadVoltageAndStatus)
+      {
+        CheckVoltageGuard(&slot->packet, slot->receivedMillisecond);
+      }
 
-          // SERIAL_DEBUG.print(F("*FAIL*"));
-          // dumpPacketToDebug('F', &ps);
-        }
+      if (!processed)
+      {
+        // Error blue
+        LED(RGBLED::Blue);
+
+        ESP_LOGE(TAG, "Packet Failed");
+
+        // SERIAL_DEBUG.print(F("*FAIL*"));
+        // dumpPacketToDebug('F', &slot->packet);
       }
+
+      replyRing.Release(slot);
+      replyRing.processCycles += ESP.getCycleCount() - start;
     }
   }
 }
 
 void onPacketReceived()
 {
-  PacketStruct ps;
-  memcpy(&ps, SerialPacketReceiveBuffer, sizeof(PacketStruct));
+  // Timestamp at the earliest possible moment
+  auto t = millis();
+  auto start = ESP.getCycleCount();
 
-  if ((ps.command & 0x0F) == COMMAND::Timing)
+  ReplyRing::Slot *slot = replyRing.Acquire();
+  if (slot == nullptr)
   {
-    // Timestamp at the earliest possible moment
-    auto t = millis();
-    ps.moduledata[2] = (t & 0xFFFF0000) >> 16;
-    ps.moduledata[3] = t & (uint32_t)0x0000FFFF;
-    // Ensure CRC is correct
-    ps.crc = CRC16::CalculateArray((uint8_t *)&ps, sizeof(PacketStruct) - 2);
+    ESP_LOGE(TAG, "Reply Q full");
+    return;
   }
 
-  if (xQueueSendToBack(reply_q_handle, &ps, (TickType_t)100) != pdPASS)
+  // Only copy of the reply, replyqueue_task processes it in the slot
+  memcpy(&slot->packet, SerialPacketReceiveBuffer, sizeof(PacketStruct));
+  slot->receivedMillisecond = t;
+  replyRing.Publish(slot);
+
+  replyRing.packets++;
+  replyRing.decodeCycles += ESP.getCycleCount() - start;
+}
+
+// Wait until the next request can be released onto the module ring.
+// Up to "packetwindow" requests can be outstanding, PacketReceiveProcessor wakes us as replies arrive.
+void wait_for_window(int64_t last_sent)
+{
+  const int64_t legacy_delay = (int64_t)PacketPacing::LegacyDelay(mysettings.baudRate) * 1000;
+  const int64_t spacing = (int64_t)PacketPacing::MinimumSpacing(mysettings.baudRate) * 1000;
+
+  for (;;)
   {
-    ESP_LOGE(TAG, "Reply Q full");
-  }
+    receiveProc.ExpireRequests();
+
+    const int64_t elapsed = esp_timer_get_time() - last_sent;
 
-  // ESP_LOGI(TAG,"Reply Q length %i",replyQueue.getCount());
+    // Never slower than the fixed delay
+    if (elapsed >= legacy_delay)
+    {
+      return;
+    }
+
+    int64_t wait = legacy_delay - elapsed;
+
+    auto outstanding = receiveProc.OutstandingRequests();
+    if (outstanding < mysettings.packetwindow)
+    {
+      // Ring is empty, or the first module has had time to forward the previous request
+      if (outstanding == 0 || elapsed >= spacing)
+      {
+        return;
+      }
+      wait = spacing - elapsed;
+    }
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000) + 1);
+  }
 }
 
 [[noreturn]] void transmit_task(void *)
 {
+  int64_t last_sent = 0;
+
   for (;;)
   {
     PacketStruct transmitBuffer;
-    if (request_q_handle != nullptr)
+    if (mysettings.replydrivenpacing)
     {
-      if (xQueueReceive(request_q_handle, &transmitBuffer, portMAX_DELAY) == pdPASS)
+      wait_for_window(last_sent);
+    }
+
+    // Highest priority request waiting
+    if (prg.nextRequest(&transmitBuffer, portMAX_DELAY))
+    {
+
+      sequence++;
+      transmitBuffer.sequence = sequence;
+
+      if (transmitBuffer.command == COMMAND::Timing)
       {
+        // Timestamp at the last possible moment
+        auto t = millis();
+        transmitBuffer.moduledata[0] = (t & 0xFFFF0000) >> 16;
+        transmitBuffer.moduledata[1] = t & (uint32_t)0x0000FFFF;
+      }
 
-        sequence++;
-        transmitBuffer.sequence = sequence;
+      transmitBuffer.crc = CRC16::CalculateArray((uint8_t *)&transmitBuffer, sizeof(PacketStruct) - 2);
+      myPacketSerial.sendBuffer((byte *)&transmitBuffer);
 
-        if (transmitBuffer.command == COMMAND::Timing)
-        {
-          // Timestamp at the last possible moment
-          auto t = millis();
-          transmitBuffer.moduledata[0] = (t & 0xFFFF0000) >> 16;
-          transmitBuffer.moduledata[1] = t & (uint32_t)0x0000FFFF;
-        }
+      last_sent = esp_timer_get_time();
+      receiveProc.RequestSent(sequence, mysettings.replydrivenpacing ? mysettings.packetwindow : 0);
 
-        transmitBuffer.crc = CRC16::CalculateArray((uint8_t *)&transmitBuffer, sizeof(PacketStruct) - 2);
-        myPacketSerial.sendBuffer((byte *)&transmitBuffer);
+      // Output the packet we just transmitted to debug console
+      // #if defined(PACKET_LOGGING_SEND)
+      //      dumpPacketToDebug('S', &transmitBuffer);
+      // #endif
+    }
 
-        // Output the packet we just transmitted to debug console
-        // #if defined(PACKET_LOGGING_SEND)
-        //      dumpPacketToDebug('S', &transmitBuffer);
-        // #endif
-      }
+    if (!mysettings.replydrivenpacing)
+    {
+      receiveProc.ExpireRequests();
 
       // Delay based on comms speed, ensure the first module has time to process and clear the request
       // before sending another packet
-      uint16_t delay_ms = 900;
-
-      if (mysettings.baudRate == 10000)
-      {
-        delay_ms = 350;
-      }
-      else if (mysettings.baudRate == 9600)
-      {
-        delay_ms = 450;
-      }
-      else if (mysettings.baudRate == 5000)
-      {
-        delay_ms = 700;
-      }
-
-      // Delay whilst cell module processes request
-      vTaskDelay(pdMS_TO_TICKS(delay_ms));
+      vTaskDelay(pdMS_TO_TICKS(PacketPacing::LegacyDelay(mysettings.baudRate)));
     }
   }
 }
@@ -1158,7 +1285,6 @@ void onPacketReceived()
 // are only processed once every module has returned at least 1 reading/communication
 void ProcessRules()
 {
-  rules.ClearValues();
   rules.ClearWarnings();
   rules.ClearErrors();
 
@@ -1200,16 +1326,22 @@ void ProcessRules()
     }
   }
 
-  rules.highestBankRange = 0;
   rules.numberOfBalancingModules = 0;
+
+  // Use one consistent set of readings, cellReadings may be part way through the next sweep
+  auto view = cellSnapshot.Acquire();
+  rules.snapshotEpoch = view.epoch;
+  rules.snapshotPublished = view.published;
+
+  // Only banks with new readings are scanned again
+  rules.UpdateCellValues(view.cells, mysettings.totalNumberOfBanks, mysettings.totalNumberOfSeriesModules, mysettings.cellmaxmv);
+
   uint8_t cellid = 0;
   for (uint8_t bank = 0; bank < mysettings.totalNumberOfBanks; bank++)
   {
     for (uint8_t i = 0; i < mysettings.totalNumberOfSeriesModules; i++)
     {
-      rules.ProcessCell(bank, cellid, &cmi[cellid], mysettings.cellmaxmv);
-
-      if (cmi[cellid].valid && cmi[cellid].settingsCached)
+      if (view.cells->valid[cellid] && cmi[cellid].settingsCached)
       {
 
         if (cmi[cellid].BypassThresholdmV != mysettings.BypassThresholdmV)
@@ -1222,7 +1354,7 @@ void ProcessRules()
           rules.SetWarning(InternalWarningCode::ModuleInconsistantBypassTemperature);
         }
 
-        if (cmi[cellid].inBypass)
+        if (view.cells->inBypass[cellid])
         {
           rules.numberOfBalancingModules++;
         }
@@ -1242,12 +1374,11 @@ void ProcessRules()
 
       cellid++;
     }
-    rules.ProcessBank(bank);
   }
 
   rules.CalculateChargingMode(&mysettings, &currentMonitor);
   // Need to call these even if Dynamic is switched off, as it seeds the internal variables with the correct values
-  rules.CalculateDynamicChargeVoltage(&mysettings, cmi);
+  rules.CalculateDynamicChargeVoltage(&mysettings, view.cells);
   rules.CalculateDynamicChargeCurrent(&mysettings);
 
   if (mysettings.loggingEnabled && !_sd_card_installed && !_avrsettings.programmingModeEnabled)
@@ -1327,103 +1458,87 @@ void ProcessRules()
 
 void pulse_relay_off(const TimerHandle_t)
 {
+  // Timer callbacks must not block, try again shortly if the relays are being changed
+  if (xSemaphoreTake(relayMutex, 0) != pdTRUE)
+  {
+    xTimerStart(pulse_relay_off_timer, 0);
+    return;
+  }
+
+  RelayState outputs[RELAY_TOTAL];
   for (int8_t y = 0; y < RELAY_TOTAL; y++)
   {
+    outputs[y] = hal.GetOutputState(y);
     if (previousRelayPulse[y])
     {
       // We now need to rapidly turn off the relay after a fixed period of time (pulse mode)
       // However we leave the relay and previousRelayState looking like the relay has triggered (it has!)
       // to prevent multiple pulses being sent on each rule refresh
-      hal.SetOutputState(y, RelayState::RELAY_OFF);
+      outputs[y] = RelayState::RELAY_OFF;
 
       previousRelayPulse[y] = false;
     }
   }
+  hal.SetOutputStates(outputs);
+  xSemaphoreGive(relayMutex);
 
   // Fire task to record state of outputs to SD Card
   xTaskNotify(sdcardlog_outputs_task_handle, 0x00, eNotifyAction::eNoAction);
 }
 
+// Time from a snapshot of the cell readings being published to the relays reflecting it
+LatencyHistogram snapshotToRelay;
+portMUX_TYPE snapshotToRelayLock = portMUX_INITIALIZER_UNLOCKED;
+
 [[noreturn]] void rules_task(void *)
 {
+  uint32_t lastEpoch = 0;
+
   for (;;)
   {
-    // 3 seconds
-    vTaskDelay(pdMS_TO_TICKS(3000));
+    // Woken by voltageandstatussnapshot_task as each new snapshot is published, or after
+    // 3 seconds so timers, comms timeouts and current monitor rules still run without one
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(3000));
 
     // Run the rules
     ProcessRules();
 
-    RelayState relay[RELAY_TOTAL];
-
-    // Set defaults based on configuration
-    for (int8_t y = 0; y < RELAY_TOTAL; y++)
+    xSemaphoreTake(relayMutex, portMAX_DELAY);
+    voltageGuard.armed = (_controller_state == ControllerState::Running && rules.invalidModuleCount == 0 && rules.zeroVoltageModuleCount == 0);
+    voltageGuard.Release(&rules);
+    for (uint8_t n = 0; n < RELAY_RULES; n++)
     {
-      relay[y] = mysettings.rulerelaydefault[y] == RELAY_ON ? RELAY_ON : RELAY_OFF;
+      relayRuleOutcome[n] = rules.ruleOutcome((Rule)n);
     }
+    uint8_t changes = SetRelays();
+    xSemaphoreGive(relayMutex);
 
-    // Test the rules (in reverse order)
-    for (int8_t n = RELAY_RULES - 1; n >= 0; n--)
+    if (rules.snapshotEpoch != lastEpoch)
     {
-      if (rules.ruleOutcome((Rule)n) == true)
-      {
-        for (int8_t y = 0; y < RELAY_TOTAL; y++)
-        {
-          // Dont change relay if its set to ignore/X
-          if (mysettings.rulerelaystate[n][y] != RELAY_X)
-          {
-            if (mysettings.rulerelaystate[n][y] == RELAY_ON)
-            {
-              relay[y] = RELAY_ON;
-            }
-            else
-            {
-              relay[y] = RELAY_OFF;
-            }
-          }
-        }
-      }
-    }
+      lastEpoch = rules.snapshotEpoch;
+      auto latency_us = (uint32_t)(esp_timer_get_time() - rules.snapshotPublished);
+      portENTER_CRITICAL(&snapshotToRelayLock);
+      snapshotToRelay.Add(latency_us);
+      portEXIT_CRITICAL(&snapshotToRelayLock);
 
-    uint8_t changes = 0;
-    bool firePulse = false;
-    for (int8_t n = 0; n < RELAY_TOTAL; n++)
-    {
-      if (previousRelayState[n] != relay[n])
+      // History from every snapshot with all modules, once SNTP has set the clock
+      time_t now;
+      time(&now);
+      struct tm timeinfo;
+      localtime_r(&now, &timeinfo);
+      if (timeinfo.tm_year > 70 && rules.invalidModuleCount == 0 && rules.zeroVoltageModuleCount == 0)
       {
-        ESP_LOGI(TAG, "Set relay %i=%i", n, relay[n] == RelayState::RELAY_ON ? 1 : 0);
-        changes++;
-
-        // This would be better if we worked out the bit pattern first and then just submitted that as a single i2c read/write transaction
-        hal.SetOutputState(n, relay[n]);
-
-        // Record the previous state of the relay, to use on the next loop to prevent chatter
-        previousRelayState[n] = relay[n];
-
-        if (mysettings.relaytype[n] == RELAY_PULSE)
-        {
-          previousRelayPulse[n] = true;
-          firePulse = true;
-          ESP_LOGI(TAG, "Relay %i PULSED", n);
-        }
+        history.Add(now, &rules, &currentMonitor);
       }
-    }
 
-    if (firePulse)
-    {
-      // Fire timer to switch off relay in a few ms
-      if (xTimerStart(pulse_relay_off_timer, 10) != pdPASS)
+      // Every module, including those which missed this snapshot
+      if (timeinfo.tm_year > 70)
       {
-        ESP_LOGE(TAG, "Pulse timer start error");
+        auto view = cellSnapshot.Acquire();
+        cellHistory.Add((uint32_t)now, view.cells, TotalNumberOfCells());
       }
     }
 
-    if (changes)
-    {
-      // Fire task to record state of outputs to SD Card
-      xTaskNotify(sdcardlog_outputs_task_handle, 0x00, eNotifyAction::eNoAction);
-    }
-
     if (changes || rules.anyRuleTriggered())
     {
       // A rule is TRUE or relay state has changed, so MQTT report it...
@@ -1458,7 +1573,7 @@ void pulse_relay_off(const TimerHandle_t)
       uint8_t endmodule = (startmodule + maximum_cell_modules_per_packet) - 1;
 
       // Limit to number of modules we have configured
-      if (endmodule > max)
+      if (endmodule >= max)
       {
         endmodule = max - 1;
       }
@@ -1471,7 +1586,7 @@ void pulse_relay_off(const TimerHandle_t)
       // If any module is in bypass then request PWM reading for whole bank
       for (uint8_t m = startmodule; m <= endmodule; m++)
       {
-        if (cmi[m].inBypass)
+        if (cellReadings.inBypass[m])
         {
           prg.sendReadBalancePowerRequest(startmodule, endmodule);
           // We only need 1 reading for whole bank
@@ -3233,7 +3348,6 @@ void CalculateStateOfHealth(diybms_eeprom_settings *settings)
 [[noreturn]] void lazy_tasks(void *)
 {
   int year_day = -1;
-  time_t snapshot_time = 0;
 
   for (;;)
   {
@@ -3281,26 +3395,12 @@ void CalculateStateOfHealth(diybms_eeprom_settings *settings)
           }
         }
         year_day = timeinfo.tm_yday;
-
-        // Has clock rolled over for snaps?
-        if (snapshot_time != 0 && now > snapshot_time)
-        {
-          char strftime_buf[64];
-          strftime(strftime_buf, sizeof(strftime_buf), "%c", &timeinfo);
-          ESP_LOGI(TAG, "Snap timer: %s", strftime_buf);
-
-          history.SnapshotHistory(now, &rules, &currentMonitor);
-          snapshot_time = 0;
-        }
-
-        if (snapshot_time == 0)
-        {
-          // Calculate the next time to do a snapshot in 30 minutes
-          snapshot_time = (now - (now % 1800)) + 1800;
-        }
       }
     }
 
+    // Keep the 5 and 30 minute history over a restart
+    history.Checkpoint();
+
     // Sleep between sections to give the ESP a chance to do other stuff
     vTaskDelay(delay_ticks);
 
@@ -3309,7 +3409,7 @@ void CalculateStateOfHealth(diybms_eeprom_settings *settings)
     //  Find modules that don't have settings cached and request them
     for (uint8_t m = 0; m < TotalNumberOfCells(); m++)
     {
-      if (cmi[m].valid)
+      if (cellReadings.valid[m])
       {
         if (cmi[m].settingsCached == false)
         {
@@ -3342,7 +3442,7 @@ void CalculateStateOfHealth(diybms_eeprom_settings *settings)
       uint8_t endmodule = (startmodule + maximum_cell_modules_per_packet) - 1;
 
       // Limit to number of modules we have configured
-      if (endmodule > max)
+      if (endmodule >= max)
       {
         endmodule = max - 1;
       }
@@ -3865,18 +3965,26 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
 
   // Pre configure the array
   memset(&cmi, 0, sizeof(cmi));
+  memset(&cellReadings, 0, sizeof(cellReadings));
   for (uint8_t i = 0; i < maximum_controller_cell_modules; i++)
   {
     clearModuleValues(i);
   }
 
   history.Clear();
+  history.Restore(LittleFS);
+  cellLog.Begin();
+  currentLog.Begin();
+  outputLog.Begin();
 
   rules.resetAllRules();
 
   LoadConfiguration(&mysettings);
   ValidateConfiguration(&mysettings);
 
+  // Sized from the number of modules
+  cellHistory.Begin(TotalNumberOfCells());
+
   if (strlen(mysettings.homeassist_apikey) == 0)
   {
     // Generate new key
@@ -3956,12 +4064,9 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
   rs485_transmit_q_handle = xQueueCreate(3, MAX_SEND_RS485_PACKET_LENGTH);
   assert(rs485_transmit_q_handle);
 
-  request_q_handle = xQueueCreate(30, sizeof(PacketStruct));
-  assert(request_q_handle);
-  prg.setQueueHandle(request_q_handle);
+  prg.begin();
 
-  reply_q_handle = xQueueCreate(4, sizeof(PacketStruct));
-  assert(reply_q_handle);
+  replyRing.begin();
 
   led_off_timer = xTimerCreate("LEDOFF", pdMS_TO_TICKS(100), pdFALSE, (void *)1, &ledoff);
   assert(led_off_timer);
@@ -3969,6 +4074,9 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
   pulse_relay_off_timer = xTimerCreate("PULSE", pdMS_TO_TICKS(250), pdFALSE, (void *)2, &pulse_relay_off);
   assert(pulse_relay_off_timer);
 
+  relayMutex = xSemaphoreCreateMutex();
+  assert(relayMutex);
+
   tftwake_timer = xTimerCreate("TFTWAKE", pdMS_TO_TICKS(50), pdFALSE, (void *)3, &tftwakeup);
   assert(tftwake_timer);
 
@@ -3991,15 +4099,15 @@ ESP32 Chip model = %u, Rev %u, Cores=%u, Features=%u)",
   xTaskCreate(mppt_can_task, "MPPT", 2500, nullptr, 1, &mppt_can_task_handle);
   xTaskCreate(transmit_task, "Tx", 1950, nullptr, configMAX_PRIORITIES - 3, &transmit_task_handle);
   xTaskCreate(replyqueue_task, "rxq", 4096, nullptr, configMAX_PRIORITIES - 2, &replyqueue_task_handle);
-  xTaskCreate(lazy_tasks, "lazyt", 2500, nullptr, 0, &lazy_task_handle);
+  // Larger stack for the LittleFS writes in history.Checkpoint()
+  xTaskCreate(lazy_tasks, "lazyt", 3500, nullptr, 0, &lazy_task_handle);
 
   // Set relay defaults
   for (auto y = 0; y < RELAY_TOTAL; y++)
   {
     previousRelayState[y] = mysettings.rulerelaydefault[y];
-    // Set relay defaults
-    hal.SetOutputState(y, mysettings.rulerelaydefault[y]);
   }
+  hal.SetOutputStates(mysettings.rulerelaydefault);
   // Fire task to record state of outputs to SD Card
   xTaskNotify(sdcardlog_outputs_task_handle, 0x00, eNotifyAction::eNoAction);
 
@@ -4147,11 +4255,221 @@ esp_err_t diagnosticJSON(httpd_req_t *req, char buffer[], int bufferLenMax)
   diag["HeapSize"] = ESP.getHeapSize();
   diag["SdkVersion"] = ESP.getSdkVersion();
 
+  JsonObject pace = diag["pacing"].to<JsonObject>();
+  pace["replydriven"] = mysettings.replydrivenpacing;
+  pace["window"] = mysettings.packetwindow;
+  pace["outstanding"] = receiveProc.OutstandingRequests();
+  pace["srtt"] = receiveProc.SmoothedRoundTrip();
+  pace["timeout"] = receiveProc.ReplyTimeout();
+  pace["lost"] = receiveProc.LostRequests();
+  pace["unmatched"] = receiveProc.UnmatchedReplies();
+
+  // Loss and latency (ms) for each window size used since the counters were reset, window 0 is fixed pacing
+  auto windows = pace["windows"].to<JsonArray>();
+  for (uint8_t w = 0; w <= PacketPacing::maximumWindow; w++)
+  {
+    auto stats = receiveProc.GetWindowStatistics(w);
+    if (stats.requests > 0)
+    {
+      JsonObject nested = windows.add<JsonObject>();
+      nested["w"] = w;
+      nested["req"] = stats.requests;
+      nested["lost"] = stats.lost;
+      nested["min"] = stats.latencyMinimum_us / 1000;
+      nested["avg"] = stats.replies == 0 ? 0 : (uint32_t)(stats.latencyTotal_us / stats.replies / 1000);
+      nested["max"] = stats.latencyMaximum_us / 1000;
+    }
+  }
+
+  // Round trip (ms) of replies to each command type since the counters were reset
+  auto commands = diag["commands"].to<JsonArray>();
+  for (uint8_t c = 0; c < 16; c++)
+  {
+    auto latency = receiveProc.CommandLatency(c);
+    if (latency.count > 0)
+    {
+      JsonObject nested = commands.add<JsonObject>();
+      nested["cmd"] = c;
+      nested["n"] = latency.count;
+      nested["min"] = latency.minimum_us / 1000;
+      nested["p50"] = latency.p50_us / 1000;
+      nested["p99"] = latency.p99_us / 1000;
+      nested["max"] = latency.maximum_us / 1000;
+    }
+  }
+
+  // Links of the ring with errors, link 0 is controller to first module, the last is back to the controller.
+  // Only the worst (most errors) are listed, "linkerrors" is how many links have any.
+  struct WorstLink
+  {
+    uint8_t link;
+    PacketReceiveProcessor::LinkErrors errors;
+  };
+  const uint8_t maximumLinks = 16;
+  WorstLink worst[maximumLinks];
+  uint8_t worstCount = 0;
+  uint16_t linksWithErrors = 0;
+  const uint8_t modules = TotalNumberOfCells();
+  for (uint16_t l = 0; l <= modules; l++)
+  {
+    auto errors = receiveProc.GetLinkErrors((uint8_t)l, modules);
+    const uint32_t total = errors.crc + errors.notProcessed;
+    if (total == 0)
+    {
+      continue;
+    }
+    linksWithErrors++;
+
+    // Insertion sort, most errors first
+    uint8_t i = worstCount < maximumLinks ? worstCount++ : maximumLinks;
+    while (i > 0 && worst[i - 1].errors.crc + worst[i - 1].errors.notProcessed < total)
+    {
+      if (i < maximumLinks)
+      {
+        worst[i] = worst[i - 1];
+      }
+      i--;
+    }
+    if (i < maximumLinks)
+    {
+      worst[i] = WorstLink{(uint8_t)l, errors};
+    }
+  }
+  diag["linkerrors"] = linksWithErrors;
+  auto links = diag["links"].to<JsonArray>();
+  for (uint8_t i = 0; i < worstCount; i++)
+  {
+    JsonObject nested = links.add<JsonObject>();
+    nested["link"] = worst[i].link;
+    nested["crc"] = worst[i].errors.crc;
+    nested["np"] = worst[i].errors.notProcessed;
+  }
+
+  // Rules, banks scanned/skipped because their readings had not changed, snapshot to relay output time (ms)
+  JsonObject rl = diag["rules"].to<JsonObject>();
+  rl["epoch"] = rules.snapshotEpoch;
+  rl["scanned"] = rules.banksScanned;
+  rl["skipped"] = rules.banksSkipped;
+  portENTER_CRITICAL(&snapshotToRelayLock);
+  auto latency = snapshotToRelay.Summarise();
+  portEXIT_CRITICAL(&snapshotToRelayLock);
+  rl["n"] = latency.count;
+  rl["min"] = latency.minimum_us / 1000.0F;
+  rl["p50"] = latency.p50_us / 1000.0F;
+  rl["p99"] = latency.p99_us / 1000.0F;
+  rl["max"] = latency.maximum_us / 1000.0F;
+
+  // Voltage guard fast path, reply to relay output and reply to Rules reporting the same rule (ms)
+  JsonObject vg = diag["guard"].to<JsonObject>();
+  xSemaphoreTake(relayMutex, portMAX_DELAY);
+  auto fast = voltageGuard.fastReaction.Summarise();
+  auto slow = voltageGuard.rulesReaction.Summarise();
+  vg["armed"] = voltageGuard.armed;
+  vg["trips"] = voltageGuard.trips;
+  vg["unconfirmed"] = voltageGuard.unconfirmed;
+  xSemaphoreGive(relayMutex);
+  JsonObject vgfast = vg["fast"].to<JsonObject>();
+  vgfast["n"] = fast.count;
+  vgfast["p50"] = fast.p50_us / 1000.0F;
+  vgfast["p99"] = fast.p99_us / 1000.0F;
+  vgfast["max"] = fast.maximum_us / 1000.0F;
+  JsonObject vgrules = vg["rules"].to<JsonObject>();
+  vgrules["n"] = slow.count;
+  vgrules["p50"] = slow.p50_us / 1000.0F;
+  vgrules["p99"] = slow.p99_us / 1000.0F;
+  vgrules["max"] = slow.maximum_us / 1000.0F;
+
+  // History store, records and bytes used at each resolution
+  auto hist = diag["history"].to<JsonArray>();
+  for (uint8_t i = 0; i < History::NumberOfTiers; i++)
+  {
+    auto stats = history.Statistics(i);
+    JsonObject tier = hist.add<JsonObject>();
+    tier["res"] = stats.resolution;
+    tier["records"] = stats.records;
+    tier["bytes"] = stats.bytes;
+    tier["capacity"] = stats.capacity;
+  }
+  // History file, time to restore it at power up and blocks still to be read in
+  JsonObject histfile = diag["historyfile"].to<JsonObject>();
+  histfile["restore_us"] = history.restore_us;
+  histfile["restored"] = history.restoredBlocks;
+  histfile["pending"] = history.pendingBlocks;
+  histfile["written"] = history.chunksWritten;
+  histfile["errors"] = history.fileErrors;
+
+  // Module history, bits per module sample, the oldest sample held and the time every module has
+  // samples from, which is what the history really covers for a large pack
+  JsonObject ch = diag["cellhistory"].to<JsonObject>();
+  ch["snapshots"] = cellHistory.snapshots;
+  ch["bits"] = cellHistory.cellSamples == 0 ? 0 : (float)cellHistory.cellBits / cellHistory.cellSamples;
+  ch["encodeus"] = cellHistory.snapshots == 0 ? 0 : (uint32_t)(cellHistory.encode_us / cellHistory.snapshots);
+  ch["pool"] = cellHistory.PoolSize();
+  ch["chunk"] = cellHistory.ChunkSize();
+  ch["oldest"] = cellHistory.OldestTime();
+  ch["complete"] = cellHistory.CompleteTime();
+
+  // SD card logs, writes and how long each held the VSPI mutex
+  auto sdlogs = diag["sdlog"].to<JsonArray>();
+  for (const SdLog *sdlog : {&cellLog, &currentLog, &outputLog})
+  {
+    JsonObject l = sdlogs.add<JsonObject>();
+    l["opens"] = sdlog->opens;
+    l["writes"] = sdlog->writes;
+    l["flushes"] = sdlog->flushes;
+    l["bytes"] = sdlog->bytesWritten;
+    l["dropped"] = sdlog->bytesDropped;
+    l["locks"] = sdlog->busLocks;
+    l["holdus"] = sdlog->busLocks == 0 ? 0 : (uint32_t)(sdlog->busHold_us / sdlog->busLocks);
+    l["maxholdus"] = sdlog->busHoldMax_us;
+  }
+
+  // Replies from the modules, average CPU cycles per reply in the loop task and replyqueue_task
+  JsonObject rx = diag["replies"].to<JsonObject>();
+  rx["slots"] = ReplyRing::numberOfSlots;
+  rx["full"] = replyRing.full;
+  rx["packets"] = replyRing.packets;
+  rx["decodecyc"] = replyRing.packets == 0 ? 0 : (uint32_t)(replyRing.decodeCycles / replyRing.packets);
+  rx["processcyc"] = replyRing.packets == 0 ? 0 : (uint32_t)(replyRing.processCycles / replyRing.packets);
+
   ESPCoreDumpToJSON(diag);
 
-  int bufferused = 0;
-  bufferused += serializeJson(doc, buffer, bufferLenMax);
-  return httpd_resp_send(req, buffer, bufferused);
+  // The whole document is larger than the buffer, so it is sent a section at a time
+  int bufferused = snprintf(buffer, bufferLenMax, "{\"diagnostic\":{");
+  bool first = true;
+  for (JsonPair section : diag)
+  {
+    // Quotes, colon, comma and the trailing null
+    const int needed = (int)(measureJson(section.value()) + strlen(section.key().c_str()) + 5);
+    if (bufferused > 0 && bufferused + needed > bufferLenMax - 2)
+    {
+      if (httpd_resp_send_chunk(req, buffer, bufferused) != ESP_OK)
+      {
+        return ESP_FAIL;
+      }
+      bufferused = 0;
+    }
+
+    bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "%s\"%s\":", first ? "" : ",", section.key().c_str());
+    if (needed > bufferLenMax - 2)
+    {
+      ESP_LOGE(TAG, "Diagnostic %s too large (%i)", section.key().c_str(), needed);
+      bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "null");
+    }
+    else
+    {
+      bufferused += serializeJson(section.value(), &buffer[bufferused], bufferLenMax - bufferused);
+    }
+    first = false;
+  }
+  bufferused += snprintf(&buffer[bufferused], bufferLenMax - bufferused, "}}");
+
+  if (httpd_resp_send_chunk(req, buffer, bufferused) != ESP_OK)
+  {
+    return ESP_FAIL;
+  }
+  // Indicate last chunk (zero byte length)
+  return httpd_resp_send_chunk(req, buffer, 0);
 }
 
 unsigned long wifitimer = 0;
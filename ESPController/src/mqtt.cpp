@@ -215,10 +215,14 @@ void GeneralStatusPayload(const PacketRequestGenerator *prg, const PacketReceive
         .append(std::to_string(mysettings.totalNumberOfSeriesModules))
         .append(",\"uptime\":")
         .append(std::to_string(uptime_in_seconds()))
+        .append(",\"epoch\":")
+        .append(std::to_string(cellSnapshot.Epoch()))
         .append(",\"commserr\":")
         .append(std::to_string(receiveProc->HasCommsTimedOut() ? 1 : 0))
         .append(",\"sent\":")
         .append(std::to_string(prg->packetsGenerated))
+        .append(",\"coalesced\":")
+        .append(std::to_string(prg->packetsCoalesced))
         .append(",\"received\":")
         .append(std::to_string(receiveProc->packetsReceived))
         .append(",\"badcrc\":")
@@ -254,6 +258,71 @@ void GeneralStatusPayload(const PacketRequestGenerator *prg, const PacketReceive
     publish_message(topic, status);
 }
 
+// Round trip (ms) per command and errors per link of the module ring, only entries with data are sent
+void CommsDiagnostics(const PacketReceiveProcessor *receiveProc)
+{
+    ESP_LOGI(TAG, "Comms diagnostics payload");
+    std::string status;
+    status.reserve(256);
+    status.append("{\"cmd\":{");
+    bool first = true;
+    for (uint8_t c = 0; c < 16; c++)
+    {
+        auto latency = receiveProc->CommandLatency(c);
+        if (latency.count == 0)
+        {
+            continue;
+        }
+        if (!first)
+        {
+            status.append(",");
+        }
+        first = false;
+        status.append("\"")
+            .append(std::to_string(c))
+            .append("\":{\"n\":")
+            .append(std::to_string(latency.count))
+            .append(",\"min\":")
+            .append(std::to_string(latency.minimum_us / 1000))
+            .append(",\"p50\":")
+            .append(std::to_string(latency.p50_us / 1000))
+            .append(",\"p99\":")
+            .append(std::to_string(latency.p99_us / 1000))
+            .append(",\"max\":")
+            .append(std::to_string(latency.maximum_us / 1000))
+            .append("}");
+    }
+
+    status.append("},\"links\":{");
+    first = true;
+    const uint8_t modules = TotalNumberOfCells();
+    for (uint16_t l = 0; l <= modules; l++)
+    {
+        auto errors = receiveProc->GetLinkErrors((uint8_t)l, modules);
+        if (errors.crc == 0 && errors.notProcessed == 0)
+        {
+            continue;
+        }
+        if (!first)
+        {
+            status.append(",");
+        }
+        first = false;
+        status.append("\"")
+            .append(std::to_string(l))
+            .append("\":{\"crc\":")
+            .append(std::to_string(errors.crc))
+            .append(",\"np\":")
+            .append(std::to_string(errors.notProcessed))
+            .append("}");
+    }
+    status.append("}}");
+
+    std::string topic = mysettings.mqtt_topic;
+    topic.append("/comms");
+    publish_message(topic, status);
+}
+
 void BankLevelInformation(const Rules *rules)
 {
     std::string bank_status;
@@ -368,25 +437,34 @@ void MQTTCellData()
     std::string status;
     status.reserve(128);
 
+    auto view = cellSnapshot.Acquire();
+
     while (i < TotalNumberOfCells() && counter < MAX_MODULES_PER_ITERATION)
     {
         // Only send valid module data
-        if (cmi[i].valid)
+        if (view.cells->valid[i])
         {
 
             uint8_t bank = i / mysettings.totalNumberOfSeriesModules;
             uint8_t m = i - (bank * mysettings.totalNumberOfSeriesModules);
 
             status.clear();
-            status.append("{\"voltage\":").append(float_to_string(cmi[i].voltagemV / 1000.0f)).append(",\"exttemp\":").append(std::to_string(cmi[i].externalTemp));
+            status.append("{\"voltage\":").append(float_to_string(view.cells->voltagemV[i] / 1000.0f)).append(",\"exttemp\":").append(std::to_string(view.cells->externalTemp[i]));
 
             if (mysettings.mqtt_basic_cell_reporting == false)
             {
-                status.append(",\"vMax\":").append(float_to_string(cmi[i].voltagemVMax / 1000.0f)).append(",\"vMin\":").append(float_to_string(cmi[i].voltagemVMin / 1000.0f)).append(",\"inttemp\":").append(std::to_string(cmi[i].internalTemp)).append(",\"bypass\":").append(std::to_string(cmi[i].inBypass ? 1 : 0)).append(",\"PWM\":").append(std::to_string((int)((float)cmi[i].PWMValue / (float)255.0 * 100))).append(",\"bypassT\":").append(std::to_string(cmi[i].bypassOverTemp ? 1 : 0)).append(",\"bpc\":").append(std::to_string(cmi[i].badPacketCount)).append(",\"mAh\":").append(std::to_string(cmi[i].BalanceCurrentCount));
+                status.append(",\"vMax\":").append(float_to_string(view.cells->voltagemVMax[i] / 1000.0f)).append(",\"vMin\":").append(float_to_string(view.cells->voltagemVMin[i] / 1000.0f)).append(",\"inttemp\":").append(std::to_string(view.cells->internalTemp[i])).append(",\"bypass\":").append(std::to_string(view.cells->inBypass[i] ? 1 : 0)).append(",\"PWM\":").append(std::to_string((int)((float)view.cells->PWMValue[i] / (float)255.0 * 100))).append(",\"bypassT\":").append(std::to_string(view.cells->bypassOverTemp[i] ? 1 : 0)).append(",\"bpc\":").append(std::to_string(cmi[i].badPacketCount)).append(",\"mAh\":").append(std::to_string(cmi[i].BalanceCurrentCount));
             }
 
             status.append("}");
 
+            if (!cellSnapshot.StillValid(view))
+            {
+                // The buffer was reused whilst the last message was published, build this one again from the latest
+                view = cellSnapshot.Acquire();
+                continue;
+            }
+
             std::string topic = mysettings.mqtt_topic;
             topic.append("/").append(std::to_string(bank)).append("/").append(std::to_string(m));
             publish_message(topic, status);
@@ -432,6 +510,7 @@ void mqtt2(const PacketReceiveProcessor *receiveProc,
     }
 
     GeneralStatusPayload(prg, receiveProc, requestq_count, rules);
+    CommsDiagnostics(receiveProc);
     BankLevelInformation(rules);
 }
 
@@ -2,6 +2,7 @@
 static constexpr const char *const TAG = "diybms-set";
 
 #include "settings.h"
+#include "PacketPacing.h"
 
 /*
 THESE STRINGS ARE USED AS KEYS IN THE JSON SETTINGS BACKUP FILES
@@ -11,6 +12,8 @@ static const char totalNumberOfBanks_JSONKEY[] = "totalNumberOfBanks";
 static const char totalNumberOfSeriesModules_JSONKEY[] = "totalNumberOfSeriesModules";
 static const char baudRate_JSONKEY[] = "baudRate";
 static const char interpacketgap_JSONKEY[] = "interpacketgap";
+static const char replydrivenpacing_JSONKEY[] = "replydrivenpacing";
+static const char packetwindow_JSONKEY[] = "packetwindow";
 static const char graph_voltagehigh_JSONKEY[] = "graph_voltagehigh";
 static const char graph_voltagelow_JSONKEY[] = "graph_voltagelow";
 static const char BypassOverTempShutdown_JSONKEY[] = "BypassOverTempShutdown";
@@ -21,6 +24,7 @@ static const char daylight_JSONKEY[] = "daylight";
 static const char ntpServer_JSONKEY[] = "ntpServer";
 static const char loggingEnabled_JSONKEY[] = "loggingEnabled";
 static const char loggingFrequencySeconds_JSONKEY[] = "loggingFrequencySeconds";
+static const char loggingBinary_JSONKEY[] = "loggingBinary";
 static const char currentMonitoringEnabled_JSONKEY[] = "currentMonitoringEnabled";
 static const char currentMonitoringModBusAddress_JSONKEY[] = "currentMonitoringModBusAddress";
 static const char rs485baudrate_JSONKEY[] = "rs485baudrate";
@@ -117,6 +121,8 @@ static const char totalNumberOfBanks_NVSKEY[] = "totalBanks";
 static const char totalNumberOfSeriesModules_NVSKEY[] = "totalSeriesMod";
 static const char baudRate_NVSKEY[] = "baudRate";
 static const char interpacketgap_NVSKEY[] = "interpacketgap";
+static const char replydrivenpacing_NVSKEY[] = "replypacing";
+static const char packetwindow_NVSKEY[] = "packetwindow";
 static const char rulevalue_NVSKEY[] = "rulevalue";
 static const char rulehysteresis_NVSKEY[] = "rulehysteresis";
 static const char rulerelaystate_NVSKEY[] = "rulerelaystate";
@@ -131,6 +137,7 @@ static const char minutesTimeZone_NVSKEY[] = "minutesTZ";
 static const char daylight_NVSKEY[] = "daylight";
 static const char loggingEnabled_NVSKEY[] = "logEnabled";
 static const char loggingFrequencySeconds_NVSKEY[] = "logFreqSec";
+static const char loggingBinary_NVSKEY[] = "logBinary";
 static const char currentMonitoringEnabled_NVSKEY[] = "curMonEnabled";
 static const char currentMonitoringModBusAddress_NVSKEY[] = "curMonMBAddress";
 static const char currentMonitoringDevice_NVSKEY[] = "curMonDevice";
@@ -448,6 +455,8 @@ void SaveConfiguration(const diybms_eeprom_settings *settings)
         MACRO_NVSWRITE(totalNumberOfSeriesModules)
         MACRO_NVSWRITE(baudRate)
         MACRO_NVSWRITE(interpacketgap)
+        MACRO_NVSWRITE(replydrivenpacing)
+        MACRO_NVSWRITE(packetwindow)
 
         MACRO_NVSWRITEBLOB(rulevalue)
         MACRO_NVSWRITEBLOB(rulehysteresis)
@@ -464,6 +473,7 @@ void SaveConfiguration(const diybms_eeprom_settings *settings)
         MACRO_NVSWRITE(daylight)
         MACRO_NVSWRITE(loggingEnabled)
         MACRO_NVSWRITE(loggingFrequencySeconds)
+        MACRO_NVSWRITE(loggingBinary)
 
         MACRO_NVSWRITE(currentMonitoringEnabled)
         MACRO_NVSWRITE(currentMonitoringModBusAddress)
@@ -594,6 +604,8 @@ void LoadConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSREAD(totalNumberOfSeriesModules)
         MACRO_NVSREAD(baudRate)
         MACRO_NVSREAD(interpacketgap)
+        MACRO_NVSREAD(replydrivenpacing)
+        MACRO_NVSREAD(packetwindow)
 
         MACRO_NVSREADBLOB(rulevalue)
         MACRO_NVSREADBLOB(rulehysteresis)
@@ -610,6 +622,7 @@ void LoadConfiguration(diybms_eeprom_settings *settings)
         MACRO_NVSREAD(daylight)
         MACRO_NVSREAD(loggingEnabled)
         MACRO_NVSREAD(loggingFrequencySeconds)
+        MACRO_NVSREAD(loggingBinary)
 
         MACRO_NVSREAD(currentMonitoringEnabled)
         MACRO_NVSREAD(currentMonitoringModBusAddress)
@@ -724,6 +737,8 @@ void DefaultConfiguration(diybms_eeprom_settings *_myset)
     _myset->baudRate = COMMS_BAUD_RATE;
     _myset->BypassOverTempShutdown = 65;
     _myset->interpacketgap = 6000;
+    _myset->replydrivenpacing = false;
+    _myset->packetwindow = 1;
     // 4.10V bypass
     _myset->BypassThresholdmV = 4100;
     _myset->graph_voltagehigh = 4500;
@@ -767,6 +782,7 @@ void DefaultConfiguration(diybms_eeprom_settings *_myset)
 
     _myset->loggingEnabled = false;
     _myset->loggingFrequencySeconds = 15;
+    _myset->loggingBinary = false;
 
     _myset->currentMonitoringEnabled = false;
     _myset->currentMonitoringModBusAddress = 90;
@@ -995,6 +1011,11 @@ void ValidateConfiguration(diybms_eeprom_settings *settings)
         settings->baudRate = defaults.baudRate;
     }
 
+    if (settings->packetwindow == 0 || settings->packetwindow > PacketPacing::maximumWindow)
+    {
+        settings->packetwindow = defaults.packetwindow;
+    }
+
     if (settings->graph_voltagehigh > 5000 || settings->graph_voltagehigh < 2000)
     {
         settings->graph_voltagehigh = defaults.graph_voltagehigh;
@@ -1127,6 +1148,8 @@ void GenerateSettingsJSONDocument(JsonDocument &doc, diybms_eeprom_settings *set
     root[totalNumberOfSeriesModules_JSONKEY] = settings->totalNumberOfSeriesModules;
     root[baudRate_JSONKEY] = settings->baudRate;
     root[interpacketgap_JSONKEY] = settings->interpacketgap;
+    root[replydrivenpacing_JSONKEY] = settings->replydrivenpacing;
+    root[packetwindow_JSONKEY] = settings->packetwindow;
     root[graph_voltagehigh_JSONKEY] = settings->graph_voltagehigh;
     root[graph_voltagelow_JSONKEY] = settings->graph_voltagelow;
     root[BypassOverTempShutdown_JSONKEY] = settings->BypassOverTempShutdown;
@@ -1137,6 +1160,7 @@ void GenerateSettingsJSONDocument(JsonDocument &doc, diybms_eeprom_settings *set
     root[ntpServer_JSONKEY] = settings->ntpServer;
     root[loggingEnabled_JSONKEY] = settings->loggingEnabled;
     root[loggingFrequencySeconds_JSONKEY] = settings->loggingFrequencySeconds;
+    root[loggingBinary_JSONKEY] = settings->loggingBinary;
     root[currentMonitoringEnabled_JSONKEY] = settings->currentMonitoringEnabled;
     root[currentMonitoringModBusAddress_JSONKEY] = settings->currentMonitoringModBusAddress;
 
@@ -1290,6 +1314,8 @@ void JSONToSettings(JsonDocument &doc, diybms_eeprom_settings *settings)
     settings->totalNumberOfSeriesModules = root[totalNumberOfSeriesModules_JSONKEY];
     settings->baudRate = root[baudRate_JSONKEY];
     settings->interpacketgap = root[interpacketgap_JSONKEY];
+    settings->replydrivenpacing = root[replydrivenpacing_JSONKEY];
+    settings->packetwindow = root[packetwindow_JSONKEY];
 
     settings->graph_voltagehigh = root[graph_voltagehigh_JSONKEY];
     settings->graph_voltagelow = root[graph_voltagelow_JSONKEY];
@@ -1304,6 +1330,7 @@ void JSONToSettings(JsonDocument &doc, diybms_eeprom_settings *settings)
 
     settings->loggingEnabled = root[loggingEnabled_JSONKEY];
     settings->loggingFrequencySeconds = root[loggingFrequencySeconds_JSONKEY];
+    settings->loggingBinary = root[loggingBinary_JSONKEY];
 
     settings->currentMonitoringEnabled = root[currentMonitoringEnabled_JSONKEY];
     settings->currentMonitoringModBusAddress = root[currentMonitoringModBusAddress_JSONKEY];
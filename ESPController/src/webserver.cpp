@@ -606,19 +606,19 @@ static const httpd_uri_t uri_homeassist_get = {.uri = "/ha", .method = HTTP_GET,
 
 void resetModuleMinMaxVoltage(uint8_t m)
 {
-  cmi[m].voltagemVMin = 9999;
-  cmi[m].voltagemVMax = 0;
+  cellReadings.voltagemVMin[m] = 9999;
+  cellReadings.voltagemVMax[m] = 0;
 }
 
 void clearModuleValues(uint8_t m)
 {
-  cmi[m].valid = false;
-  cmi[m].voltagemV = 0;
+  cellReadings.valid[m] = false;
+  cellReadings.voltagemV[m] = 0;
   cmi[m].badPacketCount = 0;
-  cmi[m].inBypass = false;
-  cmi[m].bypassOverTemp = false;
-  cmi[m].internalTemp = -40;
-  cmi[m].externalTemp = -40;
+  cellReadings.inBypass[m] = false;
+  cellReadings.bypassOverTemp[m] = false;
+  cellReadings.internalTemp[m] = -40;
+  cellReadings.externalTemp[m] = -40;
 
   cmi[m].FanSwitchOnTemperature = 0;
   cmi[m].RelayMinmV = 0;
@@ -37,6 +37,17 @@ esp_err_t post_savebankconfig_json_handler(httpd_req_t *req, bool urlEncoded)
                         mysettings.totalNumberOfBanks = totalBanks;
                         mysettings.baudRate = baudrate;
                         mysettings.interpacketgap = interpacketgap;
+
+                        // HTML Boolean value, so element is not POST'ed if FALSE/OFF
+                        mysettings.replydrivenpacing = false;
+                        GetKeyValue(httpbuf, "replydrivenpacing", &mysettings.replydrivenpacing, urlEncoded);
+
+                        uint8_t packetwindow;
+                        if (GetKeyValue(httpbuf, "packetwindow", &packetwindow, urlEncoded) && packetwindow > 0 && packetwindow <= PacketPacing::maximumWindow)
+                        {
+                            mysettings.packetwindow = packetwindow;
+                        }
+
                         saveConfiguration();
 
                         return SendSuccess(req);
@@ -123,7 +134,7 @@ esp_err_t post_saveglobalsetting_json_handler(httpd_req_t *req, bool urlEncoded)
 
                 for (uint8_t i = 0; i < totalModules; i++)
                 {
-                    if (cmi[i].valid)
+                    if (cellReadings.valid[i])
                     {
                         cmi[i].BypassThresholdmV = mysettings.BypassThresholdmV;
                         cmi[i].BypassOverTempShutdown = mysettings.BypassOverTempShutdown;
@@ -307,6 +318,9 @@ esp_err_t post_savestorage_json_handler(httpd_req_t *req, bool urlEncoded)
     {
     }
 
+    mysettings.loggingBinary = false;
+    GetKeyValue(httpbuf, "loggingBinary", &mysettings.loggingBinary, urlEncoded);
+
     // Validate
     if (mysettings.loggingFrequencySeconds < 15 || mysettings.loggingFrequencySeconds > 600)
     {
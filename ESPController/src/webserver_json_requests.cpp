@@ -189,9 +189,133 @@ esp_err_t content_handler_diagnostic(httpd_req_t *req)
   return diagnosticJSON(req, httpbuf, BUFSIZE);
 }
 
+// Optional query: res = seconds per record (10, 300 or 1800), from/to = seconds since 1970
+static void historyQuery(httpd_req_t *req, uint32_t &resolution, uint32_t &from, uint32_t &to)
+{
+  resolution = 0;
+  from = 0;
+  to = UINT32_MAX;
+
+  char buf[64];
+  char param[16];
+  size_t buf_len = httpd_req_get_url_query_len(req);
+  if (buf_len > 1 && httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK)
+  {
+    if (httpd_query_key_value(buf, "res", param, sizeof(param)) == ESP_OK)
+    {
+      resolution = strtoul(param, nullptr, 10);
+    }
+    if (httpd_query_key_value(buf, "from", param, sizeof(param)) == ESP_OK)
+    {
+      from = strtoul(param, nullptr, 10);
+    }
+    if (httpd_query_key_value(buf, "to", param, sizeof(param)) == ESP_OK)
+    {
+      to = strtoul(param, nullptr, 10);
+    }
+  }
+}
+
 esp_err_t content_handler_history(httpd_req_t *req)
 {
-  return history.GenerateJSON(req, httpbuf, BUFSIZE);
+  uint32_t resolution, from, to;
+  historyQuery(req, resolution, from, to);
+  return history.GenerateJSON(req, httpbuf, BUFSIZE, resolution, from, to);
+}
+
+// Same query and records as /api/history, see History::GenerateBinary for the layout
+esp_err_t content_handler_historybin(httpd_req_t *req)
+{
+  uint32_t resolution, from, to;
+  historyQuery(req, resolution, from, to);
+  return history.GenerateBinary(req, httpbuf, BUFSIZE, resolution, from, to);
+}
+
+// Query: cell = module number, or bank = every module in that bank, optional from/to = seconds since 1970
+esp_err_t content_handler_cellhistory(httpd_req_t *req)
+{
+  uint8_t firstCell = 0;
+  uint8_t lastCell = 0;
+  uint32_t from = 0;
+  uint32_t to = UINT32_MAX;
+
+  char buf[64];
+  char param[16];
+  bool valid = false;
+  size_t buf_len = httpd_req_get_url_query_len(req);
+  if (buf_len > 1 && httpd_req_get_url_query_str(req, buf, sizeof(buf)) == ESP_OK)
+  {
+    const uint16_t totalModules = mysettings.totalNumberOfBanks * mysettings.totalNumberOfSeriesModules;
+    if (httpd_query_key_value(buf, "cell", param, sizeof(param)) == ESP_OK)
+    {
+      const uint32_t cell = strtoul(param, nullptr, 10);
+      valid = cell < totalModules;
+      firstCell = lastCell = (uint8_t)cell;
+    }
+    else if (httpd_query_key_value(buf, "bank", param, sizeof(param)) == ESP_OK)
+    {
+      const uint32_t bank = strtoul(param, nullptr, 10);
+      valid = bank < mysettings.totalNumberOfBanks;
+      firstCell = (uint8_t)(bank * mysettings.totalNumberOfSeriesModules);
+      lastCell = (uint8_t)(firstCell + mysettings.totalNumberOfSeriesModules - 1);
+    }
+    if (httpd_query_key_value(buf, "from", param, sizeof(param)) == ESP_OK)
+    {
+      from = strtoul(param, nullptr, 10);
+    }
+    if (httpd_query_key_value(buf, "to", param, sizeof(param)) == ESP_OK)
+    {
+      to = strtoul(param, nullptr, 10);
+    }
+  }
+
+  if (!valid)
+  {
+    return httpd_resp_send_err(req, httpd_err_code_t::HTTPD_400_BAD_REQUEST, "Missing or invalid cell/bank");
+  }
+
+  // Each sample is [time,mV,internal temperature,external temperature], mV is null if the module had not replied
+  int bufferused = snprintf(httpbuf, BUFSIZE, "{\"cells\":[");
+  CellHistory::Sample samples[32];
+  for (uint16_t cell = firstCell; cell <= lastCell; cell++)
+  {
+    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s{\"cell\":%u,\"samples\":[", cell == firstCell ? "" : ",", cell);
+
+    bool firstSample = true;
+    uint32_t next = 0;
+    uint16_t count;
+    while ((count = cellHistory.Read((uint8_t)cell, from, to, next, samples, sizeof(samples) / sizeof(samples[0]))) > 0)
+    {
+      for (uint16_t i = 0; i < count; i++)
+      {
+        // Send it...
+        if (bufferused > BUFSIZE - 64)
+        {
+          httpd_resp_send_chunk(req, httpbuf, bufferused);
+          bufferused = 0;
+        }
+
+        const auto &s = samples[i];
+        if (s.voltagemV == 0)
+        {
+          bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s[%u,null,%i,%i]", firstSample ? "" : ",", s.time, s.internalTemp, s.externalTemp);
+        }
+        else
+        {
+          bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%s[%u,%u,%i,%i]", firstSample ? "" : ",", s.time, s.voltagemV, s.internalTemp, s.externalTemp);
+        }
+        firstSample = false;
+      }
+    }
+    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}");
+  }
+  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}");
+
+  //  Send it...
+  httpd_resp_send_chunk(req, httpbuf, bufferused);
+
+  // Indicate last chunk (zero byte length)
+  return httpd_resp_send_chunk(req, httpbuf, 0);
 }
 
 esp_err_t content_handler_storage(httpd_req_t *req)
@@ -232,6 +356,7 @@ esp_err_t content_handler_storage(httpd_req_t *req)
 
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"({"storage":{)");
   bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "logging", mysettings.loggingEnabled);
+  bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "binary", mysettings.loggingBinary);
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("frequency":%u,"sdcard":{)", mysettings.loggingFrequencySeconds);
   bufferused += printBoolean(&httpbuf[bufferused], BUFSIZE - bufferused, "available", available);
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, R"("total":%u,"used":%u,"files":[)", totalkilobytes, usedkilobytes);
@@ -745,6 +870,8 @@ esp_err_t content_handler_settings(httpd_req_t *req)
   settings["totalseriesmodules"] = mysettings.totalNumberOfSeriesModules;
   settings["baudrate"] = mysettings.baudRate;
   settings["interpacketgap"] = mysettings.interpacketgap;
+  settings["replydrivenpacing"] = mysettings.replydrivenpacing;
+  settings["packetwindow"] = mysettings.packetwindow;
 
   settings["bypassthreshold"] = mysettings.BypassThresholdmV;
   settings["bypassovertemp"] = mysettings.BypassOverTempShutdown;
@@ -887,7 +1014,7 @@ esp_err_t content_handler_monitor3(httpd_req_t *req)
 
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    if (cmi[i].valid)
+    if (cellReadings.valid[i])
     {
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].badPacketCount);
     }
@@ -911,7 +1038,7 @@ esp_err_t content_handler_monitor3(httpd_req_t *req)
 
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    if (cmi[i].valid)
+    if (cellReadings.valid[i])
     {
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].BalanceCurrentCount);
     }
@@ -935,7 +1062,7 @@ esp_err_t content_handler_monitor3(httpd_req_t *req)
 
   for (uint8_t i = 0; i < totalModules; i++)
   {
-    if (cmi[i].valid)
+    if (cellReadings.valid[i])
     {
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].PacketReceivedCount);
     }
@@ -969,12 +1096,30 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   int bufferused = 0;
   const char *nullstring = "null";
 
+  // Cell values all come from the same complete sweep of the modules
+  auto view = cellSnapshot.Acquire();
+
+  // A slow client can hold the view whilst the snapshot buffer is reused, the response is then
+  // dropped rather than send a mixture, the page asks again on its next refresh
+  auto sendChunk = [&]()
+  {
+    if (!cellSnapshot.StillValid(view))
+    {
+      ESP_LOGW(TAG, "Cell snapshot changed, monitor2 dropped");
+      return false;
+    }
+    httpd_resp_send_chunk(req, httpbuf, bufferused);
+    return true;
+  };
+
   // Output the first batch of settings/parameters/values
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
-                         R"({"banks":%u,"seriesmodules":%u,"sent":%u,"received":%u,"modulesfnd":%u,"badcrc":%u,"ignored":%u,"roundtrip":%u,"oos":%u,"activerules":%u,"uptime":%u,"can_fail":%u,"can_sent":%u,"can_rec":%u,"can_r_err":%u,"qlen":%u,"cmode":%u,"ctime":%i,)",
+                         R"({"banks":%u,"epoch":%u,"seriesmodules":%u,"sent":%u,"coalesced":%u,"received":%u,"modulesfnd":%u,"badcrc":%u,"ignored":%u,"roundtrip":%u,"oos":%u,"activerules":%u,"uptime":%u,"can_fail":%u,"can_sent":%u,"can_rec":%u,"can_r_err":%u,"qlen":%u,"cmode":%u,"ctime":%i,)",
                          mysettings.totalNumberOfBanks,
+                         view.epoch,
                          mysettings.totalNumberOfSeriesModules,
                          prg.packetsGenerated,
+                         prg.packetsCoalesced,
                          receiveProc.packetsReceived,
                          receiveProc.totalModulesFound,
                          receiveProc.totalCRCErrors,
@@ -991,12 +1136,40 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
                          (unsigned int)rules.getChargingMode(),
                          rules.getChargingTimerSecondsRemaining());
 
+  // Request queues in priority order (safety, telemetry, housekeeping), wait times in ms
+  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"lanes\":[");
+  for (uint8_t p = 0; p < numberOfRequestPriorities; p++)
+  {
+    auto lane = prg.getStatistics((RequestPriority)p);
+    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
+                           R"({"qlen":%u,"qmax":%u,"sent":%u,"wavg":%u,"wmax":%u}%s)",
+                           lane.queueLength,
+                           lane.maximumQueueLength,
+                           lane.sent,
+                           lane.sent == 0 ? 0 : lane.waitTotal / lane.sent,
+                           lane.waitMaximum,
+                           p < numberOfRequestPriorities - 1 ? "," : "");
+  }
+  bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
+
   if (mysettings.protocol != ProtocolEmulation::EMULATION_DISABLED && mysettings.dynamiccharge)
   {
     bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
                            R"("dyncv":%u,"dyncc":%u,)",
                            rules.DynamicChargeVoltage(),
                            rules.DynamicChargeCurrent());
+
+    // Charge voltage (0.1V) and voltage range (mV) calculated for each bank, dyncv is the lowest
+    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"dynbank\":[");
+    for (uint8_t bank = 0; bank < mysettings.totalNumberOfBanks; bank++)
+    {
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused,
+                             R"({"v":%u,"r":%u}%s)",
+                             rules.dynamicChargeBank.at(bank).voltage,
+                             rules.dynamicChargeBank.at(bank).range,
+                             bank < mysettings.totalNumberOfBanks - 1 ? "," : "");
+    }
+    bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
   }
 
   // current
@@ -1057,7 +1230,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   // Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // voltages
   bufferused = 0;
@@ -1071,9 +1247,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
     }
 
-    if (cmi[i].valid)
+    if (view.cells->valid[i])
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemV);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", view.cells->voltagemV[i]);
     }
     else
     {
@@ -1086,7 +1262,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   // ESP_LOGD(TAG, "bufferused=%i", bufferused);  ESP_LOGD(TAG, "monitor2: %s", buf);
 
   // Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   bufferused = 0;
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "\"minvoltages\":[");
@@ -1096,9 +1275,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid)
+    if (view.cells->valid[i])
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemVMin);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", view.cells->voltagemVMin[i]);
     }
     else
     {
@@ -1109,7 +1288,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // maxvoltages
   bufferused = 0;
@@ -1121,9 +1303,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid)
+    if (view.cells->valid[i])
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].voltagemVMax);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", view.cells->voltagemVMax[i]);
     }
     else
     {
@@ -1134,7 +1316,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // inttemp
   bufferused = 0;
@@ -1146,9 +1331,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid && cmi[i].internalTemp != -40)
+    if (view.cells->valid[i] && view.cells->internalTemp[i] != -40)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", cmi[i].internalTemp);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", view.cells->internalTemp[i]);
     }
     else
     {
@@ -1159,7 +1344,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // exttemp
   bufferused = 0;
@@ -1171,9 +1359,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid && cmi[i].externalTemp != -40)
+    if (view.cells->valid[i] && view.cells->externalTemp[i] != -40)
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", cmi[i].externalTemp);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%i", view.cells->externalTemp[i]);
     }
     else
     {
@@ -1184,7 +1372,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // bypass
   bufferused = 0;
@@ -1196,7 +1387,7 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid && cmi[i].inBypass)
+    if (view.cells->valid[i] && view.cells->inBypass[i])
     {
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "1");
     }
@@ -1208,7 +1399,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // bypasshot
   bufferused = 0;
@@ -1220,7 +1414,7 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid && cmi[i].bypassOverTemp)
+    if (view.cells->valid[i] && view.cells->bypassOverTemp[i])
     {
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "1");
     }
@@ -1232,7 +1426,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // bypasspwm
   bufferused = 0;
@@ -1244,9 +1441,9 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
     if (i)
       bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, ",");
 
-    if (cmi[i].valid && cmi[i].inBypass)
+    if (view.cells->valid[i] && view.cells->inBypass[i])
     {
-      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", cmi[i].PWMValue);
+      bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "%u", view.cells->PWMValue[i]);
     }
     else
     {
@@ -1257,7 +1454,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // bankv
   bufferused = 0;
@@ -1274,7 +1474,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "],");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // voltrange
   bufferused = 0;
@@ -1293,7 +1496,10 @@ esp_err_t content_handler_monitor2(httpd_req_t *req)
   bufferused += snprintf(&httpbuf[bufferused], BUFSIZE - bufferused, "]}");
 
   //  Send it...
-  httpd_resp_send_chunk(req, httpbuf, bufferused);
+  if (!sendChunk())
+  {
+    return ESP_FAIL;
+  }
 
   // Indicate last chunk (zero byte length)
   return httpd_resp_send_chunk(req, httpbuf, 0);
@@ -1372,21 +1578,23 @@ esp_err_t api_handler(httpd_req_t *req)
     return ESP_FAIL;
   }
 
-  const std::array<std::string, 17> uri_array = {
+  const std::array<std::string, 19> uri_array = {
       "monitor2", "monitor3", "integration",
       "settings", "rules", "rs485settings",
       "currentmonitor", "avrstatus", "modules",
       "identifyModule", "storage", "avrstorage",
       "chargeconfig", "tileconfig", "history",
-      "diagnostic", "mppt"};
+      "diagnostic", "mppt", "cellhistory",
+      "historybin"};
 
-  const std::array<std::function<esp_err_t(httpd_req_t * req)>, 17> func_ptr = {
+  const std::array<std::function<esp_err_t(httpd_req_t * req)>, 19> func_ptr = {
       content_handler_monitor2, content_handler_monitor3, content_handler_integration,
       content_handler_settings, content_handler_rules, content_handler_rs485settings,
       content_handler_currentmonitor, content_handler_avrstatus, content_handler_modules,
       content_handler_identifymodule, content_handler_storage, content_handler_avrstorage,
       content_handler_chargeconfig, content_handler_tileconfig, content_handler_history,
-      content_handler_diagnostic, content_handler_mppt};
+      content_handler_diagnostic, content_handler_mppt, content_handler_cellhistory,
+      content_handler_historybin};
 
   // Ensure arrays are equal length
   assert(uri_array.size() == func_ptr.size());
@@ -1395,39 +1395,120 @@ $(function () {
     });
 
 
-    $("#history").click(function () {
-        $(".header-right a").removeClass("active");
-        $(this).addClass("active");
-        switchPage("#historyPage");
+    // Decodes /api/historybin into the same object as /api/history, see History::GenerateBinary
+    function decodeHistory(buffer) {
+        var view = new DataView(buffer);
+        var bytes = new Uint8Array(buffer);
+        if (bytes.length < 9 || String.fromCharCode(bytes[0], bytes[1], bytes[2]) != "DHB" || bytes[3] != 1) {
+            return null;
+        }
+        var resolution = view.getUint32(4, true);
+        var numberOfFields = bytes[8];
+        var pos = 9;
+
+        var fields = [];
+        var data = { resolution: resolution };
+        for (var f = 0; f < numberOfFields; f++) {
+            var field = { flags: bytes[pos], reference: view.getInt8(pos + 1) };
+            var length = bytes[pos + 2];
+            field.name = String.fromCharCode.apply(null, bytes.subarray(pos + 3, pos + 3 + length));
+            pos += 3 + length;
+            fields.push(field);
+            data[field.name] = [];
+        }
 
-        $.getJSON("/api/history",
-            function (data) {
-                $("#historyTable tbody").empty();
-
-                for (var index = 0; index < data.time.length; index++) {
-                    var dt = new Date(data.time[index] * 1000).toLocaleString();
-                    var newRowContent = "<tr><td>" + dt + "</td>"
-                        + "<td>" + data.voltage[index] + "</td>"
-                        + "<td>" + data.current[index] + "</td>"
-                        + "<td>" + data.stateofcharge[index] + "</td>"
-                        + "<td>" + data.milliamphour_in[index] + "</td>"
-                        + "<td>" + data.milliamphour_out[index] + "</td>"
-                        + "<td>" + data.highestBankRange[index] + "</td>"
-                        + "<td>" + data.address_LowCellV[index] + "</td>"
-                        + "<td>" + data.lowestCellVoltage[index] + "</td>"
-                        + "<td>" + data.address_HighCellV[index] + "</td>"
-                        + "<td>" + data.highestCellVoltage[index] + "</td>"
-                        + "<td>" + data.lowestBankVoltage[index] + "</td>"
-                        + "<td>" + data.highestBankVoltage[index] + "</td>"
-                        + "<td>" + data.lowestExternalTemp[index] + "</td>"
-                        + "<td>" + data.highestExternalTemp[index] + "</td>"
-                        + "</tr>";
-                    $("#historyTable tbody").append(newRowContent);
+        while (pos + 8 <= bytes.length) {
+            var used = view.getUint16(pos + 4, true);
+            var records = bytes[pos + 6];
+            pos += 8;
+            var end = pos + used;
+
+            // First record in a block is relative to zero
+            var previous = new Array(numberOfFields).fill(0);
+            for (var r = 0; r < records && pos < end; r++) {
+                var record = new Array(numberOfFields);
+                for (var f = 0; f < numberOfFields; f++) {
+                    // Zigzag varint
+                    var z = 0;
+                    var scale = 1;
+                    var b;
+                    do {
+                        b = bytes[pos++];
+                        z += (b & 0x7f) * scale;
+                        scale *= 128;
+                    } while (b & 0x80);
+                    var difference = (z % 2) ? -(z + 1) / 2 : z / 2;
+
+                    var field = fields[f];
+                    var reference = (field.flags & 1) ? record[field.reference] : previous[f];
+                    if (field.flags & 8) {
+                        reference += resolution;
+                    }
+                    // Modulo 2^32, as the controller
+                    record[f] = (reference + difference) | 0;
+                }
+                previous = record;
+
+                for (var f = 0; f < numberOfFields; f++) {
+                    var v = record[f];
+                    if (fields[f].flags & 2) {
+                        v = Number((v / 100).toFixed(2));
+                    } else if (fields[f].flags & 4) {
+                        v = v >>> 0;
+                    }
+                    data[fields[f].name].push(v);
                 }
+            }
+            pos = end;
+        }
+        return data;
+    }
 
-            }).fail(function () { $.notify("Request failed", { autoHide: true, globalPosition: 'top right', className: 'error' }); }
-            );
+    function loadHistory() {
+        var xhr = new XMLHttpRequest();
+        xhr.open("GET", "/api/historybin?res=" + encodeURIComponent($("#historyResolution").val()), true);
+        xhr.responseType = "arraybuffer";
+        xhr.onload = function () {
+            var data = xhr.status == 200 ? decodeHistory(xhr.response) : null;
+            if (data == null) {
+                $.notify("Request failed", { autoHide: true, globalPosition: 'top right', className: 'error' });
+                return;
+            }
+
+            $("#historyTable tbody").empty();
+
+            for (var index = 0; index < data.time.length; index++) {
+                var dt = new Date(data.time[index] * 1000).toLocaleString();
+                var newRowContent = "<tr><td>" + dt + "</td>"
+                    + "<td>" + data.voltage[index] + "</td>"
+                    + "<td>" + data.current[index] + "</td>"
+                    + "<td>" + data.stateofcharge[index] + "</td>"
+                    + "<td>" + data.milliamphour_in[index] + "</td>"
+                    + "<td>" + data.milliamphour_out[index] + "</td>"
+                    + "<td>" + data.highestBankRange[index] + "</td>"
+                    + "<td>" + data.address_LowCellV[index] + "</td>"
+                    + "<td>" + data.lowestCellVoltage[index] + "</td>"
+                    + "<td>" + data.address_HighCellV[index] + "</td>"
+                    + "<td>" + data.highestCellVoltage[index] + "</td>"
+                    + "<td>" + data.lowestBankVoltage[index] + "</td>"
+                    + "<td>" + data.highestBankVoltage[index] + "</td>"
+                    + "<td>" + data.lowestExternalTemp[index] + "</td>"
+                    + "<td>" + data.highestExternalTemp[index] + "</td>"
+                    + "</tr>";
+                $("#historyTable tbody").append(newRowContent);
+            }
+        };
+        xhr.onerror = function () { $.notify("Request failed", { autoHide: true, globalPosition: 'top right', className: 'error' }); };
+        xhr.send();
+    }
 
+    $("#historyResolution").change(loadHistory);
+
+    $("#history").click(function () {
+        $(".header-right a").removeClass("active");
+        $(this).addClass("active");
+        switchPage("#historyPage");
+        loadHistory();
         return true;
     });
 
@@ -1574,6 +1655,13 @@ $(function () {
                 }
 
                 $("#interpacketgap").val(data.settings.interpacketgap);
+                $("#replydrivenpacing").prop("checked", data.settings.replydrivenpacing);
+
+                $("#packetwindow").empty();
+                for (let index = 1; index <= 32; index++) {
+                    $("#packetwindow").append('<option value="' + index + '">' + index + '</option>')
+                }
+                $("#packetwindow").val(data.settings.packetwindow);
                 $("#banksForm").show();
 
 
@@ -2063,6 +2151,7 @@ $(function () {
 
                 $("#loggingEnabled").prop("checked", data.storage.logging);
                 $("#loggingFreq").val(data.storage.frequency);
+                $("#loggingBinary").prop("checked", data.storage.binary);
 
                 if (data.storage.sdcard.available) {
                     $("#sdcardmissing").hide();
@@ -0,0 +1,209 @@
+#ifndef HostTools_Arduino_H_
+#define HostTools_Arduino_H_
+
+// Just enough of the Arduino, ESP-IDF and FreeRTOS API to compile the controller and module
+// sources used by the host tools.
+//
+// Everything runs on a single thread, queues never block and task notifications are only counted.
+// millis() and esp_timer_get_time() are supplied by the tool, so they can follow a simulated clock.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define F(x) (x)
+
+// Subset of Arduino binary.h used by the controller and module sources
+#define B00000001 1
+#define B00000010 2
+#define B00000011 3
+#define B00000100 4
+#define B00000101 5
+#define B00000110 6
+#define B00000111 7
+#define B00110000 48
+#define B10000000 128
+
+// Supplied by the host tool
+uint32_t millis();
+int64_t esp_timer_get_time();
+
+// ESP-IDF logging, printed to stdout when at or below host_log_level
+typedef enum
+{
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+inline esp_log_level_t host_log_level = ESP_LOG_NONE;
+
+#define HOST_LOG(level, letter, tag, format, ...)                          \
+  do                                                                       \
+  {                                                                        \
+    if (host_log_level >= level)                                           \
+    {                                                                      \
+      printf(letter " (%u) %s: " format "\n", millis(), tag, ##__VA_ARGS__); \
+    }                                                                      \
+  } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+// FreeRTOS
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define portMAX_DELAY (TickType_t)0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Critical sections are not needed with a single thread
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+// A task is just a notification counter the tool can inspect
+struct HostTask
+{
+  uint32_t notifications;
+};
+typedef HostTask *TaskHandle_t;
+
+enum eNotifyAction
+{
+  eNoAction = 0,
+  eSetBits,
+  eIncrement,
+  eSetValueWithOverwrite,
+  eSetValueWithoutOverwrite
+};
+
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t, eNotifyAction)
+{
+  task->notifications++;
+  return pdPASS;
+}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+  task->notifications++;
+  return pdPASS;
+}
+
+// Fixed size FIFO, items are copied in and out of preallocated storage like FreeRTOS.
+// Sending to a full queue fails immediately instead of blocking
+struct HostQueue
+{
+  size_t length;
+  size_t itemSize;
+  std::vector<uint8_t> storage;
+  size_t head;
+  size_t count;
+};
+typedef HostQueue *QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  return new HostQueue{length, itemSize, std::vector<uint8_t>(length * itemSize), 0, 0};
+}
+
+inline BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t)
+{
+  if (q->count == q->length)
+  {
+    return pdFAIL;
+  }
+  memcpy(&q->storage[((q->head + q->count) % q->length) * q->itemSize], item, q->itemSize);
+  q->count++;
+  return pdPASS;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void *buffer, TickType_t)
+{
+  if (q->count == 0)
+  {
+    return pdFAIL;
+  }
+  memcpy(buffer, &q->storage[q->head * q->itemSize], q->itemSize);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  return pdPASS;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+  return (UBaseType_t)q->count;
+}
+
+// Counting semaphore
+struct HostSemaphore
+{
+  UBaseType_t maximum;
+  UBaseType_t count;
+};
+typedef HostSemaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maximum, UBaseType_t initial)
+{
+  return new HostSemaphore{maximum, initial};
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+  if (s->count == s->maximum)
+  {
+    return pdFAIL;
+  }
+  s->count++;
+  return pdPASS;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t)
+{
+  if (s->count == 0)
+  {
+    return pdFAIL;
+  }
+  s->count--;
+  return pdPASS;
+}
+
+inline UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s)
+{
+  return s->count;
+}
+
+// Single thread, a mutex is a binary semaphore that starts given
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef HostTools_BinaryCellLogReader_H_
+#define HostTools_BinaryCellLogReader_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+// Reads the binary cell data log (see ESPController/include/BinaryCellLog.h) back into the CSV that
+// main.cpp writes, and the block index from the 'T' records at the end of each block.
+namespace BinaryCellLogReader
+{
+  struct Block
+  {
+    uint32_t offset;
+    uint16_t records;
+    uint32_t firstTime;
+    uint32_t lastTime;
+  };
+
+  struct Result
+  {
+    uint32_t headers = 0;
+    uint32_t keyframes = 0;
+    uint32_t deltas = 0;
+    // Blocks found reading forwards, with or without a 'T'
+    std::vector<Block> blocks;
+    std::string error;
+  };
+
+  inline uint16_t Get16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+  inline uint32_t Get32(const uint8_t *p) { return Get16(p) | (uint32_t)Get16(p + 2) << 16; }
+
+  // "YYYY-MM-DD HH:MM:SS" for the local time in the log
+  inline std::string Timestamp(uint32_t time)
+  {
+    const time_t t = (time_t)time;
+    tm tm;
+    gmtime_r(&t, &tm);
+    char s[48];
+    snprintf(s, sizeof(s), "%04i-%02i-%02i %02i:%02i:%02i", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+             tm.tm_sec);
+    return s;
+  }
+
+  inline void CsvHeader(std::string &csv, uint8_t modules)
+  {
+    csv += "DateTime,";
+    for (uint8_t i = 0; i < modules; i++)
+    {
+      const std::string n = std::to_string(i);
+      csv += "VoltagemV_" + n + ",InternalTemp_" + n + ",ExternalTemp_" + n + ",Bypass_" + n + ",PWM_" + n + ",BypassOverTemp_" + n +
+             ",BadPackets_" + n + ",BalancemAh_" + n;
+      csv += i < modules - 1 ? "," : "\r\n";
+    }
+  }
+
+  // The whole file as CSV, false (and Result::error) if it is damaged, "csv" then has the rows up to there
+  inline bool ToCsv(const std::vector<uint8_t> &file, std::string &csv, Result &result)
+  {
+    const uint8_t *p = file.data();
+    const uint8_t *end = p + file.size();
+    if (file.size() < 4 || memcmp(p, "DBL\x01", 4) != 0)
+    {
+      result.error = "not a binary cell log";
+      return false;
+    }
+    p += 4;
+
+    uint8_t modules = 0;
+    bool haveKeyframe = false;
+    uint32_t time = 0;
+    // voltage, internal, external, PWM, bad packets, balance, flags
+    std::vector<int32_t> values[7];
+
+    while (p < end)
+    {
+      const uint8_t tag = *p;
+      const size_t left = (size_t)(end - p);
+      if (tag == 'H' && left >= 6)
+      {
+        if (result.headers == 0)
+        {
+          CsvHeader(csv, p[3]);
+        }
+        modules = p[3];
+        for (auto &v : values)
+        {
+          v.assign(modules, 0);
+        }
+        haveKeyframe = false;
+        result.headers++;
+        p += 6;
+        continue;
+      }
+      if (tag == 'T' && left >= 15)
+      {
+        if (result.blocks.empty() || result.blocks.back().offset != Get32(p + 11) || result.blocks.back().records != Get16(p + 1))
+        {
+          result.error = "block index does not match the block at " + std::to_string(p - file.data());
+          return false;
+        }
+        p += 15;
+        continue;
+      }
+
+      const bool keyframe = tag == 'K';
+      if ((tag != 'K' && tag != 'D') || modules == 0 || (!keyframe && !haveKeyframe))
+      {
+        result.error = "unexpected record at " + std::to_string(p - file.data());
+        return false;
+      }
+      const size_t size = keyframe ? 5 + 11 * (size_t)modules : 3 + 7 * (size_t)modules;
+      if (left < size)
+      {
+        // Torn by a power cut
+        result.error = "incomplete record at " + std::to_string(p - file.data());
+        return false;
+      }
+
+      if (keyframe)
+      {
+        time = Get32(p + 1);
+        result.blocks.push_back({(uint32_t)(p - file.data()), 0, time, time});
+        const uint8_t *c = p + 5;
+        for (uint8_t i = 0; i < modules; i++)
+        {
+          values[0][i] = Get16(c + 2 * i);
+          values[1][i] = (int8_t)c[2 * modules + i];
+          values[2][i] = (int8_t)c[3 * modules + i];
+          values[3][i] = Get16(c + 4 * modules + 2 * i);
+          values[4][i] = Get16(c + 6 * modules + 2 * i);
+          values[5][i] = Get16(c + 8 * modules + 2 * i);
+          values[6][i] = c[10 * modules + i];
+        }
+        haveKeyframe = true;
+        result.keyframes++;
+      }
+      else
+      {
+        time += Get16(p + 1);
+        const uint8_t *c = p + 3;
+        for (uint8_t i = 0; i < modules; i++)
+        {
+          values[0][i] = (uint16_t)(values[0][i] + (int8_t)c[i]);
+          values[1][i] = (int8_t)(values[1][i] + (int8_t)c[modules + i]);
+          values[2][i] = (int8_t)(values[2][i] + (int8_t)c[2 * modules + i]);
+          values[3][i] = (uint16_t)(values[3][i] + (int8_t)c[3 * modules + i]);
+          values[4][i] = (uint16_t)(values[4][i] + (int8_t)c[4 * modules + i]);
+          values[5][i] = (uint16_t)(values[5][i] + (int8_t)c[5 * modules + i]);
+          values[6][i] = c[6 * modules + i];
+        }
+        result.deltas++;
+      }
+      result.blocks.back().records++;
+      result.blocks.back().lastTime = time;
+      p += size;
+
+      csv += Timestamp(time);
+      csv += ",";
+      char field[80];
+      for (uint8_t i = 0; i < modules; i++)
+      {
+        snprintf(field, sizeof(field), "%i,%i,%i,%s,%i,%s,%i,%i%s", values[0][i], values[1][i], values[2][i], values[6][i] & 1 ? "Y" : "N",
+                 values[3][i], values[6][i] & 2 ? "Y" : "N", values[4][i], values[5][i], i < modules - 1 ? "," : "\r\n");
+        csv += field;
+      }
+    }
+    return true;
+  }
+
+  // Blocks listed by the 'T' records, walking back from the end of the file.  Stops at a block without
+  // one (the day's last block if the file wasn't closed, or one cut short by a restart).
+  inline std::vector<Block> Index(const std::vector<uint8_t> &file)
+  {
+    // The 'T' record ending just before "end", if it is one
+    auto trailer = [&file](size_t end, Block &b)
+    {
+      if (end < 4 + 15 || file[end - 15] != 'T')
+      {
+        return false;
+      }
+      const uint8_t *t = file.data() + end - 15;
+      b = {Get32(t + 11), Get16(t + 1), Get32(t + 3), Get32(t + 7)};
+      return b.offset >= 4 && b.offset + 5 <= end - 15 && file[b.offset] == 'K' && Get32(&file[b.offset + 1]) == b.firstTime;
+    };
+
+    std::vector<Block> blocks;
+    size_t end = file.size();
+    Block b;
+    // A header can come between a block's 'T' and the next keyframe
+    while (trailer(end, b) || (end >= 6 && file[end - 6] == 'H' && trailer(end -= 6, b)))
+    {
+      blocks.insert(blocks.begin(), b);
+      end = b.offset;
+    }
+    return blocks;
+  }
+} // namespace BinaryCellLogReader
+
+#endif
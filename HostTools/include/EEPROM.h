@@ -0,0 +1,36 @@
+#ifndef HostTools_EEPROM_H_
+#define HostTools_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// RAM backed replacement for the AVR EEPROM library (ATtiny841 has 512 bytes)
+class EEPROMClass
+{
+public:
+  uint8_t read(int address) const { return data[address]; }
+  void update(int address, uint8_t value) { data[address] = value; }
+
+  template <typename T>
+  T &get(int address, T &t) const
+  {
+    memcpy(&t, &data[address], sizeof(T));
+    return t;
+  }
+
+  template <typename T>
+  const T &put(int address, const T &t)
+  {
+    memcpy(&data[address], &t, sizeof(T));
+    return t;
+  }
+
+  uint16_t length() const { return sizeof(data); }
+
+private:
+  uint8_t data[512] = {};
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef EmbeddedFiles_Defines_H
+#define EmbeddedFiles_Defines_H
+
+// Host tools are not built from a tagged release, use the same values as a local compile
+
+static const char GIT_VERSION[] = "LocalCompile";
+
+static const char GIT_VERSION_SHORT[] = "LocalCompile";
+
+static const uint16_t GIT_VERSION_B1 = 0xFFFF;
+
+static const uint16_t GIT_VERSION_B2 = 0xFFFF;
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef EmbeddedFiles_Integrity_H
+#define EmbeddedFiles_Integrity_H
+
+// Web content is not embedded into the host tools
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef HostTools_FS_H_
+#define HostTools_FS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+// Replacement for the Arduino fs::FS/fs::File used with LittleFS and SD, the files are in the directory
+// given to the FS.  Reads and writes are counted, to compare with the flash on the controller.
+//
+// Writes are also counted as 512 byte sector transfers the way FatFs on an SD card does them: a write
+// covering a whole sector goes straight to the card, a part sector goes through a one sector window
+// (read first if the file already has data there, written when another sector is needed), and
+// flush/close write the window and update the directory entry.  Finding a file reads the directory.
+namespace fs
+{
+  struct Counters
+  {
+    uint32_t opens = 0;
+    uint32_t exists = 0;
+    uint32_t seeks = 0;
+    uint32_t reads = 0;
+    uint64_t bytesRead = 0;
+    uint32_t writes = 0;
+    uint64_t bytesWritten = 0;
+    uint32_t flushes = 0;
+    uint32_t closes = 0;
+    uint32_t sectorReads = 0;
+    uint32_t sectorWrites = 0;
+  };
+  inline Counters counters;
+
+  class File
+  {
+  public:
+    File() = default;
+    explicit File(FILE *f)
+    {
+      if (f != nullptr)
+      {
+        _f.reset(new Handle{f, Window()}, Close);
+      }
+    }
+
+    explicit operator bool() const { return _f != nullptr; }
+
+    bool seek(uint32_t position)
+    {
+      counters.seeks++;
+      return _f && fseek(Raw(), (long)position, SEEK_SET) == 0;
+    }
+
+    size_t read(uint8_t *buffer, size_t length)
+    {
+      if (!_f)
+      {
+        return 0;
+      }
+      counters.reads++;
+      const size_t n = fread(buffer, 1, length, Raw());
+      counters.bytesRead += n;
+      return n;
+    }
+
+    size_t write(const uint8_t *buffer, size_t length)
+    {
+      if (!_f)
+      {
+        return 0;
+      }
+      counters.writes++;
+      const long position = ftell(Raw());
+      const long existing = (long)size();
+      const size_t n = fwrite(buffer, 1, length, Raw());
+      counters.bytesWritten += n;
+
+      Window &w = _f->window;
+      for (long sector = position / 512; n != 0 && sector <= (position + (long)n - 1) / 512; sector++)
+      {
+        if (position <= sector * 512 && position + (long)n >= (sector + 1) * 512)
+        {
+          counters.sectorWrites++;
+          if (w.sector == sector)
+          {
+            w.dirty = false;
+          }
+          continue;
+        }
+        if (w.sector != sector)
+        {
+          counters.sectorWrites += w.dirty ? 1 : 0;
+          counters.sectorReads += sector * 512 < existing ? 1 : 0;
+          w.sector = sector;
+        }
+        w.dirty = true;
+      }
+      w.modified |= n != 0;
+      return n;
+    }
+
+    size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+
+    void flush()
+    {
+      if (_f)
+      {
+        counters.flushes++;
+        Sync(_f.get());
+        fflush(Raw());
+      }
+    }
+
+    size_t size() const
+    {
+      if (!_f)
+      {
+        return 0;
+      }
+      const long position = ftell(Raw());
+      fseek(Raw(), 0, SEEK_END);
+      const long end = ftell(Raw());
+      fseek(Raw(), position, SEEK_SET);
+      return (size_t)end;
+    }
+
+    void close()
+    {
+      if (_f)
+      {
+        counters.closes++;
+        Sync(_f.get());
+      }
+      _f.reset();
+    }
+
+  private:
+    // FatFs sector buffer, per open file
+    struct Window
+    {
+      long sector = -1;
+      bool dirty = false;
+      // Directory entry needs updating
+      bool modified = false;
+    };
+    struct Handle
+    {
+      FILE *f;
+      Window window;
+    };
+
+    static void Sync(Handle *h)
+    {
+      counters.sectorWrites += h->window.dirty ? 1 : 0;
+      h->window.dirty = false;
+      if (h->window.modified)
+      {
+        // Read and write back the directory sector
+        counters.sectorReads++;
+        counters.sectorWrites++;
+        h->window.modified = false;
+      }
+    }
+    static void Close(Handle *h)
+    {
+      fclose(h->f);
+      delete h;
+    }
+
+    std::shared_ptr<Handle> _f;
+    FILE *Raw() const { return _f->f; }
+  };
+
+  class FS
+  {
+  public:
+    explicit FS(const std::string &root) : _root(root) {}
+
+    File open(const char *path, const char *mode = "r")
+    {
+      counters.opens++;
+      // Finding the file, and the end of its cluster chain to append
+      counters.sectorReads += mode[0] == 'a' ? 2 : 1;
+      // Binary, "r" is read only as on the controller
+      const std::string m = std::string(mode) + "b";
+      FILE *f = fopen(Path(path).c_str(), m.c_str());
+      if (f != nullptr && mode[0] == 'a')
+      {
+        fseek(f, 0, SEEK_END);
+      }
+      return File(f);
+    }
+
+    bool exists(const char *path)
+    {
+      counters.exists++;
+      counters.sectorReads++;
+      FILE *f = fopen(Path(path).c_str(), "rb");
+      if (f != nullptr)
+      {
+        fclose(f);
+      }
+      return f != nullptr;
+    }
+
+    bool remove(const char *path) { return ::remove(Path(path).c_str()) == 0; }
+    bool rename(const char *from, const char *to) { return ::rename(Path(from).c_str(), Path(to).c_str()) == 0; }
+
+  private:
+    std::string _root;
+    std::string Path(const char *path) const { return _root + path; }
+  };
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
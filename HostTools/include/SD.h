@@ -0,0 +1,31 @@
+#ifndef HostTools_SD_H_
+#define HostTools_SD_H_
+
+#include <FS.h>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+// Replacement for the Arduino SD card, a directory on the host (set by the tool) with a pretend size
+namespace fs
+{
+  class SDFS : public FS
+  {
+  public:
+    explicit SDFS(const std::string &root) : FS(root) {}
+
+    uint64_t totalBytes() const { return total; }
+    uint64_t usedBytes() const { return used; }
+
+    uint64_t total = 8ULL * 1024 * 1024 * 1024;
+    uint64_t used = 0;
+  };
+} // namespace fs
+
+using fs::SDFS;
+
+// The tool sets the directory with SD = SDFS(...)
+inline SDFS SD("/tmp");
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef DIYBMS_HOST_HAL_H_
+#define DIYBMS_HOST_HAL_H_
+
+#include <Arduino.h>
+
+// Host replacement for the module hardware abstraction (diybms_attiny841.h)
+// The host tool supplies ADC results by calling PacketProcessor::ADCReading() directly.
+
+#define MAXIUMUM_ATTINY_ADC_SCALE 1023.0F
+
+class diyBMSHAL
+{
+public:
+  static void SelectCellVoltageChannel() {}
+  static void SelectInternalTemperatureChannel() {}
+  static void SelectExternalTemperatureChannel() {}
+  static uint16_t BeginADCReading(uint8_t) { return 0; }
+};
+
+#endif
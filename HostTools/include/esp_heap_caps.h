@@ -0,0 +1,32 @@
+#ifndef HostTools_esp_heap_caps_H_
+#define HostTools_esp_heap_caps_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Just enough of the ESP-IDF heap API for the sources sizing buffers from the free memory.
+// The tool sets how much there is, the default is a board without PSRAM.
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+inline size_t host_heap_internal = 200 * 1024;
+inline size_t host_heap_internal_largest = 110 * 1024;
+inline size_t host_heap_spiram = 0;
+
+inline size_t heap_caps_get_free_size(uint32_t caps)
+{
+  return (caps & MALLOC_CAP_SPIRAM) ? host_heap_spiram : host_heap_internal;
+}
+
+inline size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+  return (caps & MALLOC_CAP_SPIRAM) ? host_heap_spiram : host_heap_internal_largest;
+}
+
+inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+  return heap_caps_get_largest_free_block(caps) < n * size ? nullptr : calloc(n, size);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef HostTools_esp_http_server_H_
+#define HostTools_esp_http_server_H_
+
+#include <string>
+
+// Just enough of the ESP-IDF HTTP server for the JSON generators, the response is collected in "body"
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define HTTPD_500 "500 Internal Server Error"
+
+enum httpd_err_code_t
+{
+  HTTPD_400_BAD_REQUEST
+};
+
+struct httpd_req_t
+{
+  std::string body;
+  std::string status;
+  std::string type;
+  uint32_t chunks = 0;
+};
+
+inline esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type)
+{
+  req->type = type;
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status)
+{
+  req->status = status;
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t, const char *message)
+{
+  req->status = message;
+  return ESP_FAIL;
+}
+
+inline esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buffer, ssize_t length)
+{
+  req->body.append(buffer, length);
+  req->chunks++;
+  return ESP_OK;
+}
+
+#endif
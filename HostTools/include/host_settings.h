@@ -0,0 +1,66 @@
+#ifndef HOST_SETTINGS_H_
+#define HOST_SETTINGS_H_
+
+#include <Arduino.h>
+
+#include "defines.h"
+#include "Rules.h"
+
+// The settings Rules uses, with the values DefaultConfiguration (ESPController/src/settings.cpp)
+// gives them.  Host tools cannot compile settings.cpp, keep this in step with it.
+// The defaults assume 8 cells for the bank and current monitor voltage rules, here they are
+// scaled to "series" cells.
+inline void host_default_settings(diybms_eeprom_settings &settings, uint8_t banks, uint8_t series)
+{
+  memset(&settings, 0, sizeof(settings));
+  settings.totalNumberOfBanks = banks;
+  settings.totalNumberOfSeriesModules = series;
+
+  settings.protocol = ProtocolEmulation::EMULATION_DISABLED;
+  settings.currentMonitoringEnabled = false;
+  settings.currentMonitoringDevice = CurrentMonitorDevice::DIYBMS_CURRENT_MON_MODBUS;
+
+  settings.chargevolt = 565;
+  settings.chargecurrent = 650;
+  settings.dischargevolt = 488;
+  settings.cellminmv = 3050;
+  settings.cellmaxmv = 3450;
+  settings.kneemv = 3320;
+  settings.sensitivity = 30;
+  settings.current_value1 = 50;
+  settings.current_value2 = 3;
+  settings.cellmaxspikemv = 3550;
+  settings.dynamiccharge = true;
+
+  settings.chargetemplow = 0;
+  settings.chargetemphigh = 50;
+  settings.dischargetemplow = -30;
+  settings.dischargetemphigh = 55;
+
+  settings.absorptiontimer = 60;
+  settings.floatvoltage = 528;
+  settings.floatvoltagetimer = 360;
+  settings.stateofchargeresumevalue = 96;
+
+  settings.rulevalue[Rule::CurrentMonitorOverCurrentAmps] = 100;
+  settings.rulevalue[Rule::ModuleOverVoltage] = 4150;
+  settings.rulevalue[Rule::ModuleUnderVoltage] = 3000;
+  settings.rulevalue[Rule::ModuleOverTemperatureExternal] = 50;
+  settings.rulevalue[Rule::ModuleUnderTemperatureExternal] = 2;
+  settings.rulevalue[Rule::BankOverVoltage] = 4200 * series;
+  settings.rulevalue[Rule::BankUnderVoltage] = 3000 * series;
+  settings.rulevalue[Rule::BankRange] = 30;
+  settings.rulevalue[Rule::Timer1] = 60 * 8;
+  settings.rulevalue[Rule::Timer2] = 60 * 17;
+  settings.rulevalue[Rule::ModuleOverTemperatureInternal] = 75;
+  settings.rulevalue[Rule::ModuleUnderTemperatureInternal] = 5;
+  settings.rulevalue[Rule::CurrentMonitorOverVoltage] = 4200 * series;
+  settings.rulevalue[Rule::CurrentMonitorUnderVoltage] = 3000 * series;
+  for (size_t i = 0; i < RELAY_RULES; i++)
+  {
+    settings.rulehysteresis[i] = settings.rulevalue[i];
+  }
+  settings.rulehysteresis[Rule::BankRange] = 15;
+}
+
+#endif
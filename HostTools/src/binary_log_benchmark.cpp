@@ -0,0 +1,347 @@
+/*
+  Host check and benchmark of the binary cell data log (ESPController/src/BinaryCellLog.cpp, compiled
+  unchanged) against the CSV main.cpp writes (kept below), both through SdLog onto the SD card stub.
+
+  "days" of "cells" modules every "interval" seconds, starting an hour before midnight for a day
+  rollover, with readings that drift and sometimes jump too far for a delta.  Half way through the
+  controller "restarts".  Every .dbl must convert back (BinaryCellLogReader, as dbl2csv does) to the same
+  bytes as the .csv, the index at the end of each block must match the blocks, and a file cut part way
+  through a record must convert up to that record (exits with 1 if not).
+
+  Usage: binary_log_benchmark [days=2] [interval=15] [cells=16] [dir=/tmp]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <SD.h>
+
+#include "defines.h"
+#include "SdLog.h"
+#include "BinaryCellLog.h"
+#include "BinaryCellLogReader.h"
+
+#include "../../ESPController/src/SdLog.cpp"
+// Both files have a TAG
+#define TAG binlog_TAG
+#include "../../ESPController/src/BinaryCellLog.cpp"
+#undef TAG
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+static bool LockBus() { return true; }
+static bool UnlockBus() { return true; }
+
+static SdLog cellLog("cells", 4096, LockBus, UnlockBus);
+CellReadings cells;
+CellModuleInfo cmi[maximum_controller_cell_modules];
+static uint8_t numberOfCells = 16;
+
+// Readings that drift a little between rows, with a jump now and then
+static void readings(uint32_t row, uint32_t t)
+{
+  for (uint8_t i = 0; i < numberOfCells; i++)
+  {
+    const uint32_t phase = (t / 60 + i * 7) % 200;
+    cells.voltagemV[i] = (uint16_t)(3250 + (phase < 100 ? phase : 200 - phase) + ((row + i) % 977 == 0 ? 400 : 0));
+    cells.internalTemp[i] = (int8_t)(20 + (t / 900 + i) % 15);
+    cells.externalTemp[i] = (int8_t)(-5 + (int)((t / 1800 + i) % 12));
+    cells.inBypass[i] = (t / 15 + i) % 7 == 0;
+    cells.bypassOverTemp[i] = cells.inBypass[i] && (t / 3600) % 5 == 0;
+    cells.PWMValue[i] = cells.inBypass[i] ? (uint16_t)(100 + (t / 15) % 156) : 0;
+    cmi[i].badPacketCount = (uint16_t)((row + i * 13) / 2000);
+    cmi[i].BalanceCurrentCount = (uint16_t)((row / 4 + i) % 60000);
+  }
+}
+
+static void localTime(uint32_t t, tm &timeinfo)
+{
+  const time_t tt = (time_t)t;
+  gmtime_r(&tt, &timeinfo);
+  // As main.cpp has them
+  timeinfo.tm_year += 1900;
+  timeinfo.tm_mon += 1;
+}
+
+static std::string filename(uint32_t t, const char *extension)
+{
+  tm timeinfo;
+  localTime(t, timeinfo);
+  char s[48];
+  snprintf(s, sizeof(s), "/data_%04i%02i%02i%s", timeinfo.tm_year, timeinfo.tm_mon, timeinfo.tm_mday, extension);
+  return s;
+}
+
+static std::string pad_zero(uint8_t digits, uint16_t value)
+{
+  std::string s = std::to_string(value);
+  while (s.length() < digits)
+  {
+    s.insert(0, "0");
+  }
+  return s;
+}
+
+// As log_cell_monitoring_data_to_sdcard() writes the CSV
+static void csvRow(const std::string &name, const tm &timeinfo)
+{
+  if (cellLog.Start(name))
+  {
+    cellLog.Append("DateTime,", 9);
+    std::string header;
+    for (auto i = 0; i < numberOfCells; i++)
+    {
+      const std::string n = std::to_string(i);
+      header.clear();
+      header.append("VoltagemV_").append(n).append(",InternalTemp_").append(n).append(",ExternalTemp_").append(n).append(",Bypass_");
+      header.append(n).append(",PWM_").append(n).append(",BypassOverTemp_").append(n).append(",BadPackets_").append(n);
+      header.append(",BalancemAh_").append(n).append(i < numberOfCells - 1 ? "," : "\r\n");
+      cellLog.Append(header);
+    }
+  }
+
+  std::string dataMessage;
+  dataMessage.reserve(150);
+  dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
+      .append("-")
+      .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
+      .append("-")
+      .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
+      .append(" ")
+      .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
+      .append(":")
+      .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
+      .append(":")
+      .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
+      .append(",");
+
+  for (auto i = 0; i < numberOfCells; i++)
+  {
+    dataMessage.append(std::to_string(cells.voltagemV[i]))
+        .append(",")
+        .append(std::to_string(cells.internalTemp[i]))
+        .append(",")
+        .append(std::to_string(cells.externalTemp[i]))
+        .append(",")
+        .append(cells.inBypass[i] ? "Y" : "N")
+        .append(",")
+        .append(std::to_string((int)((float)cells.PWMValue[i] / (float)255.0 * 100)))
+        .append(",")
+        .append(cells.bypassOverTemp[i] ? "Y" : "N")
+        .append(",")
+        .append(std::to_string(cmi[i].badPacketCount))
+        .append(",")
+        .append(std::to_string(cmi[i].BalanceCurrentCount));
+    dataMessage.append(i < numberOfCells - 1 ? "," : "\r\n");
+    cellLog.Append(dataMessage);
+    dataMessage.clear();
+  }
+  cellLog.End();
+}
+
+static std::vector<uint8_t> readFile(const std::string &path)
+{
+  std::vector<uint8_t> contents;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f != nullptr)
+  {
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+      contents.insert(contents.end(), buffer, buffer + n);
+    }
+    fclose(f);
+  }
+  return contents;
+}
+
+struct Phase
+{
+  fs::Counters card;
+  uint32_t writes;
+  double cpu_ms;
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t days = 2;
+  uint32_t interval = 15;
+  std::string dir = "/tmp";
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "days=", 5) == 0)
+    {
+      days = (uint32_t)max(1, atoi(argv[i] + 5));
+    }
+    else if (strncmp(argv[i], "interval=", 9) == 0)
+    {
+      interval = (uint32_t)max(1, atoi(argv[i] + 9));
+    }
+    else if (strncmp(argv[i], "cells=", 6) == 0)
+    {
+      numberOfCells = (uint8_t)min((int)maximum_controller_cell_modules, max(1, atoi(argv[i] + 6)));
+    }
+    else if (strncmp(argv[i], "dir=", 4) == 0)
+    {
+      dir = argv[i] + 4;
+    }
+  }
+
+  const std::string csvDir = dir + "/binlog_csv";
+  const std::string dblDir = dir + "/binlog_dbl";
+  for (const std::string &d : {csvDir, dblDir})
+  {
+    const std::string command = "rm -rf " + d + " && mkdir -p " + d;
+    if (system(command.c_str()) != 0)
+    {
+      printf("Unable to create %s\n", d.c_str());
+      return 1;
+    }
+  }
+
+  // Just before midnight, so the first day is short and there is a rollover
+  const uint32_t start = 1790000000 - 1790000000 % 86400 + 86400 - 3600;
+  const uint32_t rows = days * 86400 / interval;
+  cellLog.Begin();
+
+  // CSV
+  SD = SDFS(csvDir);
+  fs::counters = {};
+  auto started = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    const uint32_t t = start + r * interval;
+    now_us = (int64_t)r * interval * 1000000;
+    readings(r, t);
+    tm timeinfo;
+    localTime(t, timeinfo);
+    csvRow(filename(t, ".csv"), timeinfo);
+  }
+  cellLog.Close();
+  const Phase csv{fs::counters, cellLog.writes, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count()};
+
+  // Binary, restarting the controller half way
+  SD = SDFS(dblDir);
+  fs::counters = {};
+  const uint32_t writesBefore = cellLog.writes;
+  BinaryCellLog *binary = new BinaryCellLog();
+  uint32_t keyframes = 0;
+  uint32_t deltas = 0;
+  started = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    const uint32_t t = start + r * interval;
+    now_us = (int64_t)r * interval * 1000000;
+    if (r == rows / 2 + 7)
+    {
+      cellLog.Close();
+      keyframes += binary->keyframes;
+      deltas += binary->deltas;
+      delete binary;
+      binary = new BinaryCellLog();
+    }
+    readings(r, t);
+    tm timeinfo;
+    localTime(t, timeinfo);
+    const uint32_t time = BinaryCellLog::LocalTime((uint16_t)timeinfo.tm_year, (uint8_t)timeinfo.tm_mon, (uint8_t)timeinfo.tm_mday,
+                                                   (uint8_t)timeinfo.tm_hour, (uint8_t)timeinfo.tm_min, (uint8_t)timeinfo.tm_sec);
+    binary->Write(cellLog, filename(t, ".dbl").c_str(), time, &cells, cmi, 1, numberOfCells, numberOfCells);
+  }
+  cellLog.Close();
+  keyframes += binary->keyframes;
+  deltas += binary->deltas;
+  delete binary;
+  const Phase dbl{fs::counters, cellLog.writes - writesBefore,
+                  std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count()};
+
+  bool ok = true;
+  uint64_t csvBytes = 0;
+  uint64_t dblBytes = 0;
+  double convert_ms = 0;
+  uint32_t indexed = 0;
+  uint32_t files = 0;
+  for (uint32_t day = 0; day <= days; day++)
+  {
+    const std::vector<uint8_t> expected = readFile(csvDir + filename(start + day * 86400, ".csv"));
+    const std::string name = filename(start + day * 86400, ".dbl");
+    const std::vector<uint8_t> file = readFile(dblDir + name);
+    if (expected.empty() && file.empty())
+    {
+      continue;
+    }
+    files++;
+    csvBytes += expected.size();
+    dblBytes += file.size();
+
+    std::string converted;
+    BinaryCellLogReader::Result result;
+    const auto convertStarted = std::chrono::steady_clock::now();
+    if (!BinaryCellLogReader::ToCsv(file, converted, result))
+    {
+      printf("%s: %s\n", name.c_str(), result.error.c_str());
+      ok = false;
+    }
+    convert_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - convertStarted).count();
+    if (converted != std::string(expected.begin(), expected.end()))
+    {
+      printf("%s converts to %u bytes of CSV, not the %u written\n", name.c_str(), (uint32_t)converted.size(), (uint32_t)expected.size());
+      ok = false;
+    }
+
+    // The index reaches back to the block the restart cut short, or the start of the file.  The day's
+    // last block has none as the file wasn't closed by a new day.
+    auto forward = result.blocks;
+    if (day == days)
+    {
+      forward.pop_back();
+    }
+    const auto index = BinaryCellLogReader::Index(day == days ? std::vector<uint8_t>(file.begin(), file.begin() + result.blocks.back().offset) : file);
+    indexed += (uint32_t)index.size();
+    bool same = index.size() <= forward.size() && !index.empty();
+    for (size_t i = 0; same && i < index.size(); i++)
+    {
+      const auto &a = index[index.size() - 1 - i];
+      const auto &b = forward[forward.size() - 1 - i];
+      same = a.offset == b.offset && a.records == b.records && a.firstTime == b.firstTime && a.lastTime == b.lastTime;
+    }
+    if (!same)
+    {
+      printf("%s: index of %u blocks does not match the %u blocks read\n", name.c_str(), (uint32_t)index.size(), (uint32_t)forward.size());
+      ok = false;
+    }
+
+    // Cut by a power cut part way through a record
+    const size_t cut = result.blocks.back().offset + 7;
+    std::string partial;
+    BinaryCellLogReader::Result partialResult;
+    if (BinaryCellLogReader::ToCsv(std::vector<uint8_t>(file.begin(), file.begin() + cut), partial, partialResult) ||
+        partial.compare(0, std::string::npos, converted, 0, partial.size()) != 0 ||
+        partialResult.keyframes + partialResult.deltas != result.keyframes + result.deltas - result.blocks.back().records)
+    {
+      printf("%s: cut at byte %u did not convert up to there\n", name.c_str(), (uint32_t)cut);
+      ok = false;
+    }
+  }
+  if (cellLog.bytesDropped != 0)
+  {
+    printf("%u bytes dropped\n", cellLog.bytesDropped);
+    ok = false;
+  }
+
+  printf("%u days of %u modules every %u seconds, %u rows, %u files\n", days, numberOfCells, interval, rows, files);
+  printf("csv     %10llu bytes %8.1f a row  %6u SD writes %7u sector writes  host cpu %6.2f us a row\n", (unsigned long long)csvBytes,
+         (double)csvBytes / rows, csv.writes, csv.card.sectorWrites, csv.cpu_ms * 1000.0 / rows);
+  printf("binary  %10llu bytes %8.1f a row  %6u SD writes %7u sector writes  host cpu %6.2f us a row\n", (unsigned long long)dblBytes,
+         (double)dblBytes / rows, dbl.writes, dbl.card.sectorWrites, dbl.cpu_ms * 1000.0 / rows);
+  printf("        %.1f times smaller, %u keyframes %u deltas, %u blocks indexed, dbl2csv %.2f us a row\n", (double)csvBytes / max(1.0, (double)dblBytes),
+         keyframes, deltas, indexed, convert_ms * 1000.0 / rows);
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+  Host check and benchmark of the module history (ESPController/src/CellHistory.cpp, compiled unchanged).
+
+  Simulated packs of 16, 64 and 200 modules are sampled every "interval" seconds for "hours": a slow
+  charge/discharge swing, a few mV of noise, internal temperatures drifting with balancing and the
+  occasional missed reply.  For each pack it reports
+
+    bits      average bits per module sample (voltage and both temperatures)
+    pool      bytes Begin allocated for the number of modules and the memory free
+    chunk     chunk size picked for the number of modules
+    snapshot  bytes per snapshot of every module, including the times
+    held      hours of history the pool holds for every module of that pack, CompleteTime() must agree
+    encode    time to add one snapshot
+    decode    time to read one module, and one bank of 16, over everything held
+
+  Every sample read back is compared with what was added (temperatures with the last ones stored),
+  any difference exits with 1.
+
+  The free internal heap (and its largest block) and PSRAM are in KB, the default is a board without PSRAM.
+
+  Usage: cell_history_benchmark [hours=8] [interval=5] [heap=200] [largest=110] [psram=0]
+*/
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <chrono>
+
+#include "defines.h"
+#include "CellHistory.h"
+
+#include "../../ESPController/src/CellHistory.cpp"
+
+uint32_t millis() { return 0; }
+int64_t esp_timer_get_time()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static CellReadings cells;
+
+struct Added
+{
+  uint16_t voltagemV;
+  int8_t internalTemp;
+  int8_t externalTemp;
+};
+
+static bool run(uint8_t numberOfCells, uint32_t hours, uint32_t interval)
+{
+  // Fresh pool for each pack
+  auto *history = new CellHistory();
+  if (!history->Begin(numberOfCells))
+  {
+    printf("No memory\n");
+    return false;
+  }
+
+  const uint32_t start = 1790000000;
+  const uint32_t snapshots = hours * 3600 / interval;
+  std::vector<uint32_t> times(snapshots);
+  std::vector<Added> added((size_t)snapshots * numberOfCells);
+
+  srand(numberOfCells);
+  memset(&cells, 0, sizeof(cells));
+  for (uint32_t s = 0; s < snapshots; s++)
+  {
+    // Polling is not exactly regular
+    const uint32_t now = start + s * interval + (rand() % 8 == 0 ? 1 : 0);
+    times[s] = now;
+    const double swing = 120.0 * sin(s * interval * 2 * M_PI / (6 * 3600.0));
+
+    for (uint8_t m = 0; m < numberOfCells; m++)
+    {
+      cells.valid[m] = rand() % 2000 != 0;
+      cells.voltagemV[m] = (uint16_t)(3300 + m % 7 + swing + (rand() % 5) - 2);
+      if (rand() % 100 == 0)
+      {
+        cells.internalTemp[m] = (int8_t)(25 + (swing > 80 ? rand() % 3 : 0));
+      }
+      cells.externalTemp[m] = (int8_t)(20 + (s * interval / 1800) % 3);
+
+      added[(size_t)s * numberOfCells + m] = {cells.valid[m] ? cells.voltagemV[m] : (uint16_t)0, cells.internalTemp[m], cells.externalTemp[m]};
+    }
+    history->Add(now, &cells, numberOfCells);
+  }
+
+  // Read back everything held.  Samples are compared from the newest, so a gap shows up as a mismatch.
+  CellHistory::Sample samples[64];
+  uint32_t mismatches = 0;
+  double moduleDecode_us = 0;
+  double bankDecode_us = 0;
+  uint32_t read = 0;
+  // Snapshots held for every module, chunks are dropped separately so some modules go back further
+  uint32_t held = snapshots;
+  for (uint8_t m = 0; m < numberOfCells; m++)
+  {
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<CellHistory::Sample> all;
+    uint32_t next = 0;
+    uint16_t n;
+    while ((n = history->Read(m, 0, UINT32_MAX, next, samples, 64)) > 0)
+    {
+      all.insert(all.end(), samples, samples + n);
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+    if (m == 0)
+    {
+      moduleDecode_us = us;
+    }
+    if (m < 16)
+    {
+      bankDecode_us += us;
+    }
+
+    uint32_t s = snapshots - (uint32_t)all.size();
+    for (const auto &sample : all)
+    {
+      const Added &a = added[(size_t)s * numberOfCells + m];
+      // Temperatures are stored every sixth snapshot
+      const Added &t = added[(size_t)(s - s % 6) * numberOfCells + m];
+      if (sample.time != times[s] || sample.voltagemV != a.voltagemV || sample.internalTemp != t.internalTemp || sample.externalTemp != t.externalTemp)
+      {
+        if (mismatches++ < 5)
+        {
+          printf("Module %u snapshot %u: read %u %u %i %i, added %u %u %i %i\n", m, s, sample.time, sample.voltagemV, sample.internalTemp,
+                 sample.externalTemp, times[s], a.voltagemV, t.internalTemp, t.externalTemp);
+        }
+      }
+      s++;
+    }
+    held = min(held, (uint32_t)all.size());
+    read += (uint32_t)all.size();
+  }
+  if (held == 0)
+  {
+    printf("A module has no samples\n");
+    delete history;
+    return false;
+  }
+  const uint32_t firstSnapshot = snapshots - held;
+  if (history->CompleteTime() != times[firstSnapshot])
+  {
+    printf("CompleteTime %u, every module has samples from %u\n", history->CompleteTime(), times[firstSnapshot]);
+    mismatches++;
+  }
+
+  // A window of 10 minutes from the middle of what is held
+  const uint32_t from = times[firstSnapshot + (snapshots - firstSnapshot) / 2];
+  const uint32_t to = from + 600;
+  uint32_t expected = 0;
+  for (uint32_t s = firstSnapshot; s < snapshots; s++)
+  {
+    expected += (times[s] >= from && times[s] <= to) ? 1 : 0;
+  }
+  uint32_t next = 0;
+  uint32_t windowCount = 0;
+  uint16_t n;
+  while ((n = history->Read(numberOfCells - 1, from, to, next, samples, 64)) > 0)
+  {
+    for (uint16_t i = 0; i < n; i++)
+    {
+      if (samples[i].time < from || samples[i].time > to)
+      {
+        mismatches++;
+      }
+    }
+    windowCount += n;
+  }
+  if (windowCount != expected)
+  {
+    printf("Window of 10 minutes returned %u samples, expected %u\n", windowCount, expected);
+    mismatches++;
+  }
+
+  const double bits = (double)history->cellBits / history->cellSamples;
+  // Whole pool over the snapshots it holds, so chunk headers and unused bits are included
+  const double snapshotBytes = (double)history->PoolSize() / held;
+  printf("%3u modules  bits %.2f  pool %7u  chunk %3u  snapshot %6.1f bytes  held %5.2f h  encode %6.2f us  decode module %7.1f us  bank %8.1f us (%u samples read)\n",
+         numberOfCells, bits, history->PoolSize(), history->ChunkSize(), snapshotBytes, held * interval / 3600.0,
+         (double)history->encode_us / history->snapshots, moduleDecode_us, bankDecode_us, read);
+
+  // A different number of modules starts again
+  history->Add(times[snapshots - 1] + interval, &cells, numberOfCells / 2);
+  uint32_t after = 0;
+  if (history->Read(0, 0, UINT32_MAX, after, samples, 64) != 1 || history->CompleteTime() != times[snapshots - 1] + interval)
+  {
+    printf("History not restarted for %u modules\n", numberOfCells / 2);
+    mismatches++;
+  }
+
+  delete history;
+  return mismatches == 0;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t hours = 8;
+  uint32_t interval = 5;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "hours=", 6) == 0)
+    {
+      hours = (uint32_t)atoi(argv[i] + 6);
+    }
+    else if (strncmp(argv[i], "interval=", 9) == 0)
+    {
+      interval = (uint32_t)max(1, atoi(argv[i] + 9));
+    }
+    else if (strncmp(argv[i], "heap=", 5) == 0)
+    {
+      host_heap_internal = (size_t)atoi(argv[i] + 5) * 1024;
+    }
+    else if (strncmp(argv[i], "largest=", 8) == 0)
+    {
+      host_heap_internal_largest = (size_t)atoi(argv[i] + 8) * 1024;
+    }
+    else if (strncmp(argv[i], "psram=", 6) == 0)
+    {
+      host_heap_spiram = (size_t)atoi(argv[i] + 6) * 1024;
+    }
+  }
+
+  printf("Heap %uKB (largest block %uKB), PSRAM %uKB, %u hours of snapshots every %u seconds\n", (uint32_t)(host_heap_internal / 1024),
+         (uint32_t)(host_heap_internal_largest / 1024), (uint32_t)(host_heap_spiram / 1024), hours, interval);
+
+  bool ok = true;
+  for (uint8_t numberOfCells : {16, 64, 200})
+  {
+    ok &= run(numberOfCells, hours, interval);
+  }
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
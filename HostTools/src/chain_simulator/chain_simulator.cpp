@@ -0,0 +1,959 @@
+/*
+  Virtual module chain simulator.
+
+  Runs the controller request/reply code (PacketRequestGenerator and PacketReceiveProcessor) against
+  a chain of virtual cell modules, each running the module firmware packet handling
+  (ATTINYCellModule PacketProcessor::onPacketReceived), to measure throughput without hardware.
+
+  Every byte is clocked around the ring at the configured baud rate (8N1, COBS framed).
+  Modules store and forward: a packet is processed once its delimiter has arrived and is then sent
+  on to the next module, even if the CRC check failed.  Bytes arriving whilst a module is busy wait
+  in its 64 byte serial receive buffer, any more are lost.
+
+  transmit_task (fixed or reply driven pacing) and enqueue_task are reproduced here.  Sweeps are
+  queued back to back, so the results are the maximum rate the ring can sustain.
+
+  The run starts with a timing request and a settings request per module (as the controller does
+  after power up), then the sweeps, then a fault free read of every module's bad packet counter.
+
+  Sweep latency is the time from a sweep being queued until its voltage snapshot is complete
+  (PacketReceiveProcessor notifies voltageandstatussnapshot_task).
+
+  Usage: chain_simulator [option=value ...]
+    modules=16      modules in the chain (1-200)
+    baud=5000       baud rate of the ring
+    sweeps=100      voltage and temperature sweeps to run
+    window=0        0 = fixed delay pacing, 1-32 = reply driven pacing with this window
+    processing=5    module time (ms) from receiving a packet to starting to send it on
+    drop=0          chance (parts per million) of a byte being lost on each link
+    corrupt=0       chance (parts per million) of a byte being damaged on each link
+    link=all        only drop/damage bytes on this link (0 = controller to first module, modules = back to controller)
+    dead=M@A-B      module M (0 = first) is unresponsive from sweep A to sweep B, repeatable
+    seed=1          random number seed
+    log=0           1 = print controller warnings and errors
+*/
+
+#include <Arduino.h>
+
+#include <queue>
+
+#include "defines.h"
+#include "PacketRequestGenerator.h"
+#include "PacketReceiveProcessor.h"
+
+#include "virtual_module.h"
+
+// Globals which main.cpp provides to the controller code
+CellModuleInfo cmi[maximum_controller_cell_modules];
+CellReadings cellReadings;
+static HostTask transmit_task;
+static HostTask voltageandstatussnapshot_task;
+TaskHandle_t transmit_task_handle = &transmit_task;
+TaskHandle_t voltageandstatussnapshot_task_handle = &voltageandstatussnapshot_task;
+
+static int64_t simulated_time_us = 0;
+
+uint32_t millis() { return (uint32_t)(simulated_time_us / 1000); }
+int64_t esp_timer_get_time() { return simulated_time_us; }
+
+// Size of the module serial receive buffer (RX_BUFFER_SIZE in the module firmware)
+static constexpr size_t module_rx_buffer = 64;
+
+// Cell voltage presented to every module
+static constexpr uint16_t cell_millivolt = 3300;
+
+static constexpr uint32_t no_sweep = UINT32_MAX;
+
+struct DeadModule
+{
+  uint8_t module;
+  uint32_t from_sweep;
+  uint32_t to_sweep;
+};
+
+struct Options
+{
+  uint16_t modules = 16;
+  uint16_t baudrate = 5000;
+  uint32_t sweeps = 100;
+  uint8_t window = 0;
+  int64_t processing_us = 5000;
+  uint32_t drop_ppm = 0;
+  uint32_t corrupt_ppm = 0;
+  int32_t fault_link = -1;
+  std::vector<DeadModule> dead;
+  uint32_t seed = 1;
+};
+
+// COBS encoding as used by SerialEncoder, followed by the zero delimiter
+static std::vector<uint8_t> cobs_encode(const uint8_t *data, size_t length)
+{
+  std::vector<uint8_t> out;
+  out.reserve(length + 2);
+
+  size_t code_index = 0;
+  uint8_t code = 1;
+  out.push_back(0);
+
+  for (size_t i = 0; i < length; i++)
+  {
+    if (data[i] == 0)
+    {
+      out[code_index] = code;
+      code_index = out.size();
+      out.push_back(0);
+      code = 1;
+      continue;
+    }
+
+    out.push_back(data[i]);
+    code++;
+    if (code == 0xFF)
+    {
+      out[code_index] = code;
+      code_index = out.size();
+      out.push_back(0);
+      code = 1;
+    }
+  }
+
+  out[code_index] = code;
+  out.push_back(0);
+  return out;
+}
+
+// Returns decoded length, zero if the frame is invalid or too big
+static size_t cobs_decode(const std::vector<uint8_t> &in, uint8_t *out, size_t out_size)
+{
+  size_t r = 0;
+  size_t w = 0;
+  while (r < in.size())
+  {
+    const uint8_t code = in[r];
+    if (code == 0 || r + code > in.size())
+    {
+      return 0;
+    }
+    r++;
+
+    for (uint8_t i = 1; i < code; i++)
+    {
+      if (w == out_size)
+      {
+        return 0;
+      }
+      out[w++] = in[r++];
+    }
+
+    if (code != 0xFF && r != in.size())
+    {
+      if (w == out_size)
+      {
+        return 0;
+      }
+      out[w++] = 0;
+    }
+  }
+  return w;
+}
+
+class ChainSimulator
+{
+public:
+  explicit ChainSimulator(const Options &o) : options(o), modules(o.modules), prng_state(o.seed ? o.seed : 1)
+  {
+    prg.begin();
+    byte_us = 10 * 1000000 / options.baudrate;
+    sweep_of_sequence.assign(UINT16_MAX + 1, no_sweep);
+    packets_corrupted.assign(options.modules + 1, 0);
+  }
+
+  void Run();
+
+private:
+  enum EventType : uint8_t
+  {
+    ByteArrived,
+    ProcessingFinished,
+    TransmitFinished,
+    ControllerWake
+  };
+
+  struct Event
+  {
+    int64_t time_us;
+    uint64_t order;
+    EventType type;
+    uint16_t node;
+    uint8_t value;
+
+    bool operator>(const Event &e) const { return time_us != e.time_us ? time_us > e.time_us : order > e.order; }
+  };
+
+  enum Phase : uint8_t
+  {
+    Startup,
+    Sweeps,
+    Readout,
+    Finished
+  };
+
+  struct Module
+  {
+    // Bytes received since the last delimiter
+    std::vector<uint8_t> frame;
+    // Bytes which arrived whilst the module was busy
+    std::deque<uint8_t> rx_buffer;
+    uint8_t packet[64];
+    bool busy = false;
+    bool dead = false;
+  };
+
+  const Options &options;
+  std::vector<Module> modules;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  uint64_t event_order = 0;
+  int64_t byte_us;
+  bool faults = true;
+
+  uint32_t prng_state;
+
+  // Controller
+  PacketRequestGenerator prg;
+  PacketReceiveProcessor receiveProc;
+  uint16_t sequence = 0;
+  int64_t last_sent = 0;
+  int64_t controller_tx_free = 0;
+  std::vector<uint8_t> controller_frame;
+  // Inside vTaskDelay, only the timer wakes the task
+  bool controller_delay = false;
+  // Inside ulTaskNotifyTake, a reply also wakes the task
+  bool controller_wait = false;
+  uint64_t controller_wake_generation = 0;
+
+  // Work generation
+  Phase phase = Startup;
+  uint16_t next_settings_module = 0;
+  bool timing_sent = false;
+  uint32_t sweeps_enqueued = 0;
+  uint32_t queued_sweep = no_sweep;
+  std::vector<uint32_t> sweep_of_sequence;
+  std::vector<int64_t> sweep_started;
+
+  // Results
+  int64_t sweeps_start_us = 0;
+  int64_t sweeps_end_us = 0;
+  uint32_t replies_at_sweeps_start = 0;
+  uint32_t requests_sent = 0;
+  uint32_t snapshots = 0;
+  int64_t latency_min_us = INT64_MAX;
+  int64_t latency_max_us = 0;
+  int64_t latency_total_us = 0;
+  uint32_t bytes_dropped = 0;
+  uint32_t bytes_corrupted = 0;
+  // Packets damaged on each link, indexed like PacketReceiveProcessor::GetLinkErrors
+  std::vector<uint32_t> packets_corrupted;
+  uint32_t rx_overflow_bytes = 0;
+  uint32_t framing_errors = 0;
+
+  uint32_t prng()
+  {
+    prng_state ^= prng_state << 13;
+    prng_state ^= prng_state >> 17;
+    prng_state ^= prng_state << 5;
+    return prng_state;
+  }
+
+  void Schedule(int64_t time_us, EventType type, uint16_t node, uint8_t value = 0)
+  {
+    events.push(Event{time_us, event_order++, type, node, value});
+  }
+
+  // Sender is a module number, or options.modules for the controller
+  // Bytes go to the next module, the last module sends to the controller
+  int64_t Transmit(uint16_t sender, int64_t start_us, const std::vector<uint8_t> &bytes);
+
+  void ModuleByte(uint16_t m, uint8_t b);
+  void ModuleDecode(uint16_t m, uint8_t b);
+  void ModuleProcessingFinished(uint16_t m);
+  void ModuleTransmitFinished(uint16_t m);
+  void SetDeadModules(uint32_t sweep);
+
+  void ControllerByte(uint8_t b);
+  void ControllerPacketReceived(PacketStruct *ps);
+  void ControllerRun();
+  int64_t WaitForWindow();
+  bool Enqueue();
+  void EnqueueSweep();
+
+  void ProcessEvents();
+  void Report();
+};
+
+int64_t ChainSimulator::Transmit(uint16_t sender, int64_t start_us, const std::vector<uint8_t> &bytes)
+{
+  const uint16_t target = (sender == options.modules) ? 0 : sender + 1;
+  // The controller is node "modules", so the link index is the receiving node
+  const uint16_t link = target;
+  const bool faults_on_link = faults && (options.fault_link < 0 || options.fault_link == link);
+  bool damaged = false;
+
+  for (size_t i = 0; i < bytes.size(); i++)
+  {
+    uint8_t b = bytes[i];
+
+    if (faults_on_link && options.drop_ppm && (prng() % 1000000) < options.drop_ppm)
+    {
+      bytes_dropped++;
+      continue;
+    }
+
+    if (faults_on_link && options.corrupt_ppm && (prng() % 1000000) < options.corrupt_ppm)
+    {
+      b ^= (uint8_t)(1 << (prng() % 8));
+      bytes_corrupted++;
+      damaged = true;
+    }
+
+    // Each byte has fully arrived once its stop bit has been clocked out
+    Schedule(start_us + (int64_t)(i + 1) * byte_us, ByteArrived, target, b);
+  }
+
+  if (damaged)
+  {
+    packets_corrupted[link]++;
+  }
+
+  return start_us + (int64_t)bytes.size() * byte_us;
+}
+
+void ChainSimulator::ModuleByte(uint16_t m, uint8_t b)
+{
+  Module &module = modules[m];
+
+  if (module.dead)
+  {
+    return;
+  }
+
+  if (module.busy)
+  {
+    if (module.rx_buffer.size() == module_rx_buffer)
+    {
+      rx_overflow_bytes++;
+      return;
+    }
+    module.rx_buffer.push_back(b);
+    return;
+  }
+
+  ModuleDecode(m, b);
+}
+
+void ChainSimulator::ModuleDecode(uint16_t m, uint8_t b)
+{
+  Module &module = modules[m];
+
+  if (b != 0)
+  {
+    // Limit growth when delimiters are being lost
+    if (module.frame.size() < 256)
+    {
+      module.frame.push_back(b);
+    }
+    return;
+  }
+
+  if (module.frame.empty())
+  {
+    return;
+  }
+
+  const size_t length = cobs_decode(module.frame, module.packet, sizeof(module.packet));
+  module.frame.clear();
+
+  if (length != VirtualModules::packetSize)
+  {
+    // SerialEncoder only calls the packet handler for a complete packet
+    framing_errors++;
+    return;
+  }
+
+  module.busy = true;
+  Schedule(simulated_time_us + options.processing_us, ProcessingFinished, m);
+}
+
+void ChainSimulator::ModuleProcessingFinished(uint16_t m)
+{
+  Module &module = modules[m];
+
+  if (module.dead)
+  {
+    module.busy = false;
+    return;
+  }
+
+  // Same as onPacketReceived() in the module firmware, the packet is always sent on
+  VirtualModules::PacketReceived((uint8_t)m, module.packet);
+  auto finished = Transmit(m, simulated_time_us, cobs_encode(module.packet, VirtualModules::packetSize));
+  Schedule(finished, TransmitFinished, m);
+}
+
+void ChainSimulator::ModuleTransmitFinished(uint16_t m)
+{
+  Module &module = modules[m];
+  module.busy = false;
+
+  // Catch up with the receive buffer, this may start processing another packet
+  while (!module.busy && !module.rx_buffer.empty())
+  {
+    uint8_t b = module.rx_buffer.front();
+    module.rx_buffer.pop_front();
+    ModuleDecode(m, b);
+  }
+}
+
+void ChainSimulator::SetDeadModules(uint32_t sweep)
+{
+  for (uint16_t m = 0; m < options.modules; m++)
+  {
+    bool dead = false;
+    for (const auto &d : options.dead)
+    {
+      if (d.module == m && sweep >= d.from_sweep && sweep <= d.to_sweep)
+      {
+        dead = true;
+      }
+    }
+
+    if (dead && !modules[m].dead)
+    {
+      // Anything part received or waiting is lost
+      modules[m].frame.clear();
+      modules[m].rx_buffer.clear();
+    }
+    modules[m].dead = dead;
+  }
+}
+
+void ChainSimulator::ControllerByte(uint8_t b)
+{
+  if (b != 0)
+  {
+    if (controller_frame.size() < 256)
+    {
+      controller_frame.push_back(b);
+    }
+    return;
+  }
+
+  if (controller_frame.empty())
+  {
+    return;
+  }
+
+  PacketStruct ps;
+  const size_t length = cobs_decode(controller_frame, (uint8_t *)&ps, sizeof(ps));
+  controller_frame.clear();
+
+  if (length != sizeof(PacketStruct))
+  {
+    framing_errors++;
+    return;
+  }
+
+  ControllerPacketReceived(&ps);
+}
+
+void ChainSimulator::ControllerPacketReceived(PacketStruct *ps)
+{
+  const uint32_t snapshot_notifications = voltageandstatussnapshot_task.notifications;
+
+  // onPacketReceived() and replyqueue_task in main.cpp, the reply is processed as it arrives
+  receiveProc.ProcessReply(ps, millis());
+
+  if (voltageandstatussnapshot_task.notifications != snapshot_notifications)
+  {
+    // Complete set of voltages received, how long since the sweep was queued?
+    const uint32_t sweep = sweep_of_sequence[receiveProc.packetLastReceivedSequence];
+    if (sweep != no_sweep)
+    {
+      const int64_t latency = simulated_time_us - sweep_started[sweep];
+      latency_min_us = min(latency_min_us, latency);
+      latency_max_us = max(latency_max_us, latency);
+      latency_total_us += latency;
+      snapshots++;
+    }
+  }
+
+  if (transmit_task.notifications > 0)
+  {
+    transmit_task.notifications = 0;
+    if (controller_wait)
+    {
+      // ulTaskNotifyTake returns early
+      controller_wait = false;
+      controller_wake_generation++;
+      ControllerRun();
+    }
+  }
+}
+
+// Same decisions as wait_for_window() in main.cpp
+// Returns the time ulTaskNotifyTake() would wait for, zero when the next request can be sent
+int64_t ChainSimulator::WaitForWindow()
+{
+  const int64_t legacy_delay = (int64_t)PacketPacing::LegacyDelay(options.baudrate) * 1000;
+  const int64_t spacing = (int64_t)PacketPacing::MinimumSpacing(options.baudrate) * 1000;
+
+  receiveProc.ExpireRequests();
+
+  const int64_t elapsed = esp_timer_get_time() - last_sent;
+
+  if (elapsed >= legacy_delay)
+  {
+    return 0;
+  }
+
+  int64_t wait = legacy_delay - elapsed;
+
+  auto outstanding = receiveProc.OutstandingRequests();
+  if (outstanding < options.window)
+  {
+    if (outstanding == 0 || elapsed >= spacing)
+    {
+      return 0;
+    }
+    wait = spacing - elapsed;
+  }
+
+  // pdMS_TO_TICKS(wait / 1000) + 1 with a 1ms tick
+  return (wait / 1000 + 1) * 1000;
+}
+
+// Same as transmit_task() in main.cpp
+void ChainSimulator::ControllerRun()
+{
+  if (controller_delay || controller_wait)
+  {
+    return;
+  }
+
+  if (options.window > 0)
+  {
+    auto wait = WaitForWindow();
+    if (wait > 0)
+    {
+      controller_wait = true;
+      Schedule(simulated_time_us + wait, ControllerWake, 0, (uint8_t)++controller_wake_generation);
+      return;
+    }
+  }
+
+  if (prg.queueLength() == 0 && !Enqueue())
+  {
+    // Nothing left to send
+    return;
+  }
+
+  PacketStruct transmitBuffer;
+  prg.nextRequest(&transmitBuffer, portMAX_DELAY);
+
+  sequence++;
+  transmitBuffer.sequence = sequence;
+  sweep_of_sequence[sequence] = queued_sweep;
+
+  if (transmitBuffer.command == COMMAND::Timing)
+  {
+    auto t = millis();
+    transmitBuffer.moduledata[0] = (t & 0xFFFF0000) >> 16;
+    transmitBuffer.moduledata[1] = t & (uint32_t)0x0000FFFF;
+  }
+
+  transmitBuffer.crc = CRC16::CalculateArray((uint8_t *)&transmitBuffer, sizeof(PacketStruct) - 2);
+
+  // UART driver queues the bytes behind anything still being sent
+  controller_tx_free = Transmit(options.modules, max(simulated_time_us, controller_tx_free), cobs_encode((uint8_t *)&transmitBuffer, sizeof(PacketStruct)));
+  requests_sent++;
+
+  last_sent = esp_timer_get_time();
+  receiveProc.RequestSent(sequence, options.window);
+
+  if (options.window == 0)
+  {
+    receiveProc.ExpireRequests();
+    controller_delay = true;
+    Schedule(simulated_time_us + (int64_t)PacketPacing::LegacyDelay(options.baudrate) * 1000, ControllerWake, 0, (uint8_t)++controller_wake_generation);
+    return;
+  }
+
+  // Reply driven, go straight back to waiting for the window
+  ControllerRun();
+}
+
+// Same requests as enqueue_task() in main.cpp
+void ChainSimulator::EnqueueSweep()
+{
+  queued_sweep = sweeps_enqueued;
+  sweep_started.push_back(simulated_time_us);
+  SetDeadModules(queued_sweep);
+
+  uint16_t i = 0;
+  auto max = options.modules;
+  uint8_t startmodule = 0;
+
+  while (i < max)
+  {
+    uint8_t endmodule = (startmodule + maximum_cell_modules_per_packet) - 1;
+
+    if (endmodule >= max)
+    {
+      endmodule = max - 1;
+    }
+
+    prg.sendCellVoltageRequest(startmodule, endmodule);
+    prg.sendCellTemperatureRequest(startmodule, endmodule);
+
+    for (uint8_t m = startmodule; m <= endmodule; m++)
+    {
+      if (cellReadings.inBypass[m])
+      {
+        prg.sendReadBalancePowerRequest(startmodule, endmodule);
+        break;
+      }
+    }
+
+    startmodule = endmodule + 1;
+    i += maximum_cell_modules_per_packet;
+  }
+
+  sweeps_enqueued++;
+}
+
+// Refill the (empty) request queue, returns false when there is no more work in this phase
+bool ChainSimulator::Enqueue()
+{
+  switch (phase)
+  {
+  case Startup:
+    // Same order as the controller after power up, timing then settings for each module
+    if (!timing_sent)
+    {
+      prg.sendTimingRequest();
+      timing_sent = true;
+    }
+    while (next_settings_module < options.modules && prg.queueLength() < 16)
+    {
+      prg.sendGetSettingsRequest((uint8_t)next_settings_module);
+      next_settings_module++;
+    }
+    if (next_settings_module == options.modules)
+    {
+      phase = Sweeps;
+    }
+    return true;
+
+  case Sweeps:
+    if (sweeps_enqueued == options.sweeps)
+    {
+      return false;
+    }
+    if (sweeps_enqueued == 0)
+    {
+      sweeps_start_us = simulated_time_us;
+      replies_at_sweeps_start = receiveProc.packetsReceived;
+    }
+    EnqueueSweep();
+    return true;
+
+  case Readout:
+    queued_sweep = no_sweep;
+    for (uint16_t m = 0; m < options.modules; m += maximum_cell_modules_per_packet)
+    {
+      prg.sendReadBadPacketCounter((uint8_t)m, (uint8_t)min(m + maximum_cell_modules_per_packet - 1, options.modules - 1));
+    }
+    phase = Finished;
+    return true;
+
+  case Finished:
+    return false;
+  }
+  return false;
+}
+
+void ChainSimulator::ProcessEvents()
+{
+  while (!events.empty())
+  {
+    const Event e = events.top();
+    events.pop();
+    simulated_time_us = e.time_us;
+
+    switch (e.type)
+    {
+    case ByteArrived:
+      if (e.node == options.modules)
+      {
+        ControllerByte(e.value);
+      }
+      else
+      {
+        ModuleByte(e.node, e.value);
+      }
+      break;
+    case ProcessingFinished:
+      ModuleProcessingFinished(e.node);
+      break;
+    case TransmitFinished:
+      ModuleTransmitFinished(e.node);
+      break;
+    case ControllerWake:
+      if (e.value == (uint8_t)controller_wake_generation)
+      {
+        controller_delay = false;
+        controller_wait = false;
+        ControllerRun();
+      }
+      break;
+    }
+  }
+}
+
+void ChainSimulator::Run()
+{
+  VirtualModules::Begin(cell_millivolt);
+
+  // Start up and sweeps, with faults
+  ControllerRun();
+  ProcessEvents();
+  sweeps_end_us = simulated_time_us;
+
+  // Anything still outstanding has been lost
+  simulated_time_us += (int64_t)receiveProc.ReplyTimeout() * 1000 + 1000;
+  receiveProc.ExpireRequests();
+
+  // Collect the module bad packet counters
+  faults = false;
+  SetDeadModules(no_sweep);
+  for (auto &m : modules)
+  {
+    m.frame.clear();
+    m.rx_buffer.clear();
+  }
+  controller_frame.clear();
+  const uint32_t lost_before_readout = receiveProc.LostRequests();
+  const uint16_t crc_before_readout = receiveProc.totalCRCErrors;
+
+  phase = Readout;
+  ControllerRun();
+  ProcessEvents();
+
+  Report();
+
+  if (receiveProc.LostRequests() != lost_before_readout || receiveProc.totalCRCErrors != crc_before_readout)
+  {
+    printf("\nWARNING: bad packet counters could not be read from every module\n");
+  }
+}
+
+void ChainSimulator::Report()
+{
+  const double elapsed_s = (double)(sweeps_end_us - sweeps_start_us) / 1e6;
+
+  uint32_t bad_packets = 0;
+  uint16_t wrong_voltage = 0;
+  for (uint16_t m = 0; m < options.modules; m++)
+  {
+    bad_packets += cmi[m].badPacketCount;
+    if (cellReadings.voltagemV[m] < cell_millivolt - 5 || cellReadings.voltagemV[m] > cell_millivolt + 5)
+    {
+      wrong_voltage++;
+    }
+  }
+
+  printf("Chain of %u modules at %u baud, ", options.modules, options.baudrate);
+  if (options.window == 0)
+  {
+    printf("fixed %ums delay pacing\n", PacketPacing::LegacyDelay(options.baudrate));
+  }
+  else
+  {
+    printf("reply driven pacing, window %u\n", options.window);
+  }
+  printf("Module processing %.1fms, byte loss %uppm, byte corruption %uppm\n",
+         options.processing_us / 1000.0, options.drop_ppm, options.corrupt_ppm);
+  for (const auto &d : options.dead)
+  {
+    printf("Module %u unresponsive during sweeps %u-%u\n", d.module, d.from_sweep, d.to_sweep);
+  }
+
+  printf("\n");
+  printf("%-28s %u of %u\n", "Complete sweeps", snapshots, options.sweeps);
+  printf("%-28s %.1f\n", "Elapsed (s)", elapsed_s);
+  if (snapshots > 0)
+  {
+    printf("%-28s min %.1f, avg %.1f, max %.1f\n", "Sweep latency (ms)",
+           latency_min_us / 1000.0, latency_total_us / 1000.0 / snapshots, latency_max_us / 1000.0);
+    printf("%-28s %.2f\n", "Sweeps per second", snapshots / elapsed_s);
+  }
+  printf("%-28s %.2f\n", "Replies per second", (receiveProc.packetsReceived - replies_at_sweeps_start) / elapsed_s);
+  printf("%-28s %u\n", "Requests sent", requests_sent);
+  printf("%-28s %u\n", "Requests coalesced", prg.packetsCoalesced);
+  printf("%-28s %u\n", "Replies received", receiveProc.packetsReceived);
+  printf("%-28s %u\n", "Modules found", receiveProc.totalModulesFound);
+  printf("%-28s %u\n", "Round trip (ms)", receiveProc.packetTimerMillisecond);
+
+  printf("\nRequest lanes\n");
+  const char *laneNames[numberOfRequestPriorities] = {"Safety", "Telemetry", "Housekeeping"};
+  for (uint8_t p = 0; p < numberOfRequestPriorities; p++)
+  {
+    auto s = prg.getStatistics((RequestPriority)p);
+    printf("%-28s sent %u, max queued %u, wait avg %.0fms max %ums\n", laneNames[p], s.sent, s.maximumQueueLength,
+           s.sent ? (double)s.waitTotal / s.sent : 0.0, s.waitMaximum);
+  }
+
+  printf("\nErrors\n");
+  printf("%-28s %u\n", "Lost requests", receiveProc.LostRequests());
+  printf("%-28s %u\n", "Unmatched replies", receiveProc.UnmatchedReplies());
+  printf("%-28s %u\n", "Controller CRC errors", receiveProc.totalCRCErrors);
+  printf("%-28s %u\n", "Out of sequence", receiveProc.totalOutofSequenceErrors);
+  printf("%-28s %u\n", "Not processed", receiveProc.totalNotProcessedErrors);
+  printf("%-28s %u\n", "Module bad packets", bad_packets);
+  printf("%-28s %u\n", "Module receive overflow", rx_overflow_bytes);
+  printf("%-28s %u\n", "Framing errors", framing_errors);
+  printf("%-28s %u\n", "Wrong voltage readings", wrong_voltage);
+  printf("%-28s %u dropped, %u corrupted\n", "Injected bytes", bytes_dropped, bytes_corrupted);
+
+  printf("\nRound trip by command (ms)\n");
+  for (uint8_t c = 0; c < 16; c++)
+  {
+    auto l = receiveProc.CommandLatency(c);
+    if (l.count > 0)
+    {
+      printf("Command %-20u n %u, min %.1f, p50 %.1f, p99 %.1f, max %.1f\n", c, l.count,
+             l.minimum_us / 1000.0, l.p50_us / 1000.0, l.p99_us / 1000.0, l.maximum_us / 1000.0);
+    }
+  }
+
+  // Damage on a link is counted by every module after it, see PacketReceiveProcessor::GetLinkErrors.
+  // Packets damaged twice, or so badly a module doesn't see a packet at all, make the counts differ.
+  printf("\nLink errors (packets damaged / attributed CRC errors / not processed)\n");
+  for (uint16_t l = 0; l <= options.modules; l++)
+  {
+    auto e = receiveProc.GetLinkErrors((uint8_t)l, (uint8_t)options.modules);
+    if (packets_corrupted[l] > 0 || e.crc > 0 || e.notProcessed > 0)
+    {
+      printf("Link %-23u %u / %u / %u\n", l, packets_corrupted[l], e.crc, e.notProcessed);
+    }
+  }
+}
+
+static bool parse_dead(const char *value, DeadModule *d)
+{
+  unsigned int m, from, to;
+  if (sscanf(value, "%u@%u-%u", &m, &from, &to) != 3 || from > to)
+  {
+    return false;
+  }
+  d->module = (uint8_t)m;
+  d->from_sweep = from;
+  d->to_sweep = to;
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (value == nullptr)
+    {
+      printf("Options are name=value, see the top of chain_simulator.cpp\n");
+      return 1;
+    }
+    value++;
+
+    auto is = [arg](const char *name)
+    { return strncmp(arg, name, strlen(name)) == 0 && arg[strlen(name)] == '='; };
+
+    if (is("modules"))
+    {
+      options.modules = (uint16_t)atoi(value);
+    }
+    else if (is("baud"))
+    {
+      options.baudrate = (uint16_t)atoi(value);
+    }
+    else if (is("sweeps"))
+    {
+      options.sweeps = (uint32_t)atoi(value);
+    }
+    else if (is("window"))
+    {
+      options.window = (uint8_t)atoi(value);
+    }
+    else if (is("processing"))
+    {
+      options.processing_us = (int64_t)(atof(value) * 1000);
+    }
+    else if (is("drop"))
+    {
+      options.drop_ppm = (uint32_t)atoi(value);
+    }
+    else if (is("corrupt"))
+    {
+      options.corrupt_ppm = (uint32_t)atoi(value);
+    }
+    else if (is("link"))
+    {
+      options.fault_link = atoi(value);
+    }
+    else if (is("dead"))
+    {
+      DeadModule d;
+      if (!parse_dead(value, &d))
+      {
+        printf("dead should be module@firstsweep-lastsweep\n");
+        return 1;
+      }
+      options.dead.push_back(d);
+    }
+    else if (is("seed"))
+    {
+      options.seed = (uint32_t)atoi(value);
+    }
+    else if (is("log"))
+    {
+      host_log_level = atoi(value) ? ESP_LOG_WARN : ESP_LOG_NONE;
+    }
+    else
+    {
+      printf("Unknown option %s\n", arg);
+      return 1;
+    }
+  }
+
+  if (options.modules == 0 || options.modules > maximum_controller_cell_modules)
+  {
+    printf("modules must be 1 to %u\n", maximum_controller_cell_modules);
+    return 1;
+  }
+  if (options.baudrate == 0)
+  {
+    printf("baud must not be zero\n");
+    return 1;
+  }
+  if (options.window > PacketPacing::maximumWindow)
+  {
+    printf("window must be 0 to %u\n", PacketPacing::maximumWindow);
+    return 1;
+  }
+
+  ChainSimulator sim(options);
+  sim.Run();
+
+  return 0;
+}
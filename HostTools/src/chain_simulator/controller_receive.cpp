@@ -0,0 +1,2 @@
+// Controller reply processing compiled for the host
+#include "../../../ESPController/src/PacketReceiveProcessor.cpp"
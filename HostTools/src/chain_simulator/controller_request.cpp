@@ -0,0 +1,3 @@
+// Controller request generation compiled for the host
+#include "../../../ESPController/src/PacketRequestGenerator.cpp"
+#include "../../../ESPController/lib/crc16/crc16.cpp"
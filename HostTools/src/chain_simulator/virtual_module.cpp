@@ -0,0 +1,67 @@
+/*
+  Cell module firmware (ATTINYCellModule) compiled for the host.
+
+  Only the packet handling, ADC scaling and settings code is used, the hardware abstraction is
+  replaced by diybms_host_hal.h and the ADC results are supplied by SetCellVoltage().
+*/
+
+#include "virtual_module.h"
+
+#include "diybms_host_hal.h"
+
+// CRC16 is compiled once, from the controller copy (the files are identical)
+#include "../../../ATTINYCellModule/src/packet_processor.cpp"
+#include "../../../ATTINYCellModule/lib/Steinhart/Steinhart.cpp"
+#include "../../../ATTINYCellModule/lib/settings/settings.cpp"
+
+// ADC reading of the thermistors at 25 degrees C (50:50 divider)
+static constexpr uint16_t adc_25_celcius = 512;
+
+struct Firmware
+{
+  Firmware() : processor(&config) {}
+
+  CellModuleConfig config;
+  PacketProcessor processor;
+};
+
+// Same as the firmware, a global instance so the sample averaging buffer starts at zero
+static Firmware modules[VirtualModules::maximumModules];
+
+const size_t VirtualModules::packetSize = sizeof(PacketStruct);
+
+void VirtualModules::Begin(uint16_t millivolt)
+{
+  for (uint16_t m = 0; m < maximumModules; m++)
+  {
+    // Same as DefaultConfig() in the module firmware (ATTINY841)
+    modules[m].config.Calibration = 2.2007;
+    modules[m].config.BypassTemperatureSetPoint = 65;
+    modules[m].config.BypassThresholdmV = 4100;
+
+    SetCellVoltage((uint8_t)m, millivolt);
+  }
+}
+
+void VirtualModules::SetCellVoltage(uint8_t m, uint16_t millivolt)
+{
+  PacketProcessor &pp = modules[m].processor;
+
+  pp.TakeAnAnalogueReading(ADC_INTERNAL_TEMP);
+  pp.ADCReading(adc_25_celcius);
+  pp.TakeAnAnalogueReading(ADC_EXTERNAL_TEMP);
+  pp.ADCReading(adc_25_celcius);
+
+  // Reverse of PacketProcessor::CellVoltage()
+  const uint16_t raw = (uint16_t)lroundf((float)millivolt / ((float)MV_PER_ADC * modules[m].config.Calibration));
+  for (size_t i = 0; i < SAMPLEAVERAGING; i++)
+  {
+    pp.TakeAnAnalogueReading(ADC_CELL_VOLTAGE);
+    pp.ADCReading(raw);
+  }
+}
+
+bool VirtualModules::PacketReceived(uint8_t m, uint8_t *buffer)
+{
+  return modules[m].processor.onPacketReceived((PacketStruct *)buffer);
+}
@@ -0,0 +1,33 @@
+#ifndef VIRTUAL_MODULE_H_
+#define VIRTUAL_MODULE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Chain of cell modules running the real ATTINYCellModule packet processing code.
+//
+// Kept free of module/controller types, both projects define PacketStruct, COMMAND etc. so
+// they are compiled into separate translation units.
+class VirtualModules
+{
+public:
+  // sizeof(PacketStruct) in the module firmware
+  static const size_t packetSize;
+
+  // Maximum length of the chain (hops is a uint8_t)
+  static constexpr uint16_t maximumModules = 255;
+
+  /// @brief Reset all modules to the firmware default configuration
+  /// @param millivolt cell voltage presented to the ADC of every module
+  static void Begin(uint16_t millivolt);
+
+  /// @brief Change the voltage module m will measure
+  static void SetCellVoltage(uint8_t m, uint16_t millivolt);
+
+  /// @brief Process a received packet exactly as the module firmware does (modified in place)
+  /// @param buffer packetSize bytes
+  /// @return true if the module processed the request
+  static bool PacketReceived(uint8_t m, uint8_t *buffer);
+};
+
+#endif
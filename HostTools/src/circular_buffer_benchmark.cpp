@@ -0,0 +1,474 @@
+/*
+  Host check and benchmark for circular_buffer (ESPController/include/circular_buffer.hpp).
+
+  The checks run first, any failure exits with a non zero code:
+    - random put/get/peek/reset against the original implementation (kept below), which put() and
+      get() must still match, including dropping the oldest item when full
+    - put_n/read_n, write_spans/commit, read_spans/consume and range-for against a std::deque, with
+      batches that wrap around the end of the buffer
+    - single producer/single consumer mode, a writer thread and a reader thread passing a sequence
+      of numbers through a small buffer, item by item and in batches
+
+  Then times put+get for one item at a time with the original and new code, batches with
+  put_n/read_n, and the two thread transfer.
+
+  Usage: circular_buffer_benchmark [items=20000000]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+
+#include "circular_buffer.hpp"
+
+// circular_buffer as it was before power of two masking (modulo arithmetic and a full flag)
+template <class T, size_t TElemCount>
+class original_circular_buffer
+{
+public:
+  void put(T item) noexcept
+  {
+    buf_[head_] = item;
+    if (full_)
+    {
+      tail_ = (tail_ + 1) % TElemCount;
+    }
+    head_ = (head_ + 1) % TElemCount;
+    full_ = head_ == tail_;
+  }
+
+  T get() noexcept
+  {
+    if (empty())
+    {
+      return T();
+    }
+    auto val = buf_[tail_];
+    full_ = false;
+    tail_ = (tail_ + 1) % TElemCount;
+    return val;
+  }
+
+  T peek(uint16_t look_ahead_counter) const noexcept
+  {
+    if (empty() || look_ahead_counter > size())
+    {
+      return T();
+    }
+    size_t pos = tail_ + look_ahead_counter;
+    if (pos >= TElemCount)
+    {
+      pos -= TElemCount;
+    }
+    return buf_[pos];
+  }
+
+  void reset() noexcept
+  {
+    head_ = tail_;
+    full_ = false;
+  }
+
+  bool empty() const noexcept { return !full_ && head_ == tail_; }
+  bool full() const noexcept { return full_; }
+
+  size_t size() const noexcept
+  {
+    if (full_)
+    {
+      return TElemCount;
+    }
+    return head_ >= tail_ ? head_ - tail_ : TElemCount + head_ - tail_;
+  }
+
+private:
+  std::array<T, TElemCount> buf_{};
+  size_t head_ = 0;
+  size_t tail_ = 0;
+  bool full_ = false;
+};
+
+static uint32_t failures = 0;
+
+#define CHECK(condition)                                                   \
+  do                                                                       \
+  {                                                                        \
+    if (!(condition))                                                      \
+    {                                                                      \
+      if (failures++ < 10)                                                 \
+      {                                                                    \
+        printf("FAIL line %u: %s\n", (uint32_t)__LINE__, #condition);      \
+      }                                                                    \
+    }                                                                      \
+  } while (0)
+
+static void check_original()
+{
+  original_circular_buffer<uint32_t, 8> original;
+  circular_buffer<uint32_t, 8> buffer;
+  uint32_t next = 1;
+  srand(1);
+  for (uint32_t i = 0; i < 200000; i++)
+  {
+    switch (rand() % 8)
+    {
+    case 0:
+    case 1:
+    case 2:
+      original.put(next);
+      buffer.put(next);
+      next++;
+      break;
+    case 3:
+    case 4:
+      CHECK(original.get() == buffer.get());
+      break;
+    case 5:
+    {
+      // The original could look one past the newest item, which is not one of the items held
+      const uint16_t n = (uint16_t)(rand() % 9);
+      if (n < original.size())
+      {
+        CHECK(original.peek(n) == buffer.peek(n));
+      }
+      else
+      {
+        CHECK(buffer.peek(n) == 0);
+      }
+      break;
+    }
+    case 6:
+      if (rand() % 50 == 0)
+      {
+        original.reset();
+        buffer.reset();
+      }
+      break;
+    default:
+      break;
+    }
+    CHECK(original.size() == buffer.size());
+    CHECK(original.empty() == buffer.empty());
+    CHECK(original.full() == buffer.full());
+  }
+}
+
+template <bool TSpsc>
+static void check_batches()
+{
+  circular_buffer<uint32_t, 16, TSpsc> buffer;
+  std::deque<uint32_t> model;
+  uint32_t next = 0;
+  uint32_t items[40];
+  srand(2);
+
+  for (uint32_t i = 0; i < 100000; i++)
+  {
+    switch (rand() % 6)
+    {
+    case 0:
+    {
+      const size_t count = (size_t)(rand() % 20);
+      for (size_t n = 0; n < count; n++)
+      {
+        items[n] = next + (uint32_t)n;
+      }
+      const size_t added = buffer.put_n(items, count);
+      CHECK(added == min(count, (size_t)16 - model.size()));
+      for (size_t n = 0; n < added; n++)
+      {
+        model.push_back(next++);
+      }
+      break;
+    }
+    case 1:
+    {
+      const size_t count = (size_t)(rand() % 20);
+      const size_t read = buffer.read_n(items, count);
+      CHECK(read == min(count, model.size()));
+      for (size_t n = 0; n < read; n++)
+      {
+        CHECK(items[n] == model.front());
+        model.pop_front();
+      }
+      break;
+    }
+    case 2:
+    {
+      // Fill part of the free space in place
+      auto s = buffer.write_spans();
+      CHECK(s.size() == 16 - model.size());
+      CHECK(s.second.size == 0 || s.first.data + s.first.size == buffer.write_spans().first.data + s.first.size);
+      const size_t count = s.size() == 0 ? 0 : (size_t)(rand() % (s.size() + 1));
+      for (size_t n = 0; n < count; n++)
+      {
+        uint32_t &slot = n < s.first.size ? s.first.data[n] : s.second.data[n - s.first.size];
+        slot = next;
+        model.push_back(next++);
+      }
+      buffer.commit(count);
+      break;
+    }
+    case 3:
+    {
+      auto s = buffer.read_spans();
+      CHECK(s.size() == model.size());
+      size_t n = 0;
+      for (uint32_t v : s.first)
+      {
+        CHECK(v == model[n++]);
+      }
+      for (uint32_t v : s.second)
+      {
+        CHECK(v == model[n++]);
+      }
+      const size_t count = s.size() == 0 ? 0 : (size_t)(rand() % (s.size() + 1));
+      buffer.consume(count);
+      model.erase(model.begin(), model.begin() + (long)count);
+      break;
+    }
+    case 4:
+    {
+      size_t n = 0;
+      for (uint32_t v : buffer)
+      {
+        CHECK(n < model.size() && v == model[n]);
+        n++;
+      }
+      CHECK(n == model.size());
+      break;
+    }
+    default:
+    {
+      const bool added = buffer.try_put(next);
+      CHECK(added == (model.size() < 16));
+      if (added)
+      {
+        model.push_back(next++);
+      }
+      if (!model.empty())
+      {
+        CHECK(buffer.get() == model.front());
+        model.pop_front();
+      }
+      break;
+    }
+    }
+    CHECK(buffer.size() == model.size());
+    CHECK(buffer.full() == (model.size() == 16));
+  }
+}
+
+// Writer and reader threads, "batch" = 0 for one item at a time.  Returns items per second.
+// Each side yields when it can't go on, so this also works on a single core (as the ESP32 tasks would).
+static double spsc_transfer(uint32_t items, size_t batch)
+{
+  static circular_buffer<uint32_t, 256, true> buffer;
+  buffer.reset();
+  bool ordered = true;
+
+  const auto started = std::chrono::steady_clock::now();
+  std::thread writer([&]()
+                     {
+    uint32_t next = 0;
+    uint32_t block[64];
+    while (next < items)
+    {
+      if (batch == 0)
+      {
+        if (buffer.try_put(next))
+        {
+          next++;
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+        continue;
+      }
+      const size_t count = min(batch, (size_t)(items - next));
+      for (size_t n = 0; n < count; n++)
+      {
+        block[n] = next + (uint32_t)n;
+      }
+      const size_t added = buffer.put_n(block, count);
+      if (added == 0)
+      {
+        std::this_thread::yield();
+      }
+      next += (uint32_t)added;
+    } });
+
+  uint32_t expected = 0;
+  uint32_t block[64];
+  while (expected < items)
+  {
+    if (batch == 0)
+    {
+      if (!buffer.empty())
+      {
+        ordered &= buffer.get() == expected++;
+      }
+      else
+      {
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    const size_t read = buffer.read_n(block, batch);
+    if (read == 0)
+    {
+      std::this_thread::yield();
+    }
+    for (size_t n = 0; n < read; n++)
+    {
+      ordered &= block[n] == expected++;
+    }
+  }
+  writer.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  CHECK(ordered);
+  CHECK(buffer.empty());
+  return items / seconds;
+}
+
+template <class F>
+static double items_per_second(uint32_t items, F f)
+{
+  const auto started = std::chrono::steady_clock::now();
+  const uint32_t sum = f();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  // Stops the loops being optimised away
+  if (sum == 0x12345678)
+  {
+    printf(" ");
+  }
+  return items / seconds;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t items = 20000000;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "items=", 6) == 0)
+    {
+      items = (uint32_t)max(1000, atoi(argv[i] + 6));
+    }
+  }
+
+  check_original();
+  check_batches<false>();
+  check_batches<true>();
+  spsc_transfer(1000000, 0);
+  spsc_transfer(1000000, 32);
+  if (failures != 0)
+  {
+    printf("%u checks FAILED\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n\n");
+
+  // A burst of 16 in, then 16 out, through a 64 item buffer
+  static original_circular_buffer<uint32_t, 64> original;
+  static circular_buffer<uint32_t, 64> buffer;
+  static circular_buffer<uint32_t, 64, true> spsc;
+
+  const double original_rate = items_per_second(items, [&]()
+                                                {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < items; i += 16)
+    {
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        original.put(i + n);
+      }
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        sum += original.get();
+      }
+    }
+    return sum; });
+
+  const double new_rate = items_per_second(items, [&]()
+                                           {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < items; i += 16)
+    {
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        buffer.put(i + n);
+      }
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        sum += buffer.get();
+      }
+    }
+    return sum; });
+
+  const double batch_rate = items_per_second(items, [&]()
+                                             {
+    uint32_t sum = 0;
+    uint32_t block[16];
+    for (uint32_t i = 0; i < items; i += 16)
+    {
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        block[n] = i + n;
+      }
+      buffer.put_n(block, 16);
+      buffer.read_n(block, 16);
+      sum += block[15];
+    }
+    return sum; });
+
+  const double spsc_rate = items_per_second(items, [&]()
+                                            {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < items; i += 16)
+    {
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        spsc.try_put(i + n);
+      }
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        sum += spsc.get();
+      }
+    }
+    return sum; });
+
+  const double spsc_batch_rate = items_per_second(items, [&]()
+                                                  {
+    uint32_t sum = 0;
+    uint32_t block[16];
+    for (uint32_t i = 0; i < items; i += 16)
+    {
+      for (uint32_t n = 0; n < 16; n++)
+      {
+        block[n] = i + n;
+      }
+      spsc.put_n(block, 16);
+      spsc.read_n(block, 16);
+      sum += block[15];
+    }
+    return sum; });
+
+  printf("Single thread, bursts of 16 (million items/second)\n");
+  printf("  original put/get      %8.1f\n", original_rate / 1e6);
+  printf("  put/get               %8.1f\n", new_rate / 1e6);
+  printf("  put_n/read_n          %8.1f\n", batch_rate / 1e6);
+  printf("  SPSC try_put/get      %8.1f\n", spsc_rate / 1e6);
+  printf("  SPSC put_n/read_n     %8.1f\n", spsc_batch_rate / 1e6);
+  printf("Writer and reader threads, 256 item SPSC buffer\n");
+  printf("  one at a time         %8.1f\n", spsc_transfer(items, 0) / 1e6);
+  printf("  batches of 32         %8.1f\n", spsc_transfer(items, 32) / 1e6);
+
+  if (failures != 0)
+  {
+    printf("%u checks FAILED\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+  Host check and benchmark for the table driven CRC16 (lib/crc16 in each project).
+
+  First proves the nibble (AVR) and byte table variants, and the incremental API, give exactly the
+  same result as the original bit at a time implementation, using fixed golden vectors and random
+  data.  Exits with a non zero code if anything differs.
+
+  Then times each variant over a packet sized buffer (sizeof(PacketStruct) - 2 bytes, as checked on
+  every hop).
+
+  Usage: crc16_benchmark [iterations]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+// All three projects have an identical copy
+#include "../../ESPController/lib/crc16/crc16.cpp"
+
+// The bit at a time implementation CRC16 used before the lookup tables
+static uint16_t reference_crc16(const uint8_t *data, uint16_t length)
+{
+  const uint16_t polynomial = 0x1021;
+  const uint16_t msbMask = 0x8000;
+  uint16_t crc = 0x0000;
+
+  for (uint16_t i = 0; i < length; i++)
+  {
+    const uint8_t c = data[i];
+    for (int j = 0x80; j > 0; j >>= 1)
+    {
+      uint16_t bit = (uint16_t)(crc & msbMask);
+      crc <<= 1;
+      if ((c & j) != 0)
+      {
+        bit = (uint16_t)(bit ^ msbMask);
+      }
+      if (bit != 0)
+      {
+        crc ^= polynomial;
+      }
+    }
+  }
+  return crc;
+}
+
+static uint16_t nibble_crc16(const uint8_t *data, uint16_t length)
+{
+  uint16_t crc = CRC16::Initial;
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc = CRC16::UpdateNibble(crc, data[i]);
+  }
+  return crc;
+}
+
+static uint16_t byte_crc16(const uint8_t *data, uint16_t length)
+{
+  uint16_t crc = CRC16::Initial;
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc = CRC16::UpdateByte(crc, data[i]);
+  }
+  return crc;
+}
+
+static uint32_t prng_state = 0x12345678;
+static uint32_t prng()
+{
+  prng_state ^= prng_state << 13;
+  prng_state ^= prng_state >> 17;
+  prng_state ^= prng_state << 5;
+  return prng_state;
+}
+
+// Values produced by the original implementation
+struct GoldenVector
+{
+  const char *name;
+  std::vector<uint8_t> data;
+  uint16_t crc;
+};
+
+static std::vector<GoldenVector> golden_vectors()
+{
+  std::vector<GoldenVector> v;
+
+  v.push_back({"empty", {}, 0x0000});
+  v.push_back({"\"123456789\"", {'1', '2', '3', '4', '5', '6', '7', '8', '9'}, 0x31C3});
+  v.push_back({"0x80", {0x80}, 0x9188});
+
+  std::vector<uint8_t> packet(38);
+  for (size_t i = 0; i < packet.size(); i++)
+  {
+    packet[i] = (uint8_t)i;
+  }
+  v.push_back({"38 bytes 0..37", packet, 0x59E3});
+  v.push_back({"38 bytes 0x00", std::vector<uint8_t>(38, 0x00), 0x0000});
+  v.push_back({"38 bytes 0xFF", std::vector<uint8_t>(38, 0xFF), 0xE266});
+
+  std::vector<uint8_t> all(256);
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    all[i] = (uint8_t)i;
+  }
+  v.push_back({"256 bytes 0..255", all, 0x7E55});
+
+  return v;
+}
+
+static bool check()
+{
+  uint32_t failures = 0;
+
+  for (auto &g : golden_vectors())
+  {
+    const uint16_t length = (uint16_t)g.data.size();
+    const uint16_t results[] = {
+        reference_crc16(g.data.data(), length),
+        nibble_crc16(g.data.data(), length),
+        byte_crc16(g.data.data(), length),
+        CRC16::CalculateArray(g.data.data(), length)};
+
+    for (auto r : results)
+    {
+      if (r != g.crc)
+      {
+        printf("FAIL %s expected 0x%04X got 0x%04X\n", g.name, g.crc, r);
+        failures++;
+      }
+    }
+  }
+
+  // Random buffers of every length up to 300 bytes, also split at a random point for the incremental API
+  std::vector<uint8_t> buffer(300);
+  for (uint32_t pass = 0; pass < 100; pass++)
+  {
+    for (auto &b : buffer)
+    {
+      b = (uint8_t)prng();
+    }
+
+    for (uint16_t length = 0; length <= buffer.size(); length++)
+    {
+      const uint16_t expected = reference_crc16(buffer.data(), length);
+      const uint16_t split = length ? (uint16_t)(prng() % length) : 0;
+      const uint16_t incremental = CRC16::Update(CRC16::Update(CRC16::Initial, buffer.data(), split), buffer.data() + split, length - split);
+
+      if (nibble_crc16(buffer.data(), length) != expected ||
+          byte_crc16(buffer.data(), length) != expected ||
+          CRC16::CalculateArray(buffer.data(), length) != expected ||
+          incremental != expected)
+      {
+        printf("FAIL random data, length %u\n", length);
+        failures++;
+      }
+    }
+  }
+
+  printf("Golden vectors and random data: %s\n\n", failures ? "FAILED" : "all match the original implementation");
+  return failures == 0;
+}
+
+template <typename F>
+static void benchmark(const char *name, F f, uint32_t iterations)
+{
+  // Packet minus the CRC itself
+  uint8_t packet[38];
+  for (auto &b : packet)
+  {
+    b = (uint8_t)prng();
+  }
+
+  // Stop the compiler optimising the loop away
+  volatile uint16_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    packet[0] = (uint8_t)i;
+    sink = sink ^ f(packet, sizeof(packet));
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  const double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  printf("%-10s %8.1f ns/packet %8.1f MB/s\n", name, ns, sizeof(packet) * 1000.0 / ns);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t iterations = 2000000;
+  if (argc > 1)
+  {
+    iterations = (uint32_t)atoi(argv[1]);
+  }
+
+  if (!check())
+  {
+    return 1;
+  }
+
+  printf("%u packets of 38 bytes\n", iterations);
+  benchmark("bitwise", reference_crc16, iterations);
+  benchmark("nibble", nibble_crc16, iterations);
+  benchmark("byte", byte_crc16, iterations);
+
+  return 0;
+}
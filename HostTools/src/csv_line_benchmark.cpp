@@ -0,0 +1,547 @@
+/*
+  Host check and benchmark of the SD card log rows built by CsvLine (ESPController/src/CsvLine.cpp,
+  compiled unchanged) against the way main.cpp built them before, with pad_zero, std::to_string,
+  float_to_string and std::string::append (kept below).
+
+  Every row of the cell, current monitor and output logs, and the file names, must be the same byte for
+  byte both ways.  Float4() must match printf("%.4f") for millions of floats, including the halfway
+  cases, and Unsigned() and Signed() std::to_string (exits with 1 on any difference).  Then the time and
+  the heap allocations (operator new) for each kind of row.
+
+  Usage: csv_line_benchmark [rows=20000] [cells=64] [floats=5000000]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+#include <random>
+
+#include "defines.h"
+#include "string_utils.h"
+#include "CsvLine.h"
+#include "../../ESPController/src/CsvLine.cpp"
+
+static uint64_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+CellReadings cells;
+CellModuleInfo cmi[maximum_controller_cell_modules];
+static uint8_t numberOfCells = 64;
+static currentmonitoring_struct currentMonitor;
+static uint8_t tca6408;
+static uint8_t tca9534;
+static bool relays[RELAY_TOTAL];
+
+// Stands in for SdLog::Append, the row as the card would get it
+static std::string written;
+static void Append(const char *data, size_t length) { written.append(data, length); }
+static void Append(const std::string &data) { Append(data.data(), data.length()); }
+
+// As main.cpp did before CsvLine
+namespace before
+{
+  static void cellRow(const tm &timeinfo, bool header)
+  {
+    if (header)
+    {
+      Append("DateTime,", 9);
+      std::string h;
+      h.reserve(150);
+      for (auto i = 0; i < numberOfCells; i++)
+      {
+        std::string n;
+        n = std::to_string(i);
+        h.clear();
+        h.append("VoltagemV_").append(n).append(",InternalTemp_").append(n).append(",ExternalTemp_").append(n).append(",Bypass_");
+        h.append(n).append(",PWM_").append(n).append(",BypassOverTemp_").append(n).append(",BadPackets_").append(n);
+        h.append(",BalancemAh_").append(n).append(i < numberOfCells - 1 ? "," : "\r\n");
+        Append(h);
+      }
+    }
+
+    std::string dataMessage;
+    dataMessage.reserve(150);
+    dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
+        .append(" ")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
+        .append(",");
+
+    for (auto i = 0; i < numberOfCells; i++)
+    {
+      dataMessage.append(std::to_string(cells.voltagemV[i]))
+          .append(",")
+          .append(std::to_string(cells.internalTemp[i]))
+          .append(",")
+          .append(std::to_string(cells.externalTemp[i]))
+          .append(",")
+          .append(cells.inBypass[i] ? "Y" : "N")
+          .append(",")
+          .append(std::to_string((int)((float)cells.PWMValue[i] / (float)255.0 * 100)))
+          .append(",")
+          .append(cells.bypassOverTemp[i] ? "Y" : "N")
+          .append(",")
+          .append(std::to_string(cmi[i].badPacketCount))
+          .append(",")
+          .append(std::to_string(cmi[i].BalanceCurrentCount));
+      dataMessage.append(i < numberOfCells - 1 ? "," : "\r\n");
+      Append(dataMessage);
+      dataMessage.clear();
+    }
+  }
+
+  static void currentRow(const tm &timeinfo)
+  {
+    std::string dataMessage;
+    dataMessage.reserve(128);
+    dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
+        .append(" ")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
+        .append(",");
+    dataMessage.append(currentMonitor.validReadings ? "1" : "0")
+        .append(",")
+        .append(float_to_string(currentMonitor.modbus.voltage))
+        .append(",")
+        .append(float_to_string(currentMonitor.modbus.current))
+        .append(",")
+        .append(std::to_string(currentMonitor.modbus.milliamphour_in))
+        .append(",")
+        .append(std::to_string(currentMonitor.modbus.milliamphour_out))
+        .append(",")
+        .append(std::to_string(currentMonitor.modbus.daily_milliamphour_in))
+        .append(",")
+        .append(std::to_string(currentMonitor.modbus.daily_milliamphour_out))
+        .append(",")
+        .append(float_to_string(currentMonitor.modbus.power))
+        .append(",")
+        .append(std::to_string(currentMonitor.modbus.temperature))
+        .append(",")
+        .append(currentMonitor.RelayState ? "1" : "0")
+        .append("\r\n");
+    Append(dataMessage);
+  }
+
+  static void outputRow(const tm &timeinfo)
+  {
+    std::string dataMessage;
+    dataMessage.reserve(128);
+    dataMessage.append(pad_zero(4, (uint16_t)timeinfo.tm_year))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
+        .append("-")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
+        .append(" ")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_hour))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_min))
+        .append(":")
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_sec))
+        .append(",")
+        .append(uint8_to_binary_string(tca6408))
+        .append(",")
+        .append(uint8_to_binary_string(tca9534))
+        .append(",");
+    for (uint8_t i = 0; i < RELAY_TOTAL; i++)
+    {
+      dataMessage.append(relays[i] ? "Y" : "N");
+      if (i < RELAY_TOTAL - 1)
+      {
+        dataMessage.append(",");
+      }
+    }
+    dataMessage.append("\r\n");
+    Append(dataMessage);
+  }
+
+  static void filenames(const tm &timeinfo)
+  {
+    std::string filename;
+    filename.reserve(32);
+    filename.append("/data_").append(std::to_string(timeinfo.tm_year)).append(pad_zero(2, (uint16_t)timeinfo.tm_mon)).append(pad_zero(2, (uint16_t)timeinfo.tm_mday)).append(".csv");
+    Append(filename);
+    std::string cmon_filename;
+    cmon_filename.reserve(32);
+    cmon_filename.append("/modbus")
+        .append(pad_zero(2, 90))
+        .append("_")
+        .append(std::to_string(timeinfo.tm_year))
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mon))
+        .append(pad_zero(2, (uint16_t)timeinfo.tm_mday))
+        .append(".csv");
+    Append(cmon_filename);
+  }
+} // namespace before
+
+// As main.cpp does now
+namespace after
+{
+  static void cellRow(const tm &timeinfo, bool header)
+  {
+    char buffer[192];
+    CsvLine line(buffer, sizeof(buffer));
+    if (header)
+    {
+      line.Text("DateTime,");
+      for (auto i = 0; i < numberOfCells; i++)
+      {
+        line.Text("VoltagemV_")
+            .Unsigned(i)
+            .Text(",InternalTemp_")
+            .Unsigned(i)
+            .Text(",ExternalTemp_")
+            .Unsigned(i)
+            .Text(",Bypass_")
+            .Unsigned(i)
+            .Text(",PWM_")
+            .Unsigned(i)
+            .Text(",BypassOverTemp_")
+            .Unsigned(i)
+            .Text(",BadPackets_")
+            .Unsigned(i)
+            .Text(",BalancemAh_")
+            .Unsigned(i)
+            .Text(i < numberOfCells - 1 ? "," : "\r\n");
+        Append(line.Data(), line.Length());
+        line.Clear();
+      }
+    }
+
+    line.DateTime(timeinfo).Char(',');
+    for (auto i = 0; i < numberOfCells; i++)
+    {
+      line.Unsigned(cells.voltagemV[i])
+          .Char(',')
+          .Signed(cells.internalTemp[i])
+          .Char(',')
+          .Signed(cells.externalTemp[i])
+          .Char(',')
+          .YesNo(cells.inBypass[i])
+          .Char(',')
+          .Signed((int)((float)cells.PWMValue[i] / (float)255.0 * 100))
+          .Char(',')
+          .YesNo(cells.bypassOverTemp[i])
+          .Char(',')
+          .Unsigned(cmi[i].badPacketCount)
+          .Char(',')
+          .Unsigned(cmi[i].BalanceCurrentCount)
+          .Text(i < numberOfCells - 1 ? "," : "\r\n");
+      if (line.Space() < 48 || i == numberOfCells - 1)
+      {
+        Append(line.Data(), line.Length());
+        line.Clear();
+      }
+    }
+  }
+
+  static void currentRow(const tm &timeinfo)
+  {
+    char buffer[192];
+    CsvLine line(buffer, sizeof(buffer));
+    line.DateTime(timeinfo)
+        .Char(',')
+        .Char(currentMonitor.validReadings ? '1' : '0')
+        .Char(',')
+        .Float4(currentMonitor.modbus.voltage)
+        .Char(',')
+        .Float4(currentMonitor.modbus.current)
+        .Char(',')
+        .Unsigned(currentMonitor.modbus.milliamphour_in)
+        .Char(',')
+        .Unsigned(currentMonitor.modbus.milliamphour_out)
+        .Char(',')
+        .Unsigned(currentMonitor.modbus.daily_milliamphour_in)
+        .Char(',')
+        .Unsigned(currentMonitor.modbus.daily_milliamphour_out)
+        .Char(',')
+        .Float4(currentMonitor.modbus.power)
+        .Char(',')
+        .Signed(currentMonitor.modbus.temperature)
+        .Char(',')
+        .Char(currentMonitor.RelayState ? '1' : '0')
+        .Text("\r\n");
+    Append(line.Data(), line.Length());
+  }
+
+  static void outputRow(const tm &timeinfo)
+  {
+    char buffer[96];
+    CsvLine line(buffer, sizeof(buffer));
+    line.DateTime(timeinfo).Char(',').Binary(tca6408).Char(',').Binary(tca9534).Char(',');
+    for (uint8_t i = 0; i < RELAY_TOTAL; i++)
+    {
+      line.YesNo(relays[i]);
+      if (i < RELAY_TOTAL - 1)
+      {
+        line.Char(',');
+      }
+    }
+    line.Text("\r\n");
+    Append(line.Data(), line.Length());
+  }
+
+  static void filenames(const tm &timeinfo)
+  {
+    char filename[32];
+    CsvLine f(filename, sizeof(filename));
+    f.Text("/data_").Unsigned(timeinfo.tm_year).Unsigned(timeinfo.tm_mon, 2).Unsigned(timeinfo.tm_mday, 2).Text(".csv");
+    Append(filename, strlen(filename));
+    char cmon_filename[32];
+    CsvLine(cmon_filename, sizeof(cmon_filename))
+        .Text("/modbus")
+        .Unsigned(90, 2)
+        .Char('_')
+        .Unsigned(timeinfo.tm_year)
+        .Unsigned(timeinfo.tm_mon, 2)
+        .Unsigned(timeinfo.tm_mday, 2)
+        .Text(".csv");
+    Append(cmon_filename, strlen(cmon_filename));
+  }
+} // namespace after
+
+static std::mt19937 rng(1);
+
+static uint32_t random(uint32_t range) { return std::uniform_int_distribution<uint32_t>(0, range - 1)(rng); }
+
+static void randomReadings(uint32_t row, tm &timeinfo)
+{
+  const time_t t = (time_t)(1790000000 + row * 15);
+  gmtime_r(&t, &timeinfo);
+  timeinfo.tm_year += 1900;
+  timeinfo.tm_mon += 1;
+
+  for (uint8_t i = 0; i < numberOfCells; i++)
+  {
+    cells.voltagemV[i] = (uint16_t)(row % 100 == 0 ? random(65536) : 2800 + random(1500));
+    cells.internalTemp[i] = (int8_t)(row % 100 == 1 ? random(256) : 10 + random(40));
+    cells.externalTemp[i] = (int8_t)(random(256));
+    cells.inBypass[i] = random(5) == 0;
+    cells.bypassOverTemp[i] = random(50) == 0;
+    cells.PWMValue[i] = (uint16_t)random(256);
+    cmi[i].badPacketCount = (uint16_t)random(row % 100 == 2 ? 65536 : 20);
+    cmi[i].BalanceCurrentCount = (uint16_t)random(65536);
+  }
+
+  currentMonitor.validReadings = random(10) != 0;
+  currentMonitor.modbus.voltage = 40.0F + (float)random(2000000) / 100000.0F;
+  currentMonitor.modbus.current = (float)((int32_t)random(4000000) - 2000000) / 10000.0F;
+  currentMonitor.modbus.power = currentMonitor.modbus.voltage * currentMonitor.modbus.current;
+  currentMonitor.modbus.milliamphour_in = random(UINT32_MAX);
+  currentMonitor.modbus.milliamphour_out = random(1000000);
+  currentMonitor.modbus.daily_milliamphour_in = random(100000);
+  currentMonitor.modbus.daily_milliamphour_out = random(100000);
+  currentMonitor.modbus.temperature = (int16_t)((int32_t)random(200) - 60);
+  currentMonitor.RelayState = random(2) != 0;
+  tca6408 = (uint8_t)random(256);
+  tca9534 = (uint8_t)random(256);
+  for (auto &r : relays)
+  {
+    r = random(2) != 0;
+  }
+}
+
+struct Cost
+{
+  double us = 0;
+  uint64_t allocations = 0;
+};
+
+// Runs "format" over every row, returning the time and allocations for it alone
+template <typename Format>
+static Cost measure(uint32_t rows, std::vector<std::string> &output, Format format)
+{
+  Cost cost;
+  tm timeinfo;
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    randomReadings(r, timeinfo);
+    written.clear();
+    const uint64_t before = allocations;
+    const auto started = std::chrono::steady_clock::now();
+    format(timeinfo, r == 0);
+    cost.us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+    cost.allocations += allocations - before;
+    output.push_back(written);
+  }
+  return cost;
+}
+
+static bool checkFloat(float value)
+{
+  char expected[64];
+  snprintf(expected, sizeof(expected), "%.4f", value);
+  char buffer[64];
+  CsvLine line(buffer, sizeof(buffer));
+  line.Float4(value);
+  if (strcmp(expected, line.Data()) != 0)
+  {
+    printf("Float4(%.9g) gave %s not %s\n", value, line.Data(), expected);
+    return false;
+  }
+  return true;
+}
+
+static bool checkInteger(int64_t value)
+{
+  char buffer[32];
+  CsvLine line(buffer, sizeof(buffer));
+  const std::string expected = value < 0 ? std::to_string((int32_t)value) : std::to_string((uint32_t)value);
+  if (value < 0)
+  {
+    line.Signed((int32_t)value);
+  }
+  else
+  {
+    line.Unsigned((uint32_t)value);
+  }
+  if (expected != line.Data())
+  {
+    printf("%lld gave %s\n", (long long)value, line.Data());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t rows = 20000;
+  uint32_t floats = 5000000;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "rows=", 5) == 0)
+    {
+      rows = (uint32_t)max(2, atoi(argv[i] + 5));
+    }
+    else if (strncmp(argv[i], "cells=", 6) == 0)
+    {
+      numberOfCells = (uint8_t)min((int)maximum_controller_cell_modules, max(1, atoi(argv[i] + 6)));
+    }
+    else if (strncmp(argv[i], "floats=", 7) == 0)
+    {
+      floats = (uint32_t)max(0, atoi(argv[i] + 7));
+    }
+  }
+
+  bool ok = true;
+
+  // Numbers
+  for (int64_t v : {0LL, 1LL, 9LL, 10LL, 99LL, 100LL, 101LL, 999LL, 1000LL, 65535LL, 99999LL, 100000LL, 4294967295LL, -1LL, -9LL,
+                    -10LL, -128LL, -32768LL, -2147483648LL})
+  {
+    ok = checkInteger(v) && ok;
+  }
+  for (uint32_t i = 0; i < 1000000 && ok; i++)
+  {
+    ok = checkInteger((int64_t)random(UINT32_MAX)) && checkInteger(-(int64_t)random(INT32_MAX)) && ok;
+  }
+
+  // Halfway cases (k / 32 is x.xxxx5 exactly), either side of them, zeros, the printf fallback
+  for (int32_t k = -100000; k <= 100000 && ok; k++)
+  {
+    const float v = (float)k / 32.0F;
+    ok = checkFloat(v) && checkFloat(nextafterf(v, INFINITY)) && checkFloat(nextafterf(v, -INFINITY));
+  }
+  for (float v : {0.0F, -0.0F, 0.00004F, -0.00004F, 0.00005F, -0.00006F, 999999999.0F, 1.0e9F, -1.0e9F, 3.0e38F, INFINITY, -INFINITY, NAN})
+  {
+    ok = checkFloat(v) && ok;
+  }
+  for (uint32_t i = 0; i < floats && ok; i++)
+  {
+    // Random bit patterns, most are tiny or huge, then the ranges a current monitor gives
+    uint32_t bits = random(UINT32_MAX);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    ok = checkFloat(v) && checkFloat((float)((int32_t)random(20000000) - 10000000) / (float)(1 + random(100000))) && ok;
+  }
+
+  // Too long for the buffer
+  char small[8];
+  CsvLine line(small, sizeof(small));
+  line.Text("DateTime").Unsigned(12345);
+  if (!line.Overflowed() || line.Length() != 7 || strcmp(small, "DateTim") != 0)
+  {
+    printf("Overflow gave \"%s\"\n", small);
+    ok = false;
+  }
+  line.Truncate(4);
+  line.Char('X');
+  if (line.Overflowed() || strcmp(small, "DateX") != 0)
+  {
+    printf("Truncate gave \"%s\"\n", small);
+    ok = false;
+  }
+
+  // Rows
+  struct Kind
+  {
+    const char *name;
+    void (*before)(const tm &, bool);
+    void (*after)(const tm &, bool);
+  };
+  const Kind kinds[] = {
+      {"cells", before::cellRow, after::cellRow},
+      {"current", [](const tm &t, bool) { before::currentRow(t); }, [](const tm &t, bool) { after::currentRow(t); }},
+      {"output", [](const tm &t, bool) { before::outputRow(t); }, [](const tm &t, bool) { after::outputRow(t); }},
+      {"names", [](const tm &t, bool) { before::filenames(t); }, [](const tm &t, bool) { after::filenames(t); }},
+  };
+
+  printf("%u rows, %u modules, %u floats checked against printf\n", rows, numberOfCells, floats * 2);
+  printf("          bytes/row   before us/row allocs/row    after us/row allocs/row\n");
+  for (const Kind &kind : kinds)
+  {
+    std::vector<std::string> b;
+    std::vector<std::string> a;
+    b.reserve(rows);
+    a.reserve(rows);
+    rng.seed(2);
+    const Cost tb = measure(rows, b, kind.before);
+    rng.seed(2);
+    const Cost ta = measure(rows, a, kind.after);
+    uint64_t bytes = 0;
+    for (uint32_t r = 0; r < rows; r++)
+    {
+      bytes += b[r].size();
+      if (a[r] != b[r])
+      {
+        printf("%s row %u differs:\n%s\n%s\n", kind.name, r, b[r].c_str(), a[r].c_str());
+        ok = false;
+        break;
+      }
+    }
+    printf("%-8s %10.0f %14.2f %10.1f %14.2f %10.1f\n", kind.name, (double)bytes / rows, tb.us / rows, (double)tb.allocations / rows,
+           ta.us / rows, (double)ta.allocations / rows);
+  }
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/*
+  Converts a binary cell data log from the SD card (data_YYYYMMDD.dbl, written when "Cell data in
+  binary" is ticked on the Storage page) into the CSV the controller writes otherwise.
+
+  A damaged or power cut file is converted up to the damage, the error goes to stderr and it exits with 1.
+
+  Usage: dbl2csv data_20260101.dbl [data_20260101.csv]     (stdout if no output file)
+         dbl2csv --index data_20260101.dbl                 (the blocks, from the index at the end of each)
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BinaryCellLogReader.h"
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    return false;
+  }
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+  {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const bool index = argc > 1 && strcmp(argv[1], "--index") == 0;
+  const int first = index ? 2 : 1;
+  if (argc <= first || argc > first + (index ? 1 : 2))
+  {
+    fprintf(stderr, "Usage: dbl2csv input.dbl [output.csv]\n       dbl2csv --index input.dbl\n");
+    return 2;
+  }
+
+  std::vector<uint8_t> data;
+  if (!readFile(argv[first], data))
+  {
+    fprintf(stderr, "Unable to read %s\n", argv[first]);
+    return 2;
+  }
+
+  if (index)
+  {
+    const auto blocks = BinaryCellLogReader::Index(data);
+    for (const auto &b : blocks)
+    {
+      printf("%10u  %4u records  %s to %s\n", b.offset, b.records, BinaryCellLogReader::Timestamp(b.firstTime).c_str(),
+             BinaryCellLogReader::Timestamp(b.lastTime).c_str());
+    }
+    const size_t indexed = blocks.empty() ? data.size() : blocks.front().offset;
+    if (indexed > 10)
+    {
+      printf("Bytes 0 to %u have no index, read them with dbl2csv\n", (uint32_t)indexed);
+    }
+    return 0;
+  }
+
+  std::string csv;
+  BinaryCellLogReader::Result result;
+  const bool ok = BinaryCellLogReader::ToCsv(data, csv, result);
+
+  FILE *out = argc > first + 1 ? fopen(argv[first + 1], "wb") : stdout;
+  if (out == nullptr)
+  {
+    fprintf(stderr, "Unable to write %s\n", argv[first + 1]);
+    return 2;
+  }
+  fwrite(csv.data(), 1, csv.size(), out);
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+
+  if (!ok)
+  {
+    fprintf(stderr, "%s: %s, %u rows converted\n", argv[first], result.error.c_str(), result.keyframes + result.deltas);
+    return 1;
+  }
+  return 0;
+}
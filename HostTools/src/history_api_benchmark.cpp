@@ -0,0 +1,242 @@
+/*
+  Host check and benchmark of /api/history (JSON) against /api/historybin (ESPController/src/history.cpp,
+  compiled unchanged).
+
+  A month of snapshots every "interval" seconds is added to History.  For each resolution the binary
+  response is decoded from its header alone (as the web page does) and written out as JSON, which must
+  match /api/history exactly, any difference exits with 1.  Then it reports the size of both responses,
+  the handler time and the number of chunks sent through the 1800 byte httpbuf.
+
+  Usage: history_api_benchmark [days=31] [interval=10] [repeat=20]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "defines.h"
+#include "Rules.h"
+#include "history.h"
+
+#include "../../ESPController/lib/crc16/crc16.cpp"
+#include "../../ESPController/src/Rules.cpp"
+// Both files have a TAG
+#define TAG history_TAG
+#include "../../ESPController/src/history.cpp"
+#undef TAG
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+static Rules rules;
+static currentmonitoring_struct currentMonitor;
+// Same size as httpbuf
+static char buffer[1800];
+
+// Pack slowly cycling over a day, with some noise
+static void sample(uint32_t t)
+{
+  const double day = sin(t * 2 * M_PI / 86400.0);
+  currentMonitor.validReadings = true;
+  currentMonitor.modbus.voltage = (float)(53.0 + 2.0 * day + (rand() % 10) / 100.0);
+  currentMonitor.modbus.current = (float)(40.0 * day + (rand() % 100) / 10.0 - 5.0);
+  currentMonitor.stateofcharge = (float)(60.0 + 30.0 * day);
+  currentMonitor.modbus.milliamphour_in += (uint32_t)max(0.0, 40.0 * day) * 3;
+  currentMonitor.modbus.milliamphour_out += (uint32_t)max(0.0, -40.0 * day) * 3;
+  rules.lowestCellVoltage = (uint16_t)(3300 + 100 * day - rand() % 20);
+  rules.highestCellVoltage = (uint16_t)(rules.lowestCellVoltage + 5 + rand() % 15);
+  rules.address_LowestCellVoltage = (uint8_t)(rand() % 16);
+  rules.address_HighestCellVoltage = (uint8_t)(rand() % 16);
+  rules.highestBankRange = rules.highestCellVoltage - rules.lowestCellVoltage;
+  rules.lowestBankVoltage = rules.highestBankVoltage = (uint32_t)(currentMonitor.modbus.voltage * 1000);
+  rules.lowestExternalTemp = (int8_t)(20 + (t / 3600) % 5);
+  rules.highestExternalTemp = (int8_t)(rules.lowestExternalTemp + rand() % 3);
+}
+
+// Decodes the binary response using only what its header says, and writes it out as /api/history does
+static std::string decode(const std::string &body)
+{
+  const uint8_t *p = (const uint8_t *)body.data();
+  const uint8_t *end = p + body.size();
+  if (body.size() < 9 || memcmp(p, "DHB\x01", 4) != 0)
+  {
+    return "bad header";
+  }
+  uint32_t resolution;
+  memcpy(&resolution, p + 4, sizeof(resolution));
+  const uint8_t numberOfFields = p[8];
+  p += 9;
+
+  struct Field
+  {
+    uint8_t flags;
+    int8_t reference;
+    std::string name;
+    std::vector<int32_t> values;
+  };
+  std::vector<Field> fields(numberOfFields);
+  for (auto &f : fields)
+  {
+    f.flags = p[0];
+    f.reference = (int8_t)p[1];
+    f.name.assign((const char *)p + 3, p[2]);
+    p += 3 + p[2];
+  }
+
+  while (p + 8 <= end)
+  {
+    uint16_t used;
+    memcpy(&used, p + 4, sizeof(used));
+    const uint8_t records = p[6];
+    p += 8;
+    const uint8_t *blockEnd = p + used;
+
+    std::vector<int32_t> previous(numberOfFields, 0);
+    std::vector<int32_t> record(numberOfFields);
+    for (uint8_t r = 0; r < records; r++)
+    {
+      for (uint8_t f = 0; f < numberOfFields; f++)
+      {
+        uint32_t z = 0;
+        uint8_t shift = 0;
+        uint8_t b;
+        do
+        {
+          b = *p++;
+          z |= (uint32_t)(b & 0x7F) << shift;
+          shift += 7;
+        } while (b & 0x80);
+        const int32_t difference = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+
+        uint32_t reference = (uint32_t)((fields[f].flags & 1) ? record[fields[f].reference] : previous[f]);
+        if (fields[f].flags & 8)
+        {
+          reference += resolution;
+        }
+        record[f] = (int32_t)(reference + (uint32_t)difference);
+      }
+      previous = record;
+      for (uint8_t f = 0; f < numberOfFields; f++)
+      {
+        fields[f].values.push_back(record[f]);
+      }
+    }
+    p = blockEnd;
+  }
+
+  // In the order /api/history sends them
+  std::string json = "{\"resolution\":" + std::to_string(resolution);
+  for (const auto &s : series)
+  {
+    const Field *f = nullptr;
+    for (const auto &candidate : fields)
+    {
+      if (candidate.name == s.name)
+      {
+        f = &candidate;
+      }
+    }
+    if (f == nullptr)
+    {
+      return std::string("missing ") + s.name;
+    }
+    json += ",\"" + f->name + "\":[";
+    char value[24];
+    for (size_t i = 0; i < f->values.size(); i++)
+    {
+      const int32_t v = f->values[i];
+      if (f->flags & 2)
+      {
+        snprintf(value, sizeof(value), i == 0 ? "%.2f" : ",%.2f", v / 100.0F);
+      }
+      else if (f->flags & 4)
+      {
+        snprintf(value, sizeof(value), i == 0 ? "%u" : ",%u", (uint32_t)v);
+      }
+      else
+      {
+        snprintf(value, sizeof(value), i == 0 ? "%li" : ",%li", (long)v);
+      }
+      json += value;
+    }
+    json += "]";
+  }
+  return json + "}";
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t days = 31;
+  uint32_t interval = 10;
+  uint32_t repeat = 20;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "days=", 5) == 0)
+    {
+      days = (uint32_t)atoi(argv[i] + 5);
+    }
+    else if (strncmp(argv[i], "interval=", 9) == 0)
+    {
+      interval = (uint32_t)max(1, atoi(argv[i] + 9));
+    }
+    else if (strncmp(argv[i], "repeat=", 7) == 0)
+    {
+      repeat = (uint32_t)max(1, atoi(argv[i] + 7));
+    }
+  }
+
+  History history;
+  history.Clear();
+  const uint32_t start = 1790000000;
+  const uint32_t snapshots = days * 86400 / interval;
+  srand(1);
+  for (uint32_t s = 0; s < snapshots; s++)
+  {
+    const uint32_t t = start + s * interval;
+    now_us += (int64_t)interval * 1000000;
+    sample(t);
+    history.Add(t, &rules, &currentMonitor);
+  }
+
+  printf("%u days every %u seconds\n", days, interval);
+  bool ok = true;
+  for (uint8_t tier = 0; tier < History::NumberOfTiers; tier++)
+  {
+    const auto stats = history.Statistics(tier);
+
+    httpd_req_t json;
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < repeat; r++)
+    {
+      json = httpd_req_t();
+      history.GenerateJSON(&json, buffer, sizeof(buffer), stats.resolution, 0, UINT32_MAX);
+    }
+    const double json_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count() / repeat;
+
+    httpd_req_t binary;
+    started = std::chrono::steady_clock::now();
+    for (uint32_t r = 0; r < repeat; r++)
+    {
+      binary = httpd_req_t();
+      history.GenerateBinary(&binary, buffer, sizeof(buffer), stats.resolution, 0, UINT32_MAX);
+    }
+    const double binary_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count() / repeat;
+
+    if (decode(binary.body) != json.body)
+    {
+      printf("%us: decoded binary does not match the JSON\n", stats.resolution);
+      ok = false;
+    }
+
+    printf("%5us  %4u records  json %7u bytes %9.1f us %3u chunks  binary %6u bytes %7.1f us %3u chunks  size %4.1f%%  time %4.1f%%\n",
+           stats.resolution, stats.records, (uint32_t)json.body.size(), json_us, json.chunks, (uint32_t)binary.body.size(), binary_us, binary.chunks,
+           100.0 * binary.body.size() / json.body.size(), 100.0 * binary_us / json_us);
+  }
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
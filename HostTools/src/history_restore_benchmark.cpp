@@ -0,0 +1,266 @@
+/*
+  Host check and benchmark of the history file (ESPController/src/history.cpp, compiled unchanged).
+
+  "days" of snapshots every "interval" seconds are added to History, with Checkpoint() called every
+  20 seconds as lazy_tasks does, and a restart half way through.  At the end the 5 and 30 minute
+  history is restored from the file into a new History and the /api/history JSON compared with the
+  original, any difference exits with 1.  A torn chunk at the end of the file and a damaged block are
+  then restored as well.
+
+  For a restore it reports the time and the file reads, for just the chunk headers (what happens at
+  power up) and for reading in every block, the flash reads are the numbers that matter on the controller.
+
+  Usage: history_restore_benchmark [days=31] [interval=10] [dir=/tmp]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "defines.h"
+#include "Rules.h"
+#include "history.h"
+
+#include "../../ESPController/lib/crc16/crc16.cpp"
+#include "../../ESPController/src/Rules.cpp"
+// Both files have a TAG
+#define TAG history_TAG
+#include "../../ESPController/src/history.cpp"
+#undef TAG
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+static Rules rules;
+static currentmonitoring_struct currentMonitor;
+static char buffer[1800];
+
+static std::string json(History &history, uint32_t resolution)
+{
+  httpd_req_t req;
+  history.GenerateJSON(&req, buffer, sizeof(buffer), resolution, 0, UINT32_MAX);
+  return req.body;
+}
+
+// Pack slowly cycling over a day, with some noise
+static void sample(uint32_t t)
+{
+  const double day = sin(t * 2 * M_PI / 86400.0);
+  currentMonitor.validReadings = true;
+  currentMonitor.modbus.voltage = (float)(53.0 + 2.0 * day + (rand() % 10) / 100.0);
+  currentMonitor.modbus.current = (float)(40.0 * day + (rand() % 100) / 10.0 - 5.0);
+  currentMonitor.stateofcharge = (float)(60.0 + 30.0 * day);
+  currentMonitor.modbus.milliamphour_in += (uint32_t)max(0.0, 40.0 * day) * 3;
+  currentMonitor.modbus.milliamphour_out += (uint32_t)max(0.0, -40.0 * day) * 3;
+  rules.lowestCellVoltage = (uint16_t)(3300 + 100 * day - rand() % 20);
+  rules.highestCellVoltage = (uint16_t)(rules.lowestCellVoltage + 5 + rand() % 15);
+  rules.address_LowestCellVoltage = (uint8_t)(rand() % 16);
+  rules.address_HighestCellVoltage = (uint8_t)(rand() % 16);
+  rules.highestBankRange = rules.highestCellVoltage - rules.lowestCellVoltage;
+  rules.lowestBankVoltage = rules.highestBankVoltage = (uint32_t)(currentMonitor.modbus.voltage * 1000);
+  rules.lowestExternalTemp = (int8_t)(20 + (t / 3600) % 5);
+  rules.highestExternalTemp = (int8_t)(rules.lowestExternalTemp + rand() % 3);
+}
+
+struct Measured
+{
+  double header_ms;
+  fs::Counters header;
+  double all_ms;
+  fs::Counters all;
+};
+
+// New History restored from the file, the same as a power up
+static History *restore(fs::FS &fs, Measured &m)
+{
+  auto *history = new History();
+  history->Clear();
+
+  fs::counters = {};
+  auto started = std::chrono::steady_clock::now();
+  history->Restore(fs);
+  m.header_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  m.header = fs::counters;
+
+  // What the first /api/history request after a restart does
+  fs::counters = {};
+  started = std::chrono::steady_clock::now();
+  httpd_req_t req;
+  history->GenerateJSON(&req, buffer, sizeof(buffer), 1800, UINT32_MAX, UINT32_MAX);
+  m.all_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+  m.all = fs::counters;
+  return history;
+}
+
+static bool compare(History &original, History &restored, const char *what)
+{
+  bool ok = true;
+  for (uint32_t resolution : {300, 1800})
+  {
+    const std::string a = json(original, resolution);
+    const std::string b = json(restored, resolution);
+    if (a != b)
+    {
+      size_t i = 0;
+      while (i < a.size() && i < b.size() && a[i] == b[i])
+      {
+        i++;
+      }
+      printf("%s: %us history differs at character %u\n  %.80s\n  %.80s\n", what, resolution, (uint32_t)i,
+             a.c_str() + (i > 20 ? i - 20 : 0), b.c_str() + (i > 20 ? i - 20 : 0));
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+static void report(const char *what, const Measured &m, const History &h)
+{
+  printf("%-16s blocks %3u  headers %7.3f ms  %4u reads %6u bytes   every block %7.3f ms  %4u reads %6u bytes\n", what,
+         h.restoredBlocks, m.header_ms, m.header.reads, (uint32_t)m.header.bytesRead, m.all_ms, m.all.reads, (uint32_t)m.all.bytesRead);
+}
+
+static long fileSize(const std::string &path)
+{
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == nullptr)
+  {
+    return -1;
+  }
+  fseek(f, 0, SEEK_END);
+  const long size = ftell(f);
+  fclose(f);
+  return size;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t days = 31;
+  uint32_t interval = 10;
+  std::string dir = "/tmp";
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "days=", 5) == 0)
+    {
+      days = (uint32_t)atoi(argv[i] + 5);
+    }
+    else if (strncmp(argv[i], "interval=", 9) == 0)
+    {
+      interval = (uint32_t)max(1, atoi(argv[i] + 9));
+    }
+    else if (strncmp(argv[i], "dir=", 4) == 0)
+    {
+      dir = argv[i] + 4;
+    }
+  }
+
+  fs::FS fs(dir);
+  const std::string path = dir + History::filename;
+  fs.remove(History::filename);
+
+  const uint32_t start = 1790000000;
+  const uint32_t snapshots = days * 86400 / interval;
+  auto *history = new History();
+  history->Clear();
+  history->Restore(fs);
+
+  srand(1);
+  bool ok = true;
+  uint32_t written = 0;
+  long largest = 0;
+  int64_t nextCheckpoint = 0;
+  for (uint32_t s = 0; s < snapshots; s++)
+  {
+    const uint32_t t = start + s * interval;
+    now_us += (int64_t)interval * 1000000;
+    sample(t);
+    history->Add(t, &rules, &currentMonitor);
+
+    if (now_us >= nextCheckpoint)
+    {
+      history->Checkpoint();
+      nextCheckpoint = now_us + 20 * 1000000LL;
+      largest = max(largest, fileSize(path));
+    }
+
+    if (s == snapshots / 2)
+    {
+      // Restart, the history since the last checkpoint is lost as on the controller
+      written += history->chunksWritten;
+      delete history;
+      Measured m;
+      history = restore(fs, m);
+      now_us = 0;
+      nextCheckpoint = 0;
+    }
+  }
+
+  // Everything written before comparing
+  now_us += (int64_t)History::CheckpointInterval * 1000000;
+  history->Checkpoint();
+  written += history->chunksWritten;
+
+  printf("%u days every %u seconds, %u chunks written (%u bytes each), largest file %ld bytes, now %ld\n", days, interval, written,
+         (uint32_t)sizeof(History::Block) + 12, largest, fileSize(path));
+  if (largest > (long)(History::CompactSize + 2 * (sizeof(History::Block) + 12)))
+  {
+    printf("File was not compacted\n");
+    ok = false;
+  }
+
+  Measured m;
+  History *restored = restore(fs, m);
+  report("month", m, *restored);
+  ok &= compare(*history, *restored, "Restored");
+  ok &= restored->fileErrors == 0;
+  delete restored;
+
+  // Part written chunk at the end, from a power cut during Checkpoint()
+  {
+    FILE *f = fopen(path.c_str(), "ab");
+    const uint8_t torn[100] = {0x44, 0x48, 0x53, 0x54};
+    fwrite(torn, 1, sizeof(torn), f);
+    fclose(f);
+  }
+  restored = restore(fs, m);
+  report("torn chunk", m, *restored);
+  ok &= compare(*history, *restored, "Torn chunk");
+  ok &= restored->fileErrors == 0;
+
+  // The rewrite drops the torn chunk
+  restored->Checkpoint();
+  if (fileSize(path) % (sizeof(History::Block) + 12) != 0)
+  {
+    printf("Torn chunk still in the file\n");
+    ok = false;
+  }
+  delete restored;
+
+  // One bit flipped in the data of the first chunk, only that block is lost
+  {
+    FILE *f = fopen(path.c_str(), "r+b");
+    fseek(f, 12 + 8 + 3, SEEK_SET);
+    const int c = fgetc(f);
+    fseek(f, 12 + 8 + 3, SEEK_SET);
+    fputc(c ^ 0x10, f);
+    fclose(f);
+  }
+  restored = restore(fs, m);
+  report("damaged block", m, *restored);
+  const auto before = restored->Statistics(1).records + restored->Statistics(2).records;
+  const auto after = history->Statistics(1).records + history->Statistics(2).records;
+  if (restored->fileErrors != 1 || before >= after)
+  {
+    printf("Damaged block: %u errors, %u of %u records\n", restored->fileErrors, before, after);
+    ok = false;
+  }
+  delete restored;
+  delete history;
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,713 @@
+/*
+  Replays the controller SD card logs through Rules, ESPController/src/Rules.cpp compiled unchanged.
+
+  Each row of the cell log (/data_YYYYMMDD.csv) becomes a CellReadings snapshot (and the bad packet
+  and balance counters in cmi[]), the current monitor log (/modbusNN_YYYYMMDD.csv) row with the same
+  time becomes currentMonitor.  Every row then goes through the Rules calls ProcessRules (main.cpp)
+  makes, with time taken from the log, so charging mode timers and Timer1/Timer2 behave as they did.
+
+  The output is a CSV row whenever the active rules, charging mode, charge voltage/current, charge or
+  discharge allowed, errors or warnings change.  Run it again with a setting changed to see what
+  that change would have done over the recorded data.
+
+  The logs do not record state of charge.  With capacity= it is rebuilt from the current monitor mAh
+  counters, starting from soc=.  Without it the state of charge is treated as unavailable, as when no
+  current monitor is fitted, and the charging mode does not change.
+
+  Usage: log_replay [option=value ...] data_YYYYMMDD.csv ... [modbusNN_YYYYMMDD.csv ...]
+    Files are replayed in time order, whatever order they are given in.
+    banks=1         banks in the pack, modules per bank are the cells in the log / banks
+    out=-           output file, - for standard output
+    all=0           1 = write a row for every log row, not just changes
+    protocol=1      ProtocolEmulation (0 = disabled), the charge calculations need one
+    capacity=0      battery capacity (Ah)
+    soc=50          state of charge (%) at the start of the first row
+    efficiency=99   charge efficiency (%) applied to mAh in
+    ruleN=V[,H]     value and hysteresis of rule number N (Rule in Rules.h)
+    Settings used by Rules, as the numbers on the settings pages:
+      chargevolt chargecurrent dischargevolt cellminmv cellmaxmv kneemv sensitivity
+      current_value1 current_value2 cellmaxspikemv dynamiccharge floatvoltage absorptiontimer
+      floatvoltagetimer stateofchargeresumevalue chargetemplow chargetemphigh dischargetemplow
+      dischargetemphigh socoverride socforcelow preventcharging preventdischarge
+*/
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "defines.h"
+#include "Rules.h"
+#include "host_settings.h"
+
+#include "../../ESPController/src/Rules.cpp"
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+CellModuleInfo cmi[maximum_controller_cell_modules];
+static CellReadings cells;
+static diybms_eeprom_settings settings;
+static currentmonitoring_struct currentMonitor;
+static Rules rules;
+
+// Values in the cell log for each module
+static constexpr uint8_t columnsPerCell = 8;
+
+struct SettingOption
+{
+  const char *name;
+  void (*set)(diybms_eeprom_settings &, int32_t);
+};
+
+static const SettingOption settingOptions[] = {
+    {"chargevolt", [](diybms_eeprom_settings &s, int32_t v) { s.chargevolt = (uint16_t)v; }},
+    {"chargecurrent", [](diybms_eeprom_settings &s, int32_t v) { s.chargecurrent = (uint16_t)v; }},
+    {"dischargevolt", [](diybms_eeprom_settings &s, int32_t v) { s.dischargevolt = (uint16_t)v; }},
+    {"cellminmv", [](diybms_eeprom_settings &s, int32_t v) { s.cellminmv = (int16_t)v; }},
+    {"cellmaxmv", [](diybms_eeprom_settings &s, int32_t v) { s.cellmaxmv = (int16_t)v; }},
+    {"kneemv", [](diybms_eeprom_settings &s, int32_t v) { s.kneemv = (int16_t)v; }},
+    {"sensitivity", [](diybms_eeprom_settings &s, int32_t v) { s.sensitivity = (int16_t)v; }},
+    {"current_value1", [](diybms_eeprom_settings &s, int32_t v) { s.current_value1 = (uint16_t)v; }},
+    {"current_value2", [](diybms_eeprom_settings &s, int32_t v) { s.current_value2 = (uint16_t)v; }},
+    {"cellmaxspikemv", [](diybms_eeprom_settings &s, int32_t v) { s.cellmaxspikemv = (int16_t)v; }},
+    {"dynamiccharge", [](diybms_eeprom_settings &s, int32_t v) { s.dynamiccharge = v != 0; }},
+    {"floatvoltage", [](diybms_eeprom_settings &s, int32_t v) { s.floatvoltage = (uint16_t)v; }},
+    {"absorptiontimer", [](diybms_eeprom_settings &s, int32_t v) { s.absorptiontimer = (uint16_t)v; }},
+    {"floatvoltagetimer", [](diybms_eeprom_settings &s, int32_t v) { s.floatvoltagetimer = (uint16_t)v; }},
+    {"stateofchargeresumevalue", [](diybms_eeprom_settings &s, int32_t v) { s.stateofchargeresumevalue = (uint8_t)v; }},
+    {"chargetemplow", [](diybms_eeprom_settings &s, int32_t v) { s.chargetemplow = (int8_t)v; }},
+    {"chargetemphigh", [](diybms_eeprom_settings &s, int32_t v) { s.chargetemphigh = (int8_t)v; }},
+    {"dischargetemplow", [](diybms_eeprom_settings &s, int32_t v) { s.dischargetemplow = (int8_t)v; }},
+    {"dischargetemphigh", [](diybms_eeprom_settings &s, int32_t v) { s.dischargetemphigh = (int8_t)v; }},
+    {"socoverride", [](diybms_eeprom_settings &s, int32_t v) { s.socoverride = v != 0; }},
+    {"socforcelow", [](diybms_eeprom_settings &s, int32_t v) { s.socforcelow = v != 0; }},
+    {"preventcharging", [](diybms_eeprom_settings &s, int32_t v) { s.preventcharging = v != 0; }},
+    {"preventdischarge", [](diybms_eeprom_settings &s, int32_t v) { s.preventdischarge = v != 0; }},
+};
+
+struct Options
+{
+  uint8_t banks = 1;
+  const char *out = "-";
+  bool all = false;
+  uint8_t protocol = ProtocolEmulation::CANBUS_VICTRON;
+  float capacityAh = 0;
+  float soc = 50;
+  float efficiency = 99;
+  std::vector<const char *> dataFiles;
+  std::vector<const char *> modbusFiles;
+  // Applied after the defaults, once the number of modules is known
+  std::vector<std::pair<const SettingOption *, int32_t>> settings;
+  std::vector<std::pair<uint8_t, std::pair<int32_t, int32_t>>> rules;
+};
+
+static bool read_file(const char *filename, std::string &contents)
+{
+  FILE *f = fopen(filename, "rb");
+  if (f == nullptr)
+  {
+    printf("Cannot open %s\n", filename);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  contents.resize((size_t)ftell(f));
+  fseek(f, 0, SEEK_SET);
+  const size_t read = fread(&contents[0], 1, contents.size(), f);
+  fclose(f);
+  contents.resize(read);
+  return true;
+}
+
+// Seconds since 1970 from "YYYY-MM-DD HH:MM:SS", as the logs write it (local time, no time zone)
+static bool parse_time(const char *&p, int64_t &seconds)
+{
+  unsigned int y, mo, d, h, mi, s;
+  int used = 0;
+  if (sscanf(p, "%4u-%2u-%2u %2u:%2u:%2u%n", &y, &mo, &d, &h, &mi, &s, &used) != 6)
+  {
+    return false;
+  }
+  p += used;
+
+  // Days from civil, proleptic Gregorian
+  const int64_t year = (int64_t)y - (mo <= 2);
+  const int64_t era = year / 400;
+  const int64_t yoe = year - era * 400;
+  const int64_t doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  const int64_t days = era * 146097 + doe - 719468;
+  seconds = days * 86400 + h * 3600 + mi * 60 + s;
+  return true;
+}
+
+static inline void next_field(const char *&p)
+{
+  while (*p != ',' && *p != '\r' && *p != '\n' && *p != 0)
+  {
+    p++;
+  }
+  if (*p == ',')
+  {
+    p++;
+  }
+}
+
+static inline int32_t int_field(const char *&p)
+{
+  char *end;
+  const long v = strtol(p, &end, 10);
+  p = end;
+  next_field(p);
+  return (int32_t)v;
+}
+
+static inline float float_field(const char *&p)
+{
+  char *end;
+  const float v = strtof(p, &end);
+  p = end;
+  next_field(p);
+  return v;
+}
+
+static inline bool flag_field(const char *&p)
+{
+  const bool v = (*p == 'Y');
+  next_field(p);
+  return v;
+}
+
+static inline void next_line(const char *&p)
+{
+  while (*p != '\n' && *p != 0)
+  {
+    p++;
+  }
+  if (*p == '\n')
+  {
+    p++;
+  }
+}
+
+struct CurrentRow
+{
+  int64_t time;
+  bool valid;
+  float voltage;
+  float current;
+  uint32_t milliamphour_in;
+  uint32_t milliamphour_out;
+  uint32_t daily_milliamphour_in;
+  uint32_t daily_milliamphour_out;
+  float power;
+  int16_t temperature;
+};
+
+// "DateTime,valid,voltage,current,mAhIn,mAhOut,DailymAhIn,DailymAhOut,power,temperature,relayState"
+static bool load_current_log(const char *filename, std::vector<CurrentRow> &rows)
+{
+  std::string contents;
+  if (!read_file(filename, contents))
+  {
+    return false;
+  }
+
+  const char *p = contents.c_str();
+  if (strncmp(p, "DateTime,valid,voltage,current", 30) != 0)
+  {
+    printf("%s is not a current monitor log\n", filename);
+    return false;
+  }
+  next_line(p);
+
+  while (*p != 0)
+  {
+    CurrentRow r;
+    if (!parse_time(p, r.time))
+    {
+      next_line(p);
+      continue;
+    }
+    next_field(p);
+    r.valid = int_field(p) != 0;
+    r.voltage = float_field(p);
+    r.current = float_field(p);
+    r.milliamphour_in = (uint32_t)strtoul(p, nullptr, 10);
+    next_field(p);
+    r.milliamphour_out = (uint32_t)strtoul(p, nullptr, 10);
+    next_field(p);
+    r.daily_milliamphour_in = (uint32_t)strtoul(p, nullptr, 10);
+    next_field(p);
+    r.daily_milliamphour_out = (uint32_t)strtoul(p, nullptr, 10);
+    next_field(p);
+    r.power = float_field(p);
+    r.temperature = (int16_t)int_field(p);
+    rows.push_back(r);
+    next_line(p);
+  }
+  return true;
+}
+
+// Number of modules in a cell log, from its header
+static int count_cells(const char *p)
+{
+  if (strncmp(p, "DateTime,", 9) != 0)
+  {
+    return -1;
+  }
+  int columns = 1;
+  for (; *p != '\n' && *p != 0; p++)
+  {
+    if (*p == ',')
+    {
+      columns++;
+    }
+  }
+  return (columns - 1) % columnsPerCell == 0 ? (columns - 1) / columnsPerCell : -1;
+}
+
+// Cell log file whose first row time is used to replay the files in order
+struct CellLog
+{
+  const char *filename;
+  std::string contents;
+  int64_t firstTime;
+};
+
+// What the output file reports, a row is written when any of it changes
+struct Outcome
+{
+  uint32_t activeRules;
+  ChargingMode mode;
+  uint16_t chargeVoltage;
+  int16_t chargeCurrent;
+  bool chargeAllowed;
+  bool dischargeAllowed;
+  uint32_t errors;
+  uint32_t warnings;
+
+  bool operator!=(const Outcome &o) const
+  {
+    return activeRules != o.activeRules || mode != o.mode || chargeVoltage != o.chargeVoltage || chargeCurrent != o.chargeCurrent ||
+           chargeAllowed != o.chargeAllowed || dischargeAllowed != o.dischargeAllowed || errors != o.errors || warnings != o.warnings;
+  }
+};
+
+// The Rules calls made by ProcessRules (main.cpp), the controller is running as it only logs then
+static Outcome process_rules(uint16_t minutesSinceMidnight)
+{
+  rules.ClearWarnings();
+  rules.ClearErrors();
+  rules.setRuleStatus(Rule::BMSError, false);
+  rules.numberOfBalancingModules = 0;
+
+  rules.UpdateCellValues(&cells, settings.totalNumberOfBanks, settings.totalNumberOfSeriesModules, settings.cellmaxmv);
+  for (uint8_t m = 0; m < settings.totalNumberOfBanks * settings.totalNumberOfSeriesModules; m++)
+  {
+    if (cells.inBypass[m])
+    {
+      rules.numberOfBalancingModules++;
+    }
+  }
+
+  rules.CalculateChargingMode(&settings, &currentMonitor);
+  rules.CalculateDynamicChargeVoltage(&settings, &cells);
+  rules.CalculateDynamicChargeCurrent(&settings);
+
+  if (rules.invalidModuleCount > 0)
+  {
+    rules.SetError(InternalErrorCode::WaitingForModulesToReply);
+  }
+  if (rules.zeroVoltageModuleCount > 0)
+  {
+    rules.SetError(InternalErrorCode::ZeroVoltModule);
+    rules.setRuleStatus(Rule::BMSError, true);
+  }
+
+  rules.RunRules(settings.rulevalue, settings.rulehysteresis, false, minutesSinceMidnight, &currentMonitor);
+
+  if (rules.moduleHasExternalTempSensor == false)
+  {
+    rules.SetWarning(InternalWarningCode::NoExternalTempSensor);
+  }
+
+  Outcome o{};
+  o.chargeAllowed = rules.IsChargeAllowed(&settings);
+  o.dischargeAllowed = rules.IsDischargeAllowed(&settings);
+  if (settings.protocol != ProtocolEmulation::EMULATION_DISABLED)
+  {
+    if (!o.chargeAllowed)
+    {
+      rules.SetWarning(InternalWarningCode::ChargePrevented);
+    }
+    if (!o.dischargeAllowed)
+    {
+      rules.SetWarning(InternalWarningCode::DischargePrevented);
+    }
+  }
+
+  for (uint8_t r = 0; r <= MAXIMUM_RuleNumber; r++)
+  {
+    if (rules.ruleOutcome((Rule)r))
+    {
+      o.activeRules |= 1U << r;
+    }
+  }
+  o.mode = rules.getChargingMode();
+  o.chargeVoltage = rules.DynamicChargeVoltage();
+  o.chargeCurrent = rules.DynamicChargeCurrent();
+  for (auto e : rules.ErrorCodes)
+  {
+    if (e != InternalErrorCode::NoError)
+    {
+      o.errors |= 1U << e;
+    }
+  }
+  for (auto w : rules.WarningCodes)
+  {
+    if (w != InternalWarningCode::NoWarning)
+    {
+      o.warnings |= 1U << w;
+    }
+  }
+  return o;
+}
+
+static const char *const modeNames[] = {"standard", "absorb", "floating", "dynamic", "stopped"};
+
+static void write_codes(FILE *out, uint32_t bits, const std::string *names, uint8_t count)
+{
+  bool first = true;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (bits & (1U << i))
+    {
+      fprintf(out, "%s%s", first ? "" : "|", names[i].c_str());
+      first = false;
+    }
+  }
+}
+
+static void write_outcome(FILE *out, const char *time, const Outcome &o)
+{
+  fprintf(out, "%.19s,", time);
+  write_codes(out, o.activeRules, Rules::RuleTextDescription.data(), 1 + MAXIMUM_RuleNumber);
+  fprintf(out, ",%s,%.1f,%.1f,%u,%u,", modeNames[(uint8_t)o.mode], o.chargeVoltage / 10.0F, o.chargeCurrent / 10.0F,
+          o.chargeAllowed ? 1 : 0, o.dischargeAllowed ? 1 : 0);
+  write_codes(out, o.errors, Rules::InternalErrorCodeDescription.data(), 1 + MAXIMUM_InternalErrorCode);
+  fprintf(out, ",");
+  write_codes(out, o.warnings, Rules::InternalWarningCodeDescription.data(), 1 + MAXIMUM_InternalWarningCode);
+  fprintf(out, "\n");
+}
+
+static bool parse_options(int argc, char **argv, Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = strchr(arg, '=');
+    if (value == nullptr)
+    {
+      // Log file, the controller names them /data_YYYYMMDD.csv and /modbusNN_YYYYMMDD.csv
+      const char *name = strrchr(arg, '/');
+      name = name ? name + 1 : arg;
+      if (strncmp(name, "modbus", 6) == 0)
+      {
+        options.modbusFiles.push_back(arg);
+      }
+      else
+      {
+        options.dataFiles.push_back(arg);
+      }
+      continue;
+    }
+    value++;
+
+    auto is = [arg](const char *name)
+    { return strncmp(arg, name, strlen(name)) == 0 && arg[strlen(name)] == '='; };
+
+    if (is("banks"))
+    {
+      options.banks = (uint8_t)atoi(value);
+    }
+    else if (is("out"))
+    {
+      options.out = value;
+    }
+    else if (is("all"))
+    {
+      options.all = atoi(value) != 0;
+    }
+    else if (is("protocol"))
+    {
+      options.protocol = (uint8_t)atoi(value);
+    }
+    else if (is("capacity"))
+    {
+      options.capacityAh = (float)atof(value);
+    }
+    else if (is("soc"))
+    {
+      options.soc = (float)atof(value);
+    }
+    else if (is("efficiency"))
+    {
+      options.efficiency = (float)atof(value);
+    }
+    else if (strncmp(arg, "rule", 4) == 0 && isdigit((unsigned char)arg[4]))
+    {
+      const int r = atoi(arg + 4);
+      int v, h;
+      const int n = sscanf(value, "%d,%d", &v, &h);
+      if (r > MAXIMUM_RuleNumber || n < 1)
+      {
+        printf("Bad rule option %s\n", arg);
+        return false;
+      }
+      options.rules.push_back({(uint8_t)r, {v, n == 2 ? h : v}});
+    }
+    else
+    {
+      const SettingOption *found = nullptr;
+      for (const auto &s : settingOptions)
+      {
+        if (is(s.name))
+        {
+          found = &s;
+        }
+      }
+      if (found == nullptr)
+      {
+        printf("Unknown option %s, see the top of log_replay.cpp\n", arg);
+        return false;
+      }
+      options.settings.push_back({found, atoi(value)});
+    }
+  }
+
+  if (options.dataFiles.empty())
+  {
+    printf("No cell log (data_YYYYMMDD.csv) given, see the top of log_replay.cpp\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, options))
+  {
+    return 1;
+  }
+
+  std::vector<CellLog> logs(options.dataFiles.size());
+  int numberOfCells = -1;
+  for (size_t f = 0; f < options.dataFiles.size(); f++)
+  {
+    CellLog &log = logs[f];
+    log.filename = options.dataFiles[f];
+    if (!read_file(log.filename, log.contents))
+    {
+      return 1;
+    }
+
+    const int n = count_cells(log.contents.c_str());
+    if (n <= 0 || (numberOfCells != -1 && n != numberOfCells))
+    {
+      printf("%s is not a cell log, or has a different number of modules\n", log.filename);
+      return 1;
+    }
+    numberOfCells = n;
+
+    const char *p = log.contents.c_str();
+    next_line(p);
+    log.firstTime = 0;
+    parse_time(p, log.firstTime);
+  }
+  std::stable_sort(logs.begin(), logs.end(), [](const CellLog &a, const CellLog &b)
+                   { return a.firstTime < b.firstTime; });
+
+  if (numberOfCells > maximum_controller_cell_modules || options.banks == 0 || numberOfCells % options.banks != 0)
+  {
+    printf("%i modules in the log cannot be split into %u banks\n", numberOfCells, options.banks);
+    return 1;
+  }
+
+  std::vector<CurrentRow> currentRows;
+  for (auto filename : options.modbusFiles)
+  {
+    if (!load_current_log(filename, currentRows))
+    {
+      return 1;
+    }
+  }
+  std::stable_sort(currentRows.begin(), currentRows.end(), [](const CurrentRow &a, const CurrentRow &b)
+                   { return a.time < b.time; });
+
+  host_default_settings(settings, options.banks, (uint8_t)(numberOfCells / options.banks));
+  settings.protocol = (ProtocolEmulation)options.protocol;
+  settings.currentMonitoringEnabled = !currentRows.empty();
+  if (options.capacityAh <= 0)
+  {
+    // A monitor without state of charge, CalculateChargingMode then leaves the mode alone
+    settings.currentMonitoringDevice = CurrentMonitorDevice::PZEM_017;
+  }
+  for (const auto &s : options.settings)
+  {
+    s.first->set(settings, s.second);
+  }
+  for (const auto &r : options.rules)
+  {
+    settings.rulevalue[r.first] = r.second.first;
+    settings.rulehysteresis[r.first] = r.second.second;
+  }
+
+  FILE *out = stdout;
+  if (strcmp(options.out, "-") != 0)
+  {
+    out = fopen(options.out, "w");
+    if (out == nullptr)
+    {
+      printf("Cannot create %s\n", options.out);
+      return 1;
+    }
+  }
+  static char outBuffer[1 << 16];
+  setvbuf(out, outBuffer, _IOFBF, sizeof(outBuffer));
+  fprintf(out, "DateTime,ActiveRules,ChargeMode,ChargeVoltage,ChargeCurrent,ChargeAllowed,DischargeAllowed,Errors,Warnings\n");
+
+  // Summary, for standard error so it can be kept apart from the output
+  uint32_t rows = 0;
+  uint32_t written = 0;
+  uint32_t transitions[1 + MAXIMUM_RuleNumber] = {};
+  int64_t firstTime = 0;
+  int64_t lastTime = 0;
+
+  size_t nextCurrent = 0;
+  const CurrentRow *current = nullptr;
+  const CurrentRow *previousCurrent = nullptr;
+  float soc = options.soc;
+
+  Outcome previous{};
+  bool first = true;
+
+  auto start = std::chrono::steady_clock::now();
+  for (const auto &log : logs)
+  {
+    const char *p = log.contents.c_str();
+    next_line(p);
+
+    while (*p != 0)
+    {
+      const char *timeText = p;
+      int64_t time;
+      if (!parse_time(p, time))
+      {
+        next_line(p);
+        continue;
+      }
+      next_field(p);
+
+      for (int m = 0; m < numberOfCells; m++)
+      {
+        const uint16_t v = (uint16_t)int_field(p);
+        cells.voltagemV[m] = v;
+        cells.valid[m] = v > 0;
+        cells.internalTemp[m] = (int8_t)int_field(p);
+        cells.externalTemp[m] = (int8_t)int_field(p);
+        cells.inBypass[m] = flag_field(p);
+        // Logged as a percentage
+        cells.PWMValue[m] = (uint8_t)(int_field(p) * 255 / 100);
+        cells.bypassOverTemp[m] = flag_field(p);
+        cmi[m].badPacketCount = (uint16_t)int_field(p);
+        cmi[m].BalanceCurrentCount = (uint16_t)strtoul(p, nullptr, 10);
+        next_field(p);
+      }
+      next_line(p);
+
+      if (rows == 0)
+      {
+        firstTime = time;
+      }
+      lastTime = time;
+      now_us = (time - firstTime) * 1000000;
+
+      // Current monitor rows are logged straight after the cell row, with the same time
+      while (nextCurrent < currentRows.size() && currentRows[nextCurrent].time <= time)
+      {
+        previousCurrent = current;
+        current = &currentRows[nextCurrent++];
+
+        if (options.capacityAh > 0 && previousCurrent != nullptr && current->milliamphour_in >= previousCurrent->milliamphour_in &&
+            current->milliamphour_out >= previousCurrent->milliamphour_out)
+        {
+          const float mAh = (current->milliamphour_in - previousCurrent->milliamphour_in) * options.efficiency / 100.0F -
+                            (float)(current->milliamphour_out - previousCurrent->milliamphour_out);
+          soc = min(100.0F, max(0.0F, soc + mAh / (options.capacityAh * 10.0F)));
+        }
+      }
+
+      memset(&currentMonitor, 0, sizeof(currentMonitor));
+      if (current != nullptr)
+      {
+        currentMonitor.validReadings = current->valid;
+        currentMonitor.modbus.voltage = current->voltage;
+        currentMonitor.modbus.current = current->current;
+        currentMonitor.modbus.milliamphour_in = current->milliamphour_in;
+        currentMonitor.modbus.milliamphour_out = current->milliamphour_out;
+        currentMonitor.modbus.daily_milliamphour_in = current->daily_milliamphour_in;
+        currentMonitor.modbus.daily_milliamphour_out = current->daily_milliamphour_out;
+        currentMonitor.modbus.power = current->power;
+        currentMonitor.modbus.temperature = current->temperature;
+        currentMonitor.stateofcharge = soc;
+      }
+
+      const uint16_t minutes = (uint16_t)((time % 86400) / 60);
+      const Outcome o = process_rules(minutes);
+      rows++;
+
+      if (first || options.all || o != previous)
+      {
+        for (uint8_t r = 0; r <= MAXIMUM_RuleNumber; r++)
+        {
+          if (!first && ((o.activeRules ^ previous.activeRules) & (1U << r)))
+          {
+            transitions[r]++;
+          }
+        }
+        write_outcome(out, timeText, o);
+        written++;
+        previous = o;
+        first = false;
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+  else
+  {
+    fflush(out);
+  }
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  fprintf(stderr, "%u rows (%i modules, %u banks) covering %.1f hours replayed in %.2f s, %.0f rows/s, %.0f times real time\n",
+          rows, numberOfCells, options.banks, (lastTime - firstTime) / 3600.0, seconds, rows / seconds,
+          (double)(lastTime - firstTime) / seconds);
+  fprintf(stderr, "%u rows written\n", written);
+  for (uint8_t r = 0; r <= MAXIMUM_RuleNumber; r++)
+  {
+    if (transitions[r])
+    {
+      fprintf(stderr, "  %-32s %u changes\n", Rules::RuleTextDescription.at(r).c_str(), transitions[r]);
+    }
+  }
+
+  return 0;
+}
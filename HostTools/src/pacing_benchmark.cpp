@@ -0,0 +1,305 @@
+/*
+  Host benchmark for controller -> module request pacing.
+
+  Models the module ring as a store and forward chain (each module receives the complete
+  packet, processes it and then transmits it to the next module) and reports how many
+  full voltage + temperature sweeps per minute transmit_task can achieve using:
+
+    fixed  - legacy fixed per-baud delay after every packet
+    w=N    - reply driven pacing with up to N requests outstanding (PacketPacing from the
+             controller source, using the same release rules as transmit_task)
+
+  A packet which starts arriving at a module while that module is still transmitting the
+  previous packet is counted as corrupt (overrun), its reply fails the CRC check.
+
+  Usage: pacing_benchmark [module processing ms] [reply loss percent] [processing jitter ms]
+
+  Note: the controller only enqueues a sweep every "interpacketgap" ms, so this is the
+  maximum rate the transmit side can sustain, not the configured polling rate.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <array>
+#include <deque>
+#include <vector>
+
+#include "PacketPacing.h"
+
+// sizeof(PacketStruct)
+static constexpr uint32_t packet_bytes = 40;
+// COBS adds an overhead byte and a zero delimiter
+static constexpr uint32_t wire_bytes = packet_bytes + 2;
+// Module requests are sent to groups of up to this many modules
+static constexpr uint32_t modules_per_packet = 16;
+
+// Number of sweeps simulated per configuration
+static constexpr uint32_t sweeps = 200;
+
+struct ChainConfig
+{
+  uint16_t baudrate;
+  uint8_t banks;
+  uint8_t series;
+};
+
+struct Parameters
+{
+  int64_t processing_us;
+  int64_t jitter_us;
+  uint32_t loss_percent;
+};
+
+struct Result
+{
+  double sweeps_per_minute;
+  uint32_t lost;
+  uint32_t overruns;
+};
+
+struct Reply
+{
+  int64_t time_us;
+  uint16_t sequence;
+};
+
+// Simple deterministic PRNG so results are repeatable
+static uint32_t prng_state = 0x12345678;
+static uint32_t prng()
+{
+  prng_state ^= prng_state << 13;
+  prng_state ^= prng_state >> 17;
+  prng_state ^= prng_state << 5;
+  return prng_state;
+}
+
+// Time (microseconds) for one packet to be clocked out of a UART (8N1 = 10 bits per byte)
+static int64_t wire_time_us(uint16_t baudrate)
+{
+  return (int64_t)wire_bytes * 10 * 1000000 / baudrate;
+}
+
+// Store and forward module ring
+class ModuleRing
+{
+public:
+  ModuleRing(uint16_t baudrate, uint32_t modules, const Parameters &p) : wire(wire_time_us(baudrate)), param(p), tx_finished(modules, 0) {}
+
+  // Returns time the packet arrives back at the controller, corrupt is set if any module overran
+  int64_t Send(int64_t now_us, bool *corrupt)
+  {
+    *corrupt = false;
+    // Time the packet has been completely received by the next module
+    int64_t arrived = now_us + wire;
+
+    for (auto &finished : tx_finished)
+    {
+      // Packet started arriving before this module finished sending the previous one
+      if (arrived - wire < finished)
+      {
+        *corrupt = true;
+      }
+
+      int64_t start = arrived + param.processing_us + (param.jitter_us ? (int64_t)(prng() % param.jitter_us) : 0);
+      if (start < finished)
+      {
+        start = finished;
+      }
+      finished = start + wire;
+      arrived = finished;
+    }
+    return arrived;
+  }
+
+private:
+  int64_t wire;
+  const Parameters &param;
+  std::vector<int64_t> tx_finished;
+};
+
+// window == 0 runs the legacy fixed delay
+static Result simulate(const ChainConfig &c, uint8_t window, const Parameters &p)
+{
+  const uint32_t modules = (uint32_t)c.banks * c.series;
+  const uint32_t groups = (modules + modules_per_packet - 1) / modules_per_packet;
+  // Voltage and temperature request per group
+  const uint32_t packets = sweeps * groups * 2;
+
+  const int64_t legacy_delay = (int64_t)PacketPacing::LegacyDelay(c.baudrate) * 1000;
+  const int64_t spacing = (int64_t)PacketPacing::MinimumSpacing(c.baudrate) * 1000;
+
+  ModuleRing ring(c.baudrate, modules, p);
+  PacketPacing pacing;
+  std::deque<Reply> replies;
+
+  Result result{};
+  uint32_t good_replies = 0;
+  int64_t now = 0;
+  int64_t last_sent = -legacy_delay;
+  int64_t last_reply = 0;
+
+  // Replies (which survived the ring) that have reached the controller by "now"
+  auto deliver = [&](int64_t until)
+  {
+    while (!replies.empty() && replies.front().time_us <= until)
+    {
+      if (pacing.ReplyReceived(replies.front().sequence, replies.front().time_us))
+      {
+        good_replies++;
+      }
+      last_reply = replies.front().time_us;
+      replies.pop_front();
+    }
+  };
+
+  for (uint16_t sequence = 1; sequence <= packets; sequence++)
+  {
+    if (window == 0)
+    {
+      now = last_sent + legacy_delay;
+      deliver(now);
+      pacing.ExpireRequests(now);
+    }
+    else
+    {
+      // Same release rules as wait_for_window() in main.cpp
+      for (;;)
+      {
+        deliver(now);
+        pacing.ExpireRequests(now);
+
+        const int64_t elapsed = now - last_sent;
+        if (elapsed >= legacy_delay)
+        {
+          break;
+        }
+
+        int64_t wait_until = last_sent + legacy_delay;
+        auto outstanding = pacing.OutstandingRequests();
+        if (outstanding < window)
+        {
+          if (outstanding == 0 || elapsed >= spacing)
+          {
+            break;
+          }
+          wait_until = last_sent + spacing;
+        }
+
+        if (!replies.empty() && replies.front().time_us < wait_until)
+        {
+          now = replies.front().time_us;
+        }
+        else
+        {
+          now = wait_until;
+        }
+      }
+    }
+
+    bool corrupt;
+    const int64_t reply_time = ring.Send(now, &corrupt);
+    pacing.RequestSent(sequence, window, now);
+    last_sent = now;
+
+    if (corrupt)
+    {
+      result.overruns++;
+    }
+    else if ((prng() % 100) >= p.loss_percent)
+    {
+      replies.push_back(Reply{reply_time, sequence});
+    }
+  }
+
+  // Collect the remaining replies
+  deliver(INT64_MAX);
+  pacing.ExpireRequests(INT64_MAX);
+
+  result.lost = pacing.lostRequests;
+  result.sweeps_per_minute = 60e6 * ((double)good_replies / (groups * 2)) / (double)last_reply;
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  Parameters p{4000, 2000, 0};
+
+  if (argc > 1)
+  {
+    p.processing_us = (int64_t)(atof(argv[1]) * 1000);
+  }
+  if (argc > 2)
+  {
+    p.loss_percent = (uint32_t)atoi(argv[2]);
+  }
+  if (argc > 3)
+  {
+    p.jitter_us = (int64_t)(atof(argv[3]) * 1000);
+  }
+
+  const std::array<ChainConfig, 20> configs = {{
+      {2400, 1, 4},
+      {2400, 1, 16},
+      {2400, 2, 16},
+      {2400, 8, 4},
+      {2400, 8, 16},
+      {5000, 1, 4},
+      {5000, 1, 16},
+      {5000, 2, 16},
+      {5000, 8, 4},
+      {5000, 8, 16},
+      {9600, 1, 4},
+      {9600, 1, 16},
+      {9600, 2, 16},
+      {9600, 8, 4},
+      {9600, 8, 16},
+      {10000, 1, 4},
+      {10000, 1, 16},
+      {10000, 2, 16},
+      {10000, 8, 4},
+      {10000, 8, 16},
+  }};
+
+  const std::array<uint8_t, 7> windows = {0, 1, 2, 4, 8, 16, 32};
+
+  printf("Module processing %.1fms (+0-%.1fms jitter), reply loss %u%%\n",
+         p.processing_us / 1000.0, p.jitter_us / 1000.0, p.loss_percent);
+  printf("Sweeps per minute, (lost requests/overruns) over %u sweeps\n\n", sweeps);
+
+  printf("%6s %5s %6s %7s %8s |", "baud", "banks", "series", "modules", "rtt(ms)");
+  for (auto w : windows)
+  {
+    if (w == 0)
+    {
+      printf(" %15s", "fixed");
+    }
+    else
+    {
+      printf("            w=%-2u", w);
+    }
+  }
+  printf("\n");
+
+  for (const auto &c : configs)
+  {
+    const uint32_t modules = (uint32_t)c.banks * c.series;
+
+    // Round trip of a single request on an idle ring
+    Parameters idle = p;
+    idle.jitter_us = 0;
+    ModuleRing ring(c.baudrate, modules, idle);
+    bool corrupt;
+
+    printf("%6u %5u %6u %7u %8.1f |", c.baudrate, c.banks, c.series, modules, ring.Send(0, &corrupt) / 1000.0);
+
+    for (auto w : windows)
+    {
+      auto r = simulate(c, w, p);
+      printf(" %6.1f (%3u/%3u)", r.sweeps_per_minute, r.lost, r.overruns);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
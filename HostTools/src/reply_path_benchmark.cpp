@@ -0,0 +1,180 @@
+/*
+  Host benchmark of the controller reply path, from the serial decoder buffer to PacketReceiveProcessor.
+
+  "copy" is the path before ReplyRing: onPacketReceived copies the decoded reply to the stack (and
+  recalculates the CRC of timing replies), the reply queue copies it in and out, and ProcessReply
+  copies it again before checking the CRC.
+
+  "ring" is the current path: one copy into a ReplyRing slot, slot numbers are queued and
+  ProcessReply works on the slot in place.
+
+  Both use the same PacketReceiveProcessor and host queues (memcpy into fixed storage, like FreeRTOS),
+  so the difference is the copies and CRC work removed.  On the controller the same split is reported
+  in CPU cycles by /api/diagnostic ("replies").
+
+  Usage: reply_path_benchmark [iterations]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "defines.h"
+#include "PacketReceiveProcessor.h"
+#include "ReplyRing.h"
+
+#include "../../ESPController/src/PacketReceiveProcessor.cpp"
+#include "../../ESPController/lib/crc16/crc16.cpp"
+
+CellModuleInfo cmi[maximum_controller_cell_modules];
+CellReadings cellReadings;
+static HostTask voltageandstatussnapshot_task;
+TaskHandle_t transmit_task_handle = nullptr;
+TaskHandle_t voltageandstatussnapshot_task_handle = &voltageandstatussnapshot_task;
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+// Decoded reply as SerialEncoder leaves it
+static uint8_t decoderBuffer[2 * sizeof(PacketStruct)];
+
+// Voltage replies for 16 modules with every 32nd a timing reply, as seen during normal running
+static PacketStruct replies[64];
+
+static void make_replies()
+{
+  for (uint32_t i = 0; i < 64; i++)
+  {
+    PacketStruct &p = replies[i];
+    p = PacketStruct{};
+    p.start_address = 0;
+    p.end_address = 15;
+    p.hops = 16;
+    if (i % 32 == 0)
+    {
+      p.command = COMMAND::Timing | 0x80;
+      p.end_address = maximum_controller_cell_modules;
+    }
+    else
+    {
+      p.command = COMMAND::ReadVoltageAndStatus | 0x80;
+      for (uint8_t m = 0; m < 16; m++)
+      {
+        p.moduledata[m] = (uint16_t)(3300 + m + (i & 7));
+      }
+    }
+  }
+}
+
+// The serial decoder leaving reply i in its buffer
+static void decode_reply(uint32_t i)
+{
+  PacketStruct &p = replies[i % 64];
+  p.sequence = (uint16_t)i;
+  p.crc = CRC16::CalculateArray((uint8_t *)&p, sizeof(PacketStruct) - 2);
+  memcpy(decoderBuffer, &p, sizeof(p));
+}
+
+// Path before ReplyRing
+static QueueHandle_t reply_q;
+static PacketStruct processorCopy;
+
+static bool copy_path(PacketReceiveProcessor &receiveProc)
+{
+  // onPacketReceived
+  PacketStruct ps;
+  memcpy(&ps, decoderBuffer, sizeof(PacketStruct));
+  if ((ps.command & 0x0F) == COMMAND::Timing)
+  {
+    auto t = millis();
+    ps.moduledata[2] = (t & 0xFFFF0000) >> 16;
+    ps.moduledata[3] = t & (uint32_t)0x0000FFFF;
+    ps.crc = CRC16::CalculateArray((uint8_t *)&ps, sizeof(PacketStruct) - 2);
+  }
+  xQueueSendToBack(reply_q, &ps, 0);
+
+  // replyqueue_task
+  PacketStruct received;
+  xQueueReceive(reply_q, &received, 0);
+
+  // ProcessReply took its own copy before checking the CRC
+  memcpy(&processorCopy, &received, sizeof(PacketStruct));
+  return receiveProc.ProcessReply(&processorCopy, millis());
+}
+
+// Current path
+static ReplyRing ring;
+
+static bool ring_path(PacketReceiveProcessor &receiveProc)
+{
+  // onPacketReceived
+  ReplyRing::Slot *slot = ring.Acquire();
+  memcpy(&slot->packet, decoderBuffer, sizeof(PacketStruct));
+  slot->receivedMillisecond = millis();
+  ring.Publish(slot);
+
+  // replyqueue_task
+  ReplyRing::Slot *next = ring.Next(0);
+  bool ok = receiveProc.ProcessReply(&next->packet, next->receivedMillisecond);
+  ring.Release(next);
+  return ok;
+}
+
+// Time includes preparing each reply in the decoder buffer, which is the same for both paths
+template <typename F>
+static double benchmark(const char *name, F f, uint32_t iterations)
+{
+  PacketReceiveProcessor receiveProc;
+  uint32_t failures = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    decode_reply(i);
+    now_us += 5000;
+
+    if (!f(receiveProc))
+    {
+      failures++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  const double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  printf("%-6s %8.1f ns/reply, %u CRC errors, %u failed\n", name, ns, receiveProc.totalCRCErrors, failures);
+  return ns;
+}
+
+static double baseline(uint32_t iterations)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    decode_reply(i);
+    now_us += 5000;
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t iterations = 2000000;
+  if (argc > 1)
+  {
+    iterations = (uint32_t)atoi(argv[1]);
+  }
+
+  reply_q = xQueueCreate(4, sizeof(PacketStruct));
+  ring.begin();
+
+  make_replies();
+
+  printf("%u replies (voltage, every 32nd timing)\n", iterations);
+  const double decode = baseline(iterations);
+  const double before = benchmark("copy", copy_path, iterations) - decode;
+  const double after = benchmark("ring", ring_path, iterations) - decode;
+  printf("Excluding the decoder: copy %.1f ns, ring %.1f ns per reply (%.0f%%)\n", before, after, 100.0 * after / before);
+
+  return 0;
+}
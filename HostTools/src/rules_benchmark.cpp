@@ -0,0 +1,597 @@
+/*
+  Host checks and benchmark of the Rules engine, ESPController/src/Rules.cpp compiled unchanged.
+
+  1. Golden outputs, always run first.  Dynamic charge voltage and current for a set of packs in
+     every ChargingMode, with dynamic charge on, off, and with no CANBUS protocol, followed by the
+     charging mode sequence (dynamic, absorb, float, stopped and back) as state of charge and time
+     move on, and the pack values UpdateCellValues works out (bank range, temperatures) for some
+     awkward packs.  Any difference from the tables below is printed and the tool exits with 1.
+
+     After a deliberate change to these calculations run "rules_benchmark print", check the
+     differences and paste the new tables over the old ones.
+
+  2. Complete rule cycles per second (the Rules calls ProcessRules in main.cpp makes) for packs of
+     1 to 16 banks, with new readings in every bank on each cycle.
+
+  3. CalculateDynamicChargeVoltage for 16 banks, every bank from its own cells, against the
+     calculation before it looked at each bank (one bank, using the first bank's cells).
+     16 banks of 12 modules, 16 of 16 would be over maximum_controller_cell_modules.
+
+  Settings are the controller defaults (DefaultConfiguration in settings.cpp) with a CANBUS
+  protocol and a current monitor, as the charge calculations are only used with both.
+
+  Usage: rules_benchmark [cycles] | rules_benchmark print
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "defines.h"
+#include "Rules.h"
+#include "host_settings.h"
+
+#include "../../ESPController/src/Rules.cpp"
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+static diybms_eeprom_settings settings;
+static currentmonitoring_struct currentMonitor;
+static CellReadings cells;
+
+// Controller defaults with a CANBUS protocol and a current monitor
+static void default_settings(uint8_t banks, uint8_t series)
+{
+  host_default_settings(settings, banks, series);
+  settings.protocol = ProtocolEmulation::CANBUS_VICTRON;
+  settings.currentMonitoringEnabled = true;
+
+  memset(&currentMonitor, 0, sizeof(currentMonitor));
+  currentMonitor.validReadings = true;
+  currentMonitor.stateofcharge = 50;
+  // Banks are in parallel
+  currentMonitor.modbus.voltage = 3.3F * series;
+  currentMonitor.modbus.current = 20;
+}
+
+// Every cell at "voltage" except the last cell of "runnerBank", which is at "runner" (if not zero), and
+// the first "missingModules" of "missingBank" which haven't replied
+struct Pack
+{
+  const char *name;
+  uint8_t banks;
+  uint16_t voltage;
+  uint16_t runner;
+  uint8_t runnerBank;
+  // Added to every cell voltage for each bank number
+  uint16_t bankStep;
+  uint8_t missingBank;
+  uint8_t missingModules;
+  // Modules in each bank, 0 for "series"
+  uint8_t seriesModules;
+};
+
+static void make_cells(const Pack &pack, uint8_t series)
+{
+  memset(&cells, 0, sizeof(cells));
+  for (uint8_t bank = 0; bank < pack.banks; bank++)
+  {
+    for (uint8_t i = 0; i < series; i++)
+    {
+      const uint8_t m = bank * series + i;
+      cells.valid[m] = true;
+      cells.voltagemV[m] = pack.voltage + bank * pack.bankStep;
+      cells.voltagemVMin[m] = cells.voltagemV[m];
+      cells.voltagemVMax[m] = cells.voltagemV[m];
+      cells.internalTemp[m] = 25;
+      cells.externalTemp[m] = 20;
+    }
+    if (pack.runner != 0 && bank == pack.runnerBank)
+    {
+      cells.voltagemV[bank * series + series - 1] = pack.runner;
+    }
+    if (bank == pack.missingBank)
+    {
+      for (uint8_t i = 0; i < pack.missingModules; i++)
+      {
+        const uint8_t m = bank * series + i;
+        cells.valid[m] = false;
+        cells.voltagemV[m] = 0;
+        cells.voltagemVMin[m] = 0;
+        cells.voltagemVMax[m] = 0;
+      }
+    }
+  }
+}
+
+static constexpr uint8_t series = 16;
+
+static const Pack packs[] = {
+    {"1x16 3300mV, below knee", 1, 3300, 0, 0, 0},
+    {"1x16 3340mV, over knee", 1, 3340, 0, 0, 0},
+    {"1x16 3350mV, one at 3420mV", 1, 3350, 3420, 0, 0},
+    {"1x16 3350mV, one over cellmaxmv", 1, 3350, 3460, 0, 0},
+    {"2x16 3300mV, below knee", 2, 3300, 0, 0, 0},
+    {"2x16 3350mV, one at 3420mV in bank 1", 2, 3350, 3420, 1, 0},
+    {"2x16 3350mV, one over cellmaxmv in bank 1", 2, 3350, 3460, 1, 0},
+    {"4x16 3330-3360mV by bank", 4, 3330, 0, 0, 10},
+    {"2x16 3350mV, one at 3420mV in bank 0, bank 1 not replied", 2, 3350, 3420, 0, 0, 1, 16},
+    {"2x16 3350mV, one at 3420mV in bank 0, 4 modules of bank 1 not replied", 2, 3350, 3420, 0, 0, 1, 4},
+    {"1x16, not replied", 1, 3350, 0, 0, 0, 0, 16},
+    {"16x12 3330-3360mV by bank, one at 3400mV in bank 9, bank 15 not replied", 16, 3330, 3400, 9, 2, 15, 12, 12},
+};
+static constexpr size_t numberOfPacks = sizeof(packs) / sizeof(packs[0]);
+
+static const char *const variants[] = {"dynamic", "fixed", "no protocol"};
+static constexpr size_t numberOfVariants = 3;
+static constexpr size_t numberOfModes = 5;
+
+struct ChargeOutput
+{
+  uint16_t voltage;
+  int16_t current;
+};
+
+// [pack * numberOfVariants + variant][ChargingMode]
+static const ChargeOutput chargeGolden[numberOfPacks * numberOfVariants][numberOfModes] = {
+    {{552, 650}, {552, 650}, {528, 650}, {552, 650}, {552, 650}}, // 1x16 3300mV, below knee, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3300mV, below knee, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3300mV, below knee, no protocol
+    {{552, 568}, {552, 568}, {528, 568}, {552, 568}, {552, 568}}, // 1x16 3340mV, over knee, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3340mV, over knee, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3340mV, over knee, no protocol
+    {{537, 312}, {537, 312}, {528, 312}, {537, 312}, {537, 312}}, // 1x16 3350mV, one at 3420mV, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3350mV, one at 3420mV, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3350mV, one at 3420mV, no protocol
+    {{537, 7}, {537, 7}, {537, 7}, {537, 7}, {537, 7}}, // 1x16 3350mV, one over cellmaxmv, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3350mV, one over cellmaxmv, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16 3350mV, one over cellmaxmv, no protocol
+    {{552, 650}, {552, 650}, {528, 650}, {552, 650}, {552, 650}}, // 2x16 3300mV, below knee, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3300mV, below knee, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3300mV, below knee, no protocol
+    {{537, 312}, {537, 312}, {528, 312}, {537, 312}, {537, 312}}, // 2x16 3350mV, one at 3420mV in bank 1, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 1, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 1, no protocol
+    {{536, 7}, {536, 7}, {536, 7}, {536, 7}, {536, 7}}, // 2x16 3350mV, one over cellmaxmv in bank 1, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one over cellmaxmv in bank 1, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one over cellmaxmv in bank 1, no protocol
+    {{552, 540}, {552, 540}, {528, 540}, {552, 540}, {552, 540}}, // 4x16 3330-3360mV by bank, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 4x16 3330-3360mV by bank, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 4x16 3330-3360mV by bank, no protocol
+    {{537, 312}, {537, 312}, {528, 312}, {537, 312}, {537, 312}}, // 2x16 3350mV, one at 3420mV in bank 0, bank 1 not replied, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 0, bank 1 not replied, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 0, bank 1 not replied, no protocol
+    {{537, 312}, {537, 312}, {528, 312}, {537, 312}, {537, 312}}, // 2x16 3350mV, one at 3420mV in bank 0, 4 modules of bank 1 not replied, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 0, 4 modules of bank 1 not replied, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 2x16 3350mV, one at 3420mV in bank 0, 4 modules of bank 1 not replied, no protocol
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16, not replied, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16, not replied, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 1x16, not replied, no protocol
+    {{402, 425}, {402, 425}, {402, 425}, {402, 425}, {402, 425}}, // 16x12 3330-3360mV by bank, one at 3400mV in bank 9, bank 15 not replied, dynamic
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 16x12 3330-3360mV by bank, one at 3400mV in bank 9, bank 15 not replied, fixed
+    {{565, 650}, {565, 650}, {528, 650}, {565, 650}, {565, 650}}, // 16x12 3330-3360mV by bank, one at 3400mV in bank 9, bank 15 not replied, no protocol
+};
+
+struct ModeStep
+{
+  uint16_t minute;
+  float stateofcharge;
+  bool validReadings;
+};
+
+static const ModeStep modeSteps[] = {
+    {0, 50.0F, true},
+    {1, 97.0F, true},
+    {2, 99.5F, true},
+    {30, 99.5F, false},
+    {61, 99.5F, true},
+    {63, 99.5F, true},
+    {200, 97.0F, true},
+    {424, 97.0F, true},
+    {430, 99.9F, true},
+    {431, 95.0F, true},
+};
+static constexpr size_t numberOfModeSteps = sizeof(modeSteps) / sizeof(modeSteps[0]);
+
+struct ModeOutput
+{
+  ChargingMode mode;
+  int32_t secondsRemaining;
+};
+
+static const ModeOutput modeGolden[numberOfModeSteps] = {
+    {ChargingMode::dynamic, -1},
+    {ChargingMode::dynamic, -1},
+    {ChargingMode::absorb, 3600},
+    {ChargingMode::absorb, 1920},
+    {ChargingMode::absorb, 60},
+    {ChargingMode::floating, 21600},
+    {ChargingMode::floating, 13380},
+    {ChargingMode::stopped, -1},
+    {ChargingMode::stopped, -1},
+    {ChargingMode::dynamic, -1},
+};
+
+// Pack values from UpdateCellValues.  Two differ from the controller before the per bank scan, on purpose:
+// lowestInternalTemp compared the *external* temperature against it, so it was only right by luck (and
+// was the internal temperature of the last module when none had an external sensor), and
+// highestBankRange only counted banks scanned before the first invalid module, it is now 0 for every
+// bank until all the modules are valid, as VoltageRangeInBank has always said.
+struct AggregateCase
+{
+  const char *name;
+  uint8_t banks;
+  void (*setup)();
+};
+
+static constexpr uint8_t aggregateSeries = 8;
+
+static const AggregateCase aggregateCases[] = {
+    {"3x8, bank ranges 0, 20 and 50mV", 3,
+     []
+     {
+       cells.voltagemV[aggregateSeries + 2] = 3320;
+       cells.voltagemV[2 * aggregateSeries + 5] = 3350;
+     }},
+    // Was 20mV, the range of bank 1, scanned before the invalid module
+    {"3x8, bank ranges 0, 20 and 50mV, module 21 not replied", 3,
+     []
+     {
+       cells.voltagemV[aggregateSeries + 2] = 3320;
+       cells.voltagemV[2 * aggregateSeries + 5] = 3350;
+       cells.valid[2 * aggregateSeries + 5] = false;
+     }},
+    // Was 25, module 5's external temperature isn't below 25
+    {"2x8, module 5 internal 18 external 30", 2,
+     []
+     {
+       cells.internalTemp[5] = 18;
+       cells.externalTemp[5] = 30;
+     }},
+    // Was 25, the last module's internal temperature
+    {"2x8, no external sensors, module 3 internal 22", 2,
+     []
+     {
+       for (uint8_t m = 0; m < 2 * aggregateSeries; m++)
+       {
+         cells.externalTemp[m] = -40;
+       }
+       cells.internalTemp[3] = 22;
+     }},
+};
+static constexpr size_t numberOfAggregateCases = sizeof(aggregateCases) / sizeof(aggregateCases[0]);
+
+struct AggregateOutput
+{
+  uint16_t highestBankRange;
+  int8_t lowestInternalTemp;
+  int8_t highestInternalTemp;
+  int8_t lowestExternalTemp;
+  int8_t highestExternalTemp;
+  uint8_t invalidModuleCount;
+};
+
+static const AggregateOutput aggregateGolden[numberOfAggregateCases] = {
+    {50, 25, 25, 20, 20, 0}, // 3x8, bank ranges 0, 20 and 50mV
+    {0, 25, 25, 20, 20, 1}, // 3x8, bank ranges 0, 20 and 50mV, module 21 not replied
+    {0, 18, 25, 20, 30, 0}, // 2x8, module 5 internal 18 external 30
+    {0, 22, 25, 127, -127, 0}, // 2x8, no external sensors, module 3 internal 22
+};
+
+static void charge_outputs(ChargeOutput (&out)[numberOfPacks * numberOfVariants][numberOfModes])
+{
+  for (size_t p = 0; p < numberOfPacks; p++)
+  {
+    for (size_t v = 0; v < numberOfVariants; v++)
+    {
+      for (size_t mode = 0; mode < numberOfModes; mode++)
+      {
+        const uint8_t seriesModules = packs[p].seriesModules ? packs[p].seriesModules : series;
+        default_settings(packs[p].banks, seriesModules);
+        settings.dynamiccharge = (v != 1);
+        if (v == 2)
+        {
+          settings.protocol = ProtocolEmulation::EMULATION_DISABLED;
+        }
+        make_cells(packs[p], seriesModules);
+
+        static Rules rules;
+        rules = Rules{};
+        rules.UpdateCellValues(&cells, settings.totalNumberOfBanks, settings.totalNumberOfSeriesModules, settings.cellmaxmv);
+        rules.setChargingMode((ChargingMode)mode);
+        rules.CalculateDynamicChargeVoltage(&settings, &cells);
+        rules.CalculateDynamicChargeCurrent(&settings);
+
+        out[p * numberOfVariants + v][mode] = ChargeOutput{rules.DynamicChargeVoltage(), rules.DynamicChargeCurrent()};
+      }
+    }
+  }
+}
+
+static void mode_outputs(ModeOutput (&out)[numberOfModeSteps])
+{
+  default_settings(1, series);
+  static Rules rules;
+  rules = Rules{};
+
+  for (size_t i = 0; i < numberOfModeSteps; i++)
+  {
+    now_us = (int64_t)modeSteps[i].minute * 60000000;
+    currentMonitor.stateofcharge = modeSteps[i].stateofcharge;
+    currentMonitor.validReadings = modeSteps[i].validReadings;
+    rules.CalculateChargingMode(&settings, &currentMonitor);
+    out[i] = ModeOutput{rules.getChargingMode(), rules.getChargingTimerSecondsRemaining()};
+  }
+  now_us = 0;
+}
+
+static void aggregate_outputs(AggregateOutput (&out)[numberOfAggregateCases])
+{
+  for (size_t i = 0; i < numberOfAggregateCases; i++)
+  {
+    const AggregateCase &c = aggregateCases[i];
+    default_settings(c.banks, aggregateSeries);
+    make_cells(Pack{c.name, c.banks, 3300, 0, 0, 0}, aggregateSeries);
+    c.setup();
+
+    static Rules rules;
+    rules = Rules{};
+    rules.UpdateCellValues(&cells, c.banks, aggregateSeries, settings.cellmaxmv);
+    out[i] = AggregateOutput{rules.highestBankRange, rules.lowestInternalTemp, rules.highestInternalTemp,
+                             rules.lowestExternalTemp, rules.highestExternalTemp, rules.invalidModuleCount};
+  }
+}
+
+static const char *const modeNames[] = {"standard", "absorb", "floating", "dynamic", "stopped"};
+
+static void print_golden()
+{
+  static ChargeOutput charge[numberOfPacks * numberOfVariants][numberOfModes];
+  charge_outputs(charge);
+  printf("// [pack * numberOfVariants + variant][ChargingMode]\n");
+  printf("static const ChargeOutput chargeGolden[numberOfPacks * numberOfVariants][numberOfModes] = {\n");
+  for (size_t p = 0; p < numberOfPacks; p++)
+  {
+    for (size_t v = 0; v < numberOfVariants; v++)
+    {
+      const ChargeOutput *row = charge[p * numberOfVariants + v];
+      printf("    {");
+      for (size_t mode = 0; mode < numberOfModes; mode++)
+      {
+        printf("%s{%u, %i}", mode ? ", " : "", row[mode].voltage, row[mode].current);
+      }
+      printf("}, // %s, %s\n", packs[p].name, variants[v]);
+    }
+  }
+  printf("};\n\n");
+
+  ModeOutput modes[numberOfModeSteps];
+  mode_outputs(modes);
+  printf("static const ModeOutput modeGolden[numberOfModeSteps] = {\n");
+  for (size_t i = 0; i < numberOfModeSteps; i++)
+  {
+    printf("    {ChargingMode::%s, %i},\n", modeNames[(uint8_t)modes[i].mode], modes[i].secondsRemaining);
+  }
+  printf("};\n\n");
+
+  AggregateOutput aggregates[numberOfAggregateCases];
+  aggregate_outputs(aggregates);
+  printf("static const AggregateOutput aggregateGolden[numberOfAggregateCases] = {\n");
+  for (size_t i = 0; i < numberOfAggregateCases; i++)
+  {
+    const AggregateOutput &a = aggregates[i];
+    printf("    {%u, %i, %i, %i, %i, %u}, // %s\n", a.highestBankRange, a.lowestInternalTemp, a.highestInternalTemp,
+           a.lowestExternalTemp, a.highestExternalTemp, a.invalidModuleCount, aggregateCases[i].name);
+  }
+  printf("};\n");
+}
+
+static bool check_golden()
+{
+  bool ok = true;
+
+  static ChargeOutput charge[numberOfPacks * numberOfVariants][numberOfModes];
+  charge_outputs(charge);
+  for (size_t p = 0; p < numberOfPacks; p++)
+  {
+    for (size_t v = 0; v < numberOfVariants; v++)
+    {
+      for (size_t mode = 0; mode < numberOfModes; mode++)
+      {
+        const ChargeOutput &actual = charge[p * numberOfVariants + v][mode];
+        const ChargeOutput &expected = chargeGolden[p * numberOfVariants + v][mode];
+        if (actual.voltage != expected.voltage || actual.current != expected.current)
+        {
+          printf("FAIL %s, %s, %s: voltage %u current %i, expected %u and %i\n", packs[p].name, variants[v], modeNames[mode],
+                 actual.voltage, actual.current, expected.voltage, expected.current);
+          ok = false;
+        }
+      }
+    }
+  }
+
+  ModeOutput modes[numberOfModeSteps];
+  mode_outputs(modes);
+  for (size_t i = 0; i < numberOfModeSteps; i++)
+  {
+    if (modes[i].mode != modeGolden[i].mode || modes[i].secondsRemaining != modeGolden[i].secondsRemaining)
+    {
+      printf("FAIL minute %u SoC %.1f: %s with %is remaining, expected %s with %is\n", modeSteps[i].minute, modeSteps[i].stateofcharge,
+             modeNames[(uint8_t)modes[i].mode], modes[i].secondsRemaining, modeNames[(uint8_t)modeGolden[i].mode], modeGolden[i].secondsRemaining);
+      ok = false;
+    }
+  }
+
+  AggregateOutput aggregates[numberOfAggregateCases];
+  aggregate_outputs(aggregates);
+  for (size_t i = 0; i < numberOfAggregateCases; i++)
+  {
+    const AggregateOutput &a = aggregates[i];
+    const AggregateOutput &e = aggregateGolden[i];
+    if (a.highestBankRange != e.highestBankRange || a.lowestInternalTemp != e.lowestInternalTemp ||
+        a.highestInternalTemp != e.highestInternalTemp || a.lowestExternalTemp != e.lowestExternalTemp ||
+        a.highestExternalTemp != e.highestExternalTemp || a.invalidModuleCount != e.invalidModuleCount)
+    {
+      printf("FAIL %s: range %u internal %i to %i external %i to %i invalid %u, expected %u, %i to %i, %i to %i, %u\n",
+             aggregateCases[i].name, a.highestBankRange, a.lowestInternalTemp, a.highestInternalTemp, a.lowestExternalTemp,
+             a.highestExternalTemp, a.invalidModuleCount, e.highestBankRange, e.lowestInternalTemp, e.highestInternalTemp,
+             e.lowestExternalTemp, e.highestExternalTemp, e.invalidModuleCount);
+      ok = false;
+    }
+  }
+
+  printf("Golden outputs: %zu charge voltage/current, %zu charging mode steps, %zu pack values, %s\n",
+         numberOfPacks * numberOfVariants * numberOfModes, numberOfModeSteps, numberOfAggregateCases, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+// The Rules calls made by ProcessRules (main.cpp) for one new snapshot
+static void rule_cycle(Rules &rules)
+{
+  rules.ClearWarnings();
+  rules.ClearErrors();
+  rules.setRuleStatus(Rule::BMSError, false);
+  rules.UpdateCellValues(&cells, settings.totalNumberOfBanks, settings.totalNumberOfSeriesModules, settings.cellmaxmv);
+  rules.CalculateChargingMode(&settings, &currentMonitor);
+  rules.CalculateDynamicChargeVoltage(&settings, &cells);
+  rules.CalculateDynamicChargeCurrent(&settings);
+  if (rules.invalidModuleCount > 0)
+  {
+    rules.SetError(InternalErrorCode::WaitingForModulesToReply);
+  }
+  rules.RunRules(settings.rulevalue, settings.rulehysteresis, false, (uint16_t)((now_us / 60000000) % 1440), &currentMonitor);
+  if (!rules.IsChargeAllowed(&settings))
+  {
+    rules.SetWarning(InternalWarningCode::ChargePrevented);
+  }
+  if (!rules.IsDischargeAllowed(&settings))
+  {
+    rules.SetWarning(InternalWarningCode::DischargePrevented);
+  }
+}
+
+static void benchmark(uint8_t banks, uint32_t cycles)
+{
+  const uint8_t seriesModules = min((uint8_t)16, (uint8_t)(maximum_controller_cell_modules / banks));
+  default_settings(banks, seriesModules);
+  // Around the knee so the dynamic charge calculations do their full work
+  make_cells(Pack{"", banks, 3330, 0, 0, 0}, seriesModules);
+
+  static Rules rules;
+  rules = Rules{};
+  uint32_t charging = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t c = 0; c < cycles; c++)
+  {
+    // A new sweep, one cell in every bank moves
+    for (uint8_t bank = 0; bank < banks; bank++)
+    {
+      const uint8_t m = bank * seriesModules + (c % seriesModules);
+      cells.voltagemV[m] = (uint16_t)(3330 + ((c + bank) & 31));
+    }
+    now_us += 1000000;
+    currentMonitor.stateofcharge = 50.0F + (float)(c & 63) * 0.1F;
+
+    rule_cycle(rules);
+    if (rules.IsChargeAllowed(&settings))
+    {
+      charging++;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  printf("%2u x %2u modules %10.0f cycles/s %8.2f us/cycle (charge allowed %u)\n", banks, seriesModules,
+         cycles / seconds, 1e6 * seconds / cycles, charging);
+}
+
+// CalculateDynamicChargeVoltage (all cells under cellmaxmv) before it calculated each bank: bank with the
+// highest cell only, and it read the cells from the start of the array rather than from that bank
+static uint16_t LegacyDynamicChargeVoltage(const Rules &rules, const diybms_eeprom_settings *mysettings, const CellReadings *cells)
+{
+  const int16_t UniformDerating = 1;
+  uint32_t R = min(
+      (int16_t)((mysettings->cellmaxmv - rules.highestCellVoltage) * UniformDerating),
+      (int16_t)((mysettings->cellmaxspikemv - mysettings->kneemv) / ((float)mysettings->sensitivity / 10.0F)));
+  if (R == 0)
+  {
+    R = 1;
+  }
+  uint32_t S = rules.bankvoltage.at(rules.index_bank_HighestCellVoltage);
+  uint32_t HminusR = (uint32_t)rules.highestCellVoltage - R;
+  uint32_t MminusH = mysettings->cellmaxmv - rules.highestCellVoltage;
+  for (uint8_t i = 0; i < mysettings->totalNumberOfSeriesModules; i++)
+  {
+    if (cells->voltagemV[i] >= HminusR)
+    {
+      S += ((MminusH) * (cells->voltagemV[i] - (HminusR)) / R);
+    }
+  }
+  S = S / 100;
+  return (uint16_t)min(S, (uint32_t)mysettings->chargevolt);
+}
+
+static void charge_voltage_benchmark(uint32_t cycles)
+{
+  const uint8_t banks = 16;
+  const uint8_t seriesModules = maximum_controller_cell_modules / banks;
+  default_settings(banks, seriesModules);
+  make_cells(Pack{"", banks, 3330, 3400, 9, 2}, seriesModules);
+
+  static Rules rules;
+  rules = Rules{};
+  rules.UpdateCellValues(&cells, banks, seriesModules, settings.cellmaxmv);
+
+  uint32_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t c = 0; c < cycles; c++)
+  {
+    // Stop the compiler hoisting the calculation out of the loop
+    settings.kneemv = (int16_t)(3320 - (c & 1));
+    total += LegacyDynamicChargeVoltage(rules, &settings, &cells);
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for (uint32_t c = 0; c < cycles; c++)
+  {
+    settings.kneemv = (int16_t)(3320 - (c & 1));
+    rules.CalculateDynamicChargeVoltage(&settings, &cells);
+    total += rules.DynamicChargeVoltage();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  const double before = std::chrono::duration<double, std::nano>(middle - start).count() / cycles;
+  const double after = std::chrono::duration<double, std::nano>(end - middle).count() / cycles;
+  printf("Charge voltage %u x %u modules: one bank %.0f ns (%u), every bank %.0f ns (%u), checksum %u\n", banks, seriesModules,
+         before, LegacyDynamicChargeVoltage(rules, &settings, &cells), after, rules.DynamicChargeVoltage(), total);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1 && strcmp(argv[1], "print") == 0)
+  {
+    print_golden();
+    return 0;
+  }
+
+  uint32_t cycles = 200000;
+  if (argc > 1)
+  {
+    cycles = (uint32_t)atoi(argv[1]);
+  }
+
+  if (!check_golden())
+  {
+    return 1;
+  }
+
+  printf("%u rule cycles, new readings in every bank each cycle\n", cycles);
+  for (uint8_t banks : {1, 2, 4, 8, 16})
+  {
+    benchmark(banks, cycles);
+  }
+  charge_voltage_benchmark(cycles);
+
+  return 0;
+}
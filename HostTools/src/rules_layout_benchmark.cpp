@@ -0,0 +1,367 @@
+/*
+  Host benchmark of one complete rules pass over 200 modules (8 banks of 25) with the two cell layouts.
+
+  "struct" is the layout before CellReadings: one CellModuleInfo per module holding the readings
+  together with the module settings and counters, Rules::ProcessCell read one record at a time.
+
+  "arrays" is the current layout: readings in CellReadings (one array per field) scanned a bank at a
+  time by Rules::UpdateCellValues, settings checks read the much smaller CellModuleInfo.
+
+  "one bank" is the usual case on the controller since rules run on every new snapshot: one bank's
+  readings have changed since the last pass, so UpdateCellValues only scans that bank.
+
+  Both passes do the same work as ProcessRules in main.cpp (cell values, bank values, settings
+  consistency warnings, balancing count), the results of the two are compared before timing.
+
+  Usage: rules_layout_benchmark [passes]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+
+#include "defines.h"
+#include "Rules.h"
+
+#include "../../ESPController/src/Rules.cpp"
+
+static constexpr uint8_t banks = 8;
+static constexpr uint8_t series = 25;
+static constexpr uint8_t modules = banks * series;
+
+uint32_t millis() { return 0; }
+int64_t esp_timer_get_time() { return 0; }
+
+// CellModuleInfo as it was before the readings moved to CellReadings
+struct LegacyCellModuleInfo
+{
+  bool settingsCached : 1;
+  bool valid : 1;
+  bool inBypass : 1;
+  bool bypassOverTemp : 1;
+  bool ChangesProhibited : 1;
+
+  uint16_t voltagemV;
+  uint16_t voltagemVMin;
+  uint16_t voltagemVMax;
+  int8_t internalTemp;
+  int8_t externalTemp;
+
+  uint8_t BypassOverTempShutdown;
+  uint16_t BypassThresholdmV;
+  uint16_t badPacketCount;
+
+  float LoadResistance;
+  float Calibration;
+  float mVPerADC;
+  uint16_t Internal_BCoefficient;
+  uint16_t External_BCoefficient;
+  uint16_t BoardVersionNumber;
+  uint32_t CodeVersionNumber;
+  uint16_t PWMValue;
+
+  uint16_t BalanceCurrentCount;
+  uint16_t PacketReceivedCount;
+
+  int16_t FanSwitchOnTemperature;
+  uint16_t RelayMinmV;
+  uint16_t RelayRangemV;
+  uint16_t ParasiteVoltagemV;
+  uint16_t RunAwayCellMinimumVoltagemV;
+  uint16_t RunAwayCellDifferentialmV;
+};
+
+static LegacyCellModuleInfo legacy[maximum_controller_cell_modules];
+static CellModuleInfo cold[maximum_controller_cell_modules];
+static CellReadings readings;
+
+static constexpr uint16_t BypassThresholdmV = 4100;
+static constexpr uint8_t BypassOverTempShutdown = 65;
+static constexpr uint16_t cellmaxmv = 4200;
+
+// Rules::ProcessCell before CellReadings
+static void LegacyProcessCell(Rules &r, uint8_t bank, uint8_t cellNumber, const LegacyCellModuleInfo *c)
+{
+  if (c->valid == false)
+  {
+    r.invalidModuleCount++;
+    return;
+  }
+
+  r.bankvoltage.at(bank) += c->voltagemV;
+  r.limitedbankvoltage.at(bank) += min(c->voltagemV, cellmaxmv);
+
+  if (c->voltagemV == 0)
+  {
+    r.zeroVoltageModuleCount++;
+  }
+
+  if (c->voltagemV > r.HighestCellVoltageInBank.at(bank))
+  {
+    r.HighestCellVoltageInBank.at(bank) = c->voltagemV;
+  }
+  if (c->voltagemV < r.LowestCellVoltageInBank.at(bank))
+  {
+    r.LowestCellVoltageInBank.at(bank) = c->voltagemV;
+  }
+
+  if (c->voltagemV > r.highestCellVoltage)
+  {
+    r.highestCellVoltage = c->voltagemV;
+    r.address_HighestCellVoltage = cellNumber;
+    r.index_bank_HighestCellVoltage = bank;
+  }
+
+  if (c->voltagemV < r.lowestCellVoltage)
+  {
+    r.lowestCellVoltage = c->voltagemV;
+    r.address_LowestCellVoltage = cellNumber;
+  }
+
+  if (c->externalTemp != -40)
+  {
+    r.moduleHasExternalTempSensor = true;
+
+    if (c->externalTemp > r.highestExternalTemp)
+    {
+      r.highestExternalTemp = c->externalTemp;
+      r.address_highestExternalTemp = cellNumber;
+    }
+
+    if (c->externalTemp < r.lowestExternalTemp)
+    {
+      r.lowestExternalTemp = c->externalTemp;
+      r.address_lowestExternalTemp = cellNumber;
+    }
+  }
+
+  if (c->internalTemp > r.highestInternalTemp)
+  {
+    r.highestInternalTemp = c->internalTemp;
+  }
+
+  // Originally compared externalTemp here, corrected so the results can be compared
+  if (c->internalTemp < r.lowestInternalTemp)
+  {
+    r.lowestInternalTemp = c->internalTemp;
+  }
+}
+
+// Rules::ProcessBank before CellReadings
+static void LegacyProcessBank(Rules &r, uint8_t bank)
+{
+  if (r.bankvoltage.at(bank) > r.highestBankVoltage)
+  {
+    r.highestBankVoltage = r.bankvoltage.at(bank);
+    r.address_highestBankVoltage = bank;
+  }
+  if (r.bankvoltage.at(bank) < r.lowestBankVoltage)
+  {
+    r.lowestBankVoltage = r.bankvoltage.at(bank);
+    r.address_lowestBankVoltage = bank;
+  }
+
+  if (r.VoltageRangeInBank(bank) > r.highestBankRange)
+  {
+    r.highestBankRange = r.VoltageRangeInBank(bank);
+  }
+}
+
+static void begin_pass(Rules &r)
+{
+  r.ClearValues();
+  r.highestBankRange = 0;
+  r.numberOfBalancingModules = 0;
+}
+
+// Cell and bank values only, the part of the pass which streams over every module's readings
+static void legacy_cells_pass(Rules &r)
+{
+  begin_pass(r);
+  uint8_t cellid = 0;
+  for (uint8_t bank = 0; bank < banks; bank++)
+  {
+    for (uint8_t i = 0; i < series; i++)
+    {
+      LegacyProcessCell(r, bank, cellid, &legacy[cellid]);
+      cellid++;
+    }
+    LegacyProcessBank(r, bank);
+  }
+}
+
+static void arrays_cells_pass(Rules &r)
+{
+  // ClearValues makes every bank be scanned again
+  begin_pass(r);
+  r.UpdateCellValues(&readings, banks, series, cellmaxmv);
+}
+
+// A new reading in one bank since the last pass
+static void one_bank_pass(Rules &r)
+{
+  static uint8_t bank = 0;
+  bank = (bank + 1) % banks;
+  readings.voltagemV[bank * series] ^= 1;
+  r.UpdateCellValues(&readings, banks, series, cellmaxmv);
+}
+
+// Everything ProcessRules does per module
+static void legacy_pass(Rules &r)
+{
+  begin_pass(r);
+  uint8_t cellid = 0;
+  for (uint8_t bank = 0; bank < banks; bank++)
+  {
+    for (uint8_t i = 0; i < series; i++)
+    {
+      const LegacyCellModuleInfo &c = legacy[cellid];
+      LegacyProcessCell(r, bank, cellid, &c);
+
+      if (c.valid && c.settingsCached)
+      {
+        if (c.BypassThresholdmV != BypassThresholdmV || c.BypassOverTempShutdown != BypassOverTempShutdown ||
+            c.CodeVersionNumber != legacy[0].CodeVersionNumber || c.BoardVersionNumber != legacy[0].BoardVersionNumber)
+        {
+          r.numberOfActiveWarnings++;
+        }
+        if (c.inBypass)
+        {
+          r.numberOfBalancingModules++;
+        }
+      }
+      cellid++;
+    }
+    LegacyProcessBank(r, bank);
+  }
+}
+
+static void arrays_pass(Rules &r)
+{
+  begin_pass(r);
+  r.UpdateCellValues(&readings, banks, series, cellmaxmv);
+
+  for (uint8_t cellid = 0; cellid < modules; cellid++)
+  {
+    const CellModuleInfo &c = cold[cellid];
+    if (readings.valid[cellid] && c.settingsCached)
+    {
+      if (c.BypassThresholdmV != BypassThresholdmV || c.BypassOverTempShutdown != BypassOverTempShutdown ||
+          c.CodeVersionNumber != cold[0].CodeVersionNumber || c.BoardVersionNumber != cold[0].BoardVersionNumber)
+      {
+        r.numberOfActiveWarnings++;
+      }
+      if (readings.inBypass[cellid])
+      {
+        r.numberOfBalancingModules++;
+      }
+    }
+  }
+}
+
+static void make_cells()
+{
+  srand(1);
+  for (uint8_t m = 0; m < modules; m++)
+  {
+    LegacyCellModuleInfo &l = legacy[m];
+    l = LegacyCellModuleInfo{};
+    l.settingsCached = true;
+    l.valid = true;
+    l.voltagemV = (uint16_t)(3200 + rand() % 1000);
+    l.inBypass = l.voltagemV > BypassThresholdmV;
+    l.internalTemp = (int8_t)(20 + rand() % 20);
+    l.externalTemp = (m % 3 == 0) ? -40 : (int8_t)(15 + rand() % 20);
+    l.BypassThresholdmV = (m == 150) ? 4000 : BypassThresholdmV;
+    l.BypassOverTempShutdown = BypassOverTempShutdown;
+    l.CodeVersionNumber = 0x12345678;
+    l.BoardVersionNumber = 440;
+
+    readings.valid[m] = l.valid;
+    readings.voltagemV[m] = l.voltagemV;
+    readings.inBypass[m] = l.inBypass;
+    readings.internalTemp[m] = l.internalTemp;
+    readings.externalTemp[m] = l.externalTemp;
+
+    CellModuleInfo &c = cold[m];
+    c = CellModuleInfo{};
+    c.settingsCached = l.settingsCached;
+    c.BypassThresholdmV = l.BypassThresholdmV;
+    c.BypassOverTempShutdown = l.BypassOverTempShutdown;
+    c.CodeVersionNumber = l.CodeVersionNumber;
+    c.BoardVersionNumber = l.BoardVersionNumber;
+  }
+}
+
+static bool same_result(const Rules &a, const Rules &b)
+{
+  return a.bankvoltage == b.bankvoltage && a.limitedbankvoltage == b.limitedbankvoltage &&
+         a.LowestCellVoltageInBank == b.LowestCellVoltageInBank && a.HighestCellVoltageInBank == b.HighestCellVoltageInBank &&
+         a.highestBankVoltage == b.highestBankVoltage && a.lowestBankVoltage == b.lowestBankVoltage &&
+         a.highestCellVoltage == b.highestCellVoltage && a.lowestCellVoltage == b.lowestCellVoltage &&
+         a.highestBankRange == b.highestBankRange && a.address_HighestCellVoltage == b.address_HighestCellVoltage &&
+         a.address_LowestCellVoltage == b.address_LowestCellVoltage && a.index_bank_HighestCellVoltage == b.index_bank_HighestCellVoltage &&
+         a.highestExternalTemp == b.highestExternalTemp && a.lowestExternalTemp == b.lowestExternalTemp &&
+         a.highestInternalTemp == b.highestInternalTemp && a.lowestInternalTemp == b.lowestInternalTemp &&
+         a.invalidModuleCount == b.invalidModuleCount && a.zeroVoltageModuleCount == b.zeroVoltageModuleCount &&
+         a.numberOfBalancingModules == b.numberOfBalancingModules && a.numberOfActiveWarnings == b.numberOfActiveWarnings;
+}
+
+typedef void (*Pass)(Rules &r);
+
+// Best of several rounds, alternating the two layouts so both see the same machine state
+static void compare(const char *name, Pass legacyPass, Pass arraysPass, uint32_t passes)
+{
+  static Rules r;
+  double best[2] = {1e12, 1e12};
+  const Pass pass[2] = {legacyPass, arraysPass};
+
+  for (uint8_t round = 0; round < 5; round++)
+  {
+    for (uint8_t layout = 0; layout < 2; layout++)
+    {
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < passes; i++)
+      {
+        pass[layout](r);
+        // Stop the compiler discarding passes whose results are never read
+        asm volatile("" : : "r"(&r) : "memory");
+      }
+      auto end = std::chrono::steady_clock::now();
+      best[layout] = std::min(best[layout], std::chrono::duration<double, std::nano>(end - start).count() / passes);
+    }
+  }
+
+  printf("%-12s struct %8.1f ns/pass, arrays %8.1f ns/pass (%.0f%%)\n", name, best[0], best[1], 100.0 * best[1] / best[0]);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t passes = 50000;
+  if (argc > 1)
+  {
+    passes = (uint32_t)atoi(argv[1]);
+  }
+
+  make_cells();
+
+  static Rules before;
+  static Rules after;
+  legacy_pass(before);
+  arrays_pass(after);
+  if (!same_result(before, after))
+  {
+    printf("FAIL: layouts give different rules results\n");
+    return 1;
+  }
+
+  printf("%u passes over %u modules (%u banks of %u), best of 5 rounds\n", passes, modules, banks, series);
+  printf("Cell data: struct %u bytes, arrays %u bytes of readings + %u bytes of settings\n",
+         (uint32_t)(modules * sizeof(LegacyCellModuleInfo)),
+         (uint32_t)(sizeof(CellReadings) * modules / maximum_controller_cell_modules),
+         (uint32_t)(modules * sizeof(CellModuleInfo)));
+  compare("cell values", legacy_cells_pass, arrays_cells_pass, passes);
+  compare("full pass", legacy_pass, arrays_pass, passes);
+  compare("one bank", legacy_cells_pass, one_bank_pass, passes);
+
+  return 0;
+}
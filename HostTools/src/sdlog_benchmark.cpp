@@ -0,0 +1,389 @@
+/*
+  Host check and benchmark of the SD card logs (ESPController/src/SdLog.cpp, compiled unchanged) against
+  the way they were written before (exists, open, write, flush and close for every row, all inside the
+  VSPI mutex, kept below).
+
+  "days" of cell, current monitor and output rows every "interval" seconds are logged both ways into two
+  directories, and the files must be the same byte for byte (exits with 1 if not), including across the
+  day rollover.  A nearly full card must stop the logging.
+
+  The card isn't here, so the SD card stub counts 512 byte sector reads and writes the way FatFs would do
+  them (see HostTools/include/FS.h).  Each time the VSPI mutex is held the sectors moved are turned into
+  a time with "readms" and "writems" per sector, typical for a card on a 16MHz SPI bus, giving an
+  estimate of how long the TFT could be kept waiting.  On the controller the real figures are in
+  /api/diagnostic "sdlog".
+
+  Usage: sdlog_benchmark [days=2] [interval=15] [cells=16] [readms=0.4] [writems=1.0] [dir=/tmp]
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <SD.h>
+
+#include "defines.h"
+#include "SdLog.h"
+#include "../../ESPController/src/SdLog.cpp"
+
+static int64_t now_us = 0;
+uint32_t millis() { return (uint32_t)(now_us / 1000); }
+int64_t esp_timer_get_time() { return now_us; }
+
+static double readMs = 0.4;
+static double writeMs = 1.0;
+
+// The VSPI mutex, with the sectors moved whilst it is held
+struct Bus
+{
+  fs::Counters atLock;
+  uint32_t locks = 0;
+  uint32_t sectorReads = 0;
+  uint32_t sectorWrites = 0;
+  double hold_ms = 0;
+  double holdMax_ms = 0;
+};
+static Bus bus;
+
+static bool LockBus()
+{
+  bus.atLock = fs::counters;
+  bus.locks++;
+  return true;
+}
+
+static bool UnlockBus()
+{
+  const uint32_t reads = fs::counters.sectorReads - bus.atLock.sectorReads;
+  const uint32_t writes = fs::counters.sectorWrites - bus.atLock.sectorWrites;
+  bus.sectorReads += reads;
+  bus.sectorWrites += writes;
+  const double ms = reads * readMs + writes * writeMs;
+  bus.hold_ms += ms;
+  bus.holdMax_ms = max(bus.holdMax_ms, ms);
+  return true;
+}
+
+static SdLog cellLog("cells", 4096, LockBus, UnlockBus);
+static SdLog currentLog("current", 1024, LockBus, UnlockBus);
+static SdLog outputLog("outputs", 1024, LockBus, UnlockBus);
+
+static uint8_t numberOfCells = 16;
+
+// Readings that move a little between rows
+static std::string timestamp(uint32_t t)
+{
+  const time_t tt = (time_t)t;
+  tm tm;
+  gmtime_r(&tt, &tm);
+  char s[48];
+  snprintf(s, sizeof(s), "%04i-%02i-%02i %02i:%02i:%02i,", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+  return s;
+}
+
+static std::string filename(const char *prefix, uint32_t t)
+{
+  const time_t tt = (time_t)t;
+  tm tm;
+  gmtime_r(&tt, &tm);
+  char s[48];
+  snprintf(s, sizeof(s), "/%s%04i%02i%02i.csv", prefix, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+  return s;
+}
+
+static std::string cellHeader(uint8_t i)
+{
+  const std::string n = std::to_string(i);
+  return "VoltagemV_" + n + ",InternalTemp_" + n + ",ExternalTemp_" + n + ",Bypass_" + n + ",PWM_" + n + ",BypassOverTemp_" + n +
+         ",BadPackets_" + n + ",BalancemAh_" + n + (i < numberOfCells - 1 ? "," : "\r\n");
+}
+
+static std::string cellRow(uint8_t i, uint32_t t)
+{
+  return std::to_string(3300 + (t / 60 + i) % 50) + "," + std::to_string(25 + i % 3) + "," + std::to_string(22 + (t / 600) % 4) + "," +
+         ((t / 15 + i) % 7 == 0 ? "Y" : "N") + "," + std::to_string((t / 15 + i) % 7 == 0 ? 40 : 0) + ",N," + std::to_string(i / 4) + "," +
+         std::to_string(t / 3600 + i) + (i < numberOfCells - 1 ? "," : "\r\n");
+}
+
+static const char *currentHeader = "DateTime,valid,voltage,current,mAhIn,mAhOut,DailymAhIn,DailymAhOut,power,temperature,relayState\r\n";
+
+static std::string currentRow(uint32_t t)
+{
+  char s[128];
+  snprintf(s, sizeof(s), "1,%.3f,%.3f,%u,%u,%u,%u,%.3f,%u,0\r\n", 53.0 + (t % 100) / 100.0, (t % 800) / 10.0 - 40.0, t / 10, t / 12,
+           (t % 86400) / 10, (t % 86400) / 12, (t % 800) * 0.53, 25 + (t / 3600) % 5);
+  return s;
+}
+
+static const char *outputHeader = "DateTime,TCA6408,TCA9534,Output_0,Output_1,Output_2,Output_3\r\n";
+
+static std::string outputRow(uint32_t t)
+{
+  const uint32_t state = t / 600;
+  std::string s = "00000000,00000000,";
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    s += (state >> i) & 1 ? "Y" : "N";
+    s += i < 3 ? "," : "\r\n";
+  }
+  return s;
+}
+
+// As main.cpp did before SdLog, the mutex held for all of it
+static void before(SDFS &card, uint32_t t, bool outputChanged)
+{
+  LockBus();
+
+  std::string name = filename("data_", t);
+  bool exists = card.exists(name.c_str());
+  File file = card.open(name.c_str(), exists ? FILE_APPEND : FILE_WRITE);
+  if (!exists)
+  {
+    file.write((const uint8_t *)"DateTime,", 9);
+    for (uint8_t i = 0; i < numberOfCells; i++)
+    {
+      const std::string h = cellHeader(i);
+      file.write((const uint8_t *)h.data(), h.length());
+    }
+  }
+  std::string row = timestamp(t);
+  for (uint8_t i = 0; i < numberOfCells; i++)
+  {
+    row += cellRow(i, t);
+    file.write((const uint8_t *)row.data(), row.length());
+    row.clear();
+  }
+  file.flush();
+  file.close();
+
+  name = filename("modbus90_", t);
+  exists = card.exists(name.c_str());
+  File file2 = card.open(name.c_str(), exists ? FILE_APPEND : FILE_WRITE);
+  if (!exists)
+  {
+    file2.write(currentHeader);
+  }
+  row = timestamp(t) + currentRow(t);
+  file2.write((const uint8_t *)row.data(), row.length());
+  file2.flush();
+  file2.close();
+
+  UnlockBus();
+
+  if (outputChanged)
+  {
+    LockBus();
+    name = filename("output_status_", t);
+    exists = card.exists(name.c_str());
+    file = card.open(name.c_str(), exists ? FILE_APPEND : FILE_WRITE);
+    if (!exists)
+    {
+      file.write(outputHeader);
+    }
+    row = timestamp(t) + outputRow(t);
+    file.write((const uint8_t *)row.data(), row.length());
+    file.flush();
+    file.close();
+    UnlockBus();
+  }
+}
+
+// As main.cpp does now
+static void after(uint32_t t, bool outputChanged)
+{
+  if (cellLog.Start(filename("data_", t)))
+  {
+    cellLog.Append("DateTime,", 9);
+    for (uint8_t i = 0; i < numberOfCells; i++)
+    {
+      cellLog.Append(cellHeader(i));
+    }
+  }
+  std::string row = timestamp(t);
+  for (uint8_t i = 0; i < numberOfCells; i++)
+  {
+    row += cellRow(i, t);
+    cellLog.Append(row);
+    row.clear();
+  }
+  cellLog.End();
+
+  if (currentLog.Start(filename("modbus90_", t)))
+  {
+    currentLog.Append(currentHeader);
+  }
+  currentLog.Append(timestamp(t) + currentRow(t));
+  currentLog.End();
+
+  if (outputChanged)
+  {
+    if (outputLog.Start(filename("output_status_", t)))
+    {
+      outputLog.Append(outputHeader);
+    }
+    outputLog.Append(timestamp(t) + outputRow(t));
+    outputLog.End();
+  }
+  outputLog.FlushIfDue();
+}
+
+static std::string readFile(const std::string &path)
+{
+  std::string contents;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f != nullptr)
+  {
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+      contents.append(buffer, n);
+    }
+    fclose(f);
+  }
+  return contents;
+}
+
+struct Result
+{
+  Bus bus;
+  fs::Counters card;
+  double cpu_ms;
+};
+
+static void report(const char *what, const Result &r, uint32_t rows, uint32_t days)
+{
+  printf("%-7s %6u locks  %6u opens %6u exists %6u flushes %6u closes  %7u sector reads %7u writes\n", what, r.bus.locks, r.card.opens,
+         r.card.exists, r.card.flushes, r.card.closes, r.bus.sectorReads, r.bus.sectorWrites);
+  printf("        mutex held %8.1f ms a row, longest %6.1f ms, %7.1f s a day    host cpu %6.2f us a row\n", r.bus.hold_ms / rows,
+         r.bus.holdMax_ms, r.bus.hold_ms / 1000.0 / days, r.cpu_ms * 1000.0 / rows);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t days = 2;
+  uint32_t interval = 15;
+  std::string dir = "/tmp";
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "days=", 5) == 0)
+    {
+      days = (uint32_t)max(1, atoi(argv[i] + 5));
+    }
+    else if (strncmp(argv[i], "interval=", 9) == 0)
+    {
+      interval = (uint32_t)max(1, atoi(argv[i] + 9));
+    }
+    else if (strncmp(argv[i], "cells=", 6) == 0)
+    {
+      numberOfCells = (uint8_t)min((int)maximum_controller_cell_modules, max(1, atoi(argv[i] + 6)));
+    }
+    else if (strncmp(argv[i], "readms=", 7) == 0)
+    {
+      readMs = atof(argv[i] + 7);
+    }
+    else if (strncmp(argv[i], "writems=", 8) == 0)
+    {
+      writeMs = atof(argv[i] + 8);
+    }
+    else if (strncmp(argv[i], "dir=", 4) == 0)
+    {
+      dir = argv[i] + 4;
+    }
+  }
+
+  const std::string beforeDir = dir + "/sdlog_before";
+  const std::string afterDir = dir + "/sdlog_after";
+  for (const std::string &d : {beforeDir, afterDir})
+  {
+    const std::string command = "rm -rf " + d + " && mkdir -p " + d;
+    if (system(command.c_str()) != 0)
+    {
+      printf("Unable to create %s\n", d.c_str());
+      return 1;
+    }
+  }
+
+  // Just before midnight, so the first day is short and there is a rollover
+  const uint32_t start = 1790000000 - 1790000000 % 86400 + 86400 - 3600;
+  const uint32_t rows = days * 86400 / interval;
+
+  // Before
+  SDFS beforeCard(beforeDir);
+  fs::counters = {};
+  bus = Bus();
+  auto started = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    const uint32_t t = start + r * interval;
+    before(beforeCard, t, r == 0 || t / 600 != (t - interval) / 600);
+  }
+  Result b{bus, fs::counters, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count()};
+
+  // After
+  SD = SDFS(afterDir);
+  cellLog.Begin();
+  currentLog.Begin();
+  outputLog.Begin();
+  fs::counters = {};
+  bus = Bus();
+  started = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < rows; r++)
+  {
+    const uint32_t t = start + r * interval;
+    now_us = (int64_t)r * interval * 1000000;
+    after(t, r == 0 || t / 600 != (t - interval) / 600);
+  }
+  cellLog.Close();
+  currentLog.Close();
+  outputLog.Close();
+  Result a{bus, fs::counters, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count()};
+
+  bool ok = true;
+  uint32_t files = 0;
+  for (uint32_t day = 0; day <= days; day++)
+  {
+    for (const char *prefix : {"data_", "modbus90_", "output_status_"})
+    {
+      const std::string name = filename(prefix, start + day * 86400);
+      const std::string x = readFile(beforeDir + name);
+      const std::string y = readFile(afterDir + name);
+      if (x != y)
+      {
+        printf("%s differs, %u bytes before and %u after\n", name.c_str(), (uint32_t)x.size(), (uint32_t)y.size());
+        ok = false;
+      }
+      files += x.empty() ? 0 : 1;
+    }
+  }
+  for (const SdLog *log : {&cellLog, &currentLog, &outputLog})
+  {
+    if (log->bytesDropped != 0)
+    {
+      printf("%u bytes dropped\n", log->bytesDropped);
+      ok = false;
+    }
+  }
+
+  // Nearly full card, logging stops at the next file
+  SD.used = SD.total - SdLog::MinimumFreeSpace + 1;
+  after(start + (days + 1) * 86400, false);
+  if (cellLog.SpaceAvailable() || cellLog.bytesDropped == 0)
+  {
+    printf("Nearly full card was still written\n");
+    ok = false;
+  }
+
+  printf("%u days of %u modules every %u seconds, %u rows, %u files\n", days, numberOfCells, interval, rows, files);
+  printf("Estimated at %.1f ms per sector read and %.1f ms per sector write\n", readMs, writeMs);
+  report("before", b, rows, days);
+  report("after", a, rows, days);
+  printf("SdLog   cells %u writes of %.0f bytes, current %u writes of %.0f bytes, outputs %u writes of %.0f bytes\n", cellLog.writes,
+         (double)cellLog.bytesWritten / max(1U, cellLog.writes), currentLog.writes, (double)currentLog.bytesWritten / max(1U, currentLog.writes),
+         outputLog.writes, (double)outputLog.bytesWritten / max(1U, outputLog.writes));
+
+  if (!ok)
+  {
+    printf("FAILED\n");
+    return 1;
+  }
+  return 0;
+}
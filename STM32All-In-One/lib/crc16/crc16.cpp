@@ -1,72 +1,71 @@
 #include "crc16.h"
 
-// Calculate XMODEM 16 crc code on data array
-uint16_t CRC16::CalculateArray(uint8_t data[], uint16_t length)
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define CRC16_TABLE_ATTRIBUTE PROGMEM
+#define CRC16_READ_TABLE(table, index) pgm_read_word(&table[index])
+#else
+#define CRC16_TABLE_ATTRIBUTE
+#define CRC16_READ_TABLE(table, index) (table[index])
+#endif
+
+// XMODEM
+static constexpr uint16_t polynomial = 0x1021;
+
+// Shift "bits" bits out of the top of crc, one at a time (same as the original bitwise calculation)
+// Written as a single expression so it is a valid C++11 constexpr for the AVR compiler
+static constexpr uint16_t TableEntry(uint16_t crc, uint8_t bits)
 {
-  //Calculates XMODEM CRC16
-  uint8_t reflectIn=false;
-  uint8_t reflectOut=false;
-  uint16_t polynomial=0x1021;
-  uint16_t xorIn=0x0000;
-  uint16_t xorOut=0x0000;
-  uint16_t msbMask=0x8000;
-  uint16_t mask=0xffff;
-
-	uint16_t crc = xorIn;
-
-	int j;
-	uint8_t c;
-	uint16_t bit;
-
-	if (length == 0) return crc;
-
-	for (uint16_t i = 0; i < length; i++)
-	{
-		c = data[i];
-
-		if (reflectIn != 0)
-			c = (uint8_t) reflect(c, 8);
-
-		j = 0x80;
-
-		while (j > 0)
-		{
-			bit = (uint16_t)(crc & msbMask);
-			crc <<= 1;
+  return bits == 0 ? crc : TableEntry((crc & 0x8000) ? (uint16_t)((crc << 1) ^ polynomial) : (uint16_t)(crc << 1), bits - 1);
+}
 
-			if ((c & j) != 0)
-			{
-				bit = (uint16_t)(bit ^ msbMask);
-			}
+#define CRC16_NIBBLE(n) TableEntry((uint16_t)((n) << 12), 4)
+#define CRC16_BYTE(n) TableEntry((uint16_t)((n) << 8), 8)
+#define CRC16_ROW(F, n) F(n + 0), F(n + 1), F(n + 2), F(n + 3), F(n + 4), F(n + 5), F(n + 6), F(n + 7), \
+                        F(n + 8), F(n + 9), F(n + 10), F(n + 11), F(n + 12), F(n + 13), F(n + 14), F(n + 15)
 
-			if (bit != 0)
-			{
-				crc ^= polynomial;
-			}
+static constexpr uint16_t nibbleTable[16] CRC16_TABLE_ATTRIBUTE = {CRC16_ROW(CRC16_NIBBLE, 0)};
 
-			j >>= 1;
-		}
-	}
+uint16_t CRC16::UpdateNibble(uint16_t crc, uint8_t data)
+{
+  crc = (uint16_t)(crc << 4) ^ CRC16_READ_TABLE(nibbleTable, ((crc >> 12) ^ (data >> 4)) & 0x0F);
+  crc = (uint16_t)(crc << 4) ^ CRC16_READ_TABLE(nibbleTable, ((crc >> 12) ^ data) & 0x0F);
+  return crc;
+}
 
-	if (reflectOut != 0)
-		crc = (uint16_t)((reflect(crc) ^ xorOut) & mask);
+#if !defined(__AVR__)
+static constexpr uint16_t byteTable[256] = {
+    CRC16_ROW(CRC16_BYTE, 0x00), CRC16_ROW(CRC16_BYTE, 0x10), CRC16_ROW(CRC16_BYTE, 0x20), CRC16_ROW(CRC16_BYTE, 0x30),
+    CRC16_ROW(CRC16_BYTE, 0x40), CRC16_ROW(CRC16_BYTE, 0x50), CRC16_ROW(CRC16_BYTE, 0x60), CRC16_ROW(CRC16_BYTE, 0x70),
+    CRC16_ROW(CRC16_BYTE, 0x80), CRC16_ROW(CRC16_BYTE, 0x90), CRC16_ROW(CRC16_BYTE, 0xA0), CRC16_ROW(CRC16_BYTE, 0xB0),
+    CRC16_ROW(CRC16_BYTE, 0xC0), CRC16_ROW(CRC16_BYTE, 0xD0), CRC16_ROW(CRC16_BYTE, 0xE0), CRC16_ROW(CRC16_BYTE, 0xF0)};
 
-	return crc;
+uint16_t CRC16::UpdateByte(uint16_t crc, uint8_t data)
+{
+  return (uint16_t)(crc << 8) ^ byteTable[((crc >> 8) ^ data) & 0xFF];
 }
+#endif
 
-uint8_t CRC16::reflect(uint8_t data, uint8_t bits)
+uint16_t CRC16::Update(uint16_t crc, uint8_t data)
 {
-	unsigned long reflection = 0x00000000;
-
-	for (uint8_t bit = 0; bit < bits; bit++)
-	{
-		if ((data & 0x01) != 0)
-		{
-			reflection |= (unsigned long)(1 << ((bits - 1) - bit));
-		}
+#if defined(__AVR__)
+  return UpdateNibble(crc, data);
+#else
+  return UpdateByte(crc, data);
+#endif
+}
 
-		data = (uint8_t)(data >> 1);
-	}
+uint16_t CRC16::Update(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+  for (uint16_t i = 0; i < length; i++)
+  {
+    crc = Update(crc, data[i]);
+  }
+  return crc;
+}
 
-	return reflection;
+// Calculate XMODEM 16 crc code on data array
+uint16_t CRC16::CalculateArray(uint8_t data[], uint16_t length)
+{
+  return Update(Initial, data, length);
 }